@@ -37,41 +37,38 @@ void HybridPipelineRT::render()
         return;
     }
 
-    updateUniformBuffers(imageIndex);
-
-    // Get the frame index that was used for acquisition (needed for the acquisition semaphore)
-    size_t frameIndex = getAcquisitionFrameIndex(imageIndex);
+    const auto frame = m_currentFrame;
+    updateUniformBuffers(frame);
+    buildComputeCommandBuffer(frame, imageIndex);
 
     // Submit the draw command buffer
     VkSubmitInfo submitInfo {};
     submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
     submitInfo.waitSemaphoreCount = 1;
-    submitInfo.pWaitSemaphores = &m_imageAvailableSemaphores[frameIndex];
+    submitInfo.pWaitSemaphores = &m_imageAvailableSemaphores[frame];
     VkPipelineStageFlags drawWaitStageMask = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
     submitInfo.pWaitDstStageMask = &drawWaitStageMask;
     submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &m_drawCmdBuffers[imageIndex];
+    submitInfo.pCommandBuffers = &m_drawCmdBuffers[frame];
     submitInfo.signalSemaphoreCount = 1;
-    submitInfo.pSignalSemaphores = &m_compute.semaphores[imageIndex];
-    vkResetFences(m_device, 1, &m_inFlightFences[imageIndex]);
-    CHECK_RESULT(vkQueueSubmit(m_queue, 1, &submitInfo, m_inFlightFences[imageIndex]))
+    submitInfo.pSignalSemaphores = &m_compute.semaphores[frame];
+    vkResetFences(m_device, 1, &m_inFlightFences[frame]);
+    CHECK_RESULT(vkQueueSubmit(m_queue, 1, &submitInfo, m_inFlightFences[frame]))
     // ----
 
     // Submit Compute Command Buffer:
-    vkWaitForFences(m_device, 1, &m_compute.fences[imageIndex], VK_TRUE, UINT64_MAX);
     VkSubmitInfo computeSubmitInfo {};
     computeSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
     computeSubmitInfo.commandBufferCount = 1;
-    computeSubmitInfo.pCommandBuffers = &m_compute.commandBuffers[imageIndex];
+    computeSubmitInfo.pCommandBuffers = &m_compute.commandBuffers[frame];
     computeSubmitInfo.waitSemaphoreCount = 1;
-    computeSubmitInfo.pWaitSemaphores = &m_compute.semaphores[imageIndex];
+    computeSubmitInfo.pWaitSemaphores = &m_compute.semaphores[frame];
     computeSubmitInfo.signalSemaphoreCount = 1;
     computeSubmitInfo.pSignalSemaphores = &m_renderFinishedSemaphores[imageIndex];
     VkPipelineStageFlags computeWaitStageMask = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
     computeSubmitInfo.pWaitDstStageMask = &computeWaitStageMask;
-    vkResetFences(m_device, 1, &m_compute.fences[imageIndex]);
-    CHECK_RESULT(
-        vkQueueSubmit(m_compute.queue, 1, &computeSubmitInfo, m_compute.fences[imageIndex]));
+    vkResetFences(m_device, 1, &m_compute.fences[frame]);
+    CHECK_RESULT(vkQueueSubmit(m_compute.queue, 1, &computeSubmitInfo, m_compute.fences[frame]));
     // ----
 
     if (BaseProject::queuePresentSwapChain(imageIndex) == VK_SUCCESS) {
@@ -146,93 +143,89 @@ void HybridPipelineRT::buildCommandBuffers()
         CHECK_RESULT(vkEndCommandBuffer(m_drawCmdBuffers[i]))
     }
     // ---
-    // Compute command buffers
+}
+
+void HybridPipelineRT::buildComputeCommandBuffer(uint32_t t_frame, uint32_t t_imageIndex)
+{
+    // Recorded on every frame, the swap chain image the result is copied to is only known once
+    // it is acquired
     VkCommandBufferBeginInfo computeCmdBufInfo = {};
     computeCmdBufInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    for (int32_t i = 0; i < m_compute.commandBuffers.size(); ++i) {
-        CHECK_RESULT(vkBeginCommandBuffer(m_compute.commandBuffers[i], &computeCmdBufInfo))
-        m_autoExposure->buildCommandBuffer(i, m_compute.commandBuffers[i]);
-        m_postProcess->buildCommandBuffer(i, m_compute.commandBuffers[i], m_width, m_height);
-
-        // Move result to swap chain image:
-
-        // Prepare images to transfer
-        VkImageSubresourceRange subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
-        tools::setImageLayout(m_compute.commandBuffers[i],
-            m_swapChain.images[i],
-            VK_IMAGE_LAYOUT_UNDEFINED,
-            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-            subresourceRange);
-        tools::setImageLayout(m_compute.commandBuffers[i],
-            m_storageImages[i].postProcessResultImage.getImage(),
-            VK_IMAGE_LAYOUT_GENERAL,
-            VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-            subresourceRange);
-
-        VkImageCopy copyRegion {};
-        copyRegion.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
-        copyRegion.srcOffset = { 0, 0, 0 };
-        copyRegion.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
-        copyRegion.dstOffset = { 0, 0, 0 };
-        copyRegion.extent = { m_width, m_height, 1 };
-        vkCmdCopyImage(m_compute.commandBuffers[i],
-            m_storageImages[i].postProcessResultImage.getImage(),
-            VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-            m_swapChain.images[i],
-            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-            1,
-            &copyRegion);
-
-        // Transition back to previous layouts:
-        tools::setImageLayout(m_compute.commandBuffers[i],
-            m_swapChain.images[i],
-            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-            VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
-            subresourceRange);
-        tools::setImageLayout(m_compute.commandBuffers[i],
-            m_storageImages[i].postProcessResultImage.getImage(),
-            VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-            VK_IMAGE_LAYOUT_GENERAL,
-            subresourceRange);
-
-        vkEndCommandBuffer(m_compute.commandBuffers[i]);
-    }
-    // ---
+    computeCmdBufInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    CHECK_RESULT(vkBeginCommandBuffer(m_compute.commandBuffers[t_frame], &computeCmdBufInfo))
+    m_autoExposure->buildCommandBuffer(t_frame, m_compute.commandBuffers[t_frame]);
+    m_postProcess->buildCommandBuffer(t_frame,
+        m_compute.commandBuffers[t_frame],
+        m_width,
+        m_height);
+
+    // Move result to swap chain image:
+
+    // Prepare images to transfer
+    VkImageSubresourceRange subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+    tools::setImageLayout(m_compute.commandBuffers[t_frame],
+        m_swapChain.images[t_imageIndex],
+        VK_IMAGE_LAYOUT_UNDEFINED,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        subresourceRange);
+    tools::setImageLayout(m_compute.commandBuffers[t_frame],
+        m_storageImages[t_frame].postProcessResultImage.getImage(),
+        VK_IMAGE_LAYOUT_GENERAL,
+        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        subresourceRange);
+
+    VkImageCopy copyRegion {};
+    copyRegion.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+    copyRegion.srcOffset = { 0, 0, 0 };
+    copyRegion.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+    copyRegion.dstOffset = { 0, 0, 0 };
+    copyRegion.extent = { m_width, m_height, 1 };
+    vkCmdCopyImage(m_compute.commandBuffers[t_frame],
+        m_storageImages[t_frame].postProcessResultImage.getImage(),
+        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        m_swapChain.images[t_imageIndex],
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        1,
+        &copyRegion);
+
+    // Transition back to previous layouts:
+    tools::setImageLayout(m_compute.commandBuffers[t_frame],
+        m_swapChain.images[t_imageIndex],
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+        subresourceRange);
+    tools::setImageLayout(m_compute.commandBuffers[t_frame],
+        m_storageImages[t_frame].postProcessResultImage.getImage(),
+        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        VK_IMAGE_LAYOUT_GENERAL,
+        subresourceRange);
+
+    CHECK_RESULT(vkEndCommandBuffer(m_compute.commandBuffers[t_frame]))
 }
 
 void HybridPipelineRT::createDescriptorPool()
 {
-    // Calculate the number of textures needed
-    // Textures are used in TWO descriptor sets: raster (set1Materials) and ray tracing
-    // (set3Materials) Each set needs textureCount descriptors, so we need textureCount * 2 total
-    uint32_t textureCount
-        = m_scene->textures.empty() ? 1 : static_cast<uint32_t>(m_scene->textures.size());
-    uint32_t totalTextureDescriptors = textureCount * 2; // One set for raster, one for ray tracing
-
     std::vector<VkDescriptorPoolSize> poolSizes = {
         { VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR, 1 },
         // Scene uniform buffer
-        { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, m_swapChain.imageCount },
-        // Vertex, Index and Material Indexes
-        { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, m_swapChain.imageCount },
-        // Textures (needs to accommodate textures used in both raster and ray tracing descriptor
-        // sets)
-        { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, totalTextureDescriptors },
-        // Material array
-        { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1 },
+        { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, m_settings.framesInFlight },
+        // Instance information (geometry addresses and material indexes)
+        { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, m_settings.framesInFlight },
+        // Textures and materials are in the descriptor heap, shared by the raster and ray tracing
+        // pipelines
         // Lights array
         { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1 },
-        // Offscreen images (per swapchain image)
-        { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, m_swapChain.imageCount },
+        // Offscreen images (per frame in flight)
+        { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, m_settings.framesInFlight },
         // Storage images
-        { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, m_swapChain.imageCount },
+        { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, m_settings.framesInFlight },
     };
     // Calculate max set for pool
-    const auto sceneSets = 1 * m_swapChain.imageCount;
-    const auto exposurePipelineSets = 2 * m_swapChain.imageCount;
-    const auto postProcessPipelineSets = 4 * m_swapChain.imageCount;
-    const auto rayTracingPipelineSets = 5 + 3 * m_swapChain.imageCount;
-    const auto offscreenPipelineSets = 2 + 1 * m_swapChain.imageCount;
+    const auto sceneSets = 1 * m_settings.framesInFlight;
+    const auto exposurePipelineSets = 2 * m_settings.framesInFlight;
+    const auto postProcessPipelineSets = 4 * m_settings.framesInFlight;
+    const auto rayTracingPipelineSets = 4 + 3 * m_settings.framesInFlight;
+    const auto offscreenPipelineSets = 1 + 1 * m_settings.framesInFlight;
     uint32_t maxSetsForPool = sceneSets + exposurePipelineSets + postProcessPipelineSets
         + rayTracingPipelineSets + offscreenPipelineSets;
     // ---
@@ -262,25 +255,7 @@ void HybridPipelineRT::createDescriptorSetLayout()
             nullptr,
             &m_rasterDescriptorSetLayouts.set0Scene))
 
-        // Set 1 Raster: Material data
-        setLayoutBindings.clear();
-        // Texture list binding 0
-        setLayoutBindings.push_back(
-            initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-                VK_SHADER_STAGE_FRAGMENT_BIT,
-                0,
-                m_scene->textures.size()));
-        // Material list binding 1
-        setLayoutBindings.push_back(
-            initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-                VK_SHADER_STAGE_FRAGMENT_BIT,
-                1));
-        descriptorLayout = initializers::descriptorSetLayoutCreateInfo(setLayoutBindings.data(),
-            setLayoutBindings.size());
-        CHECK_RESULT(vkCreateDescriptorSetLayout(m_device,
-            &descriptorLayout,
-            nullptr,
-            &m_rasterDescriptorSetLayouts.set1Materials))
+        // Set 1 Raster: Material data, the layout of the descriptor heap
 
         // Set 2 Raster: Lighting data
         setLayoutBindings.clear();
@@ -298,16 +273,20 @@ void HybridPipelineRT::createDescriptorSetLayout()
             &m_rasterDescriptorSetLayouts.set2Lights))
 
         std::array<VkDescriptorSetLayout, 3> setLayouts = { m_rasterDescriptorSetLayouts.set0Scene,
-            m_rasterDescriptorSetLayouts.set1Materials,
+            m_descriptorHeap.getLayout(),
             m_rasterDescriptorSetLayouts.set2Lights };
         VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo
             = initializers::pipelineLayoutCreateInfo(setLayouts.data(), setLayouts.size());
 
-        // Push constant to pass the material index for each mesh
-        VkPushConstantRange pushConstantRange
-            = initializers::pushConstantRange(VK_SHADER_STAGE_FRAGMENT_BIT, sizeof(uint32_t), 0);
-        pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
-        pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+        // Push constants to pass the transform of each instance and the material index of its mesh
+        std::array<VkPushConstantRange, 2> pushConstantRanges = {
+            initializers::pushConstantRange(VK_SHADER_STAGE_VERTEX_BIT, sizeof(glm::mat4), 0),
+            initializers::pushConstantRange(
+                VK_SHADER_STAGE_FRAGMENT_BIT, sizeof(uint32_t), sizeof(glm::mat4))
+        };
+        pipelineLayoutCreateInfo.pushConstantRangeCount
+            = static_cast<uint32_t>(pushConstantRanges.size());
+        pipelineLayoutCreateInfo.pPushConstantRanges = pushConstantRanges.data();
         CHECK_RESULT(vkCreatePipelineLayout(m_device,
             &pipelineLayoutCreateInfo,
             nullptr,
@@ -315,7 +294,7 @@ void HybridPipelineRT::createDescriptorSetLayout()
     }
 
     // Ray Tracing
-    m_rayTracing->createDescriptorSetsLayout(m_scene);
+    m_rayTracing->createDescriptorSetsLayout(&m_descriptorHeap);
 
     // Postprocess
     m_postProcess->createDescriptorSetsLayout();
@@ -329,16 +308,16 @@ void HybridPipelineRT::createDescriptorSets()
     // Offscreen
     {
         // Set 0 Raster: Scene descriptor
-        std::vector<VkDescriptorSetLayout> layouts(m_swapChain.imageCount,
+        std::vector<VkDescriptorSetLayout> layouts(m_settings.framesInFlight,
             m_rasterDescriptorSetLayouts.set0Scene);
         VkDescriptorSetAllocateInfo allocInfo
             = initializers::descriptorSetAllocateInfo(m_descriptorPool,
                 layouts.data(),
-                m_swapChain.imageCount);
-        m_rasterDescriptorSets.set0Scene.resize(m_swapChain.imageCount);
+                m_settings.framesInFlight);
+        m_rasterDescriptorSets.set0Scene.resize(m_settings.framesInFlight);
         CHECK_RESULT(
             vkAllocateDescriptorSets(m_device, &allocInfo, m_rasterDescriptorSets.set0Scene.data()))
-        for (size_t i = 0; i < m_swapChain.imageCount; ++i) {
+        for (size_t i = 0; i < m_settings.framesInFlight; ++i) {
             std::vector<VkWriteDescriptorSet> writeDescriptorSet0 = {
                 // Binding 0 : Vertex shader uniform buffer
                 initializers::writeDescriptorSet(m_rasterDescriptorSets.set0Scene[i],
@@ -353,42 +332,9 @@ void HybridPipelineRT::createDescriptorSets()
                 VK_NULL_HANDLE);
         }
 
-        // Set 1 Raster: Material descriptor
-        // Materials and Textures descriptor sets
-        VkDescriptorSetAllocateInfo textureAllocInfo
-            = initializers::descriptorSetAllocateInfo(m_descriptorPool,
-                &m_rasterDescriptorSetLayouts.set1Materials,
-                1);
-        CHECK_RESULT(vkAllocateDescriptorSets(m_device,
-            &textureAllocInfo,
-            &m_rasterDescriptorSets.set1Materials))
-
-        std::vector<VkWriteDescriptorSet> writeDescriptorSet1;
-        VkWriteDescriptorSet writeTextureDescriptorSet;
-        std::vector<VkDescriptorImageInfo> textureDescriptors;
-        if (!m_scene->textures.empty()) {
-            for (auto& texture : m_scene->textures) {
-                textureDescriptors.push_back(texture.descriptor);
-            }
-            writeTextureDescriptorSet
-                = initializers::writeDescriptorSet(m_rasterDescriptorSets.set1Materials,
-                    VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-                    0,
-                    textureDescriptors.data(),
-                    textureDescriptors.size());
-            writeDescriptorSet1.push_back(writeTextureDescriptorSet);
-        }
-        VkWriteDescriptorSet writeMaterialsDescriptorSet
-            = initializers::writeDescriptorSet(m_rasterDescriptorSets.set1Materials,
-                VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-                1,
-                &m_materialsBuffer.descriptor);
-        writeDescriptorSet1.push_back(writeMaterialsDescriptorSet);
-        vkUpdateDescriptorSets(m_device,
-            static_cast<uint32_t>(writeDescriptorSet1.size()),
-            writeDescriptorSet1.data(),
-            0,
-            nullptr);
+        // Set 1 Raster: Material descriptor, the same textures and materials the ray tracing
+        // pipeline reads
+        m_rasterDescriptorSets.set1Materials = m_descriptorHeap.getDescriptorSet();
 
         // Set 2 Raster: Lighting descriptor
         VkDescriptorSetAllocateInfo set2AllocInfo
@@ -413,32 +359,31 @@ void HybridPipelineRT::createDescriptorSets()
 
     // Ray Tracing
     m_rayTracing->createDescriptorSets(m_descriptorPool,
-        m_scene,
-        m_swapChain.imageCount,
+        &m_descriptorHeap,
+        m_settings.framesInFlight,
         m_sceneBuffers,
         &m_instancesBuffer,
-        &m_lightsBuffer,
-        &m_materialsBuffer);
+        &m_lightsBuffer);
 
     // Postprocess
     m_postProcess->createDescriptorSets(m_descriptorPool,
         m_sceneBuffers,
-        m_swapChain.imageCount,
+        m_settings.framesInFlight,
         m_exposureBuffers,
-        m_swapChain.imageCount);
+        m_settings.framesInFlight);
 
     // Exposure compute
     m_autoExposure->createDescriptorSets(m_descriptorPool,
         m_exposureBuffers,
-        m_swapChain.imageCount);
+        m_settings.framesInFlight);
 
     updateResultImageDescriptorSets();
 }
 
 void HybridPipelineRT::createStorageImages()
 {
-    m_storageImages.resize(m_swapChain.imageCount);
-    for (size_t i = 0; i < m_swapChain.imageCount; ++i) {
+    m_storageImages.resize(m_settings.framesInFlight);
+    for (size_t i = 0; i < m_settings.framesInFlight; ++i) {
         m_storageImages[i].offscreenMaterial.toColorAttachment(VK_FORMAT_R32G32B32A32_SFLOAT,
             m_width,
             m_height,
@@ -607,8 +552,8 @@ void HybridPipelineRT::createOffscreenRenderPass()
 
 void HybridPipelineRT::createOffscreenFramebuffers()
 {
-    m_offscreenFramebuffers.resize(m_swapChain.imageCount);
-    for (uint32_t i = 0; i < m_swapChain.imageCount; ++i) {
+    m_offscreenFramebuffers.resize(m_settings.framesInFlight);
+    for (uint32_t i = 0; i < m_settings.framesInFlight; ++i) {
         std::array<VkImageView, 5> attachments = {};
         attachments[0] = m_storageImages[i].offscreenMaterial.getImageView();
         attachments[1] = m_storageImages[i].offscreenAlbedo.getImageView();
@@ -633,7 +578,7 @@ void HybridPipelineRT::createOffscreenFramebuffers()
 
 void HybridPipelineRT::updateResultImageDescriptorSets()
 {
-    for (uint32_t i = 0; i < m_swapChain.imageCount; ++i) {
+    for (uint32_t i = 0; i < m_settings.framesInFlight; ++i) {
         // Ray tracing sets
         m_rayTracing->updateResultImageDescriptorSets(i,
             &m_storageImages[i].offscreenMaterial,
@@ -653,15 +598,15 @@ void HybridPipelineRT::updateResultImageDescriptorSets()
     }
 }
 
-void HybridPipelineRT::updateUniformBuffers(uint32_t t_currentImage)
+void HybridPipelineRT::updateUniformBuffers(uint32_t t_frame)
 {
-    memcpy(m_sceneBuffers[t_currentImage].mapped, &m_sceneUniformData, sizeof(m_sceneUniformData));
+    memcpy(m_sceneBuffers[t_frame].mapped, &m_sceneUniformData, sizeof(m_sceneUniformData));
 }
 
 void HybridPipelineRT::onSwapChainRecreation()
 {
     // Recreate the result image to fit the new extent size
-    for (size_t i = 0; i < m_swapChain.imageCount; ++i) {
+    for (size_t i = 0; i < m_settings.framesInFlight; ++i) {
         m_storageImages[i].rtResultImage.destroy();
         m_storageImages[i].postProcessResultImage.destroy();
         m_storageImages[i].offscreenMaterial.destroy();
@@ -680,8 +625,8 @@ void HybridPipelineRT::onSwapChainRecreation()
 void HybridPipelineRT::createUniformBuffers()
 {
     VkDeviceSize bufferSize = sizeof(m_sceneUniformData);
-    m_sceneBuffers.resize(m_swapChain.imageCount);
-    for (size_t i = 0; i < m_swapChain.imageCount; ++i) {
+    m_sceneBuffers.resize(m_settings.framesInFlight);
+    for (size_t i = 0; i < m_settings.framesInFlight; ++i) {
         m_sceneBuffers[i].create(m_vulkanDevice,
             VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
             VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
@@ -691,30 +636,30 @@ void HybridPipelineRT::createUniformBuffers()
     // Instances Information uniform
     bufferSize = sizeof(ShaderMeshInstance) * m_scene->getInstancesCount();
     m_instancesBuffer.create(m_vulkanDevice,
-        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-        bufferSize,
-        m_scene->getInstancesShaderData().data());
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        bufferSize);
     // global Material list uniform (its a storage buffer)
     bufferSize = sizeof(ShaderMaterial) * m_scene->getMaterialCount();
     m_materialsBuffer.create(m_vulkanDevice,
-        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-        bufferSize,
-        m_scene->getMaterialsShaderData().data());
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        bufferSize);
+    m_descriptorHeap.writeBuffer(BINDLESS_MATERIALS_BUFFER, m_materialsBuffer.descriptor);
 
     // global Light list uniform (its a storage buffer)
     bufferSize = sizeof(ShaderLight) * m_scene->getLightCount();
     m_lightsBuffer.create(m_vulkanDevice,
-        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-        bufferSize,
-        m_scene->getLightsShaderData().data());
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        bufferSize);
+
+    updateSceneBuffers();
 
     // Auto Exposure uniform, also set the default data
     bufferSize = sizeof(ExposureUniformData);
-    m_exposureBuffers.resize(m_swapChain.imageCount);
-    for (size_t i = 0; i < m_swapChain.imageCount; ++i) {
+    m_exposureBuffers.resize(m_settings.framesInFlight);
+    for (size_t i = 0; i < m_settings.framesInFlight; ++i) {
         m_exposureBuffers[i].create(m_vulkanDevice,
             VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
             VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
@@ -725,6 +670,27 @@ void HybridPipelineRT::createUniformBuffers()
     }
 }
 
+// Upload the instances, materials and lights of the scene to their device local buffers, call it
+// again after editing them
+void HybridPipelineRT::updateSceneBuffers()
+{
+    const auto instances = m_scene->getInstancesShaderData();
+    m_instancesBuffer.upload(m_vulkanDevice,
+        m_queue,
+        instances.data(),
+        sizeof(ShaderMeshInstance) * instances.size());
+    const auto materials = m_scene->getMaterialsShaderData();
+    m_materialsBuffer.upload(m_vulkanDevice,
+        m_queue,
+        materials.data(),
+        sizeof(ShaderMaterial) * materials.size());
+    const auto lights = m_scene->getLightsShaderData();
+    if (!lights.empty()) {
+        m_lightsBuffer.upload(
+            m_vulkanDevice, m_queue, lights.data(), sizeof(ShaderLight) * lights.size());
+    }
+}
+
 void HybridPipelineRT::createRasterPipeline()
 {
     VkPipelineInputAssemblyStateCreateInfo inputAssemblyState
@@ -893,7 +859,13 @@ void HybridPipelineRT::setupScene()
         VERTEX_COMPONENT_TANGENT,
         VERTEX_COMPONENT_UV,
         VERTEX_COMPONENT_DUMMY_FLOAT });
-    m_scene = m_rayTracing->createRTScene(m_queue, "assets/pool/Pool_I.fbx", m_vertexLayout);
+    if (m_settings.hostBlasBuild) {
+        m_rayTracing->setBlasBuildType(VK_ACCELERATION_STRUCTURE_BUILD_TYPE_HOST_KHR);
+    }
+    m_rayTracing->setTriangleSplitting(m_settings.splitTriangleBudget, m_settings.splitAreaRatio);
+    m_scene = m_rayTracing->createRTScene(
+        m_queue, "assets/pool/Pool_I.fbx", m_vertexLayout, m_settings.framesInFlight);
+    m_scene->registerTextures(&m_descriptorHeap);
     auto camera = m_scene->getCamera();
     camera->setMovementSpeed(100.0f);
     camera->setRotationSpeed(0.5f);
@@ -944,7 +916,6 @@ HybridPipelineRT::~HybridPipelineRT()
     vkDestroyPipelineLayout(m_device, m_pipelineLayouts.raster, nullptr);
 
     vkDestroyDescriptorSetLayout(m_device, m_rasterDescriptorSetLayouts.set0Scene, nullptr);
-    vkDestroyDescriptorSetLayout(m_device, m_rasterDescriptorSetLayouts.set1Materials, nullptr);
     vkDestroyDescriptorSetLayout(m_device, m_rasterDescriptorSetLayouts.set2Lights, nullptr);
 
     for (auto& offscreenImage : m_storageImages) {
@@ -957,7 +928,7 @@ HybridPipelineRT::~HybridPipelineRT()
         offscreenImage.offscreenReflectRefractMap.destroy();
     }
 
-    for (size_t i = 0; i < m_swapChain.imageCount; ++i) {
+    for (size_t i = 0; i < m_settings.framesInFlight; ++i) {
         m_sceneBuffers[i].destroy();
         m_exposureBuffers[i].destroy();
     }
@@ -41,7 +41,6 @@ private:
     } m_rasterDescriptorSets;
     struct {
         VkDescriptorSetLayout set0Scene;
-        VkDescriptorSetLayout set1Materials;
         VkDescriptorSetLayout set2Lights;
     } m_rasterDescriptorSetLayouts;
 
@@ -59,7 +58,7 @@ private:
         Texture rtResultImage;
         Texture postProcessResultImage;
     };
-    // we will have one set of images per swap image
+    // we will have one set of images per frame in flight
     std::vector<OffscreenImages> m_storageImages;
     // Offscreen raster render pass
     VkRenderPass m_offscreenRenderPass;
@@ -76,7 +75,7 @@ private:
         uint32_t frame { 0 }; // Current frame
         float manualExposureAdjust = { 0.0f };
     } m_sceneUniformData;
-    // one for each swap chain image, the scene can change on every frame
+    // one for each frame in flight, the scene can change on every frame
     std::vector<Buffer> m_sceneBuffers;
 
     struct ExposureUniformData {
@@ -89,10 +88,11 @@ private:
     void prepare() override;
     void viewChanged() override;
     void createOffscreenRenderPass();
-    void updateUniformBuffers(uint32_t t_currentImage);
+    void updateUniformBuffers(uint32_t t_frame);
     void onSwapChainRecreation() override;
     void createOffscreenFramebuffers();
     void buildCommandBuffers() override;
+    void buildComputeCommandBuffer(uint32_t t_frame, uint32_t t_imageIndex);
     void onKeyEvent(int t_key, int t_scancode, int t_action, int t_mods) override;
     void createStorageImages();
     void createRTPipeline();
@@ -104,6 +104,7 @@ private:
     void createDescriptorSets();
     void updateResultImageDescriptorSets();
     void createUniformBuffers();
+    void updateSceneBuffers();
 };
 
 #endif // MANUEME_HYBRID_PIPELINE_RAY_TRACING_H
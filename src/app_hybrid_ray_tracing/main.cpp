@@ -8,11 +8,12 @@
 
 #include "hybrid_pipeline_ray_tracing.h"
 
-int main()
+int main(int argc, char* argv[])
 {
     HybridPipelineRT app;
 
     try {
+        app.parseArguments(argc, argv);
         app.run();
     } catch (const std::exception& e) {
         std::cerr << e.what() << std::endl;
@@ -5,6 +5,7 @@
 
 #include "hy_ray_tracing_pipeline.h"
 #include "../constants.h"
+#include "core/descriptor_heap.h"
 #include <array>
 #include <vector>
 
@@ -21,7 +22,6 @@ HyRayTracingPipeline::~HyRayTracingPipeline()
         nullptr);
     vkDestroyDescriptorSetLayout(m_device, m_descriptorSetLayouts.set1Scene, nullptr);
     vkDestroyDescriptorSetLayout(m_device, m_descriptorSetLayouts.set2Geometry, nullptr);
-    vkDestroyDescriptorSetLayout(m_device, m_descriptorSetLayouts.set3Materials, nullptr);
     vkDestroyDescriptorSetLayout(m_device, m_descriptorSetLayouts.set4Lights, nullptr);
     vkDestroyDescriptorSetLayout(m_device, m_descriptorSetLayouts.set5OffscreenImages, nullptr);
     vkDestroyDescriptorSetLayout(m_device, m_descriptorSetLayouts.set6StorageImages, nullptr);
@@ -76,7 +76,7 @@ void HyRayTracingPipeline::buildCommandBuffer(uint32_t t_index, VkCommandBuffer
         1);
 }
 
-void HyRayTracingPipeline::createDescriptorSetsLayout(Scene* t_scene)
+void HyRayTracingPipeline::createDescriptorSetsLayout(DescriptorHeap* t_heap)
 {
     // Set 0: Acceleration Structure Layout
     std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings = {
@@ -113,18 +113,10 @@ void HyRayTracingPipeline::createDescriptorSetsLayout(Scene* t_scene)
     // Set 2: Geometry data
     setLayoutBindings.clear();
     setLayoutBindings = {
-        // Binding 0 : Vertex uniform buffer
+        // Binding 0 : Instance Information uniform buffer, with the addresses of the geometry
         initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
             VK_SHADER_STAGE_ANY_HIT_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR,
             0),
-        // Binding 1 : Vertex Index uniform buffer
-        initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-            VK_SHADER_STAGE_ANY_HIT_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR,
-            1),
-        // Binding 2 : Instance Information uniform buffer
-        initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-            VK_SHADER_STAGE_ANY_HIT_BIT_KHR | VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR,
-            2),
     };
     descriptorLayout = initializers::descriptorSetLayoutCreateInfo(setLayoutBindings.data(),
         setLayoutBindings.size());
@@ -133,27 +125,7 @@ void HyRayTracingPipeline::createDescriptorSetsLayout(Scene* t_scene)
         nullptr,
         &m_descriptorSetLayouts.set2Geometry));
 
-    // Set 3: Textures data
-    setLayoutBindings.clear();
-    // Texture list binding 0
-    setLayoutBindings.push_back(
-        initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-            VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR | VK_SHADER_STAGE_ANY_HIT_BIT_KHR
-                | VK_SHADER_STAGE_RAYGEN_BIT_KHR,
-            0,
-            t_scene->textures.size()));
-    // Material list binding 1
-    setLayoutBindings.push_back(
-        initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-            VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR | VK_SHADER_STAGE_ANY_HIT_BIT_KHR
-                | VK_SHADER_STAGE_RAYGEN_BIT_KHR,
-            1));
-    descriptorLayout = initializers::descriptorSetLayoutCreateInfo(setLayoutBindings.data(),
-        setLayoutBindings.size());
-    CHECK_RESULT(vkCreateDescriptorSetLayout(m_device,
-        &descriptorLayout,
-        nullptr,
-        &m_descriptorSetLayouts.set3Materials));
+    // Set 3: Textures and materials, the layout of the descriptor heap
 
     // Set 4: Lighting data
     setLayoutBindings.clear();
@@ -230,7 +202,7 @@ void HyRayTracingPipeline::createDescriptorSetsLayout(Scene* t_scene)
         = { m_descriptorSetLayouts.set0AccelerationStructure,
               m_descriptorSetLayouts.set1Scene,
               m_descriptorSetLayouts.set2Geometry,
-              m_descriptorSetLayouts.set3Materials,
+              t_heap->getLayout(),
               m_descriptorSetLayouts.set4Lights,
               m_descriptorSetLayouts.set5OffscreenImages,
               m_descriptorSetLayouts.set6StorageImages };
@@ -246,9 +218,9 @@ void HyRayTracingPipeline::createDescriptorSetsLayout(Scene* t_scene)
         &m_pipelineLayout));
 }
 
-void HyRayTracingPipeline::createDescriptorSets(VkDescriptorPool t_descriptorPool, Scene* t_scene,
-    uint32_t t_swapChainCount, std::vector<Buffer>& t_sceneBuffers, Buffer* t_instancesBuffer,
-    Buffer* t_lightsBuffer, Buffer* t_materialsBuffer)
+void HyRayTracingPipeline::createDescriptorSets(VkDescriptorPool t_descriptorPool,
+    DescriptorHeap* t_heap, uint32_t t_swapChainCount, std::vector<Buffer>& t_sceneBuffers,
+    Buffer* t_instancesBuffer, Buffer* t_lightsBuffer)
 {
     // Set 0: Acceleration Structure descriptor
     VkDescriptorSetAllocateInfo set0AllocInfo
@@ -312,70 +284,20 @@ void HyRayTracingPipeline::createDescriptorSets(VkDescriptorPool t_descriptorPoo
             1);
     CHECK_RESULT(vkAllocateDescriptorSets(m_device, &set2AllocInfo, &m_descriptorSets.set2Geometry))
 
-    VkDescriptorBufferInfo vertexBufferDescriptor {};
-    vertexBufferDescriptor.buffer = t_scene->vertices.buffer;
-    vertexBufferDescriptor.range = VK_WHOLE_SIZE;
-
-    VkDescriptorBufferInfo indexBufferDescriptor {};
-    indexBufferDescriptor.buffer = t_scene->indices.buffer;
-    indexBufferDescriptor.range = VK_WHOLE_SIZE;
-
-    VkWriteDescriptorSet vertexBufferWrite
-        = initializers::writeDescriptorSet(m_descriptorSets.set2Geometry,
-            VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-            0,
-            &vertexBufferDescriptor);
-    VkWriteDescriptorSet indexBufferWrite
-        = initializers::writeDescriptorSet(m_descriptorSets.set2Geometry,
-            VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-            1,
-            &indexBufferDescriptor);
     VkWriteDescriptorSet materialIndexBufferWrite
         = initializers::writeDescriptorSet(m_descriptorSets.set2Geometry,
             VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-            2,
+            0,
             &t_instancesBuffer->descriptor);
-    std::vector<VkWriteDescriptorSet> writeDescriptorSet2
-        = { vertexBufferWrite, indexBufferWrite, materialIndexBufferWrite };
+    std::vector<VkWriteDescriptorSet> writeDescriptorSet2 = { materialIndexBufferWrite };
     vkUpdateDescriptorSets(m_device,
         static_cast<uint32_t>(writeDescriptorSet2.size()),
         writeDescriptorSet2.data(),
         0,
         VK_NULL_HANDLE);
 
-    // Set 3: Materials and Textures descriptor
-    VkDescriptorSetAllocateInfo set3AllocInfo
-        = initializers::descriptorSetAllocateInfo(t_descriptorPool,
-            &m_descriptorSetLayouts.set3Materials,
-            1);
-    CHECK_RESULT(
-        vkAllocateDescriptorSets(m_device, &set3AllocInfo, &m_descriptorSets.set3Materials))
-
-    std::vector<VkWriteDescriptorSet> writeDescriptorSet3 = {};
-    VkWriteDescriptorSet writeTextureDescriptorSet;
-    std::vector<VkDescriptorImageInfo> textureDescriptors = {};
-    if (!t_scene->textures.empty()) {
-        for (auto& texture : t_scene->textures) {
-            textureDescriptors.push_back(texture.descriptor);
-        }
-        writeTextureDescriptorSet = initializers::writeDescriptorSet(m_descriptorSets.set3Materials,
-            VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-            0,
-            textureDescriptors.data(),
-            textureDescriptors.size());
-        writeDescriptorSet3.push_back(writeTextureDescriptorSet);
-    }
-    VkWriteDescriptorSet writeMaterialsDescriptorSet
-        = initializers::writeDescriptorSet(m_descriptorSets.set3Materials,
-            VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-            1,
-            &t_materialsBuffer->descriptor);
-    writeDescriptorSet3.push_back(writeMaterialsDescriptorSet);
-    vkUpdateDescriptorSets(m_device,
-        static_cast<uint32_t>(writeDescriptorSet3.size()),
-        writeDescriptorSet3.data(),
-        0,
-        nullptr);
+    // Set 3: Materials and Textures descriptor, shared with the other pipelines
+    m_descriptorSets.set3Materials = t_heap->getDescriptorSet();
 
     // Set 4: Lighting descriptor
     VkDescriptorSetAllocateInfo set4AllocInfo
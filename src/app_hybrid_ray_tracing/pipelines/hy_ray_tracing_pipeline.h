@@ -12,6 +12,7 @@
 #include "scene/scene.h"
 #include "vulkan/vulkan_core.h"
 
+class DescriptorHeap;
 class Texture;
 class Device;
 
@@ -23,11 +24,12 @@ public:
     void buildCommandBuffer(
         uint32_t t_index, VkCommandBuffer t_commandBuffer, uint32_t t_width, uint32_t t_height);
 
-    void createDescriptorSetsLayout(Scene* t_scene) override;
+    void createDescriptorSetsLayout(DescriptorHeap* t_heap) override;
 
-    void createDescriptorSets(VkDescriptorPool t_descriptorPool, Scene* t_scene,
+    /** @brief Sets of the pipeline, the textures and materials (set 3) are the ones of t_heap */
+    void createDescriptorSets(VkDescriptorPool t_descriptorPool, DescriptorHeap* t_heap,
         uint32_t t_swapChainCount, std::vector<Buffer>& t_sceneBuffers, Buffer* t_instancesBuffer,
-        Buffer* t_lightsBuffer, Buffer* t_materialsBuffer);
+        Buffer* t_lightsBuffer);
 
     void updateResultImageDescriptorSets(uint32_t t_index,
         Texture* t_offscreenMaterial, Texture* t_offscreenAlbedo,
@@ -48,7 +50,6 @@ private:
         VkDescriptorSetLayout set0AccelerationStructure;
         VkDescriptorSetLayout set1Scene;
         VkDescriptorSetLayout set2Geometry;
-        VkDescriptorSetLayout set3Materials;
         VkDescriptorSetLayout set4Lights;
         VkDescriptorSetLayout set5OffscreenImages;
         VkDescriptorSetLayout set6StorageImages;
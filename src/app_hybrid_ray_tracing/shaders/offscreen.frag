@@ -13,14 +13,16 @@
 #include "../../framework/shaders/utils.glsl"
 #include "app_scene.glsl"
 
-layout(binding = 0, set = 1) uniform sampler2D textures[];
-layout(binding = 1, set = 1) buffer _Materials { MaterialProperties m[]; }
-materials;
+// Bindless descriptor heap, shared with the ray tracing pipeline
+layout(binding = BINDLESS_TEXTURES_BINDING, set = 1) uniform sampler2D textures[];
+layout(binding = BINDLESS_BUFFERS_BINDING, set = 1) buffer _Materials { MaterialProperties m[]; }
+materialBuffers[];
+#define materials materialBuffers[BINDLESS_MATERIALS_BUFFER]
 
 layout(binding = 0, set = 2) buffer _Lights { LightProperties l[]; }
 lighting;
 
-layout(push_constant) uniform Index { int i; }
+layout(push_constant) uniform Index { layout(offset = 64) int i; }
 materialIndex;
 
 layout(location = 0) in vec2 inUV;
@@ -62,9 +64,10 @@ void main()
     // #### Compute shading normal ####
     vec3 shadingNormal;
     if (normalMapIndex >= 0) {
-        shadingNormal = texture(textures[nonuniformEXT(normalMapIndex)], inUV).rgb;
-        shadingNormal = normalize(shadingNormal * 2.0 - 1.0);
-        shadingNormal = TBN * shadingNormal;
+        // Only X and Y are read, BC5 normal maps do not store Z
+        shadingNormal.xy = texture(textures[nonuniformEXT(normalMapIndex)], inUV).rg * 2.0 - 1.0;
+        shadingNormal.z = sqrt(max(0.0, 1.0 - dot(shadingNormal.xy, shadingNormal.xy)));
+        shadingNormal = TBN * normalize(shadingNormal);
     } else {
         shadingNormal = inNormal;
     }
@@ -21,6 +21,10 @@ layout(binding = 0) uniform SceneProperties
 }
 scene;
 
+// Object to world transform of the instance being drawn
+layout(push_constant) uniform Instance { mat4 transform; }
+instance;
+
 layout(location = 0) out vec2 outUV;
 layout(location = 1) out vec3 outNormal;
 layout(location = 2) out vec3 outTangent;
@@ -33,16 +37,19 @@ void main()
     const mat3 worldNormal = transpose(inverse(mat3(scene.model)));
     const mat3 viewNormal = transpose(mat3(scene.viewInverse));
 
-    const vec3 hitNormal = inNormal;
+    const mat3 instanceNormal = transpose(inverse(mat3(instance.transform)));
+    const vec3 hitNormal = normalize(instanceNormal * inNormal);
     outNormal = normalize(viewNormal * hitNormal);
-    const vec3 hitTangent = normalize(inTangent - dot(inTangent, hitNormal) * hitNormal);
+    const vec3 instanceTangent = normalize(mat3(instance.transform) * inTangent);
+    const vec3 hitTangent
+        = normalize(instanceTangent - dot(instanceTangent, hitNormal) * hitNormal);
     outTangent = normalize(worldNormal * hitTangent);
     const vec3 hitBitangent = normalize(cross(hitNormal, hitTangent));
     outBitangent = hitBitangent;
 
     outUV = inTexCoord;
 
-    mat4 modelView = scene.view * scene.model;
+    mat4 modelView = scene.view * scene.model * instance.transform;
     vec4 pos = modelView * vec4(inPos, 1.0);
     gl_Position = scene.projection * pos;
     outEyePos = pos.xyz;
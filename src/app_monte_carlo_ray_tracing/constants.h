@@ -28,6 +28,7 @@
 // Shadow Ray Hit Group
 #define SBT_SHADOW_HIT_GROUP 4
 #define SBT_SHADOW_ANY_HIT_INDEX 5
+#define SBT_SHADOW_CLOSEST_HIT_INDEX 6
 // Group count
 #define SBT_NUM_SHADER_GROUPS 5
 // ----
@@ -8,11 +8,12 @@
 
 #include "monte_carlo_ray_tracing.h"
 
-int main()
+int main(int argc, char* argv[])
 {
     MonteCarloRTApp app;
 
     try {
+        app.parseArguments(argc, argv);
         app.run();
     } catch (const std::exception& e) {
         std::cerr << e.what() << std::endl;
@@ -24,6 +24,7 @@ MonteCarloRTApp::MonteCarloRTApp()
     m_settings.useRayTracing = true;
     // Make sure no more than 1 frame is processed at the same time to
     // avoid issues in the accumulated image
+    m_settings.framesInFlight = 1;
 }
 
 void MonteCarloRTApp::buildCommandBuffers()
@@ -37,66 +38,89 @@ void MonteCarloRTApp::buildCommandBuffers()
         CHECK_RESULT(vkEndCommandBuffer(m_drawCmdBuffers[i]))
     }
     // ---
-    // Compute command buffers
+}
+
+void MonteCarloRTApp::buildComputeCommandBuffer(uint32_t t_frame, uint32_t t_imageIndex)
+{
+    // Recorded on every frame, the swap chain image the result is copied to is only known once
+    // it is acquired
     VkCommandBufferBeginInfo computeCmdBufInfo = {};
     computeCmdBufInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    for (int32_t i = 0; i < m_compute.commandBuffers.size(); ++i) {
-        CHECK_RESULT(vkBeginCommandBuffer(m_compute.commandBuffers[i], &computeCmdBufInfo))
-        m_autoExposure->buildCommandBuffer(m_compute.commandBuffers[i]);
-        m_postProcess->buildCommandBuffer(m_compute.commandBuffers[i], m_width, m_height);
-
-        // Move result to swap chain image:
-
-        // Prepare images to transfer
-        VkImageSubresourceRange subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
-        tools::setImageLayout(m_compute.commandBuffers[i],
-            m_swapChain.images[i],
-            VK_IMAGE_LAYOUT_UNDEFINED,
-            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-            subresourceRange);
-        tools::setImageLayout(m_compute.commandBuffers[i],
-            m_storageImage.postProcessResult.getImage(),
-            VK_IMAGE_LAYOUT_GENERAL,
-            VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-            subresourceRange);
-
-        VkImageCopy copyRegion {};
-        copyRegion.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
-        copyRegion.srcOffset = { 0, 0, 0 };
-        copyRegion.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
-        copyRegion.dstOffset = { 0, 0, 0 };
-        copyRegion.extent = { m_width, m_height, 1 };
-        vkCmdCopyImage(m_compute.commandBuffers[i],
-            m_storageImage.postProcessResult.getImage(),
-            VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-            m_swapChain.images[i],
-            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-            1,
-            &copyRegion);
-
-        // Transition back to previous layouts:
-        tools::setImageLayout(m_compute.commandBuffers[i],
-            m_swapChain.images[i],
-            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-            VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
-            subresourceRange);
-        tools::setImageLayout(m_compute.commandBuffers[i],
-            m_storageImage.postProcessResult.getImage(),
-            VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-            VK_IMAGE_LAYOUT_GENERAL,
-            subresourceRange);
-
-        vkEndCommandBuffer(m_compute.commandBuffers[i]);
+    computeCmdBufInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    CHECK_RESULT(vkBeginCommandBuffer(m_compute.commandBuffers[t_frame], &computeCmdBufInfo))
+    m_autoExposure->buildCommandBuffer(m_compute.commandBuffers[t_frame]);
+    m_postProcess->buildCommandBuffer(m_compute.commandBuffers[t_frame], m_width, m_height);
+
+    // Move result to swap chain image:
+
+    // Prepare images to transfer
+    VkImageSubresourceRange subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+    tools::setImageLayout(m_compute.commandBuffers[t_frame],
+        m_swapChain.images[t_imageIndex],
+        VK_IMAGE_LAYOUT_UNDEFINED,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        subresourceRange);
+    tools::setImageLayout(m_compute.commandBuffers[t_frame],
+        m_storageImage.postProcessResult.getImage(),
+        VK_IMAGE_LAYOUT_GENERAL,
+        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        subresourceRange);
+
+    VkImageCopy copyRegion {};
+    copyRegion.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+    copyRegion.srcOffset = { 0, 0, 0 };
+    copyRegion.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+    copyRegion.dstOffset = { 0, 0, 0 };
+    copyRegion.extent = { m_width, m_height, 1 };
+    vkCmdCopyImage(m_compute.commandBuffers[t_frame],
+        m_storageImage.postProcessResult.getImage(),
+        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        m_swapChain.images[t_imageIndex],
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        1,
+        &copyRegion);
+
+    // Transition back to previous layouts:
+    tools::setImageLayout(m_compute.commandBuffers[t_frame],
+        m_swapChain.images[t_imageIndex],
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+        subresourceRange);
+    tools::setImageLayout(m_compute.commandBuffers[t_frame],
+        m_storageImage.postProcessResult.getImage(),
+        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        VK_IMAGE_LAYOUT_GENERAL,
+        subresourceRange);
+
+    CHECK_RESULT(vkEndCommandBuffer(m_compute.commandBuffers[t_frame]))
+}
+
+bool MonteCarloRTApp::buildInstanceUpdateCommandBuffer(uint32_t t_frame)
+{
+    if (m_animateInstances) {
+        m_animationTime += m_frameTimer;
+        for (uint32_t i = 0; i < m_instanceBaseTransforms.size(); ++i) {
+            const float offset = 0.25f * sinf(2.0f * m_animationTime + static_cast<float>(i));
+            m_rayTracing->setInstanceTransform(i,
+                glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, offset, 0.0f))
+                    * m_instanceBaseTransforms[i]);
+        }
+        // The samples accumulated with the old positions are discarded
+        m_sceneUniformData.frameIteration = 0;
     }
-    // ---
+
+    VkCommandBufferBeginInfo cmdBufInfo = {};
+    cmdBufInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    cmdBufInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    CHECK_RESULT(vkBeginCommandBuffer(m_instanceUpdateCmdBuffers[t_frame], &cmdBufInfo))
+    const bool updated = m_rayTracing->recordTopLevelAccelerationStructureUpdate(
+        m_instanceUpdateCmdBuffers[t_frame], t_frame, m_instancesBuffer);
+    CHECK_RESULT(vkEndCommandBuffer(m_instanceUpdateCmdBuffers[t_frame]))
+    return updated;
 }
 
 void MonteCarloRTApp::createDescriptorPool()
 {
-    // Calculate the number of textures needed
-    uint32_t textureCount
-        = m_scene->textures.empty() ? 1 : static_cast<uint32_t>(m_scene->textures.size());
-
     // Storage images: ray tracing set5ResultImage (2 bindings) + postprocess set3ResultImage (1
     // binding) = 3 total
     uint32_t storageImageCount = 3;
@@ -107,12 +131,9 @@ void MonteCarloRTApp::createDescriptorPool()
         { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1 },
         // Exposure
         { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1 },
-        // Vertex, Index and Material Indexes
-        { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1 },
-        // Textures (needs to accommodate all textures in the scene)
-        { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, textureCount },
-        // Material array
+        // Instance information (geometry addresses and material indexes)
         { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1 },
+        // Textures and materials are in the descriptor heap
         // Lights array
         { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1 },
         // Result images
@@ -124,12 +145,9 @@ void MonteCarloRTApp::createDescriptorPool()
     const auto asSets = 1;
     const auto sceneSets = 1;
     const auto vertexAndIndexes = 3;
-    const auto textures = 1;
-    const auto materials = 1;
     const auto lights = 1;
     const auto resultImages = 4;
-    uint32_t maxSetsForPool
-        = asSets + sceneSets + vertexAndIndexes + textures + materials + lights + resultImages;
+    uint32_t maxSetsForPool = asSets + sceneSets + vertexAndIndexes + lights + resultImages;
     // ---
 
     VkDescriptorPoolCreateInfo descriptorPoolCreateInfo
@@ -143,7 +161,7 @@ void MonteCarloRTApp::createDescriptorPool()
 void MonteCarloRTApp::createDescriptorSetsLayout()
 {
     // Ray Tracing
-    m_rayTracing->createDescriptorSetsLayout(m_scene);
+    m_rayTracing->createDescriptorSetsLayout(&m_descriptorHeap);
 
     // Postprocess
     m_postProcess->createDescriptorSetsLayout();
@@ -160,7 +178,7 @@ void MonteCarloRTApp::createPostprocessPipeline()
 
 void MonteCarloRTApp::createRTPipeline()
 {
-    std::vector<VkPipelineShaderStageCreateInfo> shaderStages(6);
+    std::vector<VkPipelineShaderStageCreateInfo> shaderStages(7);
     shaderStages[SBT_RAY_GEN_INDEX]
         = loadShader("./shaders/raygen.rgen.spv", VK_SHADER_STAGE_RAYGEN_BIT_KHR);
     shaderStages[SBT_MISS_INDEX]
@@ -173,6 +191,8 @@ void MonteCarloRTApp::createRTPipeline()
         = loadShader("./shaders/closesthit.rchit.spv", VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR);
     shaderStages[SBT_SHADOW_ANY_HIT_INDEX]
         = loadShader("./shaders/shadow.rahit.spv", VK_SHADER_STAGE_ANY_HIT_BIT_KHR);
+    shaderStages[SBT_SHADOW_CLOSEST_HIT_INDEX]
+        = loadShader("./shaders/shadow.rchit.spv", VK_SHADER_STAGE_CLOSEST_HIT_BIT_KHR);
     /*
       Setup ray tracing shader groups
     */
@@ -203,6 +223,7 @@ void MonteCarloRTApp::createRTPipeline()
     // Shadow closest hit shader group
     groups[SBT_SHADOW_HIT_GROUP].type = VK_RAY_TRACING_SHADER_GROUP_TYPE_TRIANGLES_HIT_GROUP_KHR;
     groups[SBT_SHADOW_HIT_GROUP].anyHitShader = SBT_SHADOW_ANY_HIT_INDEX;
+    groups[SBT_SHADOW_HIT_GROUP].closestHitShader = SBT_SHADOW_CLOSEST_HIT_INDEX;
 
     m_rayTracing->createPipeline(shaderStages, groups);
 }
@@ -217,11 +238,10 @@ void MonteCarloRTApp::createDescriptorSets()
 {
     // Ray Tracing
     m_rayTracing->createDescriptorSets(m_descriptorPool,
-        m_scene,
+        &m_descriptorHeap,
         &m_sceneBuffer,
         &m_instancesBuffer,
-        &m_lightsBuffer,
-        &m_materialsBuffer);
+        &m_lightsBuffer);
 
     // Postprocess
     m_postProcess->createDescriptorSets(m_descriptorPool, &m_sceneBuffer, &m_exposureBuffer);
@@ -245,7 +265,7 @@ void MonteCarloRTApp::updateResultImageDescriptorSets()
     m_autoExposure->updateResultImageDescriptorSets(&m_storageImage.result);
 }
 
-void MonteCarloRTApp::updateUniformBuffers(uint32_t t_currentImage)
+void MonteCarloRTApp::updateUniformBuffers(uint32_t t_frame)
 {
     // As long as we use accumulation in one single image it doesnt make sense to have multiple
     // scene buffers to update (using single buffer approach)
@@ -268,20 +288,19 @@ void MonteCarloRTApp::createUniformBuffers()
         throw std::runtime_error("Cannot create instances buffer with zero size");
     }
     m_instancesBuffer.create(m_vulkanDevice,
-        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-        bufferSize,
-        m_scene->getInstancesShaderData().data());
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        bufferSize);
     // global Material list uniform (its a storage buffer)
     bufferSize = sizeof(ShaderMaterial) * m_scene->getMaterialCount();
     if (bufferSize == 0) {
         throw std::runtime_error("Cannot create materials buffer with zero size");
     }
     m_materialsBuffer.create(m_vulkanDevice,
-        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-        bufferSize,
-        m_scene->getMaterialsShaderData().data());
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        bufferSize);
+    m_descriptorHeap.writeBuffer(BINDLESS_MATERIALS_BUFFER, m_materialsBuffer.descriptor);
 
     // global Light list uniform (its a storage buffer)
     auto lightCount = m_scene->getLightCount();
@@ -290,10 +309,11 @@ void MonteCarloRTApp::createUniformBuffers()
         bufferSize = sizeof(ShaderLight); // Create at least one element
     }
     m_lightsBuffer.create(m_vulkanDevice,
-        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-        bufferSize,
-        lightCount > 0 ? m_scene->getLightsShaderData().data() : nullptr);
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        bufferSize);
+
+    updateSceneBuffers();
 
     // Auto Exposure uniform, also set the default data
     bufferSize = sizeof(ExposureUniformData);
@@ -306,6 +326,27 @@ void MonteCarloRTApp::createUniformBuffers()
     m_exposureBuffer.unmap();
 }
 
+// Upload the instances, materials and lights of the scene to their device local buffers, call it
+// again after editing them
+void MonteCarloRTApp::updateSceneBuffers()
+{
+    const auto instances = m_scene->getInstancesShaderData();
+    m_instancesBuffer.upload(m_vulkanDevice,
+        m_queue,
+        instances.data(),
+        sizeof(ShaderMeshInstance) * instances.size());
+    const auto materials = m_scene->getMaterialsShaderData();
+    m_materialsBuffer.upload(m_vulkanDevice,
+        m_queue,
+        materials.data(),
+        sizeof(ShaderMaterial) * materials.size());
+    const auto lights = m_scene->getLightsShaderData();
+    if (!lights.empty()) {
+        m_lightsBuffer.upload(
+            m_vulkanDevice, m_queue, lights.data(), sizeof(ShaderLight) * lights.size());
+    }
+}
+
 /*
     Set up a storage image that the ray generation shader will be writing to
 */
@@ -354,7 +395,18 @@ void MonteCarloRTApp::setupScene()
         VERTEX_COMPONENT_TANGENT,
         VERTEX_COMPONENT_UV,
         VERTEX_COMPONENT_DUMMY_FLOAT });
-    m_scene = m_rayTracing->createRTScene(m_queue, "assets/scene.gltf", m_vertexLayout);
+    if (m_settings.hostBlasBuild) {
+        m_rayTracing->setBlasBuildType(VK_ACCELERATION_STRUCTURE_BUILD_TYPE_HOST_KHR);
+    }
+    m_rayTracing->setTriangleSplitting(m_settings.splitTriangleBudget, m_settings.splitAreaRatio);
+    // The shadow hit group has a closest hit shader, shadows stay correct without any-hit
+    m_rayTracing->setOpaqueGeometry(true);
+    m_scene = m_rayTracing->createRTScene(
+        m_queue, "assets/scene.gltf", m_vertexLayout, m_settings.framesInFlight);
+    m_scene->registerTextures(&m_descriptorHeap);
+    for (uint32_t i = 0; i < m_rayTracing->getTlasInstanceCount(); ++i) {
+        m_instanceBaseTransforms.push_back(m_rayTracing->getInstanceTransform(i));
+    }
     auto camera = m_scene->getCamera();
     camera->setMovementSpeed(10.0f);
     camera->setRotationSpeed(0.5f);
@@ -383,6 +435,16 @@ void MonteCarloRTApp::prepare()
     createDescriptorPool();
     createDescriptorSets();
     buildCommandBuffers();
+
+    m_instanceUpdateCmdBuffers.resize(m_settings.framesInFlight);
+    VkCommandBufferAllocateInfo cmdBufAllocateInfo {};
+    cmdBufAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    cmdBufAllocateInfo.commandPool = m_cmdPool;
+    cmdBufAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    cmdBufAllocateInfo.commandBufferCount
+        = static_cast<uint32_t>(m_instanceUpdateCmdBuffers.size());
+    CHECK_RESULT(vkAllocateCommandBuffers(
+        m_device, &cmdBufAllocateInfo, m_instanceUpdateCmdBuffers.data()))
     m_prepared = true;
 }
 
@@ -398,41 +460,41 @@ void MonteCarloRTApp::render()
         return;
     }
 
-    updateUniformBuffers(imageIndex);
-
-    // Get the frame index that was used for acquisition (needed for the acquisition semaphore)
-    size_t frameIndex = getAcquisitionFrameIndex(imageIndex);
+    const auto frame = m_currentFrame;
+    const bool instancesUpdated = buildInstanceUpdateCommandBuffer(frame);
+    updateUniformBuffers(frame);
+    buildComputeCommandBuffer(frame, imageIndex);
 
-    // Submit the draw command buffer
+    // Submit the draw command buffer, after the instance update if any
+    const VkCommandBuffer drawCmdBuffers[] = { m_instanceUpdateCmdBuffers[frame],
+        m_drawCmdBuffers[frame] };
     VkSubmitInfo submitInfo {};
     submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
     submitInfo.waitSemaphoreCount = 1;
-    submitInfo.pWaitSemaphores = &m_imageAvailableSemaphores[frameIndex];
+    submitInfo.pWaitSemaphores = &m_imageAvailableSemaphores[frame];
     VkPipelineStageFlags drawWaitStageMask = VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR;
     submitInfo.pWaitDstStageMask = &drawWaitStageMask;
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &m_drawCmdBuffers[imageIndex];
+    submitInfo.commandBufferCount = instancesUpdated ? 2 : 1;
+    submitInfo.pCommandBuffers = instancesUpdated ? drawCmdBuffers : &m_drawCmdBuffers[frame];
     submitInfo.signalSemaphoreCount = 1;
-    submitInfo.pSignalSemaphores = &m_compute.semaphores[imageIndex];
-    vkResetFences(m_device, 1, &m_inFlightFences[imageIndex]);
-    CHECK_RESULT(vkQueueSubmit(m_queue, 1, &submitInfo, m_inFlightFences[imageIndex]))
+    submitInfo.pSignalSemaphores = &m_compute.semaphores[frame];
+    vkResetFences(m_device, 1, &m_inFlightFences[frame]);
+    CHECK_RESULT(vkQueueSubmit(m_queue, 1, &submitInfo, m_inFlightFences[frame]))
     // ----
 
     // Submit Compute Command Buffer:
-    vkWaitForFences(m_device, 1, &m_compute.fences[imageIndex], VK_TRUE, UINT64_MAX);
     VkSubmitInfo computeSubmitInfo {};
     computeSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
     computeSubmitInfo.commandBufferCount = 1;
-    computeSubmitInfo.pCommandBuffers = &m_compute.commandBuffers[imageIndex];
+    computeSubmitInfo.pCommandBuffers = &m_compute.commandBuffers[frame];
     computeSubmitInfo.waitSemaphoreCount = 1;
-    computeSubmitInfo.pWaitSemaphores = &m_compute.semaphores[imageIndex];
+    computeSubmitInfo.pWaitSemaphores = &m_compute.semaphores[frame];
     computeSubmitInfo.signalSemaphoreCount = 1;
     computeSubmitInfo.pSignalSemaphores = &m_renderFinishedSemaphores[imageIndex];
     VkPipelineStageFlags computeWaitStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
     computeSubmitInfo.pWaitDstStageMask = &computeWaitStageMask;
-    vkResetFences(m_device, 1, &m_compute.fences[imageIndex]);
-    CHECK_RESULT(
-        vkQueueSubmit(m_compute.queue, 1, &computeSubmitInfo, m_compute.fences[imageIndex]));
+    vkResetFences(m_device, 1, &m_compute.fences[frame]);
+    CHECK_RESULT(vkQueueSubmit(m_compute.queue, 1, &computeSubmitInfo, m_compute.fences[frame]));
     // ----
 
     if (BaseProject::queuePresentSwapChain(imageIndex) == VK_SUCCESS) {
@@ -465,6 +527,13 @@ MonteCarloRTApp::~MonteCarloRTApp()
     delete m_autoExposure;
     delete m_postProcess;
 
+    if (!m_instanceUpdateCmdBuffers.empty()) {
+        vkFreeCommandBuffers(m_device,
+            m_cmdPool,
+            static_cast<uint32_t>(m_instanceUpdateCmdBuffers.size()),
+            m_instanceUpdateCmdBuffers.data());
+    }
+
     m_storageImage.result.destroy();
     m_storageImage.postProcessResult.destroy();
     m_storageImage.depthMap.destroy();
@@ -517,6 +586,18 @@ void MonteCarloRTApp::onKeyEvent(int t_key, int t_scancode, int t_action, int t_
     case GLFW_KEY_H:
         m_sceneUniformData.manualExposureAdjust -= 0.1;
         break;
+    case GLFW_KEY_T:
+        if (t_action == GLFW_PRESS) {
+            m_animateInstances = !m_animateInstances;
+            // Back to the rest positions, written by the next updates of every frame
+            if (!m_animateInstances) {
+                for (uint32_t i = 0; i < m_instanceBaseTransforms.size(); ++i) {
+                    m_rayTracing->setInstanceTransform(i, m_instanceBaseTransforms[i]);
+                }
+                m_sceneUniformData.frameIteration = 0;
+            }
+        }
+        break;
     default:
         break;
     }
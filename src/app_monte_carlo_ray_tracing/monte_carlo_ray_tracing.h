@@ -51,14 +51,24 @@ private:
     } m_exposureData;
     Buffer m_exposureBuffer;
 
+    // Instances moving up and down (T key), their TLAS refits are submitted before the draw
+    bool m_animateInstances = false;
+    float m_animationTime = 0.0f;
+    std::vector<glm::mat4> m_instanceBaseTransforms;
+    std::vector<VkCommandBuffer> m_instanceUpdateCmdBuffers;
+
     void render() override;
     void setupScene();
     void prepare() override;
     void viewChanged() override;
     void windowResized() override;
-    void updateUniformBuffers(uint32_t t_currentImage);
+    void updateUniformBuffers(uint32_t t_frame);
     void onSwapChainRecreation() override;
     void buildCommandBuffers() override;
+    void buildComputeCommandBuffer(uint32_t t_frame, uint32_t t_imageIndex);
+    /** @brief Moves the instances when animated and records the update of the TLAS and of the
+     * scene instances of t_frame, returns false if there was nothing to update */
+    bool buildInstanceUpdateCommandBuffer(uint32_t t_frame);
     void onKeyEvent(int t_key, int t_scancode, int t_action, int t_mods) override;
     void createStorageImages();
     void createDescriptorPool();
@@ -66,6 +76,7 @@ private:
     void createDescriptorSets();
     void updateResultImageDescriptorSets();
     void createUniformBuffers();
+    void updateSceneBuffers();
     void createRTPipeline();
     void createPostprocessPipeline();
     void createAutoExposurePipeline();
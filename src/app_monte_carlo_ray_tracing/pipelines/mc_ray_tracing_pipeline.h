@@ -12,6 +12,7 @@
 #include "scene/scene.h"
 #include "vulkan/vulkan_core.h"
 
+class DescriptorHeap;
 class Texture;
 class Device;
 
@@ -22,11 +23,11 @@ public:
 
     void buildCommandBuffer(VkCommandBuffer t_commandBuffer, uint32_t t_width, uint32_t t_height);
 
-    void createDescriptorSetsLayout(Scene* t_scene) override;
+    void createDescriptorSetsLayout(DescriptorHeap* t_heap) override;
 
-    void createDescriptorSets(VkDescriptorPool t_descriptorPool, Scene* t_scene,
-        Buffer* t_sceneBuffer, Buffer* t_instancesBuffer, Buffer* t_lightsBuffer,
-        Buffer* t_materialsBuffer);
+    /** @brief Sets of the pipeline, the textures and materials (set 3) are the ones of t_heap */
+    void createDescriptorSets(VkDescriptorPool t_descriptorPool, DescriptorHeap* t_heap,
+        Buffer* t_sceneBuffer, Buffer* t_instancesBuffer, Buffer* t_lightsBuffer);
 
     void updateResultImageDescriptorSets(Texture* t_result, Texture* t_depthMap);
 
@@ -43,7 +44,6 @@ private:
         VkDescriptorSetLayout set0AccelerationStructure;
         VkDescriptorSetLayout set1Scene;
         VkDescriptorSetLayout set2Geometry;
-        VkDescriptorSetLayout set3Materials;
         VkDescriptorSetLayout set4Lights;
         VkDescriptorSetLayout set5ResultImage;
     } m_descriptorSetLayouts;
@@ -40,6 +40,7 @@ void BufferCuda::create(Device* t_device, VkBufferUsageFlags t_usageFlags,
 #endif
     memoryHandleEx.pNext = t_allocationInfoNext;
     // ---
+    MemoryCategoryScope category(MEMORY_CATEGORY_DENOISER);
     Buffer::create(t_device,
         t_usageFlags,
         t_memoryPropertyFlags,
@@ -8,11 +8,12 @@
 
 #include "ray_tracing_optix_denoiser.h"
 
-int main()
+int main(int argc, char* argv[])
 {
     RayTracingOptixDenoiser app;
 
     try {
+        app.parseArguments(argc, argv);
         app.run();
     } catch (const std::exception& e) {
         std::cerr << e.what() << std::endl;
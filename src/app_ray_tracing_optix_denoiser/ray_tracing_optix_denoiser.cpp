@@ -26,6 +26,7 @@ RayTracingOptixDenoiser::RayTracingOptixDenoiser()
     m_settings.useRayTracing = true;
     // Make sure no more than 1 frame is processed at the same time to
     // avoid issues in the accumulated image
+    m_settings.framesInFlight = 1;
 
     m_enabledInstanceExtensions.push_back(VK_KHR_EXTERNAL_MEMORY_CAPABILITIES_EXTENSION_NAME);
     m_enabledInstanceExtensions.push_back(VK_KHR_EXTERNAL_SEMAPHORE_CAPABILITIES_EXTENSION_NAME);
@@ -60,66 +61,65 @@ void RayTracingOptixDenoiser::buildCommandBuffers()
         CHECK_RESULT(vkEndCommandBuffer(m_drawCmdBuffers[i]))
     }
     // ---
-    // Compute command buffers
+}
+
+void RayTracingOptixDenoiser::buildComputeCommandBuffer(uint32_t t_frame, uint32_t t_imageIndex)
+{
+    // Recorded on every frame, the swap chain image the result is copied to is only known once
+    // it is acquired
     VkCommandBufferBeginInfo computeCmdBufInfo = {};
     computeCmdBufInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    for (int32_t i = 0; i < m_compute.commandBuffers.size(); ++i) {
-        CHECK_RESULT(vkBeginCommandBuffer(m_compute.commandBuffers[i], &computeCmdBufInfo))
-        m_autoExposure->buildCommandBuffer(m_compute.commandBuffers[i]);
-        m_postProcess->buildCommandBuffer(m_compute.commandBuffers[i], m_width, m_height);
-
-        // Move post process output to swap chain image:
-
-        // Prepare images to transfer
-        VkImageSubresourceRange subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
-        tools::setImageLayout(m_compute.commandBuffers[i],
-            m_swapChain.images[i],
-            VK_IMAGE_LAYOUT_UNDEFINED,
-            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-            subresourceRange);
-        tools::setImageLayout(m_compute.commandBuffers[i],
-            m_storageImage.postProcessResult.getImage(),
-            VK_IMAGE_LAYOUT_GENERAL,
-            VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-            subresourceRange);
-
-        VkImageCopy copyRegion {};
-        copyRegion.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
-        copyRegion.srcOffset = { 0, 0, 0 };
-        copyRegion.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
-        copyRegion.dstOffset = { 0, 0, 0 };
-        copyRegion.extent = { m_width, m_height, 1 };
-        vkCmdCopyImage(m_compute.commandBuffers[i],
-            m_storageImage.postProcessResult.getImage(),
-            VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-            m_swapChain.images[i],
-            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-            1,
-            &copyRegion);
-
-        // Transition back to previous layouts:
-        tools::setImageLayout(m_compute.commandBuffers[i],
-            m_swapChain.images[i],
-            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-            VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
-            subresourceRange);
-        tools::setImageLayout(m_compute.commandBuffers[i],
-            m_storageImage.postProcessResult.getImage(),
-            VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-            VK_IMAGE_LAYOUT_GENERAL,
-            subresourceRange);
-
-        vkEndCommandBuffer(m_compute.commandBuffers[i]);
-    }
-    // ---
+    computeCmdBufInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    CHECK_RESULT(vkBeginCommandBuffer(m_compute.commandBuffers[t_frame], &computeCmdBufInfo))
+    m_autoExposure->buildCommandBuffer(m_compute.commandBuffers[t_frame]);
+    m_postProcess->buildCommandBuffer(m_compute.commandBuffers[t_frame], m_width, m_height);
+
+    // Move post process output to swap chain image:
+
+    // Prepare images to transfer
+    VkImageSubresourceRange subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+    tools::setImageLayout(m_compute.commandBuffers[t_frame],
+        m_swapChain.images[t_imageIndex],
+        VK_IMAGE_LAYOUT_UNDEFINED,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        subresourceRange);
+    tools::setImageLayout(m_compute.commandBuffers[t_frame],
+        m_storageImage.postProcessResult.getImage(),
+        VK_IMAGE_LAYOUT_GENERAL,
+        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        subresourceRange);
+
+    VkImageCopy copyRegion {};
+    copyRegion.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+    copyRegion.srcOffset = { 0, 0, 0 };
+    copyRegion.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+    copyRegion.dstOffset = { 0, 0, 0 };
+    copyRegion.extent = { m_width, m_height, 1 };
+    vkCmdCopyImage(m_compute.commandBuffers[t_frame],
+        m_storageImage.postProcessResult.getImage(),
+        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        m_swapChain.images[t_imageIndex],
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        1,
+        &copyRegion);
+
+    // Transition back to previous layouts:
+    tools::setImageLayout(m_compute.commandBuffers[t_frame],
+        m_swapChain.images[t_imageIndex],
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+        subresourceRange);
+    tools::setImageLayout(m_compute.commandBuffers[t_frame],
+        m_storageImage.postProcessResult.getImage(),
+        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        VK_IMAGE_LAYOUT_GENERAL,
+        subresourceRange);
+
+    CHECK_RESULT(vkEndCommandBuffer(m_compute.commandBuffers[t_frame]))
 }
 
 void RayTracingOptixDenoiser::createDescriptorPool()
 {
-    // Calculate the number of textures needed
-    uint32_t textureCount
-        = m_scene->textures.empty() ? 1 : static_cast<uint32_t>(m_scene->textures.size());
-
     // Storage images: ray tracing set5ResultImages (1 binding) + postprocess set3ResultImage (1
     // binding) = 2 total
     uint32_t storageImageCount = 2;
@@ -130,12 +130,9 @@ void RayTracingOptixDenoiser::createDescriptorPool()
         { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1 },
         // Exposure
         { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1 },
-        // Vertex, Index and Material Indexes
-        { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1 },
-        // Textures (needs to accommodate all textures in the scene)
-        { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, textureCount },
-        // Material array
+        // Instance information (geometry addresses and material indexes)
         { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1 },
+        // Textures and materials are in the descriptor heap
         // Lights array
         { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1 },
         // Result images
@@ -158,7 +155,7 @@ void RayTracingOptixDenoiser::createDescriptorPool()
 void RayTracingOptixDenoiser::createDescriptorSetsLayout()
 {
     // Ray Tracing
-    m_rayTracing->createDescriptorSetsLayout(m_scene);
+    m_rayTracing->createDescriptorSetsLayout(&m_descriptorHeap);
 
     // Postprocess
     m_postProcess->createDescriptorSetsLayout();
@@ -232,11 +229,10 @@ void RayTracingOptixDenoiser::createDescriptorSets()
 {
     // Ray Tracing
     m_rayTracing->createDescriptorSets(m_descriptorPool,
-        m_scene,
+        &m_descriptorHeap,
         &m_sceneBuffer,
         &m_instancesBuffer,
-        &m_lightsBuffer,
-        &m_materialsBuffer);
+        &m_lightsBuffer);
 
     // Postprocess
     m_postProcess->createDescriptorSets(m_descriptorPool, &m_sceneBuffer, &m_exposureBuffer);
@@ -264,9 +260,9 @@ void RayTracingOptixDenoiser::updateResultImageDescriptorSets()
     m_autoExposure->updateResultImageDescriptorSets(&m_denoiserData.pixelBufferOut);
 }
 
-void RayTracingOptixDenoiser::updateUniformBuffers(uint32_t t_currentImage)
+void RayTracingOptixDenoiser::updateUniformBuffers(uint32_t t_frame)
 {
-    // "max frames in flight" is 1 so this shouldn't run concurrently, ignore t_currentImage
+    // "max frames in flight" is 1 so this shouldn't run concurrently, ignore t_frame
     memcpy(m_sceneBuffer.mapped, &m_sceneUniformData, sizeof(UniformData));
 }
 
@@ -284,26 +280,26 @@ void RayTracingOptixDenoiser::createUniformBuffers()
     // Instances Information uniform
     bufferSize = sizeof(ShaderMeshInstance) * m_scene->getInstancesCount();
     m_instancesBuffer.create(m_vulkanDevice,
-        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-        bufferSize,
-        m_scene->getInstancesShaderData().data());
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        bufferSize);
 
     // Global Material list uniform (its a storage buffer)
     bufferSize = sizeof(ShaderMaterial) * m_scene->getMaterialCount();
     m_materialsBuffer.create(m_vulkanDevice,
-        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-        bufferSize,
-        m_scene->getMaterialsShaderData().data());
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        bufferSize);
+    m_descriptorHeap.writeBuffer(BINDLESS_MATERIALS_BUFFER, m_materialsBuffer.descriptor);
 
     // Global Light list uniform (its a storage buffer)
     bufferSize = sizeof(ShaderLight) * m_scene->getLightCount();
     m_lightsBuffer.create(m_vulkanDevice,
-        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-        bufferSize,
-        m_scene->getLightsShaderData().data());
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        bufferSize);
+
+    updateSceneBuffers();
 
     // Auto Exposure buffer, also set the default data
     bufferSize = sizeof(ExposureUniformData);
@@ -316,6 +312,27 @@ void RayTracingOptixDenoiser::createUniformBuffers()
     m_exposureBuffer.unmap();
 }
 
+// Upload the instances, materials and lights of the scene to their device local buffers, call it
+// again after editing them
+void RayTracingOptixDenoiser::updateSceneBuffers()
+{
+    const auto instances = m_scene->getInstancesShaderData();
+    m_instancesBuffer.upload(m_vulkanDevice,
+        m_queue,
+        instances.data(),
+        sizeof(ShaderMeshInstance) * instances.size());
+    const auto materials = m_scene->getMaterialsShaderData();
+    m_materialsBuffer.upload(m_vulkanDevice,
+        m_queue,
+        materials.data(),
+        sizeof(ShaderMaterial) * materials.size());
+    const auto lights = m_scene->getLightsShaderData();
+    if (!lights.empty()) {
+        m_lightsBuffer.upload(
+            m_vulkanDevice, m_queue, lights.data(), sizeof(ShaderLight) * lights.size());
+    }
+}
+
 void RayTracingOptixDenoiser::createStorageImages()
 {
     m_storageImage.depthMap.fromNothing(VK_FORMAT_R32_SFLOAT,
@@ -348,8 +365,15 @@ void RayTracingOptixDenoiser::setupScene()
         VERTEX_COMPONENT_TANGENT,
         VERTEX_COMPONENT_UV,
         VERTEX_COMPONENT_DUMMY_FLOAT });
-    m_scene
-        = m_rayTracing->createRTScene(m_queue, "assets/cornellbox/Cornellbox.fbx", m_vertexLayout);
+    if (m_settings.hostBlasBuild) {
+        m_rayTracing->setBlasBuildType(VK_ACCELERATION_STRUCTURE_BUILD_TYPE_HOST_KHR);
+    }
+    m_rayTracing->setTriangleSplitting(m_settings.splitTriangleBudget, m_settings.splitAreaRatio);
+    m_scene = m_rayTracing->createRTScene(m_queue,
+        "assets/cornellbox/Cornellbox.fbx",
+        m_vertexLayout,
+        m_settings.framesInFlight);
+    m_scene->registerTextures(&m_descriptorHeap);
     auto camera = m_scene->getCamera();
     camera->setMovementSpeed(100.0f);
     camera->setRotationSpeed(0.5f);
@@ -404,12 +428,9 @@ void RayTracingOptixDenoiser::render()
         return;
     }
 
-    // Get the frame index that was used for acquisition (needed for the acquisition semaphore)
-    size_t frameIndex = getAcquisitionFrameIndex(imageIndex);
-
-    vkWaitForFences(m_device, 1, &m_compute.fences[imageIndex], VK_TRUE, UINT64_MAX);
-
-    updateUniformBuffers(imageIndex);
+    const auto frame = m_currentFrame;
+    updateUniformBuffers(frame);
+    buildComputeCommandBuffer(frame, imageIndex);
 
     auto denoiserWaitForSemaphore = m_denoiserData.denoiseWaitFor.getVulkanSemaphore();
     auto denoiserSignalToSemaphore = m_denoiserData.denoiseSignalTo.getVulkanSemaphore();
@@ -427,15 +448,15 @@ void RayTracingOptixDenoiser::render()
     submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
     submitInfo.pNext = &timelineInfo;
     submitInfo.waitSemaphoreCount = 1;
-    submitInfo.pWaitSemaphores = &m_imageAvailableSemaphores[frameIndex];
+    submitInfo.pWaitSemaphores = &m_imageAvailableSemaphores[frame];
     VkPipelineStageFlags drawWaitStageMask = VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR;
     submitInfo.pWaitDstStageMask = &drawWaitStageMask;
     submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &m_drawCmdBuffers[imageIndex];
+    submitInfo.pCommandBuffers = &m_drawCmdBuffers[frame];
     submitInfo.signalSemaphoreCount = 1;
     submitInfo.pSignalSemaphores = &denoiserWaitForSemaphore;
-    vkResetFences(m_device, 1, &m_inFlightFences[imageIndex]);
-    CHECK_RESULT(vkQueueSubmit(m_queue, 1, &submitInfo, m_inFlightFences[imageIndex]))
+    vkResetFences(m_device, 1, &m_inFlightFences[frame]);
+    CHECK_RESULT(vkQueueSubmit(m_queue, 1, &submitInfo, m_inFlightFences[frame]))
     // ----
 
     m_denoiser->denoiseSubmit(&m_denoiserData.denoiseWaitFor,
@@ -448,7 +469,7 @@ void RayTracingOptixDenoiser::render()
     VkSubmitInfo computeSubmitInfo {};
     computeSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
     computeSubmitInfo.commandBufferCount = 1;
-    computeSubmitInfo.pCommandBuffers = &m_compute.commandBuffers[imageIndex];
+    computeSubmitInfo.pCommandBuffers = &m_compute.commandBuffers[frame];
     submitInfo.waitSemaphoreCount = 1;
     submitInfo.pWaitSemaphores = &denoiserSignalToSemaphore;
     drawWaitStageMask = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
@@ -457,9 +478,8 @@ void RayTracingOptixDenoiser::render()
     computeSubmitInfo.pSignalSemaphores = &m_renderFinishedSemaphores[imageIndex];
     VkPipelineStageFlags computeWaitStageMask = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
     computeSubmitInfo.pWaitDstStageMask = &computeWaitStageMask;
-    vkResetFences(m_device, 1, &m_compute.fences[imageIndex]);
-    CHECK_RESULT(
-        vkQueueSubmit(m_compute.queue, 1, &computeSubmitInfo, m_compute.fences[imageIndex]));
+    vkResetFences(m_device, 1, &m_compute.fences[frame]);
+    CHECK_RESULT(vkQueueSubmit(m_compute.queue, 1, &computeSubmitInfo, m_compute.fences[frame]));
     // ----
 
     if (BaseProject::queuePresentSwapChain(imageIndex) == VK_SUCCESS) {
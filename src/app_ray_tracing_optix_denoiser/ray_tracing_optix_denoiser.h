@@ -77,9 +77,10 @@ private:
     void prepare() override;
     void viewChanged() override;
     void windowResized() override;
-    void updateUniformBuffers(uint32_t t_currentImage);
+    void updateUniformBuffers(uint32_t t_frame);
     void onSwapChainRecreation() override;
     void buildCommandBuffers() override;
+    void buildComputeCommandBuffer(uint32_t t_frame, uint32_t t_imageIndex);
     void onKeyEvent(int t_key, int t_scancode, int t_action, int t_mods) override;
     void createStorageImages();
     void createDescriptorPool();
@@ -87,6 +88,7 @@ private:
     void createDescriptorSets();
     void updateResultImageDescriptorSets();
     void createUniformBuffers();
+    void updateSceneBuffers();
     void createRTPipeline();
     void createPostprocessPipeline();
     void createAutoExposurePipeline();
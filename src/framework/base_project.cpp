@@ -6,7 +6,9 @@
 #include "base_project.h"
 
 #include "scene/scene.h"
+#include "shaders/shared_constants.h"
 #include "tools/debug.h"
+#include <algorithm>
 #include <cmath>
 #include <string>
 #include <utility>
@@ -67,20 +69,19 @@ VkResult BaseProject::createInstance(bool t_enableValidation)
     return vkCreateInstance(&instanceCreateInfo, nullptr, &m_instance);
 }
 
-size_t BaseProject::getAcquisitionFrameIndex(uint32_t imageIndex) const
+void BaseProject::waitForFrame(uint32_t t_frame)
 {
-    size_t frameIndex = m_imageToFrameIndex[imageIndex];
-    // Safety check: if mapping is invalid, use imageIndex as fallback
-    if (frameIndex == SIZE_MAX) {
-        return imageIndex;
+    vkWaitForFences(m_device, 1, &m_inFlightFences[t_frame], VK_TRUE, UINT64_MAX);
+    if (m_settings.useCompute) {
+        vkWaitForFences(m_device, 1, &m_compute.fences[t_frame], VK_TRUE, UINT64_MAX);
     }
-    return frameIndex;
 }
 
 uint32_t BaseProject::acquireNextImage()
 {
-    // Before reusing the acquisition semaphore, wait for its fence to ensure it has been consumed
-    vkWaitForFences(m_device, 1, &m_inFlightFences[m_currentFrame], VK_TRUE, UINT64_MAX);
+    // Before reusing the acquisition semaphore and the resources of the frame, wait for its last
+    // submission to ensure they have been consumed
+    waitForFrame(m_currentFrame);
 
     // Acquire the next image from the swap chain
     uint32_t imageIndex = 0;
@@ -100,11 +101,13 @@ uint32_t BaseProject::acquireNextImage()
         return UINT32_MAX; // Invalid index, skip this frame
     }
 
-    // Wait for the fence of this image to ensure it's not being used by a previous frame
-    vkWaitForFences(m_device, 1, &m_inFlightFences[imageIndex], VK_TRUE, UINT64_MAX);
-
-    // Store which frame index was used for acquisition (needed for submit)
-    m_imageToFrameIndex[imageIndex] = m_currentFrame;
+    // Another frame may still be rendering to this image when there are more frames in flight than
+    // swap chain images, or when the images are not acquired in order
+    const uint32_t imageFrame = m_imageFrames[imageIndex];
+    if (imageFrame != UINT32_MAX && imageFrame != m_currentFrame) {
+        waitForFrame(imageFrame);
+    }
+    m_imageFrames[imageIndex] = m_currentFrame;
 
     return imageIndex;
 };
@@ -115,17 +118,17 @@ VkResult BaseProject::queuePresentSwapChain(uint32_t t_imageIndex)
     auto result = m_swapChain.queuePresent(m_queue,
         t_imageIndex,
         &m_renderFinishedSemaphores[t_imageIndex]);
+    m_lastPresentedImage = t_imageIndex;
 
     if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || m_framebufferResized) {
         m_framebufferResized = false;
         handleWindowResize();
-        // After resize, m_currentFrame was reset to 0, so don't rotate it
-        // The next acquireNextImage will use m_currentFrame = 0
+        // The device is idle after the resize, the next frame can reuse the current one
     } else if (result != VK_SUCCESS) {
         CHECK_RESULT(result)
     } else {
         // Only rotate frame index if present was successful and no resize occurred
-        m_currentFrame = (m_currentFrame + 1) % m_swapChain.imageCount;
+        m_currentFrame = (m_currentFrame + 1) % m_settings.framesInFlight;
     }
 
     return result;
@@ -133,8 +136,8 @@ VkResult BaseProject::queuePresentSwapChain(uint32_t t_imageIndex)
 
 void BaseProject::createCommandBuffers()
 {
-    // Create one command buffer for each swap chain image and reuse for rendering
-    m_drawCmdBuffers.resize(m_swapChain.imageCount);
+    // Create one command buffer for each frame in flight and reuse for rendering
+    m_drawCmdBuffers.resize(m_settings.framesInFlight);
 
     VkCommandBufferAllocateInfo cmdBufAllocateInfo {};
     cmdBufAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
@@ -171,7 +174,7 @@ void BaseProject::destroyComputeCommandBuffers()
 
 void BaseProject::createComputeCommandBuffers()
 {
-    m_compute.commandBuffers.resize(m_swapChain.imageCount);
+    m_compute.commandBuffers.resize(m_settings.framesInFlight);
 
     VkCommandBufferAllocateInfo commandBufferAllocateInfo {};
     commandBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
@@ -201,9 +204,9 @@ void BaseProject::prepareCompute()
     fenceCreateInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
     VkSemaphoreCreateInfo semaphoreCreateInfo = {};
     semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
-    m_compute.fences.resize(m_swapChain.imageCount);
-    m_compute.semaphores.resize(m_swapChain.imageCount);
-    for (size_t i = 0; i < m_swapChain.imageCount; ++i) {
+    m_compute.fences.resize(m_settings.framesInFlight);
+    m_compute.semaphores.resize(m_settings.framesInFlight);
+    for (size_t i = 0; i < m_settings.framesInFlight; ++i) {
         CHECK_RESULT(vkCreateFence(m_device, &fenceCreateInfo, nullptr, &m_compute.fences[i]))
         std::string name = "ComputeFence[" + std::to_string(i) + "]";
         debug::setObjectName(m_device,
@@ -223,6 +226,7 @@ void BaseProject::prepareCompute()
 
 void BaseProject::prepare()
 {
+    m_settings.framesInFlight = std::max(m_settings.framesInFlight, 1u);
     initSwapChain();
     createCommandPool();
     setupSwapChain();
@@ -236,6 +240,13 @@ void BaseProject::prepare()
     if (m_settings.useCompute) {
         prepareCompute();
     }
+
+    if (m_settings.useRayTracing) {
+        m_descriptorHeap.create(m_vulkanDevice,
+            DescriptorHeap::defaultTextureCapacity,
+            DescriptorHeap::defaultBufferCapacity,
+            BINDLESS_RESERVED_BUFFERS);
+    }
 }
 
 VkPipelineShaderStageCreateInfo BaseProject::loadShader(const std::string& t_fileName,
@@ -320,7 +331,7 @@ void BaseProject::saveScreenshot(const char* filename)
     }
 
     // Source for the copy is the last rendered swapchain image
-    VkImage srcImage = m_swapChain.images[m_currentFrame];
+    VkImage srcImage = m_swapChain.images[m_lastPresentedImage];
 
     // Create the linear tiled destination image to copy to and to read the memory from
     VkImageCreateInfo imageCreateCI = {};
@@ -528,17 +539,7 @@ BaseProject::~BaseProject()
 
     vkDestroyCommandPool(m_device, m_cmdPool, nullptr);
 
-    // Destroy all semaphores (created based on imageCount)
-    for (size_t i = 0; i < m_imageAvailableSemaphores.size(); ++i) {
-        vkDestroySemaphore(m_device, m_imageAvailableSemaphores[i], nullptr);
-    }
-    for (size_t i = 0; i < m_renderFinishedSemaphores.size(); ++i) {
-        vkDestroySemaphore(m_device, m_renderFinishedSemaphores[i], nullptr);
-    }
-    // Destroy all fences (created based on imageCount)
-    for (size_t i = 0; i < m_inFlightFences.size(); ++i) {
-        vkDestroyFence(m_device, m_inFlightFences[i], nullptr);
-    }
+    destroySynchronizationPrimitives();
 
     if (m_settings.useCompute) {
         destroyComputeCommandBuffers();
@@ -551,6 +552,7 @@ BaseProject::~BaseProject()
         }
     }
 
+    m_descriptorHeap.destroy();
     delete m_vulkanDevice;
 
     if (m_settings.validation) {
@@ -605,6 +607,22 @@ bool BaseProject::initVulkan()
     // Derived classes can override this to set actual features to enable for logical device
     // creation
     getEnabledFeatures();
+    // Scene textures are block compressed when the device can sample them
+    VkPhysicalDeviceFeatures supportedFeatures;
+    vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+    m_enabledFeatures.textureCompressionBC = supportedFeatures.textureCompressionBC;
+    if (m_settings.useRayTracing) {
+        // Lets the pipelines build acceleration structures on the host
+        VkPhysicalDeviceAccelerationStructureFeaturesKHR accelerationStructureFeatures {};
+        accelerationStructureFeatures.sType
+            = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR;
+        VkPhysicalDeviceFeatures2 supportedFeatures2 {};
+        supportedFeatures2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        supportedFeatures2.pNext = &accelerationStructureFeatures;
+        vkGetPhysicalDeviceFeatures2(physicalDevice, &supportedFeatures2);
+        m_rayTracingFeatures.accelerationStructureFeatures.accelerationStructureHostCommands
+            = accelerationStructureFeatures.accelerationStructureHostCommands;
+    }
 
     // Vulkan device creation
     m_vulkanDevice = new Device(physicalDevice);
@@ -615,6 +633,13 @@ bool BaseProject::initVulkan()
         throw std::runtime_error("Could not create Vulkan device: \n" + tools::errorString(res));
     }
     m_device = m_vulkanDevice->logicalDevice;
+    const auto& memoryProperties = m_vulkanDevice->memoryProperties;
+    for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; ++i) {
+        const bool deviceLocal
+            = memoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT;
+        m_vulkanDevice->allocator->setHeapBudget(i,
+            deviceLocal ? m_settings.deviceMemoryBudget : m_settings.hostMemoryBudget);
+    }
 
     // Get a graphics queue from the device
     vkGetDeviceQueue(m_device, m_vulkanDevice->queueFamilyIndices.graphics, 0, &m_queue);
@@ -637,21 +662,16 @@ void BaseProject::buildCommandBuffers() { }
 
 void BaseProject::createSynchronizationPrimitives()
 {
-    // Create synchronization objects
-    // Use one semaphore per swapchain image to avoid semaphore reuse issues
-    // This ensures each swapchain image has its own semaphore pair
-    // Use imageCount for all synchronization primitives to maximize parallelism
-    m_imageAvailableSemaphores.resize(m_swapChain.imageCount);
-    m_renderFinishedSemaphores.resize(m_swapChain.imageCount);
-    m_inFlightFences.resize(m_swapChain.imageCount);
-    m_imageToFrameIndex.resize(m_swapChain.imageCount, SIZE_MAX);
+    // One acquisition semaphore and fence per frame in flight, a frame waits for its own fence
+    // before reusing them
+    m_imageAvailableSemaphores.resize(m_settings.framesInFlight);
+    m_inFlightFences.resize(m_settings.framesInFlight);
     VkSemaphoreCreateInfo semaphoreCreateInfo = {};
     semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
     VkFenceCreateInfo fenceCreateInfo = {};
     fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
     fenceCreateInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-    // Create semaphores for each swapchain image
-    for (size_t i = 0; i < m_swapChain.imageCount; ++i) {
+    for (size_t i = 0; i < m_settings.framesInFlight; ++i) {
         CHECK_RESULT(vkCreateSemaphore(m_device,
             &semaphoreCreateInfo,
             nullptr,
@@ -662,79 +682,56 @@ void BaseProject::createSynchronizationPrimitives()
             VK_OBJECT_TYPE_SEMAPHORE,
             name.c_str());
 
-        CHECK_RESULT(vkCreateSemaphore(m_device,
-            &semaphoreCreateInfo,
-            nullptr,
-            &m_renderFinishedSemaphores[i]))
-        name = "RenderFinishedSemaphore[" + std::to_string(i) + "]";
-        debug::setObjectName(m_device,
-            (uint64_t)m_renderFinishedSemaphores[i],
-            VK_OBJECT_TYPE_SEMAPHORE,
-            name.c_str());
-    }
-    // Create fences for each swapchain image
-    for (size_t i = 0; i < m_swapChain.imageCount; ++i) {
         CHECK_RESULT(vkCreateFence(m_device, &fenceCreateInfo, nullptr, &m_inFlightFences[i]))
-        std::string name = "InFlightFence[" + std::to_string(i) + "]";
+        name = "InFlightFence[" + std::to_string(i) + "]";
         debug::setObjectName(m_device,
             (uint64_t)m_inFlightFences[i],
             VK_OBJECT_TYPE_FENCE,
             name.c_str());
     }
+    createPresentSynchronizationPrimitives();
 }
 
 void BaseProject::destroySynchronizationPrimitives()
 {
-    // Destroy all semaphores and fences
     for (size_t i = 0; i < m_imageAvailableSemaphores.size(); ++i) {
         vkDestroySemaphore(m_device, m_imageAvailableSemaphores[i], nullptr);
     }
-    for (size_t i = 0; i < m_renderFinishedSemaphores.size(); ++i) {
-        vkDestroySemaphore(m_device, m_renderFinishedSemaphores[i], nullptr);
-    }
     for (size_t i = 0; i < m_inFlightFences.size(); ++i) {
         vkDestroyFence(m_device, m_inFlightFences[i], nullptr);
     }
-    if (m_settings.useCompute) {
-        for (size_t i = 0; i < m_compute.semaphores.size(); ++i) {
-            vkDestroySemaphore(m_device, m_compute.semaphores[i], nullptr);
-        }
-        for (size_t i = 0; i < m_compute.fences.size(); ++i) {
-            vkDestroyFence(m_device, m_compute.fences[i], nullptr);
-        }
-    }
+    destroyPresentSynchronizationPrimitives();
 }
 
-void BaseProject::recreateComputeSynchronizationPrimitives()
+void BaseProject::createPresentSynchronizationPrimitives()
 {
-    if (!m_settings.useCompute) {
-        return;
-    }
-    VkFenceCreateInfo fenceCreateInfo {};
-    fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-    fenceCreateInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+    // The presentation engine may still wait on the semaphore of an image after its frame is
+    // reused, so they are not shared between images
+    m_renderFinishedSemaphores.resize(m_swapChain.imageCount);
+    m_imageFrames.assign(m_swapChain.imageCount, UINT32_MAX);
     VkSemaphoreCreateInfo semaphoreCreateInfo = {};
     semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
-    m_compute.fences.resize(m_swapChain.imageCount);
-    m_compute.semaphores.resize(m_swapChain.imageCount);
     for (size_t i = 0; i < m_swapChain.imageCount; ++i) {
-        CHECK_RESULT(vkCreateFence(m_device, &fenceCreateInfo, nullptr, &m_compute.fences[i]))
-        std::string name = "ComputeFence[" + std::to_string(i) + "]";
-        debug::setObjectName(m_device,
-            (uint64_t)m_compute.fences[i],
-            VK_OBJECT_TYPE_FENCE,
-            name.c_str());
-
-        CHECK_RESULT(
-            vkCreateSemaphore(m_device, &semaphoreCreateInfo, nullptr, &m_compute.semaphores[i]))
-        name = "ComputeSemaphore[" + std::to_string(i) + "]";
+        CHECK_RESULT(vkCreateSemaphore(m_device,
+            &semaphoreCreateInfo,
+            nullptr,
+            &m_renderFinishedSemaphores[i]))
+        std::string name = "RenderFinishedSemaphore[" + std::to_string(i) + "]";
         debug::setObjectName(m_device,
-            (uint64_t)m_compute.semaphores[i],
+            (uint64_t)m_renderFinishedSemaphores[i],
             VK_OBJECT_TYPE_SEMAPHORE,
             name.c_str());
     }
 }
 
+void BaseProject::destroyPresentSynchronizationPrimitives()
+{
+    for (size_t i = 0; i < m_renderFinishedSemaphores.size(); ++i) {
+        vkDestroySemaphore(m_device, m_renderFinishedSemaphores[i], nullptr);
+    }
+    m_renderFinishedSemaphores.clear();
+}
+
 void BaseProject::createCommandPool()
 {
     VkCommandPoolCreateInfo cmdPoolInfo = {};
@@ -928,6 +925,16 @@ void BaseProject::getEnabledFeatures()
         m_rayTracingFeatures.descriptorIndexingFeatures.runtimeDescriptorArray = VK_TRUE;
         m_rayTracingFeatures.descriptorIndexingFeatures.shaderSampledImageArrayNonUniformIndexing
             = VK_TRUE;
+        // Bindless descriptor heap
+        m_rayTracingFeatures.descriptorIndexingFeatures.descriptorBindingPartiallyBound = VK_TRUE;
+        m_rayTracingFeatures.descriptorIndexingFeatures.descriptorBindingUpdateUnusedWhilePending
+            = VK_TRUE;
+        m_rayTracingFeatures.descriptorIndexingFeatures
+            .descriptorBindingSampledImageUpdateAfterBind
+            = VK_TRUE;
+        m_rayTracingFeatures.descriptorIndexingFeatures
+            .descriptorBindingStorageBufferUpdateAfterBind
+            = VK_TRUE;
         m_rayTracingFeatures.descriptorIndexingFeatures.pNext
             = &m_rayTracingFeatures.accelerationStructureFeatures;
 
@@ -959,11 +966,13 @@ void BaseProject::handleWindowResize()
     // Recreate swap chain (this updates m_swapChain.imageCount)
     setupSwapChain();
 
-    // Only destroy/recreate synchronization primitives if imageCount changed
+    // The frames in flight keep their synchronization, only the one of the images is recreated if
+    // imageCount changed
     if (previousImageCount != m_swapChain.imageCount) {
-        destroySynchronizationPrimitives();
-        createSynchronizationPrimitives();
-        recreateComputeSynchronizationPrimitives();
+        destroyPresentSynchronizationPrimitives();
+        createPresentSynchronizationPrimitives();
+    } else {
+        m_imageFrames.assign(m_swapChain.imageCount, UINT32_MAX);
     }
 
     // Recreate the frame buffers
@@ -1152,12 +1161,35 @@ void BaseProject::handleKeyEvent(int t_key, int t_scancode, int t_action, int t_
             camera->keys.right = false;
         }
         break;
+    case GLFW_KEY_M:
+        if (t_action == GLFW_PRESS) {
+            reportMemoryUsage();
+        }
+        break;
     default:
         break;
     }
     onKeyEvent(t_key, t_scancode, t_action, t_mods);
 }
 
+void BaseProject::parseArguments(int t_argc, char* t_argv[])
+{
+    for (int i = 1; i < t_argc; ++i) {
+        const std::string argument = t_argv[i];
+        if (argument == "--host-blas-build") {
+            m_settings.hostBlasBuild = true;
+        } else if (argument == "--split-triangles" && i + 1 < t_argc) {
+            m_settings.splitTriangleBudget = static_cast<uint32_t>(std::stoul(t_argv[++i]));
+            // The area ratio is optional
+            if (i + 1 < t_argc && t_argv[i + 1][0] != '-') {
+                m_settings.splitAreaRatio = std::stof(t_argv[++i]);
+            }
+        } else {
+            std::cout << "\nWARNING: ignoring unknown argument " << argument << std::endl;
+        }
+    }
+}
+
 void BaseProject::run()
 {
     initWindow();
@@ -1172,6 +1204,18 @@ void BaseProject::run()
     }
     if (m_device != VK_NULL_HANDLE) {
         vkDeviceWaitIdle(m_device);
+        reportMemoryUsage();
+    }
+}
+
+void BaseProject::reportMemoryUsage()
+{
+    std::cout << "\n" << m_vulkanDevice->allocator->getReport() << std::flush;
+    std::ofstream file(m_settings.memoryReportPath, std::ios::trunc);
+    file << m_vulkanDevice->allocator->getReportJson();
+    if (!file) {
+        std::cerr << "Could not write the memory report to " << m_settings.memoryReportPath
+                  << std::endl;
     }
 }
 
@@ -22,6 +22,7 @@
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 
+#include "core/descriptor_heap.h"
 #include "core/device.h"
 #include "core/swapchain.h"
 #include "scene/camera.h"
@@ -36,6 +37,11 @@ public:
     explicit BaseProject(std::string t_appName, std::string t_windowTitle,
         bool t_enableValidation = false);
     virtual ~BaseProject();
+    /** @brief Applies the command line flags to the settings, call before run:
+     * --host-blas-build  builds the BLASes on the host (see hostBlasBuild)
+     * --split-triangles <budget> [area ratio]  splits long thin triangles (see
+     * splitTriangleBudget) */
+    void parseArguments(int t_argc, char* t_argv[]);
     void run();
 
 private:
@@ -128,7 +134,7 @@ protected:
     // Command buffer pool
     VkCommandPool m_cmdPool;
 
-    // Command buffers used for rendering
+    // Command buffers used for rendering, one per frame in flight
     std::vector<VkCommandBuffer> m_drawCmdBuffers;
 
     // Global render pass for frame buffer writes
@@ -140,6 +146,10 @@ protected:
     // Descriptor set pool
     VkDescriptorPool m_descriptorPool = VK_NULL_HANDLE;
 
+    // Bindless textures and storage buffers shared by every pipeline, created by prepare for ray
+    // tracing apps. The apps register the scene textures in it once the scene is loaded
+    DescriptorHeap m_descriptorHeap;
+
     // List of shader modules created (stored for cleanup)
     std::vector<VkShaderModule> m_shaderModules;
 
@@ -149,15 +159,18 @@ protected:
     // Wraps the swap chain to present images (framebuffers) to the windowing system
     SwapChain m_swapChain;
 
-    // Synchronization
+    // Synchronization, the acquisition semaphores and the fences belong to the frames in flight,
+    // the render finished semaphores to the swap chain images they are presented with
     std::vector<VkSemaphore> m_imageAvailableSemaphores;
     std::vector<VkSemaphore> m_renderFinishedSemaphores;
     std::vector<VkFence> m_inFlightFences;
-    // Maps imageIndex to the frame index used for its acquisition semaphore
-    std::vector<size_t> m_imageToFrameIndex;
-    size_t m_currentFrame = 0;
+    // Frame in flight that last rendered to each swap chain image, UINT32_MAX for none
+    std::vector<uint32_t> m_imageFrames;
+    // Frame in flight being recorded, index of the per frame resources
+    uint32_t m_currentFrame = 0;
+    uint32_t m_lastPresentedImage = 0;
 
-    // Separated compute queue, commandPool, fence and buffer
+    // Separated compute queue, commandPool, fences and buffers (one per frame in flight)
     struct {
         VkQueue queue;
         VkCommandPool commandPool;
@@ -172,6 +185,22 @@ protected:
         bool vsync = false;
         bool useCompute = false;
         bool useRayTracing = false;
+        // Frames recorded and submitted ahead of the GPU, each one with its own command buffers,
+        // synchronization and app resources. Independent of the swap chain image count
+        uint32_t framesInFlight = 2;
+        // Build the BLASes on the host instead of the device when the driver supports it, the
+        // result is the same and lets software drivers compare both paths
+        bool hostBlasBuild = false;
+        // Triangles the split of long thin triangles may add, and the bounds to triangle area
+        // ratio above which a triangle is split (see RayTracingBasePipeline::setTriangleSplitting)
+        uint32_t splitTriangleBudget = 0;
+        float splitAreaRatio = 32.0f;
+        // Bytes the app may take from each device local heap and from each other heap, 0 for no
+        // limit. Going over fails with the memory report instead of reaching the driver
+        VkDeviceSize deviceMemoryBudget = 0;
+        VkDeviceSize hostMemoryBudget = 0;
+        // JSON copy of the memory report, written with it
+        std::string memoryReportPath = "memory_report.json";
     } m_settings;
 
     /** @brief Setup the vulkan instance, enable required extensions and connect
@@ -220,7 +249,10 @@ protected:
     void createPipelineCache();
     void createSynchronizationPrimitives();
     void destroySynchronizationPrimitives();
-    void recreateComputeSynchronizationPrimitives();
+    /** @brief Render finished semaphores of the swap chain images, recreated with the swap chain
+     * when its image count changes */
+    void createPresentSynchronizationPrimitives();
+    void destroyPresentSynchronizationPrimitives();
     void initSwapChain();
     void setupSwapChain();
     void createCommandBuffers();
@@ -235,21 +267,22 @@ protected:
     VkPipelineShaderStageCreateInfo loadShader(const std::string& t_fileName,
         VkShaderStageFlagBits t_stage);
 
-    /** @brief Acquires the next swap chain image to render to. T o submit your command buffer, use
-     * m_imageAvailableSemaphores as a wait semaphore after calling this function.
+    /** @brief Waits for the previous submission of the frame m_currentFrame and acquires the next
+     * swap chain image to render to. To submit your command buffer, use
+     * m_imageAvailableSemaphores[m_currentFrame] as a wait semaphore after calling this function,
+     * the command buffers and fences of m_currentFrame are free to be reused.
      * Automatically handles resize. If acquisition fails after resize, returns UINT32_MAX to skip
      * frame.
      *  @returns The image index in the swapChain, or UINT32_MAX if frame should be skipped */
     uint32_t acquireNextImage();
 
-    /** @brief Get the frame index that was used for acquiring the given image index.
-     *  This is needed to get the correct acquisition semaphore for the submit.
-     *  @returns The frame index, or imageIndex as fallback if mapping is invalid */
-    size_t getAcquisitionFrameIndex(uint32_t imageIndex) const;
+    /** @brief Waits until the GPU is done with the last submission of the frame in flight t_frame,
+     * graphics and compute */
+    void waitForFrame(uint32_t t_frame);
 
     /** @brief Presents the acquired swap chain image waiting for m_renderFinishedSemaphores, your
      * last command submitted must have m_renderFinishedSemaphores[t_imageIndex] as a signal
-     * semaphore.
+     * semaphore. Moves m_currentFrame to the next frame in flight.
      *  @returns The result of the present operation */
     VkResult queuePresentSwapChain(uint32_t t_imageIndex);
 
@@ -261,6 +294,10 @@ private:
     virtual void onKeyEvent(int t_key, int t_scancode, int t_action, int t_mods);
 
     void saveScreenshot(const char* filename);
+
+    /** @brief Prints the memory used by every category and heap and writes it to
+     * m_settings.memoryReportPath. Done on the M key and when the app exits */
+    void reportMemoryUsage();
 };
 
 #endif // MANUEME_BASE_PROJECT_H
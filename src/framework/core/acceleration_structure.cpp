@@ -6,6 +6,22 @@
 #include "acceleration_structure.h"
 #include <stdexcept>
 
+VkBuildAccelerationStructureFlagsKHR BlasCreateInfo::getBuildFlags(BlasPolicy t_policy)
+{
+    switch (t_policy) {
+    case BLAS_POLICY_DEFORMABLE:
+        return VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR
+            | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR
+            | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR;
+    case BLAS_POLICY_DYNAMIC:
+        return VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_BUILD_BIT_KHR
+            | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR;
+    default:
+        return VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR
+            | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR;
+    }
+}
+
 AccelerationStructure::AccelerationStructure() = default;
 
 AccelerationStructure::AccelerationStructure(Device* t_device,
@@ -24,38 +40,52 @@ AccelerationStructure::AccelerationStructure(Device* t_device,
     bufferCreateInfo.usage = VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR
         | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
     CHECK_RESULT(vkCreateBuffer(t_device->logicalDevice, &bufferCreateInfo, nullptr, &m_buffer));
-    VkMemoryRequirements memoryRequirements {};
-    vkGetBufferMemoryRequirements(t_device->logicalDevice, m_buffer, &memoryRequirements);
-    VkMemoryAllocateFlagsInfo memoryAllocateFlagsInfo {};
-    memoryAllocateFlagsInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO;
-    memoryAllocateFlagsInfo.flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT_KHR;
-    VkMemoryAllocateInfo memoryAllocateInfo {};
-    memoryAllocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    memoryAllocateInfo.pNext = &memoryAllocateFlagsInfo;
-    memoryAllocateInfo.allocationSize = memoryRequirements.size;
-    memoryAllocateInfo.memoryTypeIndex = t_device->getMemoryType(memoryRequirements.memoryTypeBits,
-        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-    CHECK_RESULT(
-        vkAllocateMemory(t_device->logicalDevice, &memoryAllocateInfo, nullptr, &m_memory));
-    CHECK_RESULT(vkBindBufferMemory(t_device->logicalDevice, m_buffer, m_memory, 0));
+    m_allocation = t_device->allocateBufferMemory(m_buffer,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        t_type == VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR ? MEMORY_CATEGORY_TLAS
+                                                             : MEMORY_CATEGORY_BLAS,
+        MEMORY_RESOURCE_ADDRESSABLE);
+    createHandle(t_type, t_buildSizeInfo.accelerationStructureSize, m_buffer, 0);
+}
+
+AccelerationStructure::AccelerationStructure(Device* t_device,
+    VkAccelerationStructureTypeKHR t_type, VkDeviceSize t_size, VkBuffer t_buffer,
+    VkDeviceSize t_offset)
+{
+    m_device = t_device->logicalDevice;
+    initFunctionPointers();
+
+    if (t_size == 0) {
+        throw std::runtime_error("Cannot create acceleration structure with zero size");
+    }
+    if (t_offset % placementAlignment != 0) {
+        throw std::runtime_error("Acceleration structure offset is not aligned");
+    }
+    createHandle(t_type, t_size, t_buffer, t_offset);
+}
+
+void AccelerationStructure::createHandle(VkAccelerationStructureTypeKHR t_type,
+    VkDeviceSize t_size, VkBuffer t_buffer, VkDeviceSize t_offset)
+{
     // Acceleration structure
     VkAccelerationStructureCreateInfoKHR accelerationStructureCreateInfo {};
     accelerationStructureCreateInfo.sType
         = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR;
-    accelerationStructureCreateInfo.buffer = m_buffer;
-    accelerationStructureCreateInfo.size = t_buildSizeInfo.accelerationStructureSize;
+    accelerationStructureCreateInfo.buffer = t_buffer;
+    accelerationStructureCreateInfo.offset = t_offset;
+    accelerationStructureCreateInfo.size = t_size;
     accelerationStructureCreateInfo.type = t_type;
-    vkCreateAccelerationStructureKHR(t_device->logicalDevice,
+    CHECK_RESULT(vkCreateAccelerationStructureKHR(m_device,
         &accelerationStructureCreateInfo,
         nullptr,
-        &m_accelerationStructure);
+        &m_accelerationStructure));
     // AS device address
     VkAccelerationStructureDeviceAddressInfoKHR accelerationDeviceAddressInfo {};
     accelerationDeviceAddressInfo.sType
         = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR;
     accelerationDeviceAddressInfo.accelerationStructure = m_accelerationStructure;
-    m_deviceAddress = vkGetAccelerationStructureDeviceAddressKHR(t_device->logicalDevice,
-        &accelerationDeviceAddressInfo);
+    m_deviceAddress
+        = vkGetAccelerationStructureDeviceAddressKHR(m_device, &accelerationDeviceAddressInfo);
 }
 
 AccelerationStructure::~AccelerationStructure() = default;
@@ -66,7 +96,7 @@ uint64_t AccelerationStructure::getDeviceAddress() const { return m_deviceAddres
 
 void AccelerationStructure::destroy()
 {
-    vkFreeMemory(m_device, m_memory, nullptr);
+    MemoryAllocator::release(m_allocation);
     vkDestroyBuffer(m_device, m_buffer, nullptr);
     vkDestroyAccelerationStructureKHR(m_device, m_accelerationStructure, nullptr);
 }
@@ -8,17 +8,34 @@
 
 #include "../base_project.h"
 
+// How the geometry of a BLAS changes after it is built, it selects the build flags
+enum BlasPolicy {
+    // Never changes: fast trace, compacted after the build
+    BLAS_POLICY_STATIC = 0x0,
+    // Deformed in place (same topology): fast trace, refitted with updates, compacted
+    BLAS_POLICY_DEFORMABLE = 0x1,
+    // Changes every few frames: fast build and updates, compaction would not pay off
+    BLAS_POLICY_DYNAMIC = 0x2
+};
+
 // This represents one BLAS with multiple geometries one per "mesh".
-// NOTE: The instance definition of this implementation contains only one material index
-// if you want to add multiple meshes to a BLAS they must have all the same material. Feel free to
-// create a per-primitive material implementation to support multiple materials per BLAS.
+// NOTE: Every geometry has its own entry (material, offsets and transform) in the scene instances,
+// the TLAS instance custom index points to the entry of the first geometry and the hit shaders
+// add gl_GeometryIndexEXT to it.
 struct BlasCreateInfo {
     std::vector<VkAccelerationStructureGeometryKHR> geomery;
     std::vector<VkAccelerationStructureBuildRangeInfoKHR> meshes; // could also be called "offsets"
+    BlasPolicy policy = BLAS_POLICY_STATIC;
+
+    static VkBuildAccelerationStructureFlagsKHR getBuildFlags(BlasPolicy t_policy);
 };
 
 struct TlasCreateInfo {
     std::vector<VkAccelerationStructureInstanceKHR> instances;
+    // Optional bounds of the BLAS of every instance, used to estimate how much the refits degrade
+    // the TLAS and to decide when to rebuild it
+    std::vector<VkAabbPositionsKHR> bounds;
+    // Refits the existing TLAS instead of building a new one, it must have the same instance count
     bool update = false;
 };
 
@@ -41,8 +58,16 @@ public:
     AccelerationStructure();
     AccelerationStructure(Device* t_device, VkAccelerationStructureTypeKHR t_type,
         VkAccelerationStructureBuildSizesInfoKHR t_buildSizeInfo);
+    /** @brief Places the acceleration structure in a range of a buffer owned by the caller,
+     * t_offset must be a multiple of placementAlignment */
+    AccelerationStructure(Device* t_device, VkAccelerationStructureTypeKHR t_type,
+        VkDeviceSize t_size, VkBuffer t_buffer, VkDeviceSize t_offset);
     ~AccelerationStructure();
 
+    // Required alignment of the offset of an acceleration structure in its buffer
+    static constexpr VkDeviceSize placementAlignment = 256;
+
+    /** @brief Destroys the acceleration structure and the buffer and memory it owns, if any */
     void destroy();
 
     VkAccelerationStructureKHR getHandle();
@@ -51,10 +76,14 @@ public:
 
 private:
     VkDevice m_device;
-    VkAccelerationStructureKHR m_accelerationStructure;
+    VkAccelerationStructureKHR m_accelerationStructure = VK_NULL_HANDLE;
     uint64_t m_deviceAddress = 0;
-    VkDeviceMemory m_memory;
-    VkBuffer m_buffer;
+    // Only set when the acceleration structure owns its buffer
+    MemoryAllocation m_allocation;
+    VkBuffer m_buffer = VK_NULL_HANDLE;
+
+    void createHandle(VkAccelerationStructureTypeKHR t_type, VkDeviceSize t_size,
+        VkBuffer t_buffer, VkDeviceSize t_offset);
 };
 
 #endif // MANUEME_ACCELERATION_STRUCTURE_H
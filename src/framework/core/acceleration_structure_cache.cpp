@@ -0,0 +1,130 @@
+/*
+ * Manuel Machado Copyright (C) 2021 This code is licensed under the MIT license (MIT)
+ * (http://opensource.org/licenses/MIT)
+ */
+
+#include "acceleration_structure_cache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <type_traits>
+
+static_assert(std::is_trivially_copyable<AccelerationStructureCacheHeader>::value,
+    "Header is written raw");
+
+namespace {
+const char cacheMagic[8] = { 'M', 'N', 'M', 'A', 'C', 'C', 'E', 'L' };
+
+uint64_t getDataOffset(uint32_t t_count)
+{
+    const uint64_t tableEnd = sizeof(AccelerationStructureCacheHeader)
+        + uint64_t(t_count) * sizeof(AccelerationStructureCacheEntry);
+    return (tableEnd + AccelerationStructureCache::dataAlignment - 1)
+        & ~(AccelerationStructureCache::dataAlignment - 1);
+}
+}
+
+std::string AccelerationStructureCache::getCachePath(const std::string& t_modelPath)
+{
+    return t_modelPath + ".ascache";
+}
+
+bool AccelerationStructureCache::open(
+    const std::string& t_path, uint64_t t_key, const uint8_t* t_driverUUID)
+{
+    m_file.close();
+    m_file.clear();
+    m_entries.clear();
+    m_file.open(t_path, std::ios::binary);
+    if (!m_file.is_open()) {
+        return false;
+    }
+    m_file.seekg(0, std::ios::end);
+    const auto fileSize = static_cast<uint64_t>(m_file.tellg());
+    m_file.seekg(0, std::ios::beg);
+
+    AccelerationStructureCacheHeader header {};
+    m_file.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!m_file || memcmp(header.magic, cacheMagic, sizeof(cacheMagic)) != 0
+        || header.version != version || header.key != t_key
+        || memcmp(header.driverUUID, t_driverUUID, VK_UUID_SIZE) != 0
+        || getDataOffset(header.count) > fileSize
+        || header.dataSize > fileSize - getDataOffset(header.count)) {
+        m_file.close();
+        return false;
+    }
+    m_entries.resize(header.count);
+    m_file.read(reinterpret_cast<char*>(m_entries.data()),
+        static_cast<std::streamsize>(m_entries.size() * sizeof(AccelerationStructureCacheEntry)));
+    if (!m_file) {
+        m_file.close();
+        return false;
+    }
+    for (const auto& entry : m_entries) {
+        if (entry.offset % dataAlignment != 0 || entry.offset > header.dataSize
+            || entry.size > header.dataSize - entry.offset) {
+            m_file.close();
+            return false;
+        }
+    }
+    m_dataOffset = getDataOffset(header.count);
+    m_dataSize = header.dataSize;
+    return true;
+}
+
+const std::vector<AccelerationStructureCacheEntry>& AccelerationStructureCache::getEntries() const
+{
+    return m_entries;
+}
+
+uint64_t AccelerationStructureCache::getDataSize() const { return m_dataSize; }
+
+bool AccelerationStructureCache::readData(void* t_data)
+{
+    if (!m_file.is_open()) {
+        return false;
+    }
+    m_file.seekg(static_cast<std::streamoff>(m_dataOffset), std::ios::beg);
+    m_file.read(static_cast<char*>(t_data), static_cast<std::streamsize>(m_dataSize));
+    const bool success = static_cast<bool>(m_file);
+    m_file.close();
+    return success;
+}
+
+bool AccelerationStructureCache::write(const std::string& t_path, uint64_t t_key,
+    const uint8_t* t_driverUUID, const std::vector<AccelerationStructureCacheEntry>& t_entries,
+    const void* t_data, uint64_t t_dataSize)
+{
+    AccelerationStructureCacheHeader header {};
+    memcpy(header.magic, cacheMagic, sizeof(cacheMagic));
+    header.version = version;
+    header.count = static_cast<uint32_t>(t_entries.size());
+    header.key = t_key;
+    memcpy(header.driverUUID, t_driverUUID, VK_UUID_SIZE);
+    header.dataSize = t_dataSize;
+
+    const auto temporaryPath = t_path + ".tmp";
+    {
+        std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        const uint64_t tableSize
+            = uint64_t(t_entries.size()) * sizeof(AccelerationStructureCacheEntry);
+        file.write(reinterpret_cast<const char*>(t_entries.data()),
+            static_cast<std::streamsize>(tableSize));
+        const uint64_t tableEnd = sizeof(header) + tableSize;
+        const std::vector<char> padding(getDataOffset(header.count) - tableEnd, 0);
+        file.write(padding.data(), static_cast<std::streamsize>(padding.size()));
+        file.write(static_cast<const char*>(t_data), static_cast<std::streamsize>(t_dataSize));
+        if (!file) {
+            file.close();
+            std::remove(temporaryPath.c_str());
+            return false;
+        }
+    }
+    std::remove(t_path.c_str());
+    if (std::rename(temporaryPath.c_str(), t_path.c_str()) != 0) {
+        std::remove(temporaryPath.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,73 @@
+/*
+ * Manuel Machado Copyright (C) 2021 This code is licensed under the MIT license (MIT)
+ * (http://opensource.org/licenses/MIT)
+ */
+
+#ifndef MANUEME_ACCELERATION_STRUCTURE_CACHE_H
+#define MANUEME_ACCELERATION_STRUCTURE_CACHE_H
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "vulkan/vulkan.h"
+
+/** @brief Fixed size header at the start of every acceleration structure cache file */
+struct AccelerationStructureCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t count;
+    uint64_t key;
+    uint8_t driverUUID[VK_UUID_SIZE];
+    uint64_t dataSize;
+};
+
+/** @brief Serialized acceleration structure, offset is relative to the start of the data */
+struct AccelerationStructureCacheEntry {
+    uint64_t offset;
+    uint64_t size;
+};
+
+/**
+ * @brief On disk cache of serialized acceleration structures (output of
+ * vkCmdCopyAccelerationStructureToMemoryKHR), stored next to the scene. Files are only valid for
+ * the driver that wrote them, the driverUUID is part of the file and every entry must still be
+ * checked with vkGetDeviceAccelerationStructureCompatibilityKHR before being deserialized.
+ */
+class AccelerationStructureCache {
+public:
+    // Increase when the layout of the file changes
+    static constexpr uint32_t version = 1;
+    // Alignment of the serialized data, required for the device addresses of the copies
+    static constexpr uint64_t dataAlignment = 256;
+
+    /** @brief Returns the cache file used for a given source model */
+    static std::string getCachePath(const std::string& t_modelPath);
+
+    /** @brief Reads the header and the entries of the file at t_path, returns false if it is
+     * missing, corrupted, from another version or driver or was written with a different key */
+    bool open(const std::string& t_path, uint64_t t_key, const uint8_t* t_driverUUID);
+
+    const std::vector<AccelerationStructureCacheEntry>& getEntries() const;
+
+    uint64_t getDataSize() const;
+
+    /** @brief Reads all the serialized data of an opened file into t_data in a single read, at
+     * least getDataSize() bytes. The file is closed afterwards */
+    bool readData(void* t_data);
+
+    /** @brief Writes a new cache file, t_data holds the serialized structures at the offsets of
+     * t_entries. The file is written to a temporary path and moved into place when complete */
+    static bool write(const std::string& t_path, uint64_t t_key, const uint8_t* t_driverUUID,
+        const std::vector<AccelerationStructureCacheEntry>& t_entries, const void* t_data,
+        uint64_t t_dataSize);
+
+private:
+    std::ifstream m_file;
+    uint64_t m_dataOffset = 0;
+    uint64_t m_dataSize = 0;
+    std::vector<AccelerationStructureCacheEntry> m_entries;
+};
+
+#endif // MANUEME_ACCELERATION_STRUCTURE_CACHE_H
@@ -31,25 +31,17 @@ void Buffer::create(Device* t_device, VkBufferUsageFlags t_usageFlags,
     bufferCreateInfo.pNext = t_createInfoNext;
     CHECK_RESULT(vkCreateBuffer(this->device, &bufferCreateInfo, nullptr, &this->buffer));
 
-    // Create the memory backing up the buffer handle
+    // Sub-allocate the memory backing up the buffer handle
     VkMemoryRequirements memReqs;
-    VkMemoryAllocateInfo memAlloc = {};
-    memAlloc.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    VkMemoryAllocateFlagsInfoKHR allocFlagsInfo {};
-    if (t_usageFlags & VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT) {
-        allocFlagsInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO_KHR;
-        allocFlagsInfo.flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT_KHR;
-        allocFlagsInfo.pNext = t_allocationInfoNext;
-        memAlloc.pNext = &allocFlagsInfo;
-    } else {
-        memAlloc.pNext = t_allocationInfoNext;
-    }
     vkGetBufferMemoryRequirements(this->device, this->buffer, &memReqs);
-    memAlloc.allocationSize = memReqs.size;
     // Find a memory type index that fits the properties of the buffer
-    memAlloc.memoryTypeIndex
-        = t_device->getMemoryType(memReqs.memoryTypeBits, t_memoryPropertyFlags);
-    CHECK_RESULT(vkAllocateMemory(this->device, &memAlloc, nullptr, &this->memory));
+    this->allocation = t_device->allocator->allocate(memReqs,
+        t_device->getMemoryType(memReqs.memoryTypeBits, t_memoryPropertyFlags),
+        (t_usageFlags & VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT) ? MEMORY_RESOURCE_ADDRESSABLE
+                                                                    : MEMORY_RESOURCE_LINEAR,
+        MemoryCategoryScope::getCurrent(),
+        t_allocationInfoNext);
+    this->memory = this->allocation.memory;
 
     this->alignment = memReqs.alignment;
     this->size = t_size;
@@ -77,20 +69,18 @@ void Buffer::create(Device* t_device, VkBufferUsageFlags t_usageFlags,
 
 VkResult Buffer::map(VkDeviceSize t_size, VkDeviceSize t_offset)
 {
-    return vkMapMemory(device, memory, t_offset, t_size, 0, &mapped);
-}
-
-void Buffer::unmap()
-{
-    if (mapped) {
-        vkUnmapMemory(device, memory);
-        mapped = nullptr;
+    if (!allocation.mapped) {
+        return VK_ERROR_MEMORY_MAP_FAILED;
     }
+    mapped = static_cast<uint8_t*>(allocation.mapped) + t_offset;
+    return VK_SUCCESS;
 }
 
+void Buffer::unmap() { mapped = nullptr; }
+
 VkResult Buffer::bind(VkDeviceSize t_offset)
 {
-    return vkBindBufferMemory(device, buffer, memory, t_offset);
+    return vkBindBufferMemory(device, buffer, memory, allocation.offset + t_offset);
 }
 
 void Buffer::setupDescriptor(VkDeviceSize t_size, VkDeviceSize t_offset)
@@ -106,34 +96,81 @@ void Buffer::copyTo(void* t_data, VkDeviceSize t_size)
     memcpy(mapped, t_data, t_size);
 }
 
+void Buffer::upload(Device* t_device, VkQueue t_queue, const void* t_data, VkDeviceSize t_size,
+    VkDeviceSize t_offset)
+{
+    MemoryCategoryScope category(MEMORY_CATEGORY_STAGING);
+    Buffer staging;
+    staging.create(t_device,
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        t_size);
+    CHECK_RESULT(staging.map());
+    memcpy(staging.mapped, t_data, t_size);
+    staging.unmap();
+
+    VkCommandBuffer cmdBuffer
+        = t_device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+    // Earlier reads of the buffer, from the frames still in flight, finish before the copy
+    VkBufferMemoryBarrier barrier {};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.buffer = buffer;
+    barrier.offset = t_offset;
+    barrier.size = t_size;
+    barrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    vkCmdPipelineBarrier(cmdBuffer,
+        VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+        VK_PIPELINE_STAGE_TRANSFER_BIT,
+        0,
+        0,
+        nullptr,
+        1,
+        &barrier,
+        0,
+        nullptr);
+
+    VkBufferCopy region { 0, t_offset, t_size };
+    vkCmdCopyBuffer(cmdBuffer, staging.buffer, buffer, 1, &region);
+
+    // And later reads see the new data
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(cmdBuffer,
+        VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+        0,
+        0,
+        nullptr,
+        1,
+        &barrier,
+        0,
+        nullptr);
+    t_device->flushCommandBuffer(cmdBuffer, t_queue);
+    staging.destroy();
+}
+
 VkResult Buffer::flush(VkDeviceSize t_size, VkDeviceSize t_offset)
 {
-    VkMappedMemoryRange mappedRange = {};
-    mappedRange.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
-    mappedRange.memory = memory;
-    mappedRange.offset = t_offset;
-    mappedRange.size = t_size;
-    return vkFlushMappedMemoryRanges(device, 1, &mappedRange);
+    return allocation.allocator->flush(allocation, t_size, t_offset);
 }
 
 VkResult Buffer::invalidate(VkDeviceSize t_size, VkDeviceSize t_offset)
 {
-    VkMappedMemoryRange mappedRange = {};
-    mappedRange.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
-    mappedRange.memory = memory;
-    mappedRange.offset = t_offset;
-    mappedRange.size = t_size;
-    return vkInvalidateMappedMemoryRanges(device, 1, &mappedRange);
+    return allocation.allocator->invalidate(allocation, t_size, t_offset);
 }
 
 void Buffer::destroy()
 {
     if (buffer) {
         vkDestroyBuffer(device, buffer, nullptr);
+        buffer = VK_NULL_HANDLE;
     }
-    if (memory) {
-        vkFreeMemory(device, memory, nullptr);
-    }
+    MemoryAllocator::release(allocation);
+    memory = VK_NULL_HANDLE;
+    mapped = nullptr;
 }
 
 VkDeviceAddress Buffer::getDeviceAddress()
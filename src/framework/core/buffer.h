@@ -9,6 +9,7 @@
 #include <vector>
 
 #include "../tools/tools.h"
+#include "memory_allocator.h"
 #include "vulkan/vulkan.h"
 
 class Device;
@@ -29,7 +30,9 @@ public:
     ~Buffer();
 
     /**
-     * Create a buffer on the device
+     * Create a buffer on the device, its memory comes from the allocator of t_device (a
+     * dedicated allocation when t_allocationInfoNext is set). The memory is counted in the
+     * category of the current MemoryCategoryScope
      *
      * @param t_usageFlags Usage flag bitmask for the buffer (i.e. index, vertex,
      * uniform buffer)
@@ -47,7 +50,9 @@ public:
 
     VkDevice device;
     VkBuffer buffer = VK_NULL_HANDLE;
+    // Shared with other resources unless the allocation is dedicated, see allocation.offset
     VkDeviceMemory memory = VK_NULL_HANDLE;
+    MemoryAllocation allocation;
     VkDescriptorBufferInfo descriptor;
     VkDeviceSize size = 0;
     VkDeviceSize alignment = 0;
@@ -55,7 +60,8 @@ public:
 
     /**
      * Map a memory range of this buffer. If successful, mapped points to the
-     * specified buffer range.
+     * specified buffer range. Host visible memory stays mapped by the allocator,
+     * no call to the driver is made.
      *
      * @param t_size (Optional) Size of the memory range to map. Pass
      * VK_WHOLE_SIZE to map the complete buffer range.
@@ -66,17 +72,15 @@ public:
     VkResult map(VkDeviceSize t_size = VK_WHOLE_SIZE, VkDeviceSize t_offset = 0);
 
     /**
-     * Unmap a mapped memory range
-     *
-     * @note Does not return a result as vkUnmapMemory can't fail
+     * Unmap a mapped memory range, only mapped is cleared
      */
     void unmap();
 
     /**
      * Attach the allocated memory block to the buffer
      *
-     * @param t_offset (Optional) Byte offset (from the beginning) for the memory
-     * region to bind
+     * @param t_offset (Optional) Byte offset (from the beginning of the allocation)
+     * for the memory region to bind
      *
      * @return VkResult of the bindBufferMemory call
      */
@@ -100,6 +104,21 @@ public:
      */
     void copyTo(void* t_data, VkDeviceSize t_size);
 
+    /**
+     * Copies data to a buffer the host cannot map, like device local ones, through a temporary
+     * staging buffer. The buffer needs the transfer destination usage. The copy waits for the
+     * work already submitted to t_queue and is visible to the work submitted after it, so it can
+     * also update the buffer between frames. Returns once the copy is done
+     *
+     * @param t_queue Queue the copy is submitted to, the one of the work reading the buffer
+     * @param t_data Pointer to the data to copy
+     * @param t_size Size of the data to copy in machine units
+     * @param t_offset (Optional) Byte offset from beginning
+     *
+     */
+    void upload(Device* t_device, VkQueue t_queue, const void* t_data, VkDeviceSize t_size,
+        VkDeviceSize t_offset = 0);
+
     /**
      * Flush a memory range of the buffer to make it visible to the device
      *
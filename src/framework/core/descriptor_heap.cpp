@@ -0,0 +1,192 @@
+/*
+ * Manuel Machado Copyright (C) 2021 This code is licensed under the MIT license (MIT)
+ * (http://opensource.org/licenses/MIT)
+ */
+
+#include "descriptor_heap.h"
+
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+
+#include "shaders/shared_constants.h"
+
+uint32_t DescriptorHeap::SlotList::acquire()
+{
+    if (!free.empty()) {
+        const uint32_t slot = free.back();
+        free.pop_back();
+        return slot;
+    }
+    if (next == capacity) {
+        return UINT32_MAX;
+    }
+    return next++;
+}
+
+void DescriptorHeap::SlotList::release(uint32_t t_slot)
+{
+    assert(t_slot < next);
+    assert(std::find(free.begin(), free.end(), t_slot) == free.end());
+    free.push_back(t_slot);
+}
+
+DescriptorHeap::DescriptorHeap() = default;
+
+DescriptorHeap::~DescriptorHeap() = default;
+
+void DescriptorHeap::create(Device* t_device, uint32_t t_textureCapacity,
+    uint32_t t_bufferCapacity, uint32_t t_reservedBuffers)
+{
+    m_device = t_device;
+
+    VkPhysicalDeviceDescriptorIndexingProperties indexingProperties {};
+    indexingProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES;
+    VkPhysicalDeviceProperties2 properties {};
+    properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    properties.pNext = &indexingProperties;
+    vkGetPhysicalDeviceProperties2(m_device->physicalDevice, &properties);
+    // Every stage sees the whole heap, so the per stage limits apply to the full arrays
+    m_textureSlots.capacity = std::min({ t_textureCapacity,
+        indexingProperties.maxDescriptorSetUpdateAfterBindSampledImages,
+        indexingProperties.maxDescriptorSetUpdateAfterBindSamplers,
+        indexingProperties.maxPerStageDescriptorUpdateAfterBindSampledImages,
+        indexingProperties.maxPerStageDescriptorUpdateAfterBindSamplers });
+    m_bufferSlots.capacity = std::min({ t_bufferCapacity,
+        indexingProperties.maxDescriptorSetUpdateAfterBindStorageBuffers,
+        indexingProperties.maxPerStageDescriptorUpdateAfterBindStorageBuffers });
+    if (t_reservedBuffers > m_bufferSlots.capacity) {
+        throw std::runtime_error("Descriptor heap has less buffer slots than the reserved ones");
+    }
+    m_textureSlots.next = 0;
+    m_bufferSlots.next = t_reservedBuffers;
+
+    std::array<VkDescriptorPoolSize, 2> poolSizes = { {
+        { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, m_textureSlots.capacity },
+        { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, m_bufferSlots.capacity },
+    } };
+    VkDescriptorPoolCreateInfo poolInfo
+        = initializers::descriptorPoolCreateInfo(poolSizes.size(), poolSizes.data(), 1);
+    poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+    CHECK_RESULT(vkCreateDescriptorPool(m_device->logicalDevice, &poolInfo, nullptr, &m_pool))
+
+    std::array<VkDescriptorSetLayoutBinding, 2> bindings = {
+        initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+            VK_SHADER_STAGE_ALL,
+            BINDLESS_TEXTURES_BINDING,
+            m_textureSlots.capacity),
+        initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            VK_SHADER_STAGE_ALL,
+            BINDLESS_BUFFERS_BINDING,
+            m_bufferSlots.capacity),
+    };
+    // Slots that are not written are never read, and free slots may be written while frames
+    // using the others are in flight
+    const VkDescriptorBindingFlags bindingFlag = VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT
+        | VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT
+        | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT;
+    std::array<VkDescriptorBindingFlags, 2> bindingFlags = { bindingFlag, bindingFlag };
+    VkDescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsInfo {};
+    bindingFlagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+    bindingFlagsInfo.bindingCount = bindingFlags.size();
+    bindingFlagsInfo.pBindingFlags = bindingFlags.data();
+    VkDescriptorSetLayoutCreateInfo layoutInfo
+        = initializers::descriptorSetLayoutCreateInfo(bindings.data(), bindings.size());
+    layoutInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+    layoutInfo.pNext = &bindingFlagsInfo;
+    CHECK_RESULT(
+        vkCreateDescriptorSetLayout(m_device->logicalDevice, &layoutInfo, nullptr, &m_layout))
+
+    VkDescriptorSetAllocateInfo allocInfo
+        = initializers::descriptorSetAllocateInfo(m_pool, &m_layout, 1);
+    CHECK_RESULT(vkAllocateDescriptorSets(m_device->logicalDevice, &allocInfo, &m_set))
+}
+
+void DescriptorHeap::destroy()
+{
+    if (!m_device) {
+        return;
+    }
+    vkDestroyDescriptorPool(m_device->logicalDevice, m_pool, nullptr);
+    vkDestroyDescriptorSetLayout(m_device->logicalDevice, m_layout, nullptr);
+    m_pool = VK_NULL_HANDLE;
+    m_layout = VK_NULL_HANDLE;
+    m_set = VK_NULL_HANDLE;
+    m_textureSlots = {};
+    m_bufferSlots = {};
+    m_device = nullptr;
+}
+
+VkDescriptorSetLayout DescriptorHeap::getLayout() const { return m_layout; }
+
+VkDescriptorSet DescriptorHeap::getDescriptorSet() const { return m_set; }
+
+uint32_t DescriptorHeap::getTextureCapacity() const { return m_textureSlots.capacity; }
+
+uint32_t DescriptorHeap::getBufferCapacity() const { return m_bufferSlots.capacity; }
+
+uint32_t DescriptorHeap::addTexture(const VkDescriptorImageInfo& t_descriptor)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const uint32_t slot = m_textureSlots.acquire();
+    if (slot == UINT32_MAX) {
+        throw std::runtime_error("Descriptor heap is out of texture slots ("
+            + std::to_string(m_textureSlots.capacity) + ")");
+    }
+    write(BINDLESS_TEXTURES_BINDING, slot, &t_descriptor, nullptr);
+    return slot;
+}
+
+void DescriptorHeap::writeTexture(uint32_t t_slot, const VkDescriptorImageInfo& t_descriptor)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    assert(t_slot < m_textureSlots.capacity);
+    write(BINDLESS_TEXTURES_BINDING, t_slot, &t_descriptor, nullptr);
+}
+
+void DescriptorHeap::removeTexture(uint32_t t_slot)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_textureSlots.release(t_slot);
+}
+
+uint32_t DescriptorHeap::addBuffer(const VkDescriptorBufferInfo& t_descriptor)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const uint32_t slot = m_bufferSlots.acquire();
+    if (slot == UINT32_MAX) {
+        throw std::runtime_error("Descriptor heap is out of buffer slots ("
+            + std::to_string(m_bufferSlots.capacity) + ")");
+    }
+    write(BINDLESS_BUFFERS_BINDING, slot, nullptr, &t_descriptor);
+    return slot;
+}
+
+void DescriptorHeap::writeBuffer(uint32_t t_slot, const VkDescriptorBufferInfo& t_descriptor)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    assert(t_slot < m_bufferSlots.capacity);
+    write(BINDLESS_BUFFERS_BINDING, t_slot, nullptr, &t_descriptor);
+}
+
+void DescriptorHeap::removeBuffer(uint32_t t_slot)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_bufferSlots.release(t_slot);
+}
+
+void DescriptorHeap::write(uint32_t t_binding, uint32_t t_slot,
+    const VkDescriptorImageInfo* t_image, const VkDescriptorBufferInfo* t_buffer)
+{
+    VkWriteDescriptorSet descriptorWrite {};
+    descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrite.dstSet = m_set;
+    descriptorWrite.dstBinding = t_binding;
+    descriptorWrite.dstArrayElement = t_slot;
+    descriptorWrite.descriptorCount = 1;
+    descriptorWrite.descriptorType = t_image ? VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER
+                                             : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    descriptorWrite.pImageInfo = t_image;
+    descriptorWrite.pBufferInfo = t_buffer;
+    vkUpdateDescriptorSets(m_device->logicalDevice, 1, &descriptorWrite, 0, nullptr);
+}
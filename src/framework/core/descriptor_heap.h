@@ -0,0 +1,89 @@
+/*
+ * Manuel Machado Copyright (C) 2021 This code is licensed under the MIT license (MIT)
+ * (http://opensource.org/licenses/MIT)
+ */
+
+#ifndef MANUEME_DESCRIPTOR_HEAP_H
+#define MANUEME_DESCRIPTOR_HEAP_H
+
+#include <mutex>
+#include <vector>
+
+#include "device.h"
+#include "vulkan/vulkan.h"
+
+/**
+ * @brief Bindless descriptors shared by every pipeline: a single set with a large array of combined
+ * image samplers (BINDLESS_TEXTURES_BINDING) and one of storage buffers
+ * (BINDLESS_BUFFERS_BINDING). Both arrays are partially bound and update after bind, slots are
+ * handed out from a free list and written while the set stays bound, so resources are added at
+ * runtime without rebuilding sets or pools. Shaders index the arrays with the slot numbers.
+ * Thread safe.
+ */
+class DescriptorHeap {
+public:
+    static constexpr uint32_t defaultTextureCapacity = 4096;
+    static constexpr uint32_t defaultBufferCapacity = 64;
+
+    DescriptorHeap();
+    ~DescriptorHeap();
+
+    DescriptorHeap(const DescriptorHeap&) = delete;
+    DescriptorHeap& operator=(const DescriptorHeap&) = delete;
+
+    /**
+     * Create the pool, the layout and the set of the heap. Capacities are clamped to the update
+     * after bind limits of the device
+     *
+     * @param t_reservedBuffers Buffer slots below it are never handed out by addBuffer, they are
+     * fixed slots known by the shaders (see shared_constants.h) written with writeBuffer
+     */
+    void create(Device* t_device, uint32_t t_textureCapacity = defaultTextureCapacity,
+        uint32_t t_bufferCapacity = defaultBufferCapacity, uint32_t t_reservedBuffers = 0);
+
+    void destroy();
+
+    VkDescriptorSetLayout getLayout() const;
+    VkDescriptorSet getDescriptorSet() const;
+
+    uint32_t getTextureCapacity() const;
+    uint32_t getBufferCapacity() const;
+
+    /** @brief Writes t_descriptor to a free texture slot and returns it
+     * @throw Throws an exception if every slot is taken */
+    uint32_t addTexture(const VkDescriptorImageInfo& t_descriptor);
+    void writeTexture(uint32_t t_slot, const VkDescriptorImageInfo& t_descriptor);
+    /** @brief Frees t_slot for the next addTexture, the descriptor is left as it is. No submitted
+     * work may still sample it once it is reused */
+    void removeTexture(uint32_t t_slot);
+
+    /** @brief Writes t_descriptor to a free buffer slot and returns it
+     * @throw Throws an exception if every slot is taken */
+    uint32_t addBuffer(const VkDescriptorBufferInfo& t_descriptor);
+    void writeBuffer(uint32_t t_slot, const VkDescriptorBufferInfo& t_descriptor);
+    void removeBuffer(uint32_t t_slot);
+
+private:
+    // Slots of one of the arrays, those below next have been handed out at least once
+    struct SlotList {
+        uint32_t capacity = 0;
+        uint32_t next = 0;
+        std::vector<uint32_t> free;
+
+        uint32_t acquire();
+        void release(uint32_t t_slot);
+    };
+
+    Device* m_device = nullptr;
+    VkDescriptorPool m_pool = VK_NULL_HANDLE;
+    VkDescriptorSetLayout m_layout = VK_NULL_HANDLE;
+    VkDescriptorSet m_set = VK_NULL_HANDLE;
+    SlotList m_textureSlots;
+    SlotList m_bufferSlots;
+    std::mutex m_mutex;
+
+    void write(uint32_t t_binding, uint32_t t_slot, const VkDescriptorImageInfo* t_image,
+        const VkDescriptorBufferInfo* t_buffer);
+};
+
+#endif // MANUEME_DESCRIPTOR_HEAP_H
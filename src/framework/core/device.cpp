@@ -47,6 +47,7 @@ Device::~Device()
     if (commandPool) {
         vkDestroyCommandPool(logicalDevice, commandPool, nullptr);
     }
+    allocator.reset();
     if (logicalDevice) {
         vkDestroyDevice(logicalDevice, nullptr);
     }
@@ -75,6 +76,33 @@ uint32_t Device::getMemoryType(
     }
 }
 
+MemoryAllocation Device::allocateBufferMemory(VkBuffer t_buffer, VkMemoryPropertyFlags t_properties,
+    MemoryCategory t_category, MemoryResourceKind t_kind) const
+{
+    VkMemoryRequirements memReqs;
+    vkGetBufferMemoryRequirements(logicalDevice, t_buffer, &memReqs);
+    const auto allocation = allocator->allocate(memReqs,
+        getMemoryType(memReqs.memoryTypeBits, t_properties),
+        t_kind,
+        t_category);
+    CHECK_RESULT(vkBindBufferMemory(logicalDevice, t_buffer, allocation.memory, allocation.offset));
+    return allocation;
+}
+
+MemoryAllocation Device::allocateImageMemory(VkImage t_image, VkMemoryPropertyFlags t_properties,
+    MemoryCategory t_category, VkImageTiling t_tiling) const
+{
+    VkMemoryRequirements memReqs;
+    vkGetImageMemoryRequirements(logicalDevice, t_image, &memReqs);
+    const auto allocation = allocator->allocate(memReqs,
+        getMemoryType(memReqs.memoryTypeBits, t_properties),
+        t_tiling == VK_IMAGE_TILING_OPTIMAL ? MEMORY_RESOURCE_OPTIMAL_IMAGE
+                                            : MEMORY_RESOURCE_LINEAR,
+        t_category);
+    CHECK_RESULT(vkBindImageMemory(logicalDevice, t_image, allocation.memory, allocation.offset));
+    return allocation;
+}
+
 uint32_t Device::getQueueFamilyIndex(VkQueueFlagBits t_queueFlags)
 {
     // Dedicated queue for compute
@@ -185,6 +213,11 @@ VkResult Device::createLogicalDevice(VkPhysicalDeviceFeatures t_enabledFeatures,
         // need to request the swapchain extension
         deviceExtensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
     }
+    // Lets the allocator respect the memory the driver leaves to the process
+    const bool memoryBudget = extensionSupported(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+    if (memoryBudget) {
+        deviceExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+    }
 
     VkDeviceCreateInfo deviceCreateInfo = {};
     deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
@@ -213,6 +246,11 @@ VkResult Device::createLogicalDevice(VkPhysicalDeviceFeatures t_enabledFeatures,
     if (result == VK_SUCCESS) {
         // Create a default command pool for graphics command buffers
         commandPool = createCommandPool(queueFamilyIndices.graphics);
+        allocator = std::make_unique<MemoryAllocator>(physicalDevice,
+            logicalDevice,
+            properties,
+            memoryProperties,
+            memoryBudget);
     }
 
     this->enabledFeatures = t_enabledFeatures;
@@ -12,6 +12,7 @@
 
 #include "../tools/tools.h"
 #include "buffer.h"
+#include "memory_allocator.h"
 #include "vulkan/vulkan.h"
 
 class Device {
@@ -57,6 +58,10 @@ public:
     // Default command pool for the graphics queue family index
     VkCommandPool commandPool = VK_NULL_HANDLE;
 
+    // Sub-allocates the memory of the buffers, images and acceleration structures, created with
+    // the logical device
+    std::unique_ptr<MemoryAllocator> allocator;
+
     // Contains queue family indices
     struct {
         uint32_t graphics;
@@ -84,6 +89,23 @@ public:
     uint32_t getMemoryType(uint32_t t_typeBits, VkMemoryPropertyFlags t_properties,
         VkBool32* t_memTypeFound = nullptr) const;
 
+    /**
+     * Allocate memory for a buffer from the allocator and bind it
+     *
+     * @param t_buffer Buffer to bind, its memory requirements select the memory type
+     * @param t_properties Bitmask of properties for the memory type to request
+     * @param t_category What the buffer is used for, for the usage reports
+     * @param t_kind MEMORY_RESOURCE_ADDRESSABLE for buffers read through their device address
+     *
+     * @return The allocation, to be released once the buffer is destroyed
+     */
+    MemoryAllocation allocateBufferMemory(VkBuffer t_buffer, VkMemoryPropertyFlags t_properties,
+        MemoryCategory t_category, MemoryResourceKind t_kind = MEMORY_RESOURCE_LINEAR) const;
+
+    /** @brief Same as allocateBufferMemory for an image of tiling t_tiling */
+    MemoryAllocation allocateImageMemory(VkImage t_image, VkMemoryPropertyFlags t_properties,
+        MemoryCategory t_category, VkImageTiling t_tiling = VK_IMAGE_TILING_OPTIMAL) const;
+
     /**
      * Get the index of a queue family that supports the requested queue flags
      *
@@ -113,7 +135,8 @@ public:
     VkResult createLogicalDevice(VkPhysicalDeviceFeatures t_enabledFeatures,
         std::vector<const char*> t_enabledExtensions, void* t_pNextChain,
         bool t_useSwapChain = true,
-        VkQueueFlags t_requestedQueueTypes = VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT);
+        VkQueueFlags t_requestedQueueTypes
+        = VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT | VK_QUEUE_TRANSFER_BIT);
 
     /**
      * Create a command pool for allocation command buffers from
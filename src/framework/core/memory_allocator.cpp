@@ -0,0 +1,745 @@
+/*
+ * Manuel Machado Copyright (C) 2021 This code is licensed under the MIT license (MIT)
+ * (http://opensource.org/licenses/MIT)
+ */
+
+#include "memory_allocator.h"
+
+#include "../tools/tools.h"
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+
+// Free ranges are indexed by size class: the first level is the power of two of the size, split
+// in 2^secondLevelLog2 linear classes by the second level. Sizes below smallSize share the first
+// class of the first level
+const uint32_t secondLevelLog2 = 4;
+const uint32_t secondLevelCount = 1 << secondLevelLog2;
+const uint32_t smallSizeLog2 = 8;
+const VkDeviceSize smallSize = VkDeviceSize(1) << smallSizeLog2;
+const uint32_t firstLevelCount = 64 - smallSizeLog2 + 1;
+// Ranges left over by a split smaller than this are kept by the allocation
+const VkDeviceSize minRangeSize = 16;
+const uint32_t nullRange = UINT32_MAX;
+
+const VkDeviceSize defaultBlockSize = VkDeviceSize(256) << 20;
+
+thread_local MemoryCategory currentCategory = MEMORY_CATEGORY_OTHER;
+
+double toMiB(VkDeviceSize t_bytes) { return double(t_bytes) / double(1 << 20); }
+
+void addUsage(MemoryUsage& t_usage, VkDeviceSize t_bytes)
+{
+    t_usage.current += t_bytes;
+    t_usage.peak = std::max(t_usage.peak, t_usage.current);
+}
+
+uint32_t floorLog2(VkDeviceSize t_value)
+{
+    uint32_t log2 = 0;
+    while (t_value >>= 1) {
+        ++log2;
+    }
+    return log2;
+}
+
+template <typename T> uint32_t lowestBit(T t_bits)
+{
+    uint32_t bit = 0;
+    while ((t_bits & 1) == 0) {
+        t_bits >>= 1;
+        ++bit;
+    }
+    return bit;
+}
+
+VkDeviceSize alignUp(VkDeviceSize t_value, VkDeviceSize t_alignment)
+{
+    return (t_value + t_alignment - 1) / t_alignment * t_alignment;
+}
+
+void getSizeClass(VkDeviceSize t_size, uint32_t& t_firstLevel, uint32_t& t_secondLevel)
+{
+    if (t_size < smallSize) {
+        t_firstLevel = 0;
+        t_secondLevel = static_cast<uint32_t>(t_size >> (smallSizeLog2 - secondLevelLog2));
+        return;
+    }
+    const uint32_t log2 = floorLog2(t_size);
+    t_firstLevel = log2 - smallSizeLog2 + 1;
+    t_secondLevel
+        = static_cast<uint32_t>(t_size >> (log2 - secondLevelLog2)) - secondLevelCount;
+}
+
+}
+
+/** @brief One VkDeviceMemory with the ranges it is split in and the TLSF index of the free ones */
+class MemoryBlock {
+public:
+    MemoryBlock(VkDeviceMemory t_memory, VkDeviceSize t_size, void* t_mapped)
+        : m_memory(t_memory)
+        , m_size(t_size)
+        , m_mapped(t_mapped)
+    {
+        for (auto& heads : m_freeHeads) {
+            std::fill(std::begin(heads), std::end(heads), nullRange);
+        }
+        m_ranges.push_back({ 0, t_size, nullRange, nullRange, nullRange, nullRange, true });
+        insertFree(0);
+    }
+
+    VkDeviceMemory getMemory() const { return m_memory; }
+
+    VkDeviceSize getSize() const { return m_size; }
+
+    void* getMapped() const { return m_mapped; }
+
+    bool isEmpty() const { return m_usedCount == 0; }
+
+    uint32_t getUsedCount() const { return m_usedCount; }
+
+    VkDeviceSize getUsedBytes() const { return m_usedBytes; }
+
+    /** @brief Takes a range of at least t_size bytes starting at a multiple of t_alignment,
+     * returns false if no free range is large enough */
+    bool allocate(VkDeviceSize t_size, VkDeviceSize t_alignment, VkDeviceSize& t_offset,
+        uint32_t& t_range)
+    {
+        // Any free range of the class found fits the size and the worst alignment padding
+        uint32_t rangeIdx = findFree(t_size + t_alignment - 1);
+        if (rangeIdx == nullRange) {
+            return false;
+        }
+        removeFree(rangeIdx);
+        const VkDeviceSize offset = m_ranges[rangeIdx].offset;
+        const VkDeviceSize padding = alignUp(offset, t_alignment) - offset;
+        if (padding > 0) {
+            // Stays free, the range before it is in use as free neighbours are always merged
+            const uint32_t alignedIdx = split(rangeIdx, padding);
+            insertFree(rangeIdx);
+            rangeIdx = alignedIdx;
+        }
+        if (m_ranges[rangeIdx].size - t_size >= minRangeSize) {
+            insertFree(split(rangeIdx, t_size));
+        }
+        auto& range = m_ranges[rangeIdx];
+        range.free = false;
+        m_usedBytes += range.size;
+        ++m_usedCount;
+        t_offset = range.offset;
+        t_range = rangeIdx;
+        return true;
+    }
+
+    void free(uint32_t t_range)
+    {
+        uint32_t rangeIdx = t_range;
+        m_ranges[rangeIdx].free = true;
+        m_usedBytes -= m_ranges[rangeIdx].size;
+        --m_usedCount;
+        const uint32_t nextIdx = m_ranges[rangeIdx].nextPhysical;
+        if (nextIdx != nullRange && m_ranges[nextIdx].free) {
+            removeFree(nextIdx);
+            merge(rangeIdx, nextIdx);
+        }
+        const uint32_t prevIdx = m_ranges[rangeIdx].prevPhysical;
+        if (prevIdx != nullRange && m_ranges[prevIdx].free) {
+            removeFree(prevIdx);
+            merge(prevIdx, rangeIdx);
+            rangeIdx = prevIdx;
+        }
+        insertFree(rangeIdx);
+    }
+
+    VkDeviceSize getLargestFreeRange() const
+    {
+        if (m_firstLevelBitmap == 0) {
+            return 0;
+        }
+        // Ranges of the highest non empty class, any of them may be the largest
+        const uint32_t firstLevel = floorLog2(m_firstLevelBitmap);
+        const uint32_t secondLevel = floorLog2(m_secondLevelBitmaps[firstLevel]);
+        VkDeviceSize largest = 0;
+        for (uint32_t i = m_freeHeads[firstLevel][secondLevel]; i != nullRange;
+             i = m_ranges[i].nextFree) {
+            largest = std::max(largest, m_ranges[i].size);
+        }
+        return largest;
+    }
+
+private:
+    struct Range {
+        VkDeviceSize offset;
+        VkDeviceSize size;
+        uint32_t prevPhysical;
+        uint32_t nextPhysical;
+        uint32_t prevFree;
+        uint32_t nextFree;
+        bool free;
+    };
+
+    VkDeviceMemory m_memory;
+    VkDeviceSize m_size;
+    void* m_mapped;
+    std::vector<Range> m_ranges;
+    // Entries of m_ranges merged into their neighbours, reused by the next splits
+    std::vector<uint32_t> m_unusedRanges;
+    uint64_t m_firstLevelBitmap = 0;
+    uint32_t m_secondLevelBitmaps[firstLevelCount] = {};
+    uint32_t m_freeHeads[firstLevelCount][secondLevelCount];
+    VkDeviceSize m_usedBytes = 0;
+    uint32_t m_usedCount = 0;
+
+    uint32_t findFree(VkDeviceSize t_size) const
+    {
+        // Rounded up to the next class, every range of a class is at least as large as its start
+        const VkDeviceSize classWidth = t_size < smallSize
+            ? smallSize >> secondLevelLog2
+            : VkDeviceSize(1) << (floorLog2(t_size) - secondLevelLog2);
+        if (t_size > UINT64_MAX - classWidth) {
+            return nullRange;
+        }
+        uint32_t firstLevel;
+        uint32_t secondLevel;
+        getSizeClass(t_size + classWidth - 1, firstLevel, secondLevel);
+        if (firstLevel >= firstLevelCount) {
+            return nullRange;
+        }
+        uint32_t secondLevelMap = m_secondLevelBitmaps[firstLevel] & (~0u << secondLevel);
+        if (secondLevelMap == 0) {
+            const uint64_t firstLevelMap
+                = m_firstLevelBitmap & (~uint64_t(0) << (firstLevel + 1));
+            if (firstLevelMap == 0) {
+                return nullRange;
+            }
+            firstLevel = lowestBit(firstLevelMap);
+            secondLevelMap = m_secondLevelBitmaps[firstLevel];
+        }
+        return m_freeHeads[firstLevel][lowestBit(secondLevelMap)];
+    }
+
+    void insertFree(uint32_t t_range)
+    {
+        uint32_t firstLevel;
+        uint32_t secondLevel;
+        getSizeClass(m_ranges[t_range].size, firstLevel, secondLevel);
+        auto& head = m_freeHeads[firstLevel][secondLevel];
+        m_ranges[t_range].prevFree = nullRange;
+        m_ranges[t_range].nextFree = head;
+        if (head != nullRange) {
+            m_ranges[head].prevFree = t_range;
+        }
+        head = t_range;
+        m_firstLevelBitmap |= uint64_t(1) << firstLevel;
+        m_secondLevelBitmaps[firstLevel] |= 1u << secondLevel;
+    }
+
+    void removeFree(uint32_t t_range)
+    {
+        const auto& range = m_ranges[t_range];
+        if (range.nextFree != nullRange) {
+            m_ranges[range.nextFree].prevFree = range.prevFree;
+        }
+        if (range.prevFree != nullRange) {
+            m_ranges[range.prevFree].nextFree = range.nextFree;
+            return;
+        }
+        uint32_t firstLevel;
+        uint32_t secondLevel;
+        getSizeClass(range.size, firstLevel, secondLevel);
+        m_freeHeads[firstLevel][secondLevel] = range.nextFree;
+        if (range.nextFree == nullRange) {
+            m_secondLevelBitmaps[firstLevel] &= ~(1u << secondLevel);
+            if (m_secondLevelBitmaps[firstLevel] == 0) {
+                m_firstLevelBitmap &= ~(uint64_t(1) << firstLevel);
+            }
+        }
+    }
+
+    /** @brief Cuts t_range after t_size bytes, the second part is a new free range (not indexed)
+     * whose entry is returned */
+    uint32_t split(uint32_t t_range, VkDeviceSize t_size)
+    {
+        uint32_t restIdx;
+        if (m_unusedRanges.empty()) {
+            restIdx = static_cast<uint32_t>(m_ranges.size());
+            m_ranges.emplace_back();
+        } else {
+            restIdx = m_unusedRanges.back();
+            m_unusedRanges.pop_back();
+        }
+        auto& range = m_ranges[t_range];
+        auto& rest = m_ranges[restIdx];
+        rest.offset = range.offset + t_size;
+        rest.size = range.size - t_size;
+        rest.prevPhysical = t_range;
+        rest.nextPhysical = range.nextPhysical;
+        rest.free = true;
+        if (range.nextPhysical != nullRange) {
+            m_ranges[range.nextPhysical].prevPhysical = restIdx;
+        }
+        range.size = t_size;
+        range.nextPhysical = restIdx;
+        return restIdx;
+    }
+
+    /** @brief Appends t_next, which must follow t_range, to it */
+    void merge(uint32_t t_range, uint32_t t_next)
+    {
+        auto& range = m_ranges[t_range];
+        const auto& next = m_ranges[t_next];
+        range.size += next.size;
+        range.nextPhysical = next.nextPhysical;
+        if (next.nextPhysical != nullRange) {
+            m_ranges[next.nextPhysical].prevPhysical = t_range;
+        }
+        m_unusedRanges.push_back(t_next);
+    }
+};
+
+MemoryCategoryScope::MemoryCategoryScope(MemoryCategory t_category)
+    : m_previous(currentCategory)
+{
+    currentCategory = t_category;
+}
+
+MemoryCategoryScope::~MemoryCategoryScope() { currentCategory = m_previous; }
+
+MemoryCategory MemoryCategoryScope::getCurrent() { return currentCategory; }
+
+MemoryAllocator::MemoryAllocator(VkPhysicalDevice t_physicalDevice, VkDevice t_device,
+    const VkPhysicalDeviceProperties& t_properties,
+    const VkPhysicalDeviceMemoryProperties& t_memoryProperties, bool t_memoryBudget)
+    : m_physicalDevice(t_physicalDevice)
+    , m_device(t_device)
+    , m_memoryProperties(t_memoryProperties)
+    , m_memoryBudget(t_memoryBudget)
+    , m_bufferImageGranularity(t_properties.limits.bufferImageGranularity)
+    , m_nonCoherentAtomSize(t_properties.limits.nonCoherentAtomSize)
+    , m_heapUsage(t_memoryProperties.memoryHeapCount)
+    , m_heapBudgets(t_memoryProperties.memoryHeapCount, 0)
+{
+    for (uint32_t i = 0; i < m_memoryProperties.memoryTypeCount; ++i) {
+        for (const auto kind : { MEMORY_RESOURCE_LINEAR,
+                 MEMORY_RESOURCE_ADDRESSABLE,
+                 MEMORY_RESOURCE_OPTIMAL_IMAGE }) {
+            m_pools.push_back({ i, kind, {} });
+        }
+    }
+}
+
+MemoryAllocator::~MemoryAllocator()
+{
+    for (auto& pool : m_pools) {
+        for (auto& block : pool.blocks) {
+            vkFreeMemory(m_device, block->getMemory(), nullptr);
+        }
+    }
+}
+
+MemoryAllocation MemoryAllocator::allocate(const VkMemoryRequirements& t_requirements,
+    uint32_t t_memoryTypeIndex, MemoryResourceKind t_kind, MemoryCategory t_category,
+    const void* t_allocationInfoNext)
+{
+    MemoryAllocation allocation;
+    allocation.allocator = this;
+    allocation.size = t_requirements.size;
+    allocation.memoryTypeIndex = t_memoryTypeIndex;
+    allocation.category = t_category;
+
+    VkDeviceSize blockSize = getBlockSize(t_memoryTypeIndex);
+    if (t_allocationInfoNext || t_requirements.size > blockSize / 2) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        const VkResult result = allocateMemory(t_requirements.size,
+            t_memoryTypeIndex,
+            t_kind,
+            t_allocationInfoNext,
+            &allocation.memory,
+            &allocation.mapped);
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error(getAllocationError(result,
+                t_requirements.size,
+                t_memoryTypeIndex,
+                t_category));
+        }
+        ++m_dedicatedCount;
+        m_dedicatedBytes += t_requirements.size;
+        addUsage(m_categoryUsage[t_category], t_requirements.size);
+        return allocation;
+    }
+
+    // Linear and optimal resources only have to be apart when bufferImageGranularity says so
+    if (t_kind == MEMORY_RESOURCE_OPTIMAL_IMAGE && m_bufferImageGranularity <= 1) {
+        t_kind = MEMORY_RESOURCE_LINEAR;
+    }
+    // Non-coherent ranges are whole atoms, flushing one never touches its neighbours
+    VkDeviceSize alignment = std::max<VkDeviceSize>(t_requirements.alignment, 1);
+    VkDeviceSize size = t_requirements.size;
+    if (!isCoherent(t_memoryTypeIndex)) {
+        alignment = std::max(alignment, m_nonCoherentAtomSize);
+        size = alignUp(size, m_nonCoherentAtomSize);
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto& pool = m_pools[t_memoryTypeIndex * 3 + t_kind];
+    for (auto& block : pool.blocks) {
+        if (block->allocate(size, alignment, allocation.offset, allocation.range)) {
+            allocation.block = block.get();
+            break;
+        }
+    }
+    if (!allocation.block) {
+        // Smaller blocks are tried when the heap is almost full
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        void* mapped = nullptr;
+        VkResult result
+            = allocateMemory(blockSize, t_memoryTypeIndex, t_kind, nullptr, &memory, &mapped);
+        while (result != VK_SUCCESS && blockSize / 2 >= size + alignment) {
+            blockSize /= 2;
+            result = allocateMemory(
+                blockSize, t_memoryTypeIndex, t_kind, nullptr, &memory, &mapped);
+        }
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error(
+                getAllocationError(result, size, t_memoryTypeIndex, t_category));
+        }
+        pool.blocks.push_back(std::make_unique<MemoryBlock>(memory, blockSize, mapped));
+        allocation.block = pool.blocks.back().get();
+        if (!allocation.block->allocate(size, alignment, allocation.offset, allocation.range)) {
+            throw std::runtime_error("Could not sub-allocate device memory");
+        }
+    }
+    allocation.memory = allocation.block->getMemory();
+    addUsage(m_categoryUsage[t_category], t_requirements.size);
+    if (allocation.block->getMapped()) {
+        allocation.mapped
+            = static_cast<uint8_t*>(allocation.block->getMapped()) + allocation.offset;
+    }
+    return allocation;
+}
+
+void MemoryAllocator::release(MemoryAllocation& t_allocation)
+{
+    if (t_allocation.allocator) {
+        t_allocation.allocator->free(t_allocation);
+    }
+    t_allocation = MemoryAllocation();
+}
+
+void MemoryAllocator::free(MemoryAllocation& t_allocation)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_categoryUsage[t_allocation.category].current -= t_allocation.size;
+    if (!t_allocation.block) {
+        freeMemory(t_allocation.memory, t_allocation.size, t_allocation.memoryTypeIndex);
+        --m_dedicatedCount;
+        m_dedicatedBytes -= t_allocation.size;
+        return;
+    }
+    t_allocation.block->free(t_allocation.range);
+    if (!t_allocation.block->isEmpty()) {
+        return;
+    }
+    // A single empty block is kept per pool, for the next allocations
+    for (auto& pool : m_pools) {
+        const auto block = std::find_if(pool.blocks.begin(),
+            pool.blocks.end(),
+            [&](const std::unique_ptr<MemoryBlock>& t_block) {
+                return t_block.get() == t_allocation.block;
+            });
+        if (block == pool.blocks.end()) {
+            continue;
+        }
+        const bool otherEmpty = std::any_of(pool.blocks.begin(),
+            pool.blocks.end(),
+            [&](const std::unique_ptr<MemoryBlock>& t_block) {
+                return t_block.get() != t_allocation.block && t_block->isEmpty();
+            });
+        if (otherEmpty) {
+            freeMemory((*block)->getMemory(), (*block)->getSize(), pool.memoryTypeIndex);
+            pool.blocks.erase(block);
+        }
+        return;
+    }
+}
+
+VkResult MemoryAllocator::flush(
+    const MemoryAllocation& t_allocation, VkDeviceSize t_size, VkDeviceSize t_offset) const
+{
+    const auto range = getMappedRange(t_allocation, t_size, t_offset);
+    return vkFlushMappedMemoryRanges(m_device, 1, &range);
+}
+
+VkResult MemoryAllocator::invalidate(
+    const MemoryAllocation& t_allocation, VkDeviceSize t_size, VkDeviceSize t_offset) const
+{
+    const auto range = getMappedRange(t_allocation, t_size, t_offset);
+    return vkInvalidateMappedMemoryRanges(m_device, 1, &range);
+}
+
+MemoryStatistics MemoryAllocator::getStatistics() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    MemoryStatistics statistics;
+    statistics.dedicatedCount = m_dedicatedCount;
+    statistics.dedicatedBytes = m_dedicatedBytes;
+    statistics.allocationCount = m_dedicatedCount;
+    // Free bytes that are not in the largest range of their block
+    VkDeviceSize scatteredBytes = 0;
+    for (const auto& pool : m_pools) {
+        for (const auto& block : pool.blocks) {
+            const VkDeviceSize largestFreeRange = block->getLargestFreeRange();
+            ++statistics.blockCount;
+            statistics.allocationCount += block->getUsedCount();
+            statistics.blockBytes += block->getSize();
+            statistics.usedBytes += block->getUsedBytes();
+            statistics.largestFreeRange = std::max(statistics.largestFreeRange, largestFreeRange);
+            scatteredBytes += block->getSize() - block->getUsedBytes() - largestFreeRange;
+        }
+    }
+    const VkDeviceSize freeBytes = statistics.blockBytes - statistics.usedBytes;
+    if (freeBytes > 0) {
+        statistics.fragmentation = static_cast<float>(double(scatteredBytes) / double(freeBytes));
+    }
+    return statistics;
+}
+
+VkDeviceSize MemoryAllocator::getBlockSize(uint32_t t_memoryTypeIndex) const
+{
+    // Small heaps (like the host visible part of the device memory) are not taken by a few blocks
+    const auto heapIndex = m_memoryProperties.memoryTypes[t_memoryTypeIndex].heapIndex;
+    const VkDeviceSize heapSize = m_memoryProperties.memoryHeaps[heapIndex].size;
+    return heapSize <= VkDeviceSize(1) << 30 ? alignUp(heapSize / 8, 1 << 20) : defaultBlockSize;
+}
+
+bool MemoryAllocator::isCoherent(uint32_t t_memoryTypeIndex) const
+{
+    const auto flags = m_memoryProperties.memoryTypes[t_memoryTypeIndex].propertyFlags;
+    return (flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) == 0
+        || (flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+}
+
+VkResult MemoryAllocator::allocateMemory(VkDeviceSize t_size, uint32_t t_memoryTypeIndex,
+    MemoryResourceKind t_kind, const void* t_next, VkDeviceMemory* t_memory, void** t_mapped)
+{
+    const uint32_t heapIndex = m_memoryProperties.memoryTypes[t_memoryTypeIndex].heapIndex;
+    if (exceedsBudget(heapIndex, t_size)) {
+        return (m_memoryProperties.memoryHeaps[heapIndex].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+            ? VK_ERROR_OUT_OF_DEVICE_MEMORY
+            : VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+
+    VkMemoryAllocateInfo memAlloc = {};
+    memAlloc.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    memAlloc.allocationSize = t_size;
+    memAlloc.memoryTypeIndex = t_memoryTypeIndex;
+    VkMemoryAllocateFlagsInfoKHR allocFlagsInfo {};
+    if (t_kind == MEMORY_RESOURCE_ADDRESSABLE) {
+        allocFlagsInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO_KHR;
+        allocFlagsInfo.flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT_KHR;
+        allocFlagsInfo.pNext = t_next;
+        memAlloc.pNext = &allocFlagsInfo;
+    } else {
+        memAlloc.pNext = t_next;
+    }
+    VkResult result = vkAllocateMemory(m_device, &memAlloc, nullptr, t_memory);
+    *t_mapped = nullptr;
+    const auto flags = m_memoryProperties.memoryTypes[t_memoryTypeIndex].propertyFlags;
+    if (result == VK_SUCCESS && (flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)) {
+        result = vkMapMemory(m_device, *t_memory, 0, VK_WHOLE_SIZE, 0, t_mapped);
+        if (result != VK_SUCCESS) {
+            vkFreeMemory(m_device, *t_memory, nullptr);
+        }
+    }
+    if (result == VK_SUCCESS) {
+        addUsage(m_heapUsage[heapIndex], t_size);
+    }
+    return result;
+}
+
+void MemoryAllocator::freeMemory(
+    VkDeviceMemory t_memory, VkDeviceSize t_size, uint32_t t_memoryTypeIndex)
+{
+    vkFreeMemory(m_device, t_memory, nullptr);
+    m_heapUsage[m_memoryProperties.memoryTypes[t_memoryTypeIndex].heapIndex].current -= t_size;
+}
+
+bool MemoryAllocator::exceedsBudget(uint32_t t_heapIndex, VkDeviceSize t_size) const
+{
+    const VkDeviceSize budget = m_heapBudgets[t_heapIndex];
+    if (budget > 0 && m_heapUsage[t_heapIndex].current + t_size > budget) {
+        return true;
+    }
+    // The usage reported by the driver is the one of the whole process, other devices and
+    // allocations made around the allocator included
+    VkPhysicalDeviceMemoryBudgetPropertiesEXT driverBudget {};
+    return getDriverBudget(driverBudget)
+        && driverBudget.heapUsage[t_heapIndex] + t_size > driverBudget.heapBudget[t_heapIndex];
+}
+
+bool MemoryAllocator::getDriverBudget(VkPhysicalDeviceMemoryBudgetPropertiesEXT& t_budget) const
+{
+    if (!m_memoryBudget) {
+        return false;
+    }
+    t_budget = {};
+    t_budget.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+    VkPhysicalDeviceMemoryProperties2 properties {};
+    properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+    properties.pNext = &t_budget;
+    vkGetPhysicalDeviceMemoryProperties2(m_physicalDevice, &properties);
+    return true;
+}
+
+std::string MemoryAllocator::getAllocationError(VkResult t_result, VkDeviceSize t_size,
+    uint32_t t_memoryTypeIndex, MemoryCategory t_category) const
+{
+    const uint32_t heapIndex = m_memoryProperties.memoryTypes[t_memoryTypeIndex].heapIndex;
+    std::ostringstream error;
+    error << std::fixed << std::setprecision(1) << "Could not allocate " << toMiB(t_size)
+          << " MiB of " << getCategoryName(t_category) << " memory from heap " << heapIndex
+          << ": ";
+    if (exceedsBudget(heapIndex, t_size)) {
+        error << "the heap would go over its budget";
+    } else {
+        error << tools::errorString(t_result);
+    }
+    error << "\n";
+    writeReport(error);
+    return error.str();
+}
+
+void MemoryAllocator::setHeapBudget(uint32_t t_heapIndex, VkDeviceSize t_budget)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_heapBudgets[t_heapIndex] = t_budget;
+}
+
+MemoryUsage MemoryAllocator::getCategoryUsage(MemoryCategory t_category) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_categoryUsage[t_category];
+}
+
+MemoryUsage MemoryAllocator::getHeapUsage(uint32_t t_heapIndex) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_heapUsage[t_heapIndex];
+}
+
+std::string MemoryAllocator::getReport() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::ostringstream report;
+    writeReport(report);
+    return report.str();
+}
+
+std::string MemoryAllocator::getReportJson() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::ostringstream report;
+    writeReportJson(report);
+    return report.str();
+}
+
+const char* MemoryAllocator::getCategoryName(MemoryCategory t_category)
+{
+    switch (t_category) {
+    case MEMORY_CATEGORY_GEOMETRY:
+        return "geometry";
+    case MEMORY_CATEGORY_TEXTURES:
+        return "textures";
+    case MEMORY_CATEGORY_BLAS:
+        return "blas";
+    case MEMORY_CATEGORY_TLAS:
+        return "tlas";
+    case MEMORY_CATEGORY_SCRATCH:
+        return "scratch";
+    case MEMORY_CATEGORY_STORAGE_IMAGES:
+        return "storage_images";
+    case MEMORY_CATEGORY_GBUFFER:
+        return "gbuffer";
+    case MEMORY_CATEGORY_STAGING:
+        return "staging";
+    case MEMORY_CATEGORY_DENOISER:
+        return "denoiser";
+    default:
+        return "other";
+    }
+}
+
+void MemoryAllocator::writeReport(std::ostream& t_output) const
+{
+    t_output << std::fixed << std::setprecision(1) << "Memory usage (MiB, current / peak):\n";
+    for (uint32_t i = 0; i < MEMORY_CATEGORY_COUNT; ++i) {
+        t_output << "  " << std::left << std::setw(16)
+                 << getCategoryName(static_cast<MemoryCategory>(i)) << std::right << std::setw(10)
+                 << toMiB(m_categoryUsage[i].current) << " / " << toMiB(m_categoryUsage[i].peak)
+                 << "\n";
+    }
+    VkPhysicalDeviceMemoryBudgetPropertiesEXT driverBudget {};
+    const bool hasDriverBudget = getDriverBudget(driverBudget);
+    for (uint32_t i = 0; i < m_memoryProperties.memoryHeapCount; ++i) {
+        const auto& heap = m_memoryProperties.memoryHeaps[i];
+        t_output << "  heap " << i
+                 << ((heap.flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) ? " (device)" : " (host)  ")
+                 << std::setw(6) << toMiB(m_heapUsage[i].current) << " / "
+                 << toMiB(m_heapUsage[i].peak) << " of " << toMiB(heap.size);
+        if (m_heapBudgets[i] > 0) {
+            t_output << ", budget " << toMiB(m_heapBudgets[i]);
+        }
+        if (hasDriverBudget) {
+            t_output << ", process " << toMiB(driverBudget.heapUsage[i]) << " of driver budget "
+                     << toMiB(driverBudget.heapBudget[i]);
+        }
+        t_output << "\n";
+    }
+}
+
+void MemoryAllocator::writeReportJson(std::ostream& t_output) const
+{
+    t_output << "{\n  \"categories\": {";
+    for (uint32_t i = 0; i < MEMORY_CATEGORY_COUNT; ++i) {
+        t_output << (i > 0 ? ",\n" : "\n") << "    \""
+                 << getCategoryName(static_cast<MemoryCategory>(i)) << "\": { \"current\": "
+                 << m_categoryUsage[i].current << ", \"peak\": " << m_categoryUsage[i].peak
+                 << " }";
+    }
+    t_output << "\n  },\n  \"heaps\": [";
+    VkPhysicalDeviceMemoryBudgetPropertiesEXT driverBudget {};
+    const bool hasDriverBudget = getDriverBudget(driverBudget);
+    for (uint32_t i = 0; i < m_memoryProperties.memoryHeapCount; ++i) {
+        const auto& heap = m_memoryProperties.memoryHeaps[i];
+        t_output << (i > 0 ? ",\n" : "\n") << "    { \"index\": " << i
+                 << ", \"deviceLocal\": "
+                 << ((heap.flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) ? "true" : "false")
+                 << ", \"size\": " << heap.size << ", \"current\": " << m_heapUsage[i].current
+                 << ", \"peak\": " << m_heapUsage[i].peak << ", \"budget\": " << m_heapBudgets[i];
+        if (hasDriverBudget) {
+            t_output << ", \"driverUsage\": " << driverBudget.heapUsage[i]
+                     << ", \"driverBudget\": " << driverBudget.heapBudget[i];
+        }
+        t_output << " }";
+    }
+    t_output << "\n  ]\n}\n";
+}
+
+VkMappedMemoryRange MemoryAllocator::getMappedRange(
+    const MemoryAllocation& t_allocation, VkDeviceSize t_size, VkDeviceSize t_offset) const
+{
+    const VkDeviceSize size = t_size == VK_WHOLE_SIZE ? t_allocation.size - t_offset : t_size;
+    const VkDeviceSize begin = (t_allocation.offset + t_offset) / m_nonCoherentAtomSize
+        * m_nonCoherentAtomSize;
+    const VkDeviceSize end = alignUp(t_allocation.offset + t_offset + size, m_nonCoherentAtomSize);
+    VkMappedMemoryRange mappedRange = {};
+    mappedRange.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+    mappedRange.memory = t_allocation.memory;
+    mappedRange.offset = begin;
+    // The ranges of the blocks are whole atoms, a dedicated allocation may end in the middle of one
+    mappedRange.size = !t_allocation.block && end > t_allocation.size ? VK_WHOLE_SIZE : end - begin;
+    return mappedRange;
+}
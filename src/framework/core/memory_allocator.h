@@ -0,0 +1,229 @@
+/*
+ * Manuel Machado Copyright (C) 2021 This code is licensed under the MIT license (MIT)
+ * (http://opensource.org/licenses/MIT)
+ */
+
+#ifndef MANUEME_MEMORY_ALLOCATOR_H
+#define MANUEME_MEMORY_ALLOCATOR_H
+
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "vulkan/vulkan.h"
+
+class MemoryAllocator;
+class MemoryBlock;
+
+// What is bound to an allocation, resources of different kinds are kept in different blocks
+enum MemoryResourceKind {
+    // Buffers and linear images
+    MEMORY_RESOURCE_LINEAR = 0x0,
+    // Buffers read through their device address, their memory needs the device address flag
+    MEMORY_RESOURCE_ADDRESSABLE = 0x1,
+    // Optimal tiling images, they share blocks with the linear resources when the device does not
+    // need them apart (bufferImageGranularity of 1)
+    MEMORY_RESOURCE_OPTIMAL_IMAGE = 0x2
+};
+
+// What the memory is used for, the usage reports are broken down by it
+enum MemoryCategory {
+    // Uniforms, scene tables, shader binding tables and anything else
+    MEMORY_CATEGORY_OTHER = 0,
+    MEMORY_CATEGORY_GEOMETRY,
+    MEMORY_CATEGORY_TEXTURES,
+    MEMORY_CATEGORY_BLAS,
+    MEMORY_CATEGORY_TLAS,
+    // Acceleration structure build and update scratch
+    MEMORY_CATEGORY_SCRATCH,
+    MEMORY_CATEGORY_STORAGE_IMAGES,
+    // Attachments of the raster passes
+    MEMORY_CATEGORY_GBUFFER,
+    MEMORY_CATEGORY_STAGING,
+    // Memory exported to the OptiX denoiser
+    MEMORY_CATEGORY_DENOISER,
+    MEMORY_CATEGORY_COUNT
+};
+
+/**
+ * @brief Sets the category of the buffers created by the current thread while it is alive, the
+ * previous one is restored when it is destroyed so scopes can be nested. Allocations made outside
+ * of any scope are MEMORY_CATEGORY_OTHER
+ */
+class MemoryCategoryScope {
+public:
+    explicit MemoryCategoryScope(MemoryCategory t_category);
+    ~MemoryCategoryScope();
+
+    MemoryCategoryScope(const MemoryCategoryScope&) = delete;
+    MemoryCategoryScope& operator=(const MemoryCategoryScope&) = delete;
+
+    static MemoryCategory getCurrent();
+
+private:
+    MemoryCategory m_previous;
+};
+
+struct MemoryUsage {
+    VkDeviceSize current = 0;
+    VkDeviceSize peak = 0;
+};
+
+/** @brief Range of device memory handed out by MemoryAllocator. Unless it is dedicated, the
+ * memory is shared with other resources and the range starts at offset */
+struct MemoryAllocation {
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0;
+    // Start of the range for host visible memory, which stays mapped while it is allocated
+    void* mapped = nullptr;
+
+    MemoryAllocator* allocator = nullptr;
+    MemoryBlock* block = nullptr; // Null for dedicated allocations
+    uint32_t range = 0;
+    uint32_t memoryTypeIndex = 0;
+    MemoryCategory category = MEMORY_CATEGORY_OTHER;
+};
+
+struct MemoryStatistics {
+    uint32_t blockCount = 0;
+    uint32_t dedicatedCount = 0;
+    // Live allocations, sub-allocated and dedicated
+    uint32_t allocationCount = 0;
+    VkDeviceSize blockBytes = 0;
+    VkDeviceSize dedicatedBytes = 0;
+    // Bytes of the blocks taken by live allocations, including their alignment
+    VkDeviceSize usedBytes = 0;
+    VkDeviceSize largestFreeRange = 0;
+    // 0 when the free memory of every block is a single range, towards 1 as it is scattered in
+    // smaller ones
+    float fragmentation = 0.0f;
+};
+
+/**
+ * @brief Sub-allocates resources from large blocks of device memory, a few per memory type, instead
+ * of one vkAllocateMemory per resource. The free ranges of every block are kept in a two level
+ * segregated fit (TLSF) index, allocation and release take constant time. Resources larger than
+ * half a block, or with an allocation chain of their own (exported memory), get a dedicated
+ * allocation. The bytes in use are tracked per category and per heap, against an optional budget.
+ * Thread safe.
+ */
+class MemoryAllocator {
+public:
+    /**
+     * @param t_memoryBudget VK_EXT_memory_budget is enabled, the budgets it reports for the heaps
+     * are enforced too
+     */
+    MemoryAllocator(VkPhysicalDevice t_physicalDevice, VkDevice t_device,
+        const VkPhysicalDeviceProperties& t_properties,
+        const VkPhysicalDeviceMemoryProperties& t_memoryProperties, bool t_memoryBudget = false);
+    /** @brief Frees every block, allocations still alive become invalid */
+    ~MemoryAllocator();
+
+    MemoryAllocator(const MemoryAllocator&) = delete;
+    MemoryAllocator& operator=(const MemoryAllocator&) = delete;
+
+    /**
+     * Memory for a resource with t_requirements in memory type t_memoryTypeIndex
+     *
+     * @param t_allocationInfoNext Chained to the VkMemoryAllocateInfo, forces a dedicated
+     * allocation
+     *
+     * @throw Throws an exception, with the usage report, if the device runs out of memory or the
+     * heap would go over its budget
+     */
+    MemoryAllocation allocate(const VkMemoryRequirements& t_requirements,
+        uint32_t t_memoryTypeIndex, MemoryResourceKind t_kind, MemoryCategory t_category,
+        const void* t_allocationInfoNext = nullptr);
+
+    /** @brief Returns t_allocation to the allocator it came from and clears it, nothing happens
+     * for an empty allocation */
+    static void release(MemoryAllocation& t_allocation);
+
+    /** @brief Range of t_allocation made visible to the device, widened to whole atoms of
+     * non-coherent memory. Only required for non-coherent memory */
+    VkResult flush(const MemoryAllocation& t_allocation, VkDeviceSize t_size = VK_WHOLE_SIZE,
+        VkDeviceSize t_offset = 0) const;
+
+    VkResult invalidate(const MemoryAllocation& t_allocation, VkDeviceSize t_size = VK_WHOLE_SIZE,
+        VkDeviceSize t_offset = 0) const;
+
+    MemoryStatistics getStatistics() const;
+
+    /** @brief Most bytes of device memory the allocator may take from heap t_heapIndex, blocks
+     * included. 0 (the default) for no limit */
+    void setHeapBudget(uint32_t t_heapIndex, VkDeviceSize t_budget);
+
+    /** @brief Bytes of the live allocations of t_category, without the free space of blocks */
+    MemoryUsage getCategoryUsage(MemoryCategory t_category) const;
+
+    /** @brief Bytes of device memory taken from heap t_heapIndex, blocks and dedicated
+     * allocations */
+    MemoryUsage getHeapUsage(uint32_t t_heapIndex) const;
+
+    /** @brief Human readable usage of every category and heap, with the budgets */
+    std::string getReport() const;
+
+    /** @brief Same content as getReport, as a JSON object. Sizes are in bytes */
+    std::string getReportJson() const;
+
+    static const char* getCategoryName(MemoryCategory t_category);
+
+private:
+    struct Pool {
+        uint32_t memoryTypeIndex;
+        MemoryResourceKind kind;
+        std::vector<std::unique_ptr<MemoryBlock>> blocks;
+    };
+
+    VkPhysicalDevice m_physicalDevice;
+    VkDevice m_device;
+    VkPhysicalDeviceMemoryProperties m_memoryProperties;
+    bool m_memoryBudget;
+    VkDeviceSize m_bufferImageGranularity;
+    VkDeviceSize m_nonCoherentAtomSize;
+    // One pool per memory type and kind of resource
+    std::vector<Pool> m_pools;
+    uint32_t m_dedicatedCount = 0;
+    VkDeviceSize m_dedicatedBytes = 0;
+    MemoryUsage m_categoryUsage[MEMORY_CATEGORY_COUNT];
+    std::vector<MemoryUsage> m_heapUsage;
+    std::vector<VkDeviceSize> m_heapBudgets;
+    mutable std::mutex m_mutex;
+
+    VkDeviceSize getBlockSize(uint32_t t_memoryTypeIndex) const;
+
+    bool isCoherent(uint32_t t_memoryTypeIndex) const;
+
+    /** @brief New memory, mapped if it is host visible. Fails without calling the driver if the
+     * heap would go over its budget */
+    VkResult allocateMemory(VkDeviceSize t_size, uint32_t t_memoryTypeIndex,
+        MemoryResourceKind t_kind, const void* t_next, VkDeviceMemory* t_memory, void** t_mapped);
+
+    void freeMemory(VkDeviceMemory t_memory, VkDeviceSize t_size, uint32_t t_memoryTypeIndex);
+
+    void free(MemoryAllocation& t_allocation);
+
+    /** @brief The budget of the application or the one of VK_EXT_memory_budget would be
+     * exceeded by t_size more bytes in heap t_heapIndex */
+    bool exceedsBudget(uint32_t t_heapIndex, VkDeviceSize t_size) const;
+
+    /** @brief Budget and usage of every heap reported by VK_EXT_memory_budget, false if it is not
+     * enabled */
+    bool getDriverBudget(VkPhysicalDeviceMemoryBudgetPropertiesEXT& t_budget) const;
+
+    /** @brief Error of an allocation that failed, with the usage report */
+    std::string getAllocationError(VkResult t_result, VkDeviceSize t_size,
+        uint32_t t_memoryTypeIndex, MemoryCategory t_category) const;
+
+    void writeReport(std::ostream& t_output) const;
+
+    void writeReportJson(std::ostream& t_output) const;
+
+    VkMappedMemoryRange getMappedRange(
+        const MemoryAllocation& t_allocation, VkDeviceSize t_size, VkDeviceSize t_offset) const;
+};
+
+#endif // MANUEME_MEMORY_ALLOCATOR_H
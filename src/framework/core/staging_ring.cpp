@@ -0,0 +1,134 @@
+/*
+ * Manuel Machado Copyright (C) 2021 This code is licensed under the MIT license (MIT)
+ * (http://opensource.org/licenses/MIT)
+ */
+
+#include "staging_ring.h"
+
+#include <limits>
+
+StagingRing::StagingRing() = default;
+
+StagingRing::~StagingRing() = default;
+
+void StagingRing::create(Device* t_device, VkQueue t_queue, uint32_t t_queueFamilyIndex,
+    VkDeviceSize t_size, uint32_t t_chunkCount)
+{
+    assert(t_chunkCount > 0);
+    MemoryCategoryScope category(MEMORY_CATEGORY_STAGING);
+    m_device = t_device;
+    m_queue = t_queue;
+    // Keep the chunks aligned so any copy region can start at the beginning of one
+    m_chunkSize = (t_size / t_chunkCount) & ~VkDeviceSize(255);
+
+    // Cached memory makes reading back the chunks (e.g. to write the scene cache) much cheaper
+    VkMemoryPropertyFlags memoryFlags
+        = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    VkBool32 cachedFound = false;
+    m_device->getMemoryType(std::numeric_limits<uint32_t>::max(),
+        memoryFlags | VK_MEMORY_PROPERTY_HOST_CACHED_BIT,
+        &cachedFound);
+    if (cachedFound) {
+        memoryFlags |= VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+    }
+    m_buffer.create(m_device,
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        memoryFlags,
+        m_chunkSize * t_chunkCount);
+    CHECK_RESULT(m_buffer.map());
+
+    m_commandPool = m_device->createCommandPool(t_queueFamilyIndex);
+    VkFenceCreateInfo fenceInfo {};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    m_chunks.resize(t_chunkCount);
+    for (uint32_t i = 0; i < t_chunkCount; ++i) {
+        auto& chunk = m_chunks[i];
+        chunk.offset = m_chunkSize * i;
+        chunk.data = static_cast<uint8_t*>(m_buffer.mapped) + chunk.offset;
+        chunk.commandBuffer
+            = m_device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, m_commandPool);
+        CHECK_RESULT(vkCreateFence(m_device->logicalDevice, &fenceInfo, nullptr, &chunk.fence))
+    }
+    m_next = 0;
+}
+
+void StagingRing::destroy()
+{
+    if (!m_device) {
+        return;
+    }
+    finish();
+    for (auto& chunk : m_chunks) {
+        vkDestroyFence(m_device->logicalDevice, chunk.fence, nullptr);
+    }
+    m_chunks.clear();
+    vkDestroyCommandPool(m_device->logicalDevice, m_commandPool, nullptr);
+    m_commandPool = VK_NULL_HANDLE;
+    m_buffer.unmap();
+    m_buffer.destroy();
+    m_device = nullptr;
+}
+
+VkDeviceSize StagingRing::getChunkSize() const { return m_chunkSize; }
+
+StagingRing::Chunk& StagingRing::acquire()
+{
+    auto& chunk = m_chunks[m_next];
+    m_next = (m_next + 1) % static_cast<uint32_t>(m_chunks.size());
+    if (chunk.pending) {
+        CHECK_RESULT(vkWaitForFences(m_device->logicalDevice,
+            1,
+            &chunk.fence,
+            VK_TRUE,
+            std::numeric_limits<uint64_t>::max()))
+        CHECK_RESULT(vkResetFences(m_device->logicalDevice, 1, &chunk.fence))
+        chunk.pending = false;
+    }
+    VkCommandBufferBeginInfo beginInfo {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    CHECK_RESULT(vkBeginCommandBuffer(chunk.commandBuffer, &beginInfo))
+    return chunk;
+}
+
+void StagingRing::copy(Chunk& t_chunk, VkBuffer t_dst, std::vector<VkBufferCopy> t_regions) const
+{
+    if (t_regions.empty()) {
+        return;
+    }
+    for (auto& region : t_regions) {
+        assert(region.srcOffset + region.size <= m_chunkSize);
+        region.srcOffset += t_chunk.offset;
+    }
+    vkCmdCopyBuffer(t_chunk.commandBuffer,
+        m_buffer.buffer,
+        t_dst,
+        static_cast<uint32_t>(t_regions.size()),
+        t_regions.data());
+}
+
+void StagingRing::submit(Chunk& t_chunk)
+{
+    CHECK_RESULT(vkEndCommandBuffer(t_chunk.commandBuffer))
+    VkSubmitInfo submitInfo {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &t_chunk.commandBuffer;
+    CHECK_RESULT(vkQueueSubmit(m_queue, 1, &submitInfo, t_chunk.fence))
+    t_chunk.pending = true;
+}
+
+void StagingRing::finish()
+{
+    for (auto& chunk : m_chunks) {
+        if (chunk.pending) {
+            CHECK_RESULT(vkWaitForFences(m_device->logicalDevice,
+                1,
+                &chunk.fence,
+                VK_TRUE,
+                std::numeric_limits<uint64_t>::max()))
+            CHECK_RESULT(vkResetFences(m_device->logicalDevice, 1, &chunk.fence))
+            chunk.pending = false;
+        }
+    }
+}
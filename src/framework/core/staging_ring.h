@@ -0,0 +1,74 @@
+/*
+ * Manuel Machado Copyright (C) 2021 This code is licensed under the MIT license (MIT)
+ * (http://opensource.org/licenses/MIT)
+ */
+
+#ifndef MANUEME_STAGING_RING_H
+#define MANUEME_STAGING_RING_H
+
+#include <vector>
+
+#include "buffer.h"
+#include "device.h"
+#include "vulkan/vulkan.h"
+
+/**
+ * @brief Fixed size, persistently mapped staging buffer split in chunks that are recycled in
+ * order. A chunk is filled by the host and its copies are submitted while the next chunk is being
+ * filled, so uploads of any size only need the memory of the ring.
+ */
+class StagingRing {
+public:
+    static constexpr VkDeviceSize defaultSize = 64ull * 1024 * 1024;
+    static constexpr uint32_t defaultChunkCount = 4;
+
+    struct Chunk {
+        uint8_t* data = nullptr;
+        VkDeviceSize offset = 0; // Offset of the chunk inside the ring buffer
+        VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+        VkFence fence = VK_NULL_HANDLE;
+        bool pending = false;
+    };
+
+    StagingRing();
+    ~StagingRing();
+
+    /**
+     * Create the ring buffer and the per chunk command buffers and fences
+     *
+     * @param t_queue Queue the copies are submitted to
+     * @param t_queueFamilyIndex Family of t_queue
+     */
+    void create(Device* t_device, VkQueue t_queue, uint32_t t_queueFamilyIndex,
+        VkDeviceSize t_size = defaultSize, uint32_t t_chunkCount = defaultChunkCount);
+
+    /** @brief Waits for all the pending copies and releases all Vulkan resources */
+    void destroy();
+
+    VkDeviceSize getChunkSize() const;
+
+    /** @brief Waits until the next chunk is no longer in use by the device and starts recording
+     * its command buffer */
+    Chunk& acquire();
+
+    /** @brief Records copies from t_chunk to t_dst, source offsets are relative to the chunk */
+    void copy(Chunk& t_chunk, VkBuffer t_dst, std::vector<VkBufferCopy> t_regions) const;
+
+    /** @brief Ends and submits the command buffer of t_chunk, the chunk data must not be written
+     * until it is acquired again */
+    void submit(Chunk& t_chunk);
+
+    /** @brief Blocks until every submitted chunk is done */
+    void finish();
+
+private:
+    Device* m_device = nullptr;
+    VkQueue m_queue = VK_NULL_HANDLE;
+    VkCommandPool m_commandPool = VK_NULL_HANDLE;
+    Buffer m_buffer;
+    VkDeviceSize m_chunkSize = 0;
+    std::vector<Chunk> m_chunks;
+    uint32_t m_next = 0;
+};
+
+#endif // MANUEME_STAGING_RING_H
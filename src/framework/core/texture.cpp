@@ -5,6 +5,9 @@
 
 #include "texture.h"
 
+#include <algorithm>
+#include <cstring>
+
 Texture::Texture() { }
 
 Texture::~Texture() = default;
@@ -38,10 +41,10 @@ void Texture::destroy()
 {
     vkDestroyImageView(m_device->logicalDevice, m_view, nullptr);
     vkDestroyImage(m_device->logicalDevice, m_image, nullptr);
-    if (m_sampler) {
+    if (m_sampler && m_ownsSampler) {
         vkDestroySampler(m_device->logicalDevice, m_sampler, nullptr);
     }
-    vkFreeMemory(m_device->logicalDevice, m_deviceMemory, nullptr);
+    MemoryAllocator::release(m_allocation);
 }
 
 VkImageView Texture::getImageView() { return m_view; }
@@ -74,16 +77,11 @@ void Texture::fromBuffer(void* t_buffer, VkDeviceSize t_bufferSize, VkFormat t_f
     m_width = t_texWidth;
     m_height = t_texHeight;
 
-    VkMemoryAllocateInfo memAllocInfo = {};
-    memAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    VkMemoryRequirements memReqs;
-
     // Use a separate command buffer for texture loading
     VkCommandBuffer copyCmd = t_device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
 
     // Create a host-visible staging buffer that contains the raw image data
     VkBuffer stagingBuffer;
-    VkDeviceMemory stagingMemory;
 
     VkBufferCreateInfo bufferCreateInfo = {};
     bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
@@ -95,24 +93,13 @@ void Texture::fromBuffer(void* t_buffer, VkDeviceSize t_bufferSize, VkFormat t_f
     CHECK_RESULT(
         vkCreateBuffer(t_device->logicalDevice, &bufferCreateInfo, nullptr, &stagingBuffer));
 
-    // Get memory requirements for the staging buffer (alignment, memory type
-    // bits)
-    vkGetBufferMemoryRequirements(t_device->logicalDevice, stagingBuffer, &memReqs);
-
-    memAllocInfo.allocationSize = memReqs.size;
-    // Get memory type index for a host visible buffer
-    memAllocInfo.memoryTypeIndex = t_device->getMemoryType(memReqs.memoryTypeBits,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-
-    CHECK_RESULT(vkAllocateMemory(t_device->logicalDevice, &memAllocInfo, nullptr, &stagingMemory));
-    CHECK_RESULT(vkBindBufferMemory(t_device->logicalDevice, stagingBuffer, stagingMemory, 0));
+    // Host visible memory for the staging buffer
+    MemoryAllocation stagingMemory = t_device->allocateBufferMemory(stagingBuffer,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        MEMORY_CATEGORY_STAGING);
 
     // Copy texture data into staging buffer
-    uint8_t* data;
-    CHECK_RESULT(
-        vkMapMemory(t_device->logicalDevice, stagingMemory, 0, memReqs.size, 0, (void**)&data));
-    memcpy(data, t_buffer, t_bufferSize);
-    vkUnmapMemory(t_device->logicalDevice, stagingMemory);
+    memcpy(stagingMemory.mapped, t_buffer, t_bufferSize);
 
     VkBufferImageCopy bufferCopyRegion = {};
     bufferCopyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
@@ -143,15 +130,9 @@ void Texture::fromBuffer(void* t_buffer, VkDeviceSize t_bufferSize, VkFormat t_f
     }
     CHECK_RESULT(vkCreateImage(t_device->logicalDevice, &imageCreateInfo, nullptr, &m_image));
 
-    vkGetImageMemoryRequirements(t_device->logicalDevice, m_image, &memReqs);
-
-    memAllocInfo.allocationSize = memReqs.size;
-
-    memAllocInfo.memoryTypeIndex
-        = t_device->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-    CHECK_RESULT(
-        vkAllocateMemory(t_device->logicalDevice, &memAllocInfo, nullptr, &m_deviceMemory));
-    CHECK_RESULT(vkBindImageMemory(t_device->logicalDevice, m_image, m_deviceMemory, 0));
+    m_allocation = t_device->allocateImageMemory(m_image,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        MEMORY_CATEGORY_TEXTURES);
 
     VkImageSubresourceRange subresourceRange = {};
     subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
@@ -187,7 +168,7 @@ void Texture::fromBuffer(void* t_buffer, VkDeviceSize t_bufferSize, VkFormat t_f
     t_device->flushCommandBuffer(copyCmd, t_copyQueue);
 
     // Clean up staging resources
-    vkFreeMemory(t_device->logicalDevice, stagingMemory, nullptr);
+    MemoryAllocator::release(stagingMemory);
     vkDestroyBuffer(t_device->logicalDevice, stagingBuffer, nullptr);
 
     // Create sampler
@@ -233,16 +214,11 @@ void Texture::fromBufferArray(void* t_buffer, uint32_t t_layerCount, VkDeviceSiz
     m_width = t_texWidth;
     m_height = t_texHeight;
 
-    VkMemoryAllocateInfo memAllocInfo = {};
-    memAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    VkMemoryRequirements memReqs;
-
     // Use a separate command buffer for texture loading
     VkCommandBuffer copyCmd = t_device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
 
     // Create a host-visible staging buffer that contains the raw image data
     VkBuffer stagingBuffer;
-    VkDeviceMemory stagingMemory;
 
     VkBufferCreateInfo bufferCreateInfo = {};
     bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
@@ -254,17 +230,10 @@ void Texture::fromBufferArray(void* t_buffer, uint32_t t_layerCount, VkDeviceSiz
     CHECK_RESULT(
         vkCreateBuffer(t_device->logicalDevice, &bufferCreateInfo, nullptr, &stagingBuffer));
 
-    // Get memory requirements for the staging buffer (alignment, memory type
-    // bits)
-    vkGetBufferMemoryRequirements(t_device->logicalDevice, stagingBuffer, &memReqs);
-
-    memAllocInfo.allocationSize = memReqs.size;
-    // Get memory type index for a host visible buffer
-    memAllocInfo.memoryTypeIndex = t_device->getMemoryType(memReqs.memoryTypeBits,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-
-    CHECK_RESULT(vkAllocateMemory(t_device->logicalDevice, &memAllocInfo, nullptr, &stagingMemory));
-    CHECK_RESULT(vkBindBufferMemory(t_device->logicalDevice, stagingBuffer, stagingMemory, 0));
+    // Host visible memory for the staging buffer
+    MemoryAllocation stagingMemory = t_device->allocateBufferMemory(stagingBuffer,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        MEMORY_CATEGORY_STAGING);
 
     // Create optimal tiled target image
     VkImageCreateInfo imageCreateInfo = {};
@@ -285,15 +254,9 @@ void Texture::fromBufferArray(void* t_buffer, uint32_t t_layerCount, VkDeviceSiz
     }
     CHECK_RESULT(vkCreateImage(t_device->logicalDevice, &imageCreateInfo, nullptr, &m_image));
 
-    vkGetImageMemoryRequirements(t_device->logicalDevice, m_image, &memReqs);
-
-    memAllocInfo.allocationSize = memReqs.size;
-
-    memAllocInfo.memoryTypeIndex
-        = t_device->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-    CHECK_RESULT(
-        vkAllocateMemory(t_device->logicalDevice, &memAllocInfo, nullptr, &m_deviceMemory));
-    CHECK_RESULT(vkBindImageMemory(t_device->logicalDevice, m_image, m_deviceMemory, 0));
+    m_allocation = t_device->allocateImageMemory(m_image,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        MEMORY_CATEGORY_TEXTURES);
 
     VkImageSubresourceRange subresourceRange = {};
     subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
@@ -325,11 +288,7 @@ void Texture::fromBufferArray(void* t_buffer, uint32_t t_layerCount, VkDeviceSiz
         subresourceRange);
 
     // Copy texture data into staging buffer
-    uint8_t* data;
-    CHECK_RESULT(
-        vkMapMemory(t_device->logicalDevice, stagingMemory, 0, memReqs.size, 0, (void**)&data));
-    memcpy(data, t_buffer, t_bufferSize);
-    vkUnmapMemory(t_device->logicalDevice, stagingMemory);
+    memcpy(stagingMemory.mapped, t_buffer, t_bufferSize);
 
     // Copy mip levels from staging buffer
     vkCmdCopyBufferToImage(copyCmd,
@@ -351,7 +310,7 @@ void Texture::fromBufferArray(void* t_buffer, uint32_t t_layerCount, VkDeviceSiz
     t_device->flushCommandBuffer(copyCmd, t_copyQueue);
 
     // Clean up staging resources
-    vkFreeMemory(t_device->logicalDevice, stagingMemory, nullptr);
+    MemoryAllocator::release(stagingMemory);
     vkDestroyBuffer(t_device->logicalDevice, stagingBuffer, nullptr);
 
     // Create sampler
@@ -386,9 +345,7 @@ void Texture::fromBufferArray(void* t_buffer, uint32_t t_layerCount, VkDeviceSiz
     updateDescriptor();
 }
 
-void Texture::loadFromAssimp(const aiTexture* t_texture, VkFormat t_format, Device* t_device,
-    VkQueue t_copyQueue, VkImageUsageFlags t_imageUsageFlags, VkImageLayout t_imageLayout,
-    bool t_forceLinear, VkImageTiling t_tiling)
+FIBITMAP* Texture::decodeAssimpTexture(const aiTexture* t_texture)
 {
     auto fiMemory
         = FreeImage_OpenMemory(reinterpret_cast<BYTE*>(t_texture->pcData), t_texture->mWidth);
@@ -404,6 +361,62 @@ void Texture::loadFromAssimp(const aiTexture* t_texture, VkFormat t_format, Devi
     }
     auto fibitmap = FreeImage_LoadFromMemory(format, fiMemory);
     const auto bitmap32 = FreeImage_ConvertTo32Bits(fibitmap);
+    FreeImage_Unload(fibitmap);
+    FreeImage_CloseMemory(fiMemory);
+    return bitmap32;
+}
+
+uint32_t Texture::getMipLevelCount(uint32_t t_width, uint32_t t_height)
+{
+    uint32_t levels = 1;
+    for (auto size = std::max(t_width, t_height); size > 1; size >>= 1) {
+        ++levels;
+    }
+    return levels;
+}
+
+VkDeviceSize Texture::getMipChainSize(uint32_t t_width, uint32_t t_height, uint32_t t_mipLevels)
+{
+    return texture_compression::getMipChainSize(
+        VK_FORMAT_B8G8R8A8_UNORM, t_width, t_height, t_mipLevels);
+}
+
+void Texture::generateMipChain(const void* t_pixels, uint32_t t_width, uint32_t t_height,
+    uint32_t t_mipLevels, uint8_t* t_output)
+{
+    memcpy(t_output, t_pixels, size_t(t_width) * t_height * 4);
+    const uint8_t* src = t_output;
+    uint8_t* dst = t_output + size_t(t_width) * t_height * 4;
+    uint32_t srcWidth = t_width;
+    uint32_t srcHeight = t_height;
+    for (uint32_t level = 1; level < t_mipLevels; ++level) {
+        const uint32_t dstWidth = std::max(srcWidth >> 1, 1u);
+        const uint32_t dstHeight = std::max(srcHeight >> 1, 1u);
+        for (uint32_t y = 0; y < dstHeight; ++y) {
+            // Clamp so 1 texel wide sources are filtered with themselves
+            const uint8_t* row0 = src + size_t(std::min(y * 2, srcHeight - 1)) * srcWidth * 4;
+            const uint8_t* row1 = src + size_t(std::min(y * 2 + 1, srcHeight - 1)) * srcWidth * 4;
+            for (uint32_t x = 0; x < dstWidth; ++x) {
+                const uint32_t x0 = std::min(x * 2, srcWidth - 1) * 4;
+                const uint32_t x1 = std::min(x * 2 + 1, srcWidth - 1) * 4;
+                for (uint32_t c = 0; c < 4; ++c) {
+                    const uint32_t sum = row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c];
+                    dst[(size_t(y) * dstWidth + x) * 4 + c] = static_cast<uint8_t>((sum + 2) >> 2);
+                }
+            }
+        }
+        src = dst;
+        dst += size_t(dstWidth) * dstHeight * 4;
+        srcWidth = dstWidth;
+        srcHeight = dstHeight;
+    }
+}
+
+void Texture::loadFromAssimp(const aiTexture* t_texture, VkFormat t_format, Device* t_device,
+    VkQueue t_copyQueue, VkImageUsageFlags t_imageUsageFlags, VkImageLayout t_imageLayout,
+    bool t_forceLinear, VkImageTiling t_tiling)
+{
+    const auto bitmap32 = decodeAssimpTexture(t_texture);
     loadFromFibitmap(bitmap32,
         t_format,
         t_device,
@@ -412,19 +425,36 @@ void Texture::loadFromAssimp(const aiTexture* t_texture, VkFormat t_format, Devi
         t_imageLayout,
         t_forceLinear,
         t_tiling);
-    FreeImage_Unload(fibitmap);
     FreeImage_Unload(bitmap32);
-    FreeImage_CloseMemory(fiMemory);
 }
 
 void Texture::loadFromFibitmap(FIBITMAP* t_fibitmap, VkFormat t_format, Device* t_device,
     VkQueue t_copyQueue, VkImageUsageFlags t_imageUsageFlags, VkImageLayout t_imageLayout,
     bool t_forceLinear, VkImageTiling t_tiling)
+{
+    // Bitmaps are always converted to 32 bits before reaching this point
+    assert(FreeImage_GetBPP(t_fibitmap) == 32);
+    loadFromPixels(FreeImage_GetBits(t_fibitmap),
+        FreeImage_GetWidth(t_fibitmap),
+        FreeImage_GetHeight(t_fibitmap),
+        t_format,
+        t_device,
+        t_copyQueue,
+        t_imageUsageFlags,
+        t_imageLayout,
+        t_forceLinear,
+        t_tiling);
+}
+
+void Texture::loadFromPixels(const void* t_pixels, uint32_t t_texWidth, uint32_t t_texHeight,
+    VkFormat t_format, Device* t_device, VkQueue t_copyQueue, VkImageUsageFlags t_imageUsageFlags,
+    VkImageLayout t_imageLayout, bool t_forceLinear, VkImageTiling t_tiling)
 {
     this->m_device = t_device;
-    m_width = FreeImage_GetWidth(t_fibitmap);
-    m_height = FreeImage_GetHeight(t_fibitmap);
-    const auto texChannels = FreeImage_GetBPP(t_fibitmap) / 8;
+    m_width = t_texWidth;
+    m_height = t_texHeight;
+    m_mipLevels = 1;
+    const auto texChannels = 4;
     VkDeviceSize imageSize = m_width * m_height * texChannels;
 
     // Get device properites for the requested texture format
@@ -438,17 +468,12 @@ void Texture::loadFromFibitmap(FIBITMAP* t_fibitmap, VkFormat t_format, Device*
     // limited amount of formats and features (mip maps, cubemaps, arrays, etc.)
     VkBool32 useStaging = !t_forceLinear;
 
-    VkMemoryAllocateInfo memAllocInfo = {};
-    memAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    VkMemoryRequirements memReqs;
-
     // Use a separate command buffer for texture loading
     VkCommandBuffer copyCmd = t_device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
 
     if (useStaging) {
         // Create a host-visible staging buffer that contains the raw image data
         VkBuffer stagingBuffer;
-        VkDeviceMemory stagingMemory;
 
         VkBufferCreateInfo bufferCreateInfo = {};
         bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
@@ -460,25 +485,13 @@ void Texture::loadFromFibitmap(FIBITMAP* t_fibitmap, VkFormat t_format, Device*
         CHECK_RESULT(
             vkCreateBuffer(t_device->logicalDevice, &bufferCreateInfo, nullptr, &stagingBuffer));
 
-        // Get memory requirements for the staging buffer (alignment, memory type
-        // bits)
-        vkGetBufferMemoryRequirements(t_device->logicalDevice, stagingBuffer, &memReqs);
-
-        memAllocInfo.allocationSize = memReqs.size;
-        // Get memory type index for a host visible buffer
-        memAllocInfo.memoryTypeIndex = t_device->getMemoryType(memReqs.memoryTypeBits,
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-
-        CHECK_RESULT(
-            vkAllocateMemory(t_device->logicalDevice, &memAllocInfo, nullptr, &stagingMemory));
-        CHECK_RESULT(vkBindBufferMemory(t_device->logicalDevice, stagingBuffer, stagingMemory, 0));
+        // Host visible memory for the staging buffer
+        MemoryAllocation stagingMemory = t_device->allocateBufferMemory(stagingBuffer,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            MEMORY_CATEGORY_STAGING);
 
         // Copy texture data into staging buffer
-        uint8_t* data;
-        CHECK_RESULT(
-            vkMapMemory(t_device->logicalDevice, stagingMemory, 0, memReqs.size, 0, (void**)&data));
-        memcpy(data, FreeImage_GetBits(t_fibitmap), imageSize);
-        vkUnmapMemory(t_device->logicalDevice, stagingMemory);
+        memcpy(stagingMemory.mapped, t_pixels, imageSize);
 
         std::vector<VkBufferImageCopy> bufferCopyRegions;
         // TODO support mipmaps or generate them automatically from original image
@@ -496,33 +509,7 @@ void Texture::loadFromFibitmap(FIBITMAP* t_fibitmap, VkFormat t_format, Device*
         bufferCopyRegions.push_back(region);
 
         // Create optimal tiled target image
-        VkImageCreateInfo imageCreateInfo = {};
-        imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-        imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
-        imageCreateInfo.format = t_format;
-        imageCreateInfo.mipLevels = 1;
-        imageCreateInfo.arrayLayers = 1;
-        imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
-        imageCreateInfo.tiling = t_tiling;
-        imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-        imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-        imageCreateInfo.extent = { m_width, m_height, 1 };
-        imageCreateInfo.usage = t_imageUsageFlags;
-        // Ensure that the TRANSFER_DST bit is set for staging
-        if (!(imageCreateInfo.usage & VK_IMAGE_USAGE_TRANSFER_DST_BIT)) {
-            imageCreateInfo.usage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
-        }
-        CHECK_RESULT(vkCreateImage(t_device->logicalDevice, &imageCreateInfo, nullptr, &m_image));
-
-        vkGetImageMemoryRequirements(t_device->logicalDevice, m_image, &memReqs);
-
-        memAllocInfo.allocationSize = memReqs.size;
-
-        memAllocInfo.memoryTypeIndex
-            = t_device->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-        CHECK_RESULT(
-            vkAllocateMemory(t_device->logicalDevice, &memAllocInfo, nullptr, &m_deviceMemory));
-        CHECK_RESULT(vkBindImageMemory(t_device->logicalDevice, m_image, m_deviceMemory, 0));
+        createImage(t_format, t_imageUsageFlags, t_tiling);
 
         VkImageSubresourceRange subresourceRange = {};
         subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
@@ -558,7 +545,7 @@ void Texture::loadFromFibitmap(FIBITMAP* t_fibitmap, VkFormat t_format, Device*
         t_device->flushCommandBuffer(copyCmd, t_copyQueue);
 
         // Clean up staging resources
-        vkFreeMemory(t_device->logicalDevice, stagingMemory, nullptr);
+        MemoryAllocator::release(stagingMemory);
         vkDestroyBuffer(t_device->logicalDevice, stagingBuffer, nullptr);
     } else {
         // Prefer using optimal tiling, as linear tiling
@@ -569,7 +556,6 @@ void Texture::loadFromFibitmap(FIBITMAP* t_fibitmap, VkFormat t_format, Device*
         assert(formatProperties.linearTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT);
 
         VkImage mappableImage;
-        VkDeviceMemory mappableMemory;
 
         VkImageCreateInfo imageCreateInfo = {};
         imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -588,22 +574,11 @@ void Texture::loadFromFibitmap(FIBITMAP* t_fibitmap, VkFormat t_format, Device*
         CHECK_RESULT(
             vkCreateImage(t_device->logicalDevice, &imageCreateInfo, nullptr, &mappableImage));
 
-        // Get memory requirements for this image
-        // like size and alignment
-        vkGetImageMemoryRequirements(t_device->logicalDevice, mappableImage, &memReqs);
-        // Set memory allocation size to required memory size
-        memAllocInfo.allocationSize = memReqs.size;
-
-        // Get memory type that can be mapped to host memory
-        memAllocInfo.memoryTypeIndex = t_device->getMemoryType(memReqs.memoryTypeBits,
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-
-        // Allocate host memory
-        CHECK_RESULT(
-            vkAllocateMemory(t_device->logicalDevice, &memAllocInfo, nullptr, &mappableMemory));
-
-        // Bind allocated image for use
-        CHECK_RESULT(vkBindImageMemory(t_device->logicalDevice, mappableImage, mappableMemory, 0));
+        // Allocate memory that can be mapped to host memory and bind it
+        m_allocation = t_device->allocateImageMemory(mappableImage,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            MEMORY_CATEGORY_TEXTURES,
+            VK_IMAGE_TILING_LINEAR);
 
         // Get sub resource layout
         // Mip map count, array layer, etc.
@@ -612,25 +587,17 @@ void Texture::loadFromFibitmap(FIBITMAP* t_fibitmap, VkFormat t_format, Device*
         subRes.mipLevel = 0;
 
         VkSubresourceLayout subResLayout;
-        void* data;
 
         // Get sub resources layout
         // Includes row pitch, size offsets, etc.
         vkGetImageSubresourceLayout(t_device->logicalDevice, mappableImage, &subRes, &subResLayout);
 
-        // Map image memory
-        CHECK_RESULT(
-            vkMapMemory(t_device->logicalDevice, mappableMemory, 0, memReqs.size, 0, &data));
-
-        // Copy image data into memory
-        memcpy(data, FreeImage_GetBits(t_fibitmap), memReqs.size);
-
-        vkUnmapMemory(t_device->logicalDevice, mappableMemory);
+        // Copy image data into the memory, which stays mapped
+        memcpy(m_allocation.mapped, t_pixels, imageSize);
 
         // Linear tiled images don't need to be staged
         // and can be directly used as textures
         m_image = mappableImage;
-        m_deviceMemory = mappableMemory;
         this->m_imageLayout = t_imageLayout;
 
         // Setup image memory barrier
@@ -643,7 +610,58 @@ void Texture::loadFromFibitmap(FIBITMAP* t_fibitmap, VkFormat t_format, Device*
         t_device->flushCommandBuffer(copyCmd, t_copyQueue);
     }
 
-    // Create a defaultsampler
+    createSamplerAndView(t_format);
+}
+
+void Texture::loadFromPixels(const void* t_pixels, uint32_t t_texWidth, uint32_t t_texHeight,
+    VkFormat t_format, Device* t_device, TextureUploader& t_uploader, uint32_t t_mipLevels,
+    VkSampler t_sampler, VkImageUsageFlags t_imageUsageFlags, VkImageLayout t_imageLayout)
+{
+    this->m_device = t_device;
+    m_width = t_texWidth;
+    m_height = t_texHeight;
+    m_mipLevels = t_mipLevels;
+    this->m_imageLayout = t_imageLayout;
+    createImage(t_format, t_imageUsageFlags, VK_IMAGE_TILING_OPTIMAL);
+    t_uploader.upload(m_image,
+        t_pixels,
+        texture_compression::getMipChainSize(t_format, m_width, m_height, m_mipLevels),
+        m_width,
+        m_height,
+        t_imageLayout,
+        m_mipLevels,
+        t_format);
+    createSamplerAndView(t_format, t_sampler);
+}
+
+void Texture::createImage(VkFormat t_format, VkImageUsageFlags t_imageUsageFlags,
+    VkImageTiling t_tiling)
+{
+    VkImageCreateInfo imageCreateInfo = {};
+    imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageCreateInfo.format = t_format;
+    imageCreateInfo.mipLevels = m_mipLevels;
+    imageCreateInfo.arrayLayers = 1;
+    imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageCreateInfo.tiling = t_tiling;
+    imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    imageCreateInfo.extent = { m_width, m_height, 1 };
+    imageCreateInfo.usage = t_imageUsageFlags;
+    // Ensure that the TRANSFER_DST bit is set for staging
+    if (!(imageCreateInfo.usage & VK_IMAGE_USAGE_TRANSFER_DST_BIT)) {
+        imageCreateInfo.usage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    }
+    CHECK_RESULT(vkCreateImage(m_device->logicalDevice, &imageCreateInfo, nullptr, &m_image));
+
+    m_allocation = m_device->allocateImageMemory(m_image,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        MEMORY_CATEGORY_TEXTURES);
+}
+
+VkSamplerCreateInfo Texture::getDefaultSamplerInfo(const Device* t_device, float t_maxLod)
+{
     VkSamplerCreateInfo samplerCreateInfo = {};
     samplerCreateInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
     samplerCreateInfo.magFilter = VK_FILTER_LINEAR;
@@ -655,15 +673,27 @@ void Texture::loadFromFibitmap(FIBITMAP* t_fibitmap, VkFormat t_format, Device*
     samplerCreateInfo.mipLodBias = 0.0f;
     samplerCreateInfo.compareOp = VK_COMPARE_OP_NEVER;
     samplerCreateInfo.minLod = 0.0f;
-    // Max level-of-detail should match mip level count
-    samplerCreateInfo.maxLod = 0.0f;
+    samplerCreateInfo.maxLod = t_maxLod;
     // Only enable anisotropic filtering if enabled on the devicec
     samplerCreateInfo.maxAnisotropy = t_device->enabledFeatures.samplerAnisotropy
         ? t_device->properties.limits.maxSamplerAnisotropy
         : 1.0f;
     samplerCreateInfo.anisotropyEnable = t_device->enabledFeatures.samplerAnisotropy;
     samplerCreateInfo.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
-    CHECK_RESULT(vkCreateSampler(t_device->logicalDevice, &samplerCreateInfo, nullptr, &m_sampler));
+    return samplerCreateInfo;
+}
+
+void Texture::createSamplerAndView(VkFormat t_format, VkSampler t_sampler)
+{
+    m_ownsSampler = t_sampler == VK_NULL_HANDLE;
+    m_sampler = t_sampler;
+    if (m_ownsSampler) {
+        // Create a defaultsampler, max level-of-detail should match mip level count
+        const auto samplerCreateInfo
+            = getDefaultSamplerInfo(m_device, static_cast<float>(m_mipLevels));
+        CHECK_RESULT(
+            vkCreateSampler(m_device->logicalDevice, &samplerCreateInfo, nullptr, &m_sampler));
+    }
 
     // Create image view
     // Textures are not directly accessed by the shaders and
@@ -688,9 +718,9 @@ void Texture::loadFromFibitmap(FIBITMAP* t_fibitmap, VkFormat t_format, Device*
     viewCreateInfo.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
     // Linear tiling usually won't support mip maps
     // Only set mip map count if optimal tiling is used
-    viewCreateInfo.subresourceRange.levelCount = 1;
+    viewCreateInfo.subresourceRange.levelCount = m_mipLevels;
     viewCreateInfo.image = m_image;
-    CHECK_RESULT(vkCreateImageView(t_device->logicalDevice, &viewCreateInfo, nullptr, &m_view));
+    CHECK_RESULT(vkCreateImageView(m_device->logicalDevice, &viewCreateInfo, nullptr, &m_view));
 
     // Update descriptor image info member that can be used for setting up
     // descriptor sets
@@ -722,16 +752,9 @@ void Texture::fromNothing(VkFormat t_format, uint32_t t_texWidth, uint32_t t_tex
     image.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
     CHECK_RESULT(vkCreateImage(m_device->logicalDevice, &image, nullptr, &m_image));
 
-    VkMemoryRequirements memReqs;
-    vkGetImageMemoryRequirements(m_device->logicalDevice, m_image, &memReqs);
-    VkMemoryAllocateInfo memoryAllocateInfo = {};
-    memoryAllocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    memoryAllocateInfo.allocationSize = memReqs.size;
-    memoryAllocateInfo.memoryTypeIndex
-        = m_device->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-    CHECK_RESULT(
-        vkAllocateMemory(m_device->logicalDevice, &memoryAllocateInfo, nullptr, &m_deviceMemory));
-    CHECK_RESULT(vkBindImageMemory(m_device->logicalDevice, m_image, m_deviceMemory, 0));
+    m_allocation = m_device->allocateImageMemory(m_image,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        MEMORY_CATEGORY_STORAGE_IMAGES);
 
     VkImageViewCreateInfo colorImageView = {};
     colorImageView.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
@@ -812,16 +835,9 @@ void Texture::toDepthAttachment(VkFormat t_format, uint32_t t_texWidth, uint32_t
     image.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
     CHECK_RESULT(vkCreateImage(m_device->logicalDevice, &image, nullptr, &m_image));
 
-    VkMemoryRequirements memReqs;
-    vkGetImageMemoryRequirements(m_device->logicalDevice, m_image, &memReqs);
-    VkMemoryAllocateInfo memoryAllocateInfo = {};
-    memoryAllocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    memoryAllocateInfo.allocationSize = memReqs.size;
-    memoryAllocateInfo.memoryTypeIndex
-        = m_device->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-    CHECK_RESULT(
-        vkAllocateMemory(m_device->logicalDevice, &memoryAllocateInfo, nullptr, &m_deviceMemory));
-    CHECK_RESULT(vkBindImageMemory(m_device->logicalDevice, m_image, m_deviceMemory, 0));
+    m_allocation = m_device->allocateImageMemory(m_image,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        MEMORY_CATEGORY_GBUFFER);
 
     VkImageViewCreateInfo colorImageView = {};
     colorImageView.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
@@ -894,16 +910,9 @@ void Texture::toColorAttachment(VkFormat t_format, uint32_t t_texWidth, uint32_t
     image.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
     CHECK_RESULT(vkCreateImage(m_device->logicalDevice, &image, nullptr, &m_image));
 
-    VkMemoryRequirements memReqs;
-    vkGetImageMemoryRequirements(m_device->logicalDevice, m_image, &memReqs);
-    VkMemoryAllocateInfo memoryAllocateInfo = {};
-    memoryAllocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    memoryAllocateInfo.allocationSize = memReqs.size;
-    memoryAllocateInfo.memoryTypeIndex
-        = m_device->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-    CHECK_RESULT(
-        vkAllocateMemory(m_device->logicalDevice, &memoryAllocateInfo, nullptr, &m_deviceMemory));
-    CHECK_RESULT(vkBindImageMemory(m_device->logicalDevice, m_image, m_deviceMemory, 0));
+    m_allocation = m_device->allocateImageMemory(m_image,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        MEMORY_CATEGORY_GBUFFER);
 
     VkImageViewCreateInfo colorImageView = {};
     colorImageView.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
@@ -11,6 +11,8 @@
 
 #include "../base_project.h"
 #include "device.h"
+#include "texture_compression.h"
+#include "texture_uploader.h"
 #include "vulkan/vulkan_core.h"
 
 class Texture {
@@ -26,6 +28,27 @@ public:
 
     static FIBITMAP* loadBitmap(const std::string& t_path);
 
+    /** @brief Decodes an embedded assimp texture into a 32 bits bitmap, the caller owns it */
+    static FIBITMAP* decodeAssimpTexture(const aiTexture* t_texture);
+
+    /** @brief Number of levels of a full mip chain down to 1x1 */
+    static uint32_t getMipLevelCount(uint32_t t_width, uint32_t t_height);
+
+    /** @brief Bytes taken by t_mipLevels tightly packed levels of 32 bits texels */
+    static VkDeviceSize getMipChainSize(uint32_t t_width, uint32_t t_height, uint32_t t_mipLevels);
+
+    /**
+     * Copy the 32 bits texels of t_pixels to t_output followed by t_mipLevels - 1 levels, each one
+     * a 2x2 box filter of the previous one
+     *
+     * @param t_output Must have room for getMipChainSize bytes
+     */
+    static void generateMipChain(const void* t_pixels, uint32_t t_width, uint32_t t_height,
+        uint32_t t_mipLevels, uint8_t* t_output);
+
+    /** @brief Trilinear, repeating and anisotropic if the device allows it */
+    static VkSamplerCreateInfo getDefaultSamplerInfo(const Device* t_device, float t_maxLod);
+
     VkDescriptorImageInfo descriptor;
 
     VkImageView getImageView();
@@ -47,6 +70,23 @@ public:
         VkImageLayout t_imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
         bool t_forceLinear = false, VkImageTiling t_tiling = VK_IMAGE_TILING_OPTIMAL);
 
+    /** @brief Same as loadFromFibitmap for already decoded 32 bits pixels */
+    void loadFromPixels(const void* t_pixels, uint32_t t_texWidth, uint32_t t_texHeight,
+        VkFormat t_format, Device* t_device, VkQueue t_copyQueue,
+        VkImageUsageFlags t_imageUsageFlags = VK_IMAGE_USAGE_SAMPLED_BIT,
+        VkImageLayout t_imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        bool t_forceLinear = false, VkImageTiling t_tiling = VK_IMAGE_TILING_OPTIMAL);
+
+    /** @brief Batched version of loadFromPixels, the texture can be used once t_uploader is
+     * flushed. t_pixels holds t_mipLevels tightly packed levels of t_format, either 32 bits
+     * texels (see generateMipChain) or blocks (see texture_compression). A t_sampler owned by
+     * the caller is used instead of creating one */
+    void loadFromPixels(const void* t_pixels, uint32_t t_texWidth, uint32_t t_texHeight,
+        VkFormat t_format, Device* t_device, TextureUploader& t_uploader,
+        uint32_t t_mipLevels = 1, VkSampler t_sampler = VK_NULL_HANDLE,
+        VkImageUsageFlags t_imageUsageFlags = VK_IMAGE_USAGE_SAMPLED_BIT,
+        VkImageLayout t_imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
     void fromBuffer(void* t_buffer, VkDeviceSize t_bufferSize, VkFormat t_format,
         uint32_t t_texWidth, uint32_t t_texHeight, Device* t_device, VkQueue t_copyQueue,
         VkFilter t_filter = VK_FILTER_LINEAR,
@@ -80,10 +120,20 @@ protected:
     Device* m_device;
     VkImage m_image;
     VkImageLayout m_imageLayout;
-    VkDeviceMemory m_deviceMemory;
+    MemoryAllocation m_allocation;
     VkImageView m_view;
     uint32_t m_width, m_height;
+    uint32_t m_mipLevels = 1;
     VkSampler m_sampler;
+    // False when m_sampler is shared, see ResourceRegistry
+    bool m_ownsSampler = true;
+
+    /** @brief Creates the device local 2D image of m_width x m_height with m_mipLevels levels */
+    void createImage(VkFormat t_format, VkImageUsageFlags t_imageUsageFlags, VkImageTiling t_tiling);
+
+    /** @brief Creates the view of m_image and updates the descriptor, with t_sampler or with a
+     * default sampler of its own if it is null */
+    void createSamplerAndView(VkFormat t_format, VkSampler t_sampler = VK_NULL_HANDLE);
 };
 
 #endif // MANUEME_TEXTURE_H
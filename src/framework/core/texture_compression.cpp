@@ -0,0 +1,545 @@
+/*
+ * Manuel Machado Copyright (C) 2021 This code is licensed under the MIT license (MIT)
+ * (http://opensource.org/licenses/MIT)
+ */
+
+#include "texture_compression.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <utility>
+
+#include "../tools/thread_pool.h"
+
+namespace {
+constexpr uint32_t blockTexels = 16;
+// Below this many block rows a level is encoded by the calling thread alone
+constexpr uint32_t parallelBlockRows = 16;
+
+// BC7 4 bits index interpolation weights, out of 64
+constexpr int bc7Weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+using Block = uint8_t[blockTexels][4];
+
+// Reads a 4x4 RGBA block from a BGRA level, texels past the edge repeat the last row / column
+void loadBlock(const uint8_t* t_level, uint32_t t_width, uint32_t t_height, uint32_t t_blockX,
+    uint32_t t_blockY, Block& t_block)
+{
+    for (uint32_t y = 0; y < 4; ++y) {
+        const uint32_t py = std::min(t_blockY * 4 + y, t_height - 1);
+        for (uint32_t x = 0; x < 4; ++x) {
+            const uint32_t px = std::min(t_blockX * 4 + x, t_width - 1);
+            const uint8_t* texel = t_level + (size_t(py) * t_width + px) * 4;
+            t_block[y * 4 + x][0] = texel[2];
+            t_block[y * 4 + x][1] = texel[1];
+            t_block[y * 4 + x][2] = texel[0];
+            t_block[y * 4 + x][3] = texel[3];
+        }
+    }
+}
+
+// Endpoints along the principal axis of the first t_channels channels of the texels in t_mask
+void fitEndpoints(const Block& t_block, uint32_t t_channels, float t_low[4], float t_high[4],
+    uint32_t t_mask = 0xFFFF)
+{
+    float mean[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < blockTexels; ++i) {
+        if (!(t_mask & (1 << i))) {
+            continue;
+        }
+        for (uint32_t c = 0; c < t_channels; ++c) {
+            mean[c] += t_block[i][c];
+        }
+        ++count;
+    }
+    float covariance[4][4] = {};
+    for (uint32_t c = 0; c < t_channels; ++c) {
+        mean[c] /= static_cast<float>(std::max(count, 1u));
+    }
+    for (uint32_t i = 0; i < blockTexels; ++i) {
+        if (!(t_mask & (1 << i))) {
+            continue;
+        }
+        for (uint32_t a = 0; a < t_channels; ++a) {
+            for (uint32_t b = 0; b < t_channels; ++b) {
+                covariance[a][b] += (t_block[i][a] - mean[a]) * (t_block[i][b] - mean[b]);
+            }
+        }
+    }
+
+    // Power iteration
+    float axis[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+    float length = 0.0f;
+    for (uint32_t iteration = 0; iteration < 8; ++iteration) {
+        float next[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        for (uint32_t a = 0; a < t_channels; ++a) {
+            for (uint32_t b = 0; b < t_channels; ++b) {
+                next[a] += covariance[a][b] * axis[b];
+            }
+        }
+        length = 0.0f;
+        for (uint32_t c = 0; c < t_channels; ++c) {
+            length += next[c] * next[c];
+        }
+        length = std::sqrt(length);
+        if (length == 0.0f) {
+            break;
+        }
+        for (uint32_t c = 0; c < t_channels; ++c) {
+            axis[c] = next[c] / length;
+        }
+    }
+
+    float minT = 0.0f;
+    float maxT = 0.0f;
+    if (length > 0.0f) {
+        for (uint32_t i = 0; i < blockTexels; ++i) {
+            if (!(t_mask & (1 << i))) {
+                continue;
+            }
+            float t = 0.0f;
+            for (uint32_t c = 0; c < t_channels; ++c) {
+                t += (t_block[i][c] - mean[c]) * axis[c];
+            }
+            minT = std::min(minT, t);
+            maxT = std::max(maxT, t);
+        }
+    }
+    for (uint32_t c = 0; c < 4; ++c) {
+        const float value = c < t_channels ? mean[c] : 255.0f;
+        const float direction = c < t_channels ? axis[c] : 0.0f;
+        t_low[c] = std::clamp(value + direction * minT, 0.0f, 255.0f);
+        t_high[c] = std::clamp(value + direction * maxT, 0.0f, 255.0f);
+    }
+}
+
+uint16_t toRGB565(const float t_color[4])
+{
+    const auto r = static_cast<uint16_t>(std::lround(t_color[0] * 31.0f / 255.0f));
+    const auto g = static_cast<uint16_t>(std::lround(t_color[1] * 63.0f / 255.0f));
+    const auto b = static_cast<uint16_t>(std::lround(t_color[2] * 31.0f / 255.0f));
+    return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+}
+
+void fromRGB565(uint16_t t_color, int t_output[3])
+{
+    const int r = (t_color >> 11) & 31;
+    const int g = (t_color >> 5) & 63;
+    const int b = t_color & 31;
+    t_output[0] = (r << 3) | (r >> 2);
+    t_output[1] = (g << 2) | (g >> 4);
+    t_output[2] = (b << 3) | (b >> 2);
+}
+
+void writeLittleEndian(uint8_t* t_output, uint64_t t_value, uint32_t t_bytes)
+{
+    for (uint32_t i = 0; i < t_bytes; ++i) {
+        t_output[i] = static_cast<uint8_t>(t_value >> (8 * i));
+    }
+}
+
+void encodeBC1(const Block& t_block, uint8_t* t_output)
+{
+    float low[4];
+    float high[4];
+    fitEndpoints(t_block, 3, low, high);
+    uint16_t color0 = toRGB565(high);
+    uint16_t color1 = toRGB565(low);
+    // color0 > color1 selects the 4 colors mode
+    if (color0 < color1) {
+        std::swap(color0, color1);
+    }
+    uint32_t indices = 0;
+    if (color0 != color1) {
+        int palette[4][3];
+        fromRGB565(color0, palette[0]);
+        fromRGB565(color1, palette[1]);
+        for (uint32_t c = 0; c < 3; ++c) {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+        }
+        for (uint32_t i = 0; i < blockTexels; ++i) {
+            uint32_t best = 0;
+            int bestError = std::numeric_limits<int>::max();
+            for (uint32_t p = 0; p < 4; ++p) {
+                int error = 0;
+                for (uint32_t c = 0; c < 3; ++c) {
+                    const int d = t_block[i][c] - palette[p][c];
+                    error += d * d;
+                }
+                if (error < bestError) {
+                    bestError = error;
+                    best = p;
+                }
+            }
+            indices |= best << (2 * i);
+        }
+    }
+    writeLittleEndian(t_output, color0, 2);
+    writeLittleEndian(t_output + 2, color1, 2);
+    writeLittleEndian(t_output + 4, indices, 4);
+}
+
+// Single channel block, used twice by BC5
+void encodeBC4(const Block& t_block, uint32_t t_channel, uint8_t* t_output)
+{
+    int low = 255;
+    int high = 0;
+    for (uint32_t i = 0; i < blockTexels; ++i) {
+        low = std::min<int>(low, t_block[i][t_channel]);
+        high = std::max<int>(high, t_block[i][t_channel]);
+    }
+    uint64_t bits = uint64_t(high) | (uint64_t(low) << 8);
+    // high > low selects the 8 values mode, with high == low every index 0 is already exact
+    if (high > low) {
+        int palette[8] = { high, low };
+        for (int p = 2; p < 8; ++p) {
+            palette[p] = ((8 - p) * high + (p - 1) * low) / 7;
+        }
+        for (uint32_t i = 0; i < blockTexels; ++i) {
+            uint64_t best = 0;
+            int bestError = std::numeric_limits<int>::max();
+            for (uint32_t p = 0; p < 8; ++p) {
+                const int error = std::abs(t_block[i][t_channel] - palette[p]);
+                if (error < bestError) {
+                    bestError = error;
+                    best = p;
+                }
+            }
+            bits |= best << (16 + 3 * i);
+        }
+    }
+    writeLittleEndian(t_output, bits, 8);
+}
+
+void encodeBC5(const Block& t_block, uint8_t* t_output)
+{
+    encodeBC4(t_block, 0, t_output);
+    encodeBC4(t_block, 1, t_output + 8);
+}
+
+// BC7 endpoints are 7 bits per channel plus a shared lowest bit
+void quantizeBC7Endpoint(const float t_color[4], int t_endpoint[4], int& t_pBit)
+{
+    int bestError = std::numeric_limits<int>::max();
+    for (int pBit = 0; pBit < 2; ++pBit) {
+        int error = 0;
+        int endpoint[4];
+        for (uint32_t c = 0; c < 4; ++c) {
+            const auto value = static_cast<int>(std::lround((t_color[c] - pBit) / 2.0f));
+            endpoint[c] = std::clamp(value, 0, 127);
+            const int d = ((endpoint[c] << 1) | pBit) - static_cast<int>(std::lround(t_color[c]));
+            error += d * d;
+        }
+        if (error < bestError) {
+            bestError = error;
+            t_pBit = pBit;
+            std::copy(endpoint, endpoint + 4, t_endpoint);
+        }
+    }
+}
+
+void writeBits(uint8_t* t_output, uint32_t& t_position, uint32_t t_value, uint32_t t_bits)
+{
+    for (uint32_t i = 0; i < t_bits; ++i, ++t_position) {
+        if ((t_value >> i) & 1) {
+            t_output[t_position >> 3] |= static_cast<uint8_t>(1 << (t_position & 7));
+        }
+    }
+}
+
+uint32_t getVisibleMask(const Block& t_block)
+{
+    uint32_t mask = 0;
+    for (uint32_t i = 0; i < blockTexels; ++i) {
+        mask |= t_block[i][3] != 0 ? 1u << i : 0u;
+    }
+    return mask;
+}
+
+// Squared error of a decoded texel, the color of alpha tested texels does not matter
+int getTexelError(const Block& t_block, uint32_t t_texel, const int t_color[4])
+{
+    const int d = t_block[t_texel][3] - t_color[3];
+    int error = d * d;
+    if (t_block[t_texel][3] != 0) {
+        for (uint32_t c = 0; c < 3; ++c) {
+            const int dc = t_block[t_texel][c] - t_color[c];
+            error += dc * dc;
+        }
+    }
+    return error;
+}
+
+// Mode 6: one subset, RGBA endpoints and 4 bits indices. Best for opaque or smooth alpha
+int encodeBC7Mode6(const Block& t_block, uint8_t* t_output)
+{
+    // Alpha tested texels must stay exactly 0 (the any hit shaders compare them with 0), they
+    // get the first endpoint and the rest of the block is fitted without them
+    const uint32_t visibleMask = getVisibleMask(t_block);
+    const bool hasCutout = visibleMask != 0xFFFF;
+    float low[4];
+    float high[4];
+    fitEndpoints(t_block, 4, low, high, visibleMask ? visibleMask : 0xFFFF);
+    if (low[3] > high[3]) {
+        std::swap(low, high);
+    }
+
+    int endpoints[2][4];
+    int pBits[2];
+    quantizeBC7Endpoint(low, endpoints[0], pBits[0]);
+    quantizeBC7Endpoint(high, endpoints[1], pBits[1]);
+    if (hasCutout) {
+        endpoints[0][3] = 0;
+        pBits[0] = 0;
+    }
+
+    int palette[16][4];
+    for (uint32_t p = 0; p < 16; ++p) {
+        for (uint32_t c = 0; c < 4; ++c) {
+            const int e0 = (endpoints[0][c] << 1) | pBits[0];
+            const int e1 = (endpoints[1][c] << 1) | pBits[1];
+            palette[p][c] = ((64 - bc7Weights[p]) * e0 + bc7Weights[p] * e1 + 32) >> 6;
+        }
+    }
+    uint32_t indices[blockTexels];
+    int totalError = 0;
+    for (uint32_t i = 0; i < blockTexels; ++i) {
+        uint32_t best = 0;
+        int bestError = std::numeric_limits<int>::max();
+        for (uint32_t p = 0; p < 16 && t_block[i][3] != 0; ++p) {
+            const int error = getTexelError(t_block, i, palette[p]);
+            if (error < bestError) {
+                bestError = error;
+                best = p;
+            }
+        }
+        indices[i] = best;
+        totalError += getTexelError(t_block, i, palette[best]);
+    }
+    // The most significant bit of the first index is implicit and must be 0, the weights are
+    // symmetric so swapping the endpoints and mirroring the indices gives the same colors
+    if (indices[0] & 8) {
+        std::swap(endpoints[0], endpoints[1]);
+        std::swap(pBits[0], pBits[1]);
+        for (auto& index : indices) {
+            index = 15 - index;
+        }
+    }
+
+    memset(t_output, 0, 16);
+    uint32_t position = 0;
+    writeBits(t_output, position, 1 << 6, 7);
+    for (uint32_t c = 0; c < 4; ++c) {
+        writeBits(t_output, position, endpoints[0][c], 7);
+        writeBits(t_output, position, endpoints[1][c], 7);
+    }
+    writeBits(t_output, position, pBits[0], 1);
+    writeBits(t_output, position, pBits[1], 1);
+    writeBits(t_output, position, indices[0], 3);
+    for (uint32_t i = 1; i < blockTexels; ++i) {
+        writeBits(t_output, position, indices[i], 4);
+    }
+    return totalError;
+}
+
+// Mode 5: one subset, 7 bits RGB and 8 bits alpha endpoints with separate 2 bits indices. Color
+// and alpha do not share the interpolation, which keeps alpha tested blocks sharp
+int encodeBC7Mode5(const Block& t_block, uint8_t* t_output)
+{
+    constexpr int weights[4] = { 0, 21, 43, 64 };
+    const uint32_t visibleMask = getVisibleMask(t_block);
+    float low[4];
+    float high[4];
+    fitEndpoints(t_block, 3, low, high, visibleMask ? visibleMask : 0xFFFF);
+    int colorEndpoints[2][3];
+    for (uint32_t c = 0; c < 3; ++c) {
+        colorEndpoints[0][c] = static_cast<int>(std::lround(low[c] * 127.0f / 255.0f));
+        colorEndpoints[1][c] = static_cast<int>(std::lround(high[c] * 127.0f / 255.0f));
+    }
+    int alphaEndpoints[2] = { 255, 0 };
+    for (uint32_t i = 0; i < blockTexels; ++i) {
+        alphaEndpoints[0] = std::min<int>(alphaEndpoints[0], t_block[i][3]);
+        alphaEndpoints[1] = std::max<int>(alphaEndpoints[1], t_block[i][3]);
+    }
+
+    int colorPalette[4][3];
+    int alphaPalette[4];
+    for (uint32_t p = 0; p < 4; ++p) {
+        for (uint32_t c = 0; c < 3; ++c) {
+            const int e0 = (colorEndpoints[0][c] << 1) | (colorEndpoints[0][c] >> 6);
+            const int e1 = (colorEndpoints[1][c] << 1) | (colorEndpoints[1][c] >> 6);
+            colorPalette[p][c] = ((64 - weights[p]) * e0 + weights[p] * e1 + 32) >> 6;
+        }
+        alphaPalette[p]
+            = ((64 - weights[p]) * alphaEndpoints[0] + weights[p] * alphaEndpoints[1] + 32) >> 6;
+    }
+    uint32_t colorIndices[blockTexels];
+    uint32_t alphaIndices[blockTexels];
+    int totalError = 0;
+    for (uint32_t i = 0; i < blockTexels; ++i) {
+        int bestColorError = std::numeric_limits<int>::max();
+        int bestAlphaError = std::numeric_limits<int>::max();
+        for (uint32_t p = 0; p < 4; ++p) {
+            int colorError = 0;
+            for (uint32_t c = 0; c < 3; ++c) {
+                const int d = t_block[i][c] - colorPalette[p][c];
+                colorError += d * d;
+            }
+            if (colorError < bestColorError) {
+                bestColorError = colorError;
+                colorIndices[i] = p;
+            }
+            const int alphaDifference = t_block[i][3] - alphaPalette[p];
+            const int alphaError = alphaDifference * alphaDifference;
+            if (alphaError < bestAlphaError) {
+                bestAlphaError = alphaError;
+                alphaIndices[i] = p;
+            }
+        }
+        totalError += bestAlphaError + (t_block[i][3] != 0 ? bestColorError : 0);
+    }
+    if (colorIndices[0] & 2) {
+        std::swap(colorEndpoints[0], colorEndpoints[1]);
+        for (auto& index : colorIndices) {
+            index = 3 - index;
+        }
+    }
+    if (alphaIndices[0] & 2) {
+        std::swap(alphaEndpoints[0], alphaEndpoints[1]);
+        for (auto& index : alphaIndices) {
+            index = 3 - index;
+        }
+    }
+
+    memset(t_output, 0, 16);
+    uint32_t position = 0;
+    writeBits(t_output, position, 1 << 5, 6);
+    writeBits(t_output, position, 0, 2); // No channel rotation
+    for (uint32_t c = 0; c < 3; ++c) {
+        writeBits(t_output, position, colorEndpoints[0][c], 7);
+        writeBits(t_output, position, colorEndpoints[1][c], 7);
+    }
+    writeBits(t_output, position, alphaEndpoints[0], 8);
+    writeBits(t_output, position, alphaEndpoints[1], 8);
+    writeBits(t_output, position, colorIndices[0], 1);
+    for (uint32_t i = 1; i < blockTexels; ++i) {
+        writeBits(t_output, position, colorIndices[i], 2);
+    }
+    writeBits(t_output, position, alphaIndices[0], 1);
+    for (uint32_t i = 1; i < blockTexels; ++i) {
+        writeBits(t_output, position, alphaIndices[i], 2);
+    }
+    return totalError;
+}
+
+// Keeps whichever of modes 5 and 6 fits the block better
+void encodeBC7(const Block& t_block, uint8_t* t_output)
+{
+    uint8_t mode5[16];
+    const int mode6Error = encodeBC7Mode6(t_block, t_output);
+    if (encodeBC7Mode5(t_block, mode5) < mode6Error) {
+        memcpy(t_output, mode5, sizeof(mode5));
+    }
+}
+
+uint32_t getBlockSize(VkFormat t_format)
+{
+    switch (t_format) {
+    case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+    case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+        return 8;
+    case VK_FORMAT_BC5_UNORM_BLOCK:
+    case VK_FORMAT_BC7_UNORM_BLOCK:
+        return 16;
+    default:
+        return 0;
+    }
+}
+
+void compressLevel(VkFormat t_format, const uint8_t* t_pixels, uint32_t t_width,
+    uint32_t t_height, uint8_t* t_output)
+{
+    const uint32_t blocksX = (t_width + 3) / 4;
+    const uint32_t blocksY = (t_height + 3) / 4;
+    const uint32_t blockSize = getBlockSize(t_format);
+    const auto encodeRow = [&](size_t t_row) {
+        Block block;
+        uint8_t* output = t_output + t_row * blocksX * blockSize;
+        for (uint32_t x = 0; x < blocksX; ++x, output += blockSize) {
+            loadBlock(t_pixels, t_width, t_height, x, static_cast<uint32_t>(t_row), block);
+            if (t_format == VK_FORMAT_BC7_UNORM_BLOCK) {
+                encodeBC7(block, output);
+            } else if (t_format == VK_FORMAT_BC5_UNORM_BLOCK) {
+                encodeBC5(block, output);
+            } else {
+                encodeBC1(block, output);
+            }
+        }
+    };
+    if (blocksY < parallelBlockRows) {
+        for (uint32_t y = 0; y < blocksY; ++y) {
+            encodeRow(y);
+        }
+    } else {
+        ThreadPool::shared().parallelFor(blocksY, encodeRow);
+    }
+}
+}
+
+namespace texture_compression {
+
+bool isBlockCompressed(VkFormat t_format) { return getBlockSize(t_format) != 0; }
+
+VkDeviceSize getLevelSize(VkFormat t_format, uint32_t t_width, uint32_t t_height)
+{
+    if (isBlockCompressed(t_format)) {
+        return VkDeviceSize((t_width + 3) / 4) * ((t_height + 3) / 4) * getBlockSize(t_format);
+    }
+    // Everything else uploaded by the framework is 32 bits per texel
+    return VkDeviceSize(t_width) * t_height * 4;
+}
+
+VkDeviceSize getMipChainSize(
+    VkFormat t_format, uint32_t t_width, uint32_t t_height, uint32_t t_mipLevels)
+{
+    VkDeviceSize size = 0;
+    for (uint32_t level = 0; level < t_mipLevels; ++level) {
+        size += getLevelSize(
+            t_format, std::max(t_width >> level, 1u), std::max(t_height >> level, 1u));
+    }
+    return size;
+}
+
+VkFormat selectFormat(
+    TextureType t_type, const uint8_t* t_pixels, uint32_t t_width, uint32_t t_height)
+{
+    if (t_type == TEXTURE_TYPE_NORMAL) {
+        return VK_FORMAT_BC5_UNORM_BLOCK;
+    }
+    const size_t texels = size_t(t_width) * t_height;
+    for (size_t i = 0; i < texels; ++i) {
+        if (t_pixels[i * 4 + 3] != 255) {
+            return VK_FORMAT_BC7_UNORM_BLOCK;
+        }
+    }
+    return VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+}
+
+void compressMipChain(VkFormat t_format, const uint8_t* t_pixels, uint32_t t_width,
+    uint32_t t_height, uint32_t t_mipLevels, uint8_t* t_output)
+{
+    for (uint32_t level = 0; level < t_mipLevels; ++level) {
+        const uint32_t width = std::max(t_width >> level, 1u);
+        const uint32_t height = std::max(t_height >> level, 1u);
+        compressLevel(t_format, t_pixels, width, height, t_output);
+        t_pixels += size_t(width) * height * 4;
+        t_output += getLevelSize(t_format, width, height);
+    }
+}
+
+} // namespace texture_compression
@@ -0,0 +1,47 @@
+/*
+ * Manuel Machado Copyright (C) 2021 This code is licensed under the MIT license (MIT)
+ * (http://opensource.org/licenses/MIT)
+ */
+
+#ifndef MANUEME_TEXTURE_COMPRESSION_H
+#define MANUEME_TEXTURE_COMPRESSION_H
+
+#include <cstdint>
+
+#include "vulkan/vulkan.h"
+
+/** @brief What a texture stores, decides the compressed format it is cooked to */
+enum TextureType { TEXTURE_TYPE_COLOR = 0x0, TEXTURE_TYPE_NORMAL = 0x1 };
+
+/**
+ * @brief Block compression of 8 bits BGRA mip chains. Opaque color textures are encoded to BC1,
+ * color textures with alpha to BC7 and normal maps to BC5 (X and Y only, Z is reconstructed by
+ * the shaders). Encoding is a principal axis fit per 4x4 block, meant for load time cooking.
+ */
+namespace texture_compression {
+
+bool isBlockCompressed(VkFormat t_format);
+
+/** @brief Bytes of one mip level of t_width x t_height texels */
+VkDeviceSize getLevelSize(VkFormat t_format, uint32_t t_width, uint32_t t_height);
+
+/** @brief Bytes of t_mipLevels tightly packed levels, largest first */
+VkDeviceSize getMipChainSize(
+    VkFormat t_format, uint32_t t_width, uint32_t t_height, uint32_t t_mipLevels);
+
+/** @brief Compressed format for the given texture, t_pixels is its first BGRA level */
+VkFormat selectFormat(
+    TextureType t_type, const uint8_t* t_pixels, uint32_t t_width, uint32_t t_height);
+
+/**
+ * Encode every level of a BGRA mip chain (see Texture::generateMipChain) to t_format. Large
+ * levels are split across the shared thread pool
+ *
+ * @param t_output Must have room for getMipChainSize(t_format, ...) bytes
+ */
+void compressMipChain(VkFormat t_format, const uint8_t* t_pixels, uint32_t t_width,
+    uint32_t t_height, uint32_t t_mipLevels, uint8_t* t_output);
+
+} // namespace texture_compression
+
+#endif // MANUEME_TEXTURE_COMPRESSION_H
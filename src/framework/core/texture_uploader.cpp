@@ -0,0 +1,309 @@
+/*
+ * Manuel Machado Copyright (C) 2021 This code is licensed under the MIT license (MIT)
+ * (http://opensource.org/licenses/MIT)
+ */
+
+#include "texture_uploader.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+#include "texture_compression.h"
+
+namespace {
+// Keeps every image offset valid for any texel block size
+constexpr VkDeviceSize stagingAlignment = 16;
+}
+
+TextureUploader::TextureUploader() = default;
+
+TextureUploader::~TextureUploader() = default;
+
+void TextureUploader::create(Device* t_device, VkQueue t_graphicsQueue, VkDeviceSize t_stagingSize)
+{
+    m_device = t_device;
+    m_graphicsQueue = t_graphicsQueue;
+    m_graphicsFamily = m_device->queueFamilyIndices.graphics;
+    m_transferFamily = m_device->queueFamilyIndices.transfer;
+    if (m_transferFamily != m_graphicsFamily) {
+        vkGetDeviceQueue(m_device->logicalDevice, m_transferFamily, 0, &m_transferQueue);
+    } else {
+        m_transferQueue = m_graphicsQueue;
+    }
+
+    MemoryCategoryScope category(MEMORY_CATEGORY_STAGING);
+    m_staging.create(m_device,
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        t_stagingSize);
+    CHECK_RESULT(m_staging.map());
+    m_stagingUsed = 0;
+
+    m_acquirePool = m_device->createCommandPool(m_graphicsFamily);
+    m_acquireCommandBuffer
+        = m_device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, m_acquirePool);
+
+    VkSemaphoreCreateInfo semaphoreInfo {};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    CHECK_RESULT(
+        vkCreateSemaphore(m_device->logicalDevice, &semaphoreInfo, nullptr, &m_transferDone))
+    VkFenceCreateInfo fenceInfo {};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    CHECK_RESULT(vkCreateFence(m_device->logicalDevice, &fenceInfo, nullptr, &m_fence))
+}
+
+void TextureUploader::destroy()
+{
+    if (!m_device) {
+        return;
+    }
+    flush();
+    for (auto& recorder : m_recorders) {
+        vkDestroyCommandPool(m_device->logicalDevice, recorder.second.commandPool, nullptr);
+    }
+    m_recorders.clear();
+    vkDestroyCommandPool(m_device->logicalDevice, m_acquirePool, nullptr);
+    vkDestroySemaphore(m_device->logicalDevice, m_transferDone, nullptr);
+    vkDestroyFence(m_device->logicalDevice, m_fence, nullptr);
+    m_staging.unmap();
+    m_staging.destroy();
+    m_device = nullptr;
+}
+
+TextureUploader::Recorder& TextureUploader::getRecorder()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto& recorder = m_recorders[std::this_thread::get_id()];
+    if (recorder.commandPool == VK_NULL_HANDLE) {
+        recorder.commandPool = m_device->createCommandPool(m_transferFamily);
+        recorder.commandBuffer
+            = m_device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, recorder.commandPool);
+    }
+    if (!recorder.recording) {
+        VkCommandBufferBeginInfo beginInfo {};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        CHECK_RESULT(vkBeginCommandBuffer(recorder.commandBuffer, &beginInfo))
+        recorder.recording = true;
+    }
+    return recorder;
+}
+
+void TextureUploader::upload(VkImage t_image, const void* t_pixels, VkDeviceSize t_size,
+    uint32_t t_width, uint32_t t_height, VkImageLayout t_layout, uint32_t t_mipLevels,
+    VkFormat t_format)
+{
+    const VkDeviceSize alignedSize = (t_size + stagingAlignment - 1) & ~(stagingAlignment - 1);
+    while (true) {
+        std::shared_lock<std::shared_mutex> lock(m_flushMutex);
+        VkBuffer source;
+        VkDeviceSize offset = 0;
+        if (alignedSize > m_staging.size) {
+            // Does not fit in the shared buffer, gets its own one until the next flush
+            MemoryCategoryScope category(MEMORY_CATEGORY_STAGING);
+            Buffer staging;
+            staging.create(m_device,
+                VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                t_size,
+                const_cast<void*>(t_pixels));
+            source = staging.buffer;
+            std::lock_guard<std::mutex> containersLock(m_mutex);
+            m_dedicatedStaging.push_back(staging);
+        } else {
+            offset = m_stagingUsed.fetch_add(alignedSize);
+            if (offset + alignedSize > m_staging.size) {
+                // Full, the first thread getting here submits the batch and everyone retries
+                const auto generation = m_generation;
+                lock.unlock();
+                std::unique_lock<std::shared_mutex> flushLock(m_flushMutex);
+                if (generation == m_generation) {
+                    flushLocked();
+                }
+                continue;
+            }
+            memcpy(static_cast<uint8_t*>(m_staging.mapped) + offset, t_pixels, t_size);
+            source = m_staging.buffer;
+        }
+
+        auto& recorder = getRecorder();
+        recordUpload(recorder.commandBuffer,
+            source,
+            offset,
+            t_image,
+            t_width,
+            t_height,
+            t_layout,
+            t_mipLevels,
+            t_format);
+        if (m_transferFamily != m_graphicsFamily) {
+            std::lock_guard<std::mutex> containersLock(m_mutex);
+            m_acquires.push_back({ t_image, t_layout, t_mipLevels });
+        }
+        return;
+    }
+}
+
+void TextureUploader::recordUpload(VkCommandBuffer t_commandBuffer, VkBuffer t_source,
+    VkDeviceSize t_offset, VkImage t_image, uint32_t t_width, uint32_t t_height,
+    VkImageLayout t_layout, uint32_t t_mipLevels, VkFormat t_format) const
+{
+    VkImageMemoryBarrier barrier {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.image = t_image;
+    barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, t_mipLevels, 0, 1 };
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    vkCmdPipelineBarrier(t_commandBuffer,
+        VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+        VK_PIPELINE_STAGE_TRANSFER_BIT,
+        0,
+        0,
+        nullptr,
+        0,
+        nullptr,
+        1,
+        &barrier);
+
+    // Levels are packed one after the other
+    std::vector<VkBufferImageCopy> regions(t_mipLevels);
+    VkDeviceSize levelOffset = t_offset;
+    for (uint32_t level = 0; level < t_mipLevels; ++level) {
+        const uint32_t width = std::max(t_width >> level, 1u);
+        const uint32_t height = std::max(t_height >> level, 1u);
+        auto& region = regions[level];
+        region.bufferOffset = levelOffset;
+        region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1 };
+        region.imageExtent = { width, height, 1 };
+        levelOffset += texture_compression::getLevelSize(t_format, width, height);
+    }
+    vkCmdCopyBufferToImage(t_commandBuffer,
+        t_source,
+        t_image,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        static_cast<uint32_t>(regions.size()),
+        regions.data());
+
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = t_layout;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    VkPipelineStageFlags dstStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+    if (m_transferFamily != m_graphicsFamily) {
+        // Release, the matching acquire is recorded on the graphics queue by flush
+        barrier.dstAccessMask = 0;
+        barrier.srcQueueFamilyIndex = m_transferFamily;
+        barrier.dstQueueFamilyIndex = m_graphicsFamily;
+        dstStage = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+    } else {
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    }
+    vkCmdPipelineBarrier(t_commandBuffer,
+        VK_PIPELINE_STAGE_TRANSFER_BIT,
+        dstStage,
+        0,
+        0,
+        nullptr,
+        0,
+        nullptr,
+        1,
+        &barrier);
+}
+
+void TextureUploader::flush()
+{
+    std::unique_lock<std::shared_mutex> flushLock(m_flushMutex);
+    flushLocked();
+}
+
+void TextureUploader::flushLocked()
+{
+    std::vector<VkCommandBuffer> commandBuffers;
+    for (auto& recorder : m_recorders) {
+        if (recorder.second.recording) {
+            CHECK_RESULT(vkEndCommandBuffer(recorder.second.commandBuffer))
+            commandBuffers.push_back(recorder.second.commandBuffer);
+        }
+    }
+
+    if (!commandBuffers.empty()) {
+        VkSubmitInfo submitInfo {};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.commandBufferCount = static_cast<uint32_t>(commandBuffers.size());
+        submitInfo.pCommandBuffers = commandBuffers.data();
+        if (m_transferFamily == m_graphicsFamily) {
+            CHECK_RESULT(vkQueueSubmit(m_graphicsQueue, 1, &submitInfo, m_fence))
+        } else {
+            submitInfo.signalSemaphoreCount = 1;
+            submitInfo.pSignalSemaphores = &m_transferDone;
+            CHECK_RESULT(vkQueueSubmit(m_transferQueue, 1, &submitInfo, VK_NULL_HANDLE))
+
+            // Acquire all the released images with a single barrier
+            std::vector<VkImageMemoryBarrier> barriers(m_acquires.size());
+            for (size_t i = 0; i < m_acquires.size(); ++i) {
+                auto& barrier = barriers[i];
+                barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+                barrier.image = m_acquires[i].image;
+                barrier.subresourceRange
+                    = { VK_IMAGE_ASPECT_COLOR_BIT, 0, m_acquires[i].mipLevels, 0, 1 };
+                barrier.srcQueueFamilyIndex = m_transferFamily;
+                barrier.dstQueueFamilyIndex = m_graphicsFamily;
+                barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+                barrier.newLayout = m_acquires[i].layout;
+                barrier.srcAccessMask = 0;
+                barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+            }
+            VkCommandBufferBeginInfo beginInfo {};
+            beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+            beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+            CHECK_RESULT(vkBeginCommandBuffer(m_acquireCommandBuffer, &beginInfo))
+            vkCmdPipelineBarrier(m_acquireCommandBuffer,
+                VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                0,
+                0,
+                nullptr,
+                0,
+                nullptr,
+                static_cast<uint32_t>(barriers.size()),
+                barriers.data());
+            CHECK_RESULT(vkEndCommandBuffer(m_acquireCommandBuffer))
+
+            const VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+            VkSubmitInfo acquireInfo {};
+            acquireInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+            acquireInfo.waitSemaphoreCount = 1;
+            acquireInfo.pWaitSemaphores = &m_transferDone;
+            acquireInfo.pWaitDstStageMask = &waitStage;
+            acquireInfo.commandBufferCount = 1;
+            acquireInfo.pCommandBuffers = &m_acquireCommandBuffer;
+            CHECK_RESULT(vkQueueSubmit(m_graphicsQueue, 1, &acquireInfo, m_fence))
+        }
+
+        CHECK_RESULT(vkWaitForFences(m_device->logicalDevice,
+            1,
+            &m_fence,
+            VK_TRUE,
+            std::numeric_limits<uint64_t>::max()))
+        CHECK_RESULT(vkResetFences(m_device->logicalDevice, 1, &m_fence))
+    }
+
+    for (auto& recorder : m_recorders) {
+        if (recorder.second.recording) {
+            CHECK_RESULT(vkResetCommandPool(m_device->logicalDevice, recorder.second.commandPool, 0))
+            recorder.second.recording = false;
+        }
+    }
+    CHECK_RESULT(vkResetCommandPool(m_device->logicalDevice, m_acquirePool, 0))
+    for (auto& staging : m_dedicatedStaging) {
+        staging.destroy();
+    }
+    m_dedicatedStaging.clear();
+    m_acquires.clear();
+    m_stagingUsed = 0;
+    ++m_generation;
+}
@@ -0,0 +1,108 @@
+/*
+ * Manuel Machado Copyright (C) 2021 This code is licensed under the MIT license (MIT)
+ * (http://opensource.org/licenses/MIT)
+ */
+
+#ifndef MANUEME_TEXTURE_UPLOADER_H
+#define MANUEME_TEXTURE_UPLOADER_H
+
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "buffer.h"
+#include "device.h"
+#include "staging_ring.h"
+#include "vulkan/vulkan.h"
+
+/**
+ * @brief Batches texture uploads. Pixels of many images share one persistently mapped staging
+ * buffer, every thread records its copies into its own command pool and the whole batch is
+ * submitted at once with a single fence. Copies run on the dedicated transfer queue when the
+ * device has one, the images are then released to the graphics queue family.
+ */
+class TextureUploader {
+public:
+    TextureUploader();
+    ~TextureUploader();
+
+    /**
+     * Create the staging buffer and synchronization objects
+     *
+     * @param t_graphicsQueue Queue the images are used on afterwards
+     * @param t_stagingSize Bytes of pixels that can be pending, the batch is flushed when full
+     */
+    void create(Device* t_device, VkQueue t_graphicsQueue,
+        VkDeviceSize t_stagingSize = StagingRing::defaultSize);
+
+    /** @brief Flushes the pending uploads and releases all Vulkan resources */
+    void destroy();
+
+    /**
+     * Stage the pixels of t_image and record its upload. Can be called from several threads at
+     * the same time, the image is ready once flush returns
+     *
+     * @param t_image Image created with TRANSFER_DST usage, in undefined layout
+     * @param t_pixels Tightly packed texels or blocks of every mip level, largest level first
+     * @param t_layout Layout the image is left in
+     * @param t_format Format of t_image, decides the size of every level
+     */
+    void upload(VkImage t_image, const void* t_pixels, VkDeviceSize t_size, uint32_t t_width,
+        uint32_t t_height, VkImageLayout t_layout, uint32_t t_mipLevels = 1,
+        VkFormat t_format = VK_FORMAT_B8G8R8A8_UNORM);
+
+    /** @brief Submits everything recorded since the last flush and waits for it */
+    void flush();
+
+private:
+    // Command recording state of a thread
+    struct Recorder {
+        VkCommandPool commandPool = VK_NULL_HANDLE;
+        VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+        bool recording = false;
+    };
+
+    // Image waiting to be acquired by the graphics queue family
+    struct Acquire {
+        VkImage image;
+        VkImageLayout layout;
+        uint32_t mipLevels;
+    };
+
+    Device* m_device = nullptr;
+    VkQueue m_graphicsQueue = VK_NULL_HANDLE;
+    VkQueue m_transferQueue = VK_NULL_HANDLE;
+    uint32_t m_graphicsFamily = 0;
+    uint32_t m_transferFamily = 0;
+
+    Buffer m_staging;
+    std::atomic<VkDeviceSize> m_stagingUsed { 0 };
+    uint64_t m_generation = 0;
+
+    // Uploads hold it shared, flushing holds it exclusively
+    std::shared_mutex m_flushMutex;
+    // Protects the containers below while uploads run concurrently
+    std::mutex m_mutex;
+    std::unordered_map<std::thread::id, Recorder> m_recorders;
+    std::vector<Acquire> m_acquires;
+    std::vector<Buffer> m_dedicatedStaging;
+
+    VkCommandPool m_acquirePool = VK_NULL_HANDLE;
+    VkCommandBuffer m_acquireCommandBuffer = VK_NULL_HANDLE;
+    VkSemaphore m_transferDone = VK_NULL_HANDLE;
+    VkFence m_fence = VK_NULL_HANDLE;
+
+    Recorder& getRecorder();
+
+    void recordUpload(VkCommandBuffer t_commandBuffer, VkBuffer t_source, VkDeviceSize t_offset,
+        VkImage t_image, uint32_t t_width, uint32_t t_height, VkImageLayout t_layout,
+        uint32_t t_mipLevels, VkFormat t_format) const;
+
+    // Must be called with m_flushMutex held exclusively
+    void flushLocked();
+};
+
+#endif // MANUEME_TEXTURE_UPLOADER_H
@@ -0,0 +1,673 @@
+/*
+ * Manuel Machado Copyright (C) 2021 This code is licensed under the MIT license (MIT)
+ * (http://opensource.org/licenses/MIT)
+ */
+
+#include "gltf_instancing.h"
+
+#include <algorithm>
+#include <assimp/quaternion.h>
+#include <assimp/vector3.h>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <limits>
+#include <memory>
+
+#include "../tools/mapped_file.h"
+
+namespace {
+
+const char* instancingExtension = "EXT_mesh_gpu_instancing";
+
+/** @brief Parsed JSON value, objects keep their keys in keys and their values in values */
+struct JsonValue {
+    enum Type { JSON_NULL, JSON_BOOL, JSON_NUMBER, JSON_STRING, JSON_ARRAY, JSON_OBJECT };
+    Type type = JSON_NULL;
+    double number = 0.0;
+    std::string string;
+    std::vector<std::string> keys;
+    std::vector<JsonValue> values;
+
+    const JsonValue* find(const char* t_key) const
+    {
+        if (type != JSON_OBJECT) {
+            return nullptr;
+        }
+        for (size_t i = 0; i < keys.size(); ++i) {
+            if (keys[i] == t_key) {
+                return &values[i];
+            }
+        }
+        return nullptr;
+    }
+
+    const JsonValue* at(size_t t_idx) const
+    {
+        return type == JSON_ARRAY && t_idx < values.size() ? &values[t_idx] : nullptr;
+    }
+
+    /** @brief Element of the array at the index t_idx holds, null if it is not a valid index */
+    const JsonValue* at(const JsonValue* t_idx) const
+    {
+        size_t idx;
+        return t_idx && t_idx->toSize(idx) ? at(idx) : nullptr;
+    }
+
+    /** @brief Converts a non-negative integral number, false (t_value untouched) otherwise */
+    bool toSize(size_t& t_value) const
+    {
+        if (type != JSON_NUMBER || !(number >= 0.0)
+            || number >= static_cast<double>(std::numeric_limits<size_t>::max())
+            || std::floor(number) != number) {
+            return false;
+        }
+        t_value = static_cast<size_t>(number);
+        return true;
+    }
+
+    /** @brief Non-negative integral member t_key, t_default if missing, false if malformed */
+    bool getSize(const char* t_key, size_t t_default, size_t& t_value) const
+    {
+        const auto value = find(t_key);
+        if (!value) {
+            t_value = t_default;
+            return true;
+        }
+        return value->toSize(t_value);
+    }
+
+    bool getBool(const char* t_key) const
+    {
+        const auto value = find(t_key);
+        return value && value->type == JSON_BOOL && value->number != 0.0;
+    }
+};
+
+/** @brief Recursive descent JSON parser, enough for glTF documents */
+class JsonParser {
+public:
+    JsonParser(const char* t_begin, const char* t_end)
+        : m_cursor(t_begin)
+        , m_end(t_end)
+    {
+    }
+
+    bool parse(JsonValue& t_value)
+    {
+        if (!parseValue(t_value, 0)) {
+            return false;
+        }
+        skipWhitespace();
+        return m_cursor == m_end;
+    }
+
+private:
+    static constexpr int maxDepth = 256;
+
+    const char* m_cursor;
+    const char* m_end;
+
+    void skipWhitespace()
+    {
+        while (m_cursor < m_end
+            && (*m_cursor == ' ' || *m_cursor == '\t' || *m_cursor == '\n' || *m_cursor == '\r')) {
+            ++m_cursor;
+        }
+    }
+
+    bool consume(char t_char)
+    {
+        skipWhitespace();
+        if (m_cursor < m_end && *m_cursor == t_char) {
+            ++m_cursor;
+            return true;
+        }
+        return false;
+    }
+
+    bool parseLiteral(const char* t_literal)
+    {
+        const auto length = strlen(t_literal);
+        if (static_cast<size_t>(m_end - m_cursor) < length
+            || strncmp(m_cursor, t_literal, length) != 0) {
+            return false;
+        }
+        m_cursor += length;
+        return true;
+    }
+
+    bool parseHex(uint32_t& t_codePoint)
+    {
+        if (m_end - m_cursor < 4) {
+            return false;
+        }
+        t_codePoint = 0;
+        for (int i = 0; i < 4; ++i) {
+            const char c = *m_cursor++;
+            t_codePoint <<= 4;
+            if (c >= '0' && c <= '9') {
+                t_codePoint |= c - '0';
+            } else if (c >= 'a' && c <= 'f') {
+                t_codePoint |= c - 'a' + 10;
+            } else if (c >= 'A' && c <= 'F') {
+                t_codePoint |= c - 'A' + 10;
+            } else {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static void appendUtf8(uint32_t t_codePoint, std::string& t_output)
+    {
+        if (t_codePoint < 0x80) {
+            t_output += static_cast<char>(t_codePoint);
+        } else if (t_codePoint < 0x800) {
+            t_output += static_cast<char>(0xC0 | (t_codePoint >> 6));
+            t_output += static_cast<char>(0x80 | (t_codePoint & 0x3F));
+        } else if (t_codePoint < 0x10000) {
+            t_output += static_cast<char>(0xE0 | (t_codePoint >> 12));
+            t_output += static_cast<char>(0x80 | ((t_codePoint >> 6) & 0x3F));
+            t_output += static_cast<char>(0x80 | (t_codePoint & 0x3F));
+        } else {
+            t_output += static_cast<char>(0xF0 | (t_codePoint >> 18));
+            t_output += static_cast<char>(0x80 | ((t_codePoint >> 12) & 0x3F));
+            t_output += static_cast<char>(0x80 | ((t_codePoint >> 6) & 0x3F));
+            t_output += static_cast<char>(0x80 | (t_codePoint & 0x3F));
+        }
+    }
+
+    bool parseString(std::string& t_output)
+    {
+        if (!consume('"')) {
+            return false;
+        }
+        while (m_cursor < m_end && *m_cursor != '"') {
+            const char c = *m_cursor++;
+            if (c != '\\') {
+                t_output += c;
+                continue;
+            }
+            if (m_cursor == m_end) {
+                return false;
+            }
+            const char escaped = *m_cursor++;
+            switch (escaped) {
+            case 'b':
+                t_output += '\b';
+                break;
+            case 'f':
+                t_output += '\f';
+                break;
+            case 'n':
+                t_output += '\n';
+                break;
+            case 'r':
+                t_output += '\r';
+                break;
+            case 't':
+                t_output += '\t';
+                break;
+            case 'u': {
+                uint32_t codePoint;
+                if (!parseHex(codePoint)) {
+                    return false;
+                }
+                // Characters outside the BMP are written as a surrogate pair
+                if (codePoint >= 0xD800 && codePoint < 0xDC00 && parseLiteral("\\u")) {
+                    uint32_t low;
+                    if (!parseHex(low) || low < 0xDC00 || low >= 0xE000) {
+                        return false;
+                    }
+                    codePoint = 0x10000 + ((codePoint - 0xD800) << 10) + (low - 0xDC00);
+                }
+                appendUtf8(codePoint, t_output);
+                break;
+            }
+            default:
+                t_output += escaped;
+            }
+        }
+        return m_cursor < m_end && *m_cursor++ == '"';
+    }
+
+    bool parseNumber(double& t_number)
+    {
+        // The buffer is not null terminated, copy the token before converting it
+        const char* begin = m_cursor;
+        while (m_cursor < m_end && strchr("+-0123456789.eE", *m_cursor) != nullptr) {
+            ++m_cursor;
+        }
+        const std::string token(begin, m_cursor);
+        char* tokenEnd = nullptr;
+        t_number = strtod(token.c_str(), &tokenEnd);
+        return !token.empty() && tokenEnd == token.c_str() + token.size();
+    }
+
+    bool parseValue(JsonValue& t_value, int t_depth)
+    {
+        skipWhitespace();
+        if (m_cursor == m_end || t_depth > maxDepth) {
+            return false;
+        }
+        switch (*m_cursor) {
+        case '{':
+            ++m_cursor;
+            t_value.type = JsonValue::JSON_OBJECT;
+            if (consume('}')) {
+                return true;
+            }
+            do {
+                t_value.keys.emplace_back();
+                t_value.values.emplace_back();
+                if (!parseString(t_value.keys.back()) || !consume(':')
+                    || !parseValue(t_value.values.back(), t_depth + 1)) {
+                    return false;
+                }
+            } while (consume(','));
+            return consume('}');
+        case '[':
+            ++m_cursor;
+            t_value.type = JsonValue::JSON_ARRAY;
+            if (consume(']')) {
+                return true;
+            }
+            do {
+                t_value.values.emplace_back();
+                if (!parseValue(t_value.values.back(), t_depth + 1)) {
+                    return false;
+                }
+            } while (consume(','));
+            return consume(']');
+        case '"':
+            t_value.type = JsonValue::JSON_STRING;
+            return parseString(t_value.string);
+        case 't':
+            t_value.type = JsonValue::JSON_BOOL;
+            t_value.number = 1.0;
+            return parseLiteral("true");
+        case 'f':
+            t_value.type = JsonValue::JSON_BOOL;
+            return parseLiteral("false");
+        case 'n':
+            return parseLiteral("null");
+        default:
+            t_value.type = JsonValue::JSON_NUMBER;
+            return parseNumber(t_value.number);
+        }
+    }
+};
+
+bool decodeBase64(const char* t_data, size_t t_size, std::vector<uint8_t>& t_output)
+{
+    uint32_t bits = 0;
+    int bitCount = 0;
+    for (size_t i = 0; i < t_size && t_data[i] != '='; ++i) {
+        const char c = t_data[i];
+        uint32_t value;
+        if (c >= 'A' && c <= 'Z') {
+            value = c - 'A';
+        } else if (c >= 'a' && c <= 'z') {
+            value = c - 'a' + 26;
+        } else if (c >= '0' && c <= '9') {
+            value = c - '0' + 52;
+        } else if (c == '+') {
+            value = 62;
+        } else if (c == '/') {
+            value = 63;
+        } else {
+            return false;
+        }
+        bits = (bits << 6) | value;
+        bitCount += 6;
+        if (bitCount >= 8) {
+            bitCount -= 8;
+            t_output.push_back(static_cast<uint8_t>(bits >> bitCount));
+        }
+    }
+    return true;
+}
+
+/** @brief Decodes the %XX escapes of a relative URI */
+std::string decodeUri(const std::string& t_uri)
+{
+    std::string decoded;
+    decoded.reserve(t_uri.size());
+    for (size_t i = 0; i < t_uri.size(); ++i) {
+        if (t_uri[i] == '%' && i + 2 < t_uri.size()
+            && isxdigit(static_cast<unsigned char>(t_uri[i + 1]))
+            && isxdigit(static_cast<unsigned char>(t_uri[i + 2]))) {
+            decoded.push_back(static_cast<char>(std::stoi(t_uri.substr(i + 1, 2), nullptr, 16)));
+            i += 2;
+        } else {
+            decoded.push_back(t_uri[i]);
+        }
+    }
+    return decoded;
+}
+
+/** @brief JSON of a glTF file and the buffers it references, loaded on first use */
+class GltfDocument {
+public:
+    bool open(const std::string& t_path, bool t_instancingOnly)
+    {
+        if (!m_file.open(t_path)) {
+            return false;
+        }
+        m_directory = std::filesystem::path(t_path).parent_path();
+        const auto data = m_file.data();
+        const auto size = m_file.size();
+        const char* json = reinterpret_cast<const char*>(data);
+        size_t jsonSize = size;
+
+        // Binary container: 12 bytes header, then a JSON chunk and an optional BIN chunk
+        if (size >= 20 && memcmp(data, "glTF", 4) == 0) {
+            uint32_t chunkLength;
+            uint32_t chunkType;
+            memcpy(&chunkLength, data + 12, sizeof(uint32_t));
+            memcpy(&chunkType, data + 16, sizeof(uint32_t));
+            if (chunkType != 0x4E4F534A || 20 + uint64_t(chunkLength) > size) {
+                return false;
+            }
+            json = reinterpret_cast<const char*>(data + 20);
+            jsonSize = chunkLength;
+            const size_t binHeader = 20 + ((chunkLength + 3) & ~3u);
+            if (binHeader + 8 <= size) {
+                memcpy(&chunkLength, data + binHeader, sizeof(uint32_t));
+                memcpy(&chunkType, data + binHeader + 4, sizeof(uint32_t));
+                if (chunkType == 0x004E4942 && binHeader + 8 + uint64_t(chunkLength) <= size) {
+                    m_bin = { data + binHeader + 8, chunkLength };
+                }
+            }
+        }
+
+        // Most files do not use the extension, skip parsing them
+        if (t_instancingOnly
+            && std::search(json,
+                json + jsonSize,
+                instancingExtension,
+                   instancingExtension + strlen(instancingExtension))
+                == json + jsonSize) {
+            return false;
+        }
+        return JsonParser(json, json + jsonSize).parse(m_root);
+    }
+
+    gltf_instancing::NodeInstances readNodeInstances()
+    {
+        gltf_instancing::NodeInstances nodeInstances;
+        const auto nodes = m_root.find("nodes");
+        if (!nodes || nodes->type != JsonValue::JSON_ARRAY) {
+            return nodeInstances;
+        }
+        for (size_t nodeIdx = 0; nodeIdx < nodes->values.size(); ++nodeIdx) {
+            const auto& node = nodes->values[nodeIdx];
+            const auto extensions = node.find("extensions");
+            const auto instancing = extensions ? extensions->find(instancingExtension) : nullptr;
+            const auto attributes = instancing ? instancing->find("attributes") : nullptr;
+            if (!attributes) {
+                continue;
+            }
+            std::vector<float> translations;
+            std::vector<float> rotations;
+            std::vector<float> scales;
+            size_t count = 0;
+            bool valid = readAttribute(*attributes, "TRANSLATION", 3, translations, count)
+                && readAttribute(*attributes, "ROTATION", 4, rotations, count)
+                && readAttribute(*attributes, "SCALE", 3, scales, count);
+            if (!valid || count == 0) {
+                std::cout << "\nWARNING: ignoring the " << instancingExtension << " of node "
+                          << nodeIdx << std::endl;
+                continue;
+            }
+            std::vector<aiMatrix4x4> transforms(count);
+            for (size_t i = 0; i < count; ++i) {
+                const aiVector3D translation = translations.empty()
+                    ? aiVector3D(0.0f)
+                    : aiVector3D(
+                        translations[3 * i], translations[3 * i + 1], translations[3 * i + 2]);
+                // glTF stores quaternions as x, y, z, w
+                const aiQuaternion rotation = rotations.empty() ? aiQuaternion()
+                                                                : aiQuaternion(rotations[4 * i + 3],
+                                                                    rotations[4 * i],
+                                                                    rotations[4 * i + 1],
+                                                                    rotations[4 * i + 2]);
+                const aiVector3D scale = scales.empty()
+                    ? aiVector3D(1.0f)
+                    : aiVector3D(scales[3 * i], scales[3 * i + 1], scales[3 * i + 2]);
+                transforms[i] = aiMatrix4x4(scale, rotation, translation);
+            }
+
+            // Unnamed nodes are named after their index by assimp, the format changed between
+            // versions so both are registered
+            const auto name = node.find("name");
+            if (name && name->type == JsonValue::JSON_STRING && !name->string.empty()) {
+                nodeInstances[name->string] = std::move(transforms);
+            } else {
+                nodeInstances["nodes_" + std::to_string(nodeIdx)] = transforms;
+                nodeInstances["nodes[" + std::to_string(nodeIdx) + "]"] = std::move(transforms);
+            }
+        }
+        return nodeInstances;
+    }
+
+    std::vector<std::string> readExternalFiles() const
+    {
+        std::vector<std::string> files;
+        for (const char* array : { "buffers", "images" }) {
+            const auto entries = m_root.find(array);
+            if (!entries || entries->type != JsonValue::JSON_ARRAY) {
+                continue;
+            }
+            for (const auto& entry : entries->values) {
+                const auto uri = entry.find("uri");
+                if (uri && uri->type == JsonValue::JSON_STRING
+                    && uri->string.compare(0, 5, "data:") != 0) {
+                    files.push_back(
+                        (m_directory / std::filesystem::u8path(decodeUri(uri->string))).string());
+                }
+            }
+        }
+        return files;
+    }
+
+private:
+    struct BufferRange {
+        const uint8_t* data = nullptr;
+        size_t size = 0;
+    };
+
+    MappedFile m_file;
+    std::filesystem::path m_directory;
+    JsonValue m_root;
+    BufferRange m_bin;
+
+    std::vector<BufferRange> m_buffers;
+    std::vector<std::unique_ptr<MappedFile>> m_externalBuffers;
+    std::vector<std::vector<uint8_t>> m_embeddedBuffers;
+
+    BufferRange getBuffer(size_t t_bufferIdx)
+    {
+        const auto buffers = m_root.find("buffers");
+        const auto buffer = buffers ? buffers->at(t_bufferIdx) : nullptr;
+        if (!buffer) {
+            return {};
+        }
+        if (m_buffers.size() <= t_bufferIdx) {
+            m_buffers.resize(t_bufferIdx + 1);
+        }
+        if (m_buffers[t_bufferIdx].data) {
+            return m_buffers[t_bufferIdx];
+        }
+        const auto uri = buffer->find("uri");
+        if (!uri || uri->type != JsonValue::JSON_STRING) {
+            // The BIN chunk of a .glb
+            m_buffers[t_bufferIdx] = m_bin;
+        } else if (uri->string.compare(0, 5, "data:") == 0) {
+            const auto separator = uri->string.find(";base64,");
+            if (separator == std::string::npos) {
+                return {};
+            }
+            m_embeddedBuffers.emplace_back();
+            auto& decoded = m_embeddedBuffers.back();
+            const auto payload = separator + strlen(";base64,");
+            if (!decodeBase64(
+                    uri->string.data() + payload, uri->string.size() - payload, decoded)) {
+                return {};
+            }
+            m_buffers[t_bufferIdx] = { decoded.data(), decoded.size() };
+        } else {
+            m_externalBuffers.push_back(std::make_unique<MappedFile>());
+            auto& file = *m_externalBuffers.back();
+            // Relative URIs may escape characters, e.g. spaces as %20
+            const auto path = m_directory / std::filesystem::u8path(decodeUri(uri->string));
+            if (!file.open(path.string())) {
+                return {};
+            }
+            m_buffers[t_bufferIdx] = { file.data(), file.size() };
+        }
+        return m_buffers[t_bufferIdx];
+    }
+
+    /**
+     * Reads the float components of t_attribute into t_output, normalized integers are converted.
+     * A missing attribute leaves t_output empty, t_count is checked against (or set from) the
+     * element count of the others
+     */
+    bool readAttribute(const JsonValue& t_attributes, const char* t_attribute,
+        uint32_t t_components, std::vector<float>& t_output, size_t& t_count)
+    {
+        const auto accessorIdx = t_attributes.find(t_attribute);
+        if (!accessorIdx) {
+            return true;
+        }
+        const auto accessors = m_root.find("accessors");
+        const auto accessor = accessors ? accessors->at(accessorIdx) : nullptr;
+        if (!accessor || accessor->find("sparse")) {
+            return false;
+        }
+        size_t count;
+        if (!accessor->getSize("count", 0, count) || count == 0
+            || (t_count != 0 && count != t_count)) {
+            return false;
+        }
+        t_count = count;
+        const auto type = accessor->find("type");
+        const char* expectedType = t_components == 3 ? "VEC3" : "VEC4";
+        if (!type || type->string != expectedType) {
+            return false;
+        }
+        size_t componentType;
+        if (!accessor->getSize("componentType", 0, componentType)) {
+            return false;
+        }
+        // Integers are only normalized if flagged (KHR_mesh_quantization allows both)
+        const bool normalized = accessor->getBool("normalized");
+        size_t componentSize;
+        switch (componentType) {
+        case 5126: // FLOAT
+            componentSize = 4;
+            break;
+        case 5120: // BYTE
+        case 5121: // UNSIGNED_BYTE
+            componentSize = 1;
+            break;
+        case 5122: // SHORT
+        case 5123: // UNSIGNED_SHORT
+            componentSize = 2;
+            break;
+        default:
+            return false;
+        }
+
+        const auto bufferViews = m_root.find("bufferViews");
+        const auto view = bufferViews ? bufferViews->at(accessor->find("bufferView")) : nullptr;
+        size_t bufferIdx;
+        size_t viewOffset;
+        size_t viewLength;
+        size_t accessorOffset;
+        size_t stride;
+        if (!view || !view->find("buffer") || !view->find("buffer")->toSize(bufferIdx)
+            || !view->getSize("byteOffset", 0, viewOffset)
+            || !view->getSize("byteLength", 0, viewLength)
+            || !accessor->getSize("byteOffset", 0, accessorOffset)
+            || !view->getSize("byteStride", 0, stride)) {
+            return false;
+        }
+        const auto buffer = getBuffer(bufferIdx);
+        const size_t elementSize = componentSize * t_components;
+        const size_t elementStride = stride != 0 ? stride : elementSize;
+        // Written to not overflow with the huge values of a malformed file
+        if (!buffer.data || viewOffset > buffer.size || viewLength > buffer.size - viewOffset
+            || accessorOffset > viewLength || elementSize > viewLength - accessorOffset
+            || count - 1 > (viewLength - accessorOffset - elementSize) / elementStride) {
+            return false;
+        }
+
+        t_output.resize(count * t_components);
+        const uint8_t* elements = buffer.data + viewOffset + accessorOffset;
+        for (size_t i = 0; i < count; ++i) {
+            const uint8_t* element = elements + i * elementStride;
+            for (uint32_t c = 0; c < t_components; ++c) {
+                const uint8_t* component = element + c * componentSize;
+                float value;
+                if (componentType == 5126) {
+                    memcpy(&value, component, sizeof(float));
+                } else if (componentType == 5120) {
+                    const auto byteValue = static_cast<float>(static_cast<int8_t>(*component));
+                    value = normalized ? std::max(byteValue / 127.0f, -1.0f) : byteValue;
+                } else if (componentType == 5121) {
+                    value = normalized ? *component / 255.0f : *component;
+                } else if (componentType == 5122) {
+                    int16_t shortValue;
+                    memcpy(&shortValue, component, sizeof(int16_t));
+                    value = normalized ? std::max(shortValue / 32767.0f, -1.0f) : shortValue;
+                } else {
+                    uint16_t shortValue;
+                    memcpy(&shortValue, component, sizeof(uint16_t));
+                    value = normalized ? shortValue / 65535.0f : shortValue;
+                }
+                t_output[i * t_components + c] = value;
+            }
+        }
+        return true;
+    }
+};
+
+} // namespace
+
+namespace gltf_instancing {
+
+NodeInstances read(const std::string& t_path)
+{
+    auto extension = std::filesystem::path(t_path).extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+    if (extension != ".gltf" && extension != ".glb") {
+        return {};
+    }
+    GltfDocument document;
+    if (!document.open(t_path, true)) {
+        return {};
+    }
+    return document.readNodeInstances();
+}
+
+std::vector<std::string> readExternalFiles(const std::string& t_path)
+{
+    auto extension = std::filesystem::path(t_path).extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+    if (extension != ".gltf" && extension != ".glb") {
+        return {};
+    }
+    GltfDocument document;
+    if (!document.open(t_path, false)) {
+        return {};
+    }
+    return document.readExternalFiles();
+}
+
+} // namespace gltf_instancing
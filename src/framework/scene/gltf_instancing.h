@@ -0,0 +1,39 @@
+/*
+ * Manuel Machado Copyright (C) 2021 This code is licensed under the MIT license (MIT)
+ * (http://opensource.org/licenses/MIT)
+ */
+
+#ifndef MANUEME_GLTF_INSTANCING_H
+#define MANUEME_GLTF_INSTANCING_H
+
+#include <assimp/matrix4x4.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief Reader of the glTF EXT_mesh_gpu_instancing extension, which assimp does not import. Only
+ * the JSON and the buffers the instance attributes point to are read. Also lists the files a glTF
+ * document depends on, so that caches of the imported scene can be invalidated.
+ */
+namespace gltf_instancing {
+
+// Instance transforms of each node, keyed by the name assimp gives to the node
+using NodeInstances = std::unordered_map<std::string, std::vector<aiMatrix4x4>>;
+
+/**
+ * Instance transforms (translation * rotation * scale) of every node of the .gltf or .glb file at
+ * t_path using EXT_mesh_gpu_instancing, relative to the node. Empty for other formats, for files
+ * not using the extension and for malformed files
+ */
+NodeInstances read(const std::string& t_path);
+
+/**
+ * Paths of the external buffers and images referenced by the .gltf or .glb file at t_path, data
+ * URIs are skipped. Empty for other formats and for malformed files
+ */
+std::vector<std::string> readExternalFiles(const std::string& t_path);
+
+} // namespace gltf_instancing
+
+#endif // MANUEME_GLTF_INSTANCING_H
@@ -7,12 +7,21 @@
 
 Instance::Instance() { }
 
-Instance::Instance(uint32_t t_blasIdx, uint32_t t_meshIdx)
+Instance::Instance(
+    uint32_t t_blasIdx, uint32_t t_meshIdx, const glm::mat4& t_transform, uint32_t t_firstIndex)
     : m_meshIdx(t_meshIdx)
     , m_blasIdx(t_blasIdx)
+    , m_transform(t_transform)
+    , m_firstIndex(t_firstIndex)
 {
 }
 
 uint32_t Instance::getMeshIdx() const { return m_meshIdx; }
 
 uint32_t Instance::getBlasIdx() const { return m_blasIdx; }
+
+const glm::mat4& Instance::getTransform() const { return m_transform; }
+
+void Instance::setTransform(const glm::mat4& t_transform) { m_transform = t_transform; }
+
+uint32_t Instance::getFirstIndex() const { return m_firstIndex; }
@@ -8,18 +8,28 @@
 
 #include "shader_instance.h"
 #include <cstdint>
+#include <glm/glm.hpp>
 
 class Instance {
 public:
     Instance();
-    Instance(uint32_t t_blasIdx, uint32_t t_meshIdx);
+    Instance(uint32_t t_blasIdx, uint32_t t_meshIdx,
+        const glm::mat4& t_transform = glm::mat4(1.0f), uint32_t t_firstIndex = 0);
 
     uint32_t getMeshIdx() const;
     uint32_t getBlasIdx() const;
+    /** @brief Object to world transform */
+    const glm::mat4& getTransform() const;
+    void setTransform(const glm::mat4& t_transform);
+    /** @brief First index of the mesh covered by the instance, when its triangles are split in
+     * several geometries */
+    uint32_t getFirstIndex() const;
 
 private:
     uint32_t m_blasIdx;
     uint32_t m_meshIdx;
+    glm::mat4 m_transform;
+    uint32_t m_firstIndex = 0;
 };
 
 #endif // MANUEME_INSTANCE_H
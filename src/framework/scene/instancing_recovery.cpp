@@ -0,0 +1,300 @@
+/*
+ * Manuel Machado Copyright (C) 2021 This code is licensed under the MIT license (MIT)
+ * (http://opensource.org/licenses/MIT)
+ */
+
+#include "instancing_recovery.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <glm/glm.hpp>
+#include <unordered_map>
+
+#include "../tools/thread_pool.h"
+#include "../tools/tools.h"
+
+namespace {
+
+// Largest distance between a transformed source vertex and the copy, relative to the mesh extent
+const double positionTolerance = 1e-4;
+// Smallest cosine between a transformed source normal and the normal of the copy
+const double normalTolerance = 0.999;
+// Sources with the same signature but another canonical shape tried before giving up
+const size_t maxShapeCandidates = 8;
+// Vertices sampled for the canonical shape
+const uint32_t shapeSamples = 64;
+
+struct Fingerprint {
+    // Counts, material, topology and texture coordinates, equal for every copy of a mesh
+    uint64_t signature = 0;
+    // Sampled positions in the canonical PCA frame, equal for similar copies unless the frame is
+    // ambiguous (symmetric meshes)
+    uint64_t shape = 0;
+    glm::dvec3 centroid { 0.0 };
+    // Sum of the outer products of the centered positions
+    glm::dmat3 scatter { 0.0 };
+    double extent = 0.0;
+    // No spread along the third principal axis, the transform needs the normals to be solved
+    bool planar = false;
+};
+
+glm::dvec3 toDouble(const aiVector3D& t_vector)
+{
+    return glm::dvec3(t_vector.x, t_vector.y, t_vector.z);
+}
+
+/** @brief Eigen decomposition of a symmetric matrix with Jacobi rotations, the eigenvectors are
+ * the columns of t_vectors sorted by decreasing eigenvalue */
+void eigenDecomposition(glm::dmat3 t_matrix, glm::dvec3& t_values, glm::dmat3& t_vectors)
+{
+    t_vectors = glm::dmat3(1.0);
+    for (int sweep = 0; sweep < 32; ++sweep) {
+        const double offDiagonal = t_matrix[1][0] * t_matrix[1][0] + t_matrix[2][0] * t_matrix[2][0]
+            + t_matrix[2][1] * t_matrix[2][1];
+        const double diagonal = t_matrix[0][0] * t_matrix[0][0] + t_matrix[1][1] * t_matrix[1][1]
+            + t_matrix[2][2] * t_matrix[2][2];
+        if (offDiagonal <= 1e-30 * diagonal || offDiagonal == 0.0) {
+            break;
+        }
+        for (int p = 0; p < 2; ++p) {
+            for (int q = p + 1; q < 3; ++q) {
+                const double apq = t_matrix[q][p];
+                if (apq == 0.0) {
+                    continue;
+                }
+                // Rotation in the pq plane that zeroes apq
+                const double theta = (t_matrix[q][q] - t_matrix[p][p]) / (2.0 * apq);
+                const double t = (theta >= 0.0 ? 1.0 : -1.0)
+                    / (std::abs(theta) + std::sqrt(theta * theta + 1.0));
+                const double c = 1.0 / std::sqrt(t * t + 1.0);
+                glm::dmat3 rotation(1.0);
+                rotation[p][p] = c;
+                rotation[q][q] = c;
+                rotation[q][p] = t * c;
+                rotation[p][q] = -t * c;
+                t_matrix = glm::transpose(rotation) * t_matrix * rotation;
+                t_vectors = t_vectors * rotation;
+            }
+        }
+    }
+    int order[3] = { 0, 1, 2 };
+    std::sort(order, order + 3, [&](int a, int b) { return t_matrix[a][a] > t_matrix[b][b]; });
+    const glm::dmat3 vectors = t_vectors;
+    for (int i = 0; i < 3; ++i) {
+        t_values[i] = t_matrix[order[i]][order[i]];
+        t_vectors[i] = vectors[order[i]];
+    }
+}
+
+Fingerprint fingerprint(const aiMesh* t_mesh)
+{
+    Fingerprint result;
+    const uint32_t n = t_mesh->mNumVertices;
+    const uint32_t description[] = { n,
+        t_mesh->mNumFaces,
+        t_mesh->mMaterialIndex,
+        t_mesh->HasNormals() ? 1u : 0u,
+        t_mesh->HasTangentsAndBitangents() ? 1u : 0u,
+        t_mesh->HasTextureCoords(0) ? 1u : 0u };
+    std::vector<uint32_t> topology;
+    topology.reserve(size_t(t_mesh->mNumFaces) * 4);
+    for (unsigned int i = 0; i < t_mesh->mNumFaces; ++i) {
+        const aiFace& face = t_mesh->mFaces[i];
+        topology.push_back(face.mNumIndices);
+        topology.insert(topology.end(), face.mIndices, face.mIndices + face.mNumIndices);
+    }
+    result.signature = tools::hashBytes(description, sizeof(description));
+    result.signature
+        = tools::hashBytes(topology.data(), topology.size() * sizeof(uint32_t), result.signature);
+    if (t_mesh->HasTextureCoords(0)) {
+        result.signature = tools::hashBytes(t_mesh->mTextureCoords[0],
+            size_t(n) * sizeof(aiVector3D),
+            result.signature);
+    }
+
+    glm::dvec3 minimum(DBL_MAX);
+    glm::dvec3 maximum(-DBL_MAX);
+    for (uint32_t i = 0; i < n; ++i) {
+        const auto position = toDouble(t_mesh->mVertices[i]);
+        result.centroid += position;
+        minimum = glm::min(minimum, position);
+        maximum = glm::max(maximum, position);
+    }
+    result.centroid /= double(n);
+    result.extent = glm::length(maximum - minimum);
+    for (uint32_t i = 0; i < n; ++i) {
+        const auto offset = toDouble(t_mesh->mVertices[i]) - result.centroid;
+        result.scatter += glm::outerProduct(offset, offset);
+    }
+
+    // Canonical frame: principal axes, scaled by the largest spread and oriented so that the
+    // third moment along each of them is positive. It removes rotation, translation and uniform
+    // scale
+    glm::dvec3 spread;
+    glm::dmat3 axes;
+    eigenDecomposition(result.scatter, spread, axes);
+    result.planar = spread.z <= 1e-12 * spread.x;
+    const double unit = std::sqrt(std::max(spread.x / n, DBL_MIN));
+    const glm::dmat3 toCanonical = glm::transpose(axes) / unit;
+    glm::dvec3 skew(0.0);
+    for (uint32_t i = 0; i < n; ++i) {
+        const auto canonical = toCanonical * (toDouble(t_mesh->mVertices[i]) - result.centroid);
+        skew += canonical * canonical * canonical;
+    }
+    const glm::dvec3 orientation = glm::sign(skew) + glm::dvec3(glm::equal(skew, glm::dvec3(0.0)));
+    std::vector<int32_t> quantized;
+    const uint32_t step = std::max(1u, n / shapeSamples);
+    for (uint32_t i = 0; i < n; i += step) {
+        const auto canonical
+            = orientation * (toCanonical * (toDouble(t_mesh->mVertices[i]) - result.centroid));
+        for (int axis = 0; axis < 3; ++axis) {
+            quantized.push_back(static_cast<int32_t>(std::lround(canonical[axis] * 16.0)));
+        }
+    }
+    result.shape = tools::hashBytes(quantized.data(), quantized.size() * sizeof(int32_t));
+    return result;
+}
+
+/** @brief Affine transform mapping t_source onto t_copy, solved by least squares with the vertex
+ * order as correspondences. False if the copy does not match within the tolerances */
+bool solveTransform(const aiMesh* t_source, const Fingerprint& t_sourceFingerprint,
+    const aiMesh* t_copy, const Fingerprint& t_copyFingerprint, aiMatrix4x4& t_transform)
+{
+    const uint32_t n = t_source->mNumVertices;
+    glm::dmat3 scatter = t_sourceFingerprint.scatter;
+    glm::dmat3 crossScatter(0.0);
+    for (uint32_t i = 0; i < n; ++i) {
+        crossScatter += glm::outerProduct(
+            toDouble(t_copy->mVertices[i]) - t_copyFingerprint.centroid,
+            toDouble(t_source->mVertices[i]) - t_sourceFingerprint.centroid);
+    }
+    if (t_sourceFingerprint.planar) {
+        // Positions leave the out of plane direction free, fix it with points offset along the
+        // normals (symmetric offsets keep the centroids)
+        if (!t_source->HasNormals()) {
+            return false;
+        }
+        const double weight = t_sourceFingerprint.extent * t_sourceFingerprint.extent;
+        for (uint32_t i = 0; i < n; ++i) {
+            const auto sourceNormal = toDouble(t_source->mNormals[i]);
+            scatter += weight * glm::outerProduct(sourceNormal, sourceNormal);
+            crossScatter
+                += weight * glm::outerProduct(toDouble(t_copy->mNormals[i]), sourceNormal);
+        }
+    }
+    if (std::abs(glm::determinant(scatter)) < DBL_MIN) {
+        return false;
+    }
+    const glm::dmat3 linear = crossScatter * glm::inverse(scatter);
+    // Mirrored copies would flip the winding of the triangles
+    if (!(glm::determinant(linear) > 0.0)) {
+        return false;
+    }
+    const glm::dvec3 translation
+        = t_copyFingerprint.centroid - linear * t_sourceFingerprint.centroid;
+
+    const double tolerance = positionTolerance * std::max(t_copyFingerprint.extent, DBL_MIN);
+    for (uint32_t i = 0; i < n; ++i) {
+        const auto position = linear * toDouble(t_source->mVertices[i]) + translation;
+        if (glm::length(position - toDouble(t_copy->mVertices[i])) > tolerance) {
+            return false;
+        }
+    }
+    if (t_source->HasNormals()) {
+        const glm::dmat3 normalTransform = glm::transpose(glm::inverse(linear));
+        for (uint32_t i = 0; i < n; ++i) {
+            const auto normal = normalTransform * toDouble(t_source->mNormals[i]);
+            const auto copyNormal = toDouble(t_copy->mNormals[i]);
+            const double lengths = glm::length(normal) * glm::length(copyNormal);
+            if (lengths > 0.0 && glm::dot(normal, copyNormal) < normalTolerance * lengths) {
+                return false;
+            }
+        }
+    }
+
+    t_transform = aiMatrix4x4(static_cast<ai_real>(linear[0][0]),
+        static_cast<ai_real>(linear[1][0]),
+        static_cast<ai_real>(linear[2][0]),
+        static_cast<ai_real>(translation.x),
+        static_cast<ai_real>(linear[0][1]),
+        static_cast<ai_real>(linear[1][1]),
+        static_cast<ai_real>(linear[2][1]),
+        static_cast<ai_real>(translation.y),
+        static_cast<ai_real>(linear[0][2]),
+        static_cast<ai_real>(linear[1][2]),
+        static_cast<ai_real>(linear[2][2]),
+        static_cast<ai_real>(translation.z),
+        0,
+        0,
+        0,
+        1);
+    return true;
+}
+}
+
+namespace instancing_recovery {
+
+Result find(const aiScene* t_scene)
+{
+    const unsigned int meshCount = t_scene->mNumMeshes;
+    Result result;
+    result.source.assign(meshCount, -1);
+    result.transforms.assign(meshCount, aiMatrix4x4());
+
+    std::vector<Fingerprint> fingerprints(meshCount);
+    ThreadPool::shared().parallelFor(meshCount, [&](size_t t_meshIdx) {
+        const aiMesh* mesh = t_scene->mMeshes[t_meshIdx];
+        if (mesh->mNumVertices > 0 && mesh->mNumFaces > 0) {
+            fingerprints[t_meshIdx] = fingerprint(mesh);
+        }
+    });
+
+    // Meshes keeping their geometry, by signature
+    std::unordered_map<uint64_t, std::vector<unsigned int>> sources;
+    std::vector<unsigned int> candidates;
+    for (unsigned int i = 0; i < meshCount; ++i) {
+        const aiMesh* mesh = t_scene->mMeshes[i];
+        if (mesh->mNumVertices == 0 || mesh->mNumFaces == 0) {
+            continue;
+        }
+        const auto& copyFingerprint = fingerprints[i];
+        auto& signatureSources = sources[copyFingerprint.signature];
+
+        // Sources with the same canonical shape first, then a few others for the copies that are
+        // not similar (non uniform scale or shear) or whose canonical frame is ambiguous
+        candidates.clear();
+        size_t otherShapes = 0;
+        for (const auto source : signatureSources) {
+            if (fingerprints[source].shape == copyFingerprint.shape) {
+                candidates.push_back(source);
+            }
+        }
+        for (const auto source : signatureSources) {
+            if (fingerprints[source].shape != copyFingerprint.shape
+                && otherShapes++ < maxShapeCandidates) {
+                candidates.push_back(source);
+            }
+        }
+
+        bool isCopy = false;
+        for (const auto source : candidates) {
+            if (solveTransform(t_scene->mMeshes[source],
+                    fingerprints[source],
+                    mesh,
+                    copyFingerprint,
+                    result.transforms[i])) {
+                result.source[i] = static_cast<int>(source);
+                ++result.copies;
+                isCopy = true;
+                break;
+            }
+        }
+        if (!isCopy) {
+            signatureSources.push_back(i);
+        }
+    }
+    return result;
+}
+
+} // namespace instancing_recovery
@@ -0,0 +1,38 @@
+/*
+ * Manuel Machado Copyright (C) 2021 This code is licensed under the MIT license (MIT)
+ * (http://opensource.org/licenses/MIT)
+ */
+
+#ifndef MANUEME_INSTANCING_RECOVERY_H
+#define MANUEME_INSTANCING_RECOVERY_H
+
+#include <assimp/scene.h>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief Recovers the instancing lost by the formats and exporters that store every copy of an
+ * object as a mesh of its own. Meshes are fingerprinted by a transform invariant signature and the
+ * affine transform between meshes with the same signature is solved, so that a single copy of the
+ * geometry is kept and the others become instances of it.
+ */
+namespace instancing_recovery {
+
+struct Result {
+    // Mesh whose geometry each mesh is a copy of, -1 for the meshes keeping their own geometry
+    std::vector<int> source;
+    // Transform from the source mesh to each copy, identity for the meshes keeping their geometry
+    std::vector<aiMatrix4x4> transforms;
+    uint32_t copies = 0;
+};
+
+/**
+ * Finds the meshes of t_scene that are an affine copy of an earlier mesh with the same material.
+ * Copies keep the vertex order, the topology and the texture coordinates of their source, as
+ * exporters do when flattening instances, only positions, normals and tangents may differ
+ */
+Result find(const aiScene* t_scene);
+
+} // namespace instancing_recovery
+
+#endif // MANUEME_INSTANCING_RECOVERY_H
@@ -23,9 +23,9 @@ Light::Light(const aiLight& t_aiLight)
     m_shaderLight.lightType = static_cast<glm::int32>(t_aiLight.mType);
 }
 
-Light::Light(unsigned int t_instanceId, unsigned int t_materialIdx, unsigned int t_primitiveCount)
+Light::Light(unsigned int t_meshIdx, unsigned int t_materialIdx, unsigned int t_primitiveCount)
 {
-    m_shaderLight.areaInstanceId = t_instanceId;
+    m_shaderLight.areaInstanceId = t_meshIdx;
     m_shaderLight.areaMaterialIdx = t_materialIdx;
     m_shaderLight.areaPrimitiveCount = t_primitiveCount;
     m_shaderLight.direction = glm::vec3(0, 0, 0);
@@ -33,4 +33,9 @@ Light::Light(unsigned int t_instanceId, unsigned int t_materialIdx, unsigned int
     m_shaderLight.lightType = static_cast<glm::int32>(aiLightSource_AREA);
 }
 
-ShaderLight Light::getShaderLight() { return m_shaderLight; }
+Light::Light(const ShaderLight& t_shaderLight)
+    : m_shaderLight(t_shaderLight)
+{
+}
+
+ShaderLight Light::getShaderLight() const { return m_shaderLight; }
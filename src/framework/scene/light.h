@@ -16,8 +16,11 @@
 class Light {
 public:
     Light(const aiLight& t_aiLight);
-    Light(unsigned int t_instanceId, unsigned int t_materialIdx, unsigned int t_primitiveCount);
-    ShaderLight getShaderLight();
+    /** @brief Area light of an emissive mesh, areaInstanceId holds t_meshIdx until
+     * Scene::getLightsShaderData expands it to one light per instance of the mesh */
+    Light(unsigned int t_meshIdx, unsigned int t_materialIdx, unsigned int t_primitiveCount);
+    explicit Light(const ShaderLight& t_shaderLight);
+    ShaderLight getShaderLight() const;
 
 private:
     ShaderLight m_shaderLight;
@@ -3,7 +3,6 @@
  * (http://opensource.org/licenses/MIT)
  */
 
-#include "../core/texture.h"
 #include "scene.h"
 #include <assimp/pbrmaterial.h>
 
@@ -14,8 +13,7 @@ Material::Material(const ShaderMaterial& t_material)
 {
 }
 
-Material::Material(Device* t_device, VkQueue t_copyQueue, Scene* t_parent, const aiScene* t_scene,
-    aiMaterial* t_aiMaterial)
+Material::Material(Scene* t_parent, const aiScene* t_scene, aiMaterial* t_aiMaterial)
 {
     ShaderMaterial material;
 
@@ -74,33 +72,21 @@ Material::Material(Device* t_device, VkQueue t_copyQueue, Scene* t_parent, const
         aiString textureFile;
         t_aiMaterial->GetTexture(aiTextureType_DIFFUSE, 0, &textureFile);
         if (auto texture = t_scene->GetEmbeddedTexture(textureFile.C_Str())) {
-            VkFormat format = VK_FORMAT_B8G8R8A8_UNORM;
-            Texture texture2D;
-            texture2D.loadFromAssimp(texture, format, t_device, t_copyQueue);
-            material.diffuseMapIndex = static_cast<int>(t_parent->textures.size());
-            t_parent->textures.push_back(texture2D);
+            material.diffuseMapIndex = t_parent->addEmbeddedTexture(texture, TEXTURE_TYPE_COLOR);
         }
     }
     if (t_aiMaterial->GetTextureCount(aiTextureType_NORMALS) > 0) {
         aiString textureFile;
         t_aiMaterial->GetTexture(aiTextureType_NORMALS, 0, &textureFile);
         if (auto texture = t_scene->GetEmbeddedTexture(textureFile.C_Str())) {
-            VkFormat format = VK_FORMAT_B8G8R8A8_UNORM;
-            Texture texture2D;
-            texture2D.loadFromAssimp(texture, format, t_device, t_copyQueue);
-            material.normalMapIndex = static_cast<int>(t_parent->textures.size());
-            t_parent->textures.push_back(texture2D);
+            material.normalMapIndex = t_parent->addEmbeddedTexture(texture, TEXTURE_TYPE_NORMAL);
         }
     }
     if (t_aiMaterial->GetTextureCount(aiTextureType_EMISSIVE) > 0) {
         aiString textureFile;
         t_aiMaterial->GetTexture(aiTextureType_EMISSIVE, 0, &textureFile);
         if (auto texture = t_scene->GetEmbeddedTexture(textureFile.C_Str())) {
-            VkFormat format = VK_FORMAT_B8G8R8A8_UNORM;
-            Texture texture2D;
-            texture2D.loadFromAssimp(texture, format, t_device, t_copyQueue);
-            material.emissiveMapIndex = static_cast<int>(t_parent->textures.size());
-            t_parent->textures.push_back(texture2D);
+            material.emissiveMapIndex = t_parent->addEmbeddedTexture(texture, TEXTURE_TYPE_COLOR);
         }
     }
     this->m_shaderMaterial = material;
@@ -113,3 +99,14 @@ bool Material::isEmissive()
     const auto emissive = this->m_shaderMaterial.emissive;
     return (emissive.r + emissive.g + emissive.b) > 0;
 }
+
+void Material::remapTextures(int t_first, const std::vector<int>& t_remap)
+{
+    for (auto index : { &m_shaderMaterial.diffuseMapIndex,
+             &m_shaderMaterial.normalMapIndex,
+             &m_shaderMaterial.emissiveMapIndex }) {
+        if (*index >= t_first) {
+            *index = t_remap[*index - t_first];
+        }
+    }
+}
@@ -6,6 +6,8 @@
 #ifndef MANUEME_MATERIAL_H
 #define MANUEME_MATERIAL_H
 
+#include <vector>
+
 #include "../core/device.h"
 #include "shader_material.h"
 
@@ -17,11 +19,14 @@ class Material {
 public:
     Material();
     explicit Material(const ShaderMaterial& t_material);
-    Material(Device* t_device, VkQueue t_copyQueue, Scene* t_parent, const aiScene* t_scene,
-        aiMaterial* t_aiMaterial);
+    /** @brief Embedded textures are only queued in t_parent, see Scene::addEmbeddedTexture */
+    Material(Scene* t_parent, const aiScene* t_scene, aiMaterial* t_aiMaterial);
     ShaderMaterial getShaderMaterial();
     bool isEmissive();
 
+    /** @brief Replaces every texture index from t_first on by t_remap[index - t_first] */
+    void remapTextures(int t_first, const std::vector<int>& t_remap);
+
 private:
     ShaderMaterial m_shaderMaterial;
 };
@@ -7,9 +7,11 @@
 
 Mesh::Mesh() = default;
 
-Mesh::Mesh(uint32_t t_idx, uint32_t t_indexOffset, uint32_t t_indexBase, uint32_t t_indexCount,
-    uint32_t t_vertexOffset, uint32_t t_vertexBase, uint32_t t_vertexCount, uint32_t t_materialIdx)
+Mesh::Mesh(uint32_t t_idx, uint32_t t_chunk, uint64_t t_indexOffset, uint32_t t_indexBase,
+    uint32_t t_indexCount, uint64_t t_vertexOffset, uint32_t t_vertexBase, uint32_t t_vertexCount,
+    uint32_t t_materialIdx)
     : m_idx(t_idx)
+    , m_chunk(t_chunk)
     , m_indexOffset(t_indexOffset)
     , m_indexBase(t_indexBase)
     , m_indexCount(t_indexCount)
@@ -22,11 +24,13 @@ Mesh::Mesh(uint32_t t_idx, uint32_t t_indexOffset, uint32_t t_indexBase, uint32_
 
 uint32_t Mesh::getIdx() const { return m_idx; }
 
+uint32_t Mesh::getChunk() const { return m_chunk; }
+
 uint32_t Mesh::getIndexBase() const { return m_indexBase; }
 
 uint32_t Mesh::getIndexCount() const { return m_indexCount; }
 
-uint32_t Mesh::getVertexOffset() const { return m_vertexOffset; }
+uint64_t Mesh::getVertexOffset() const { return m_vertexOffset; }
 
 uint32_t Mesh::getVertexBase() const { return m_vertexBase; }
 
@@ -34,4 +38,18 @@ uint32_t Mesh::getVertexCount() const { return m_vertexCount; }
 
 uint32_t Mesh::getMaterialIdx() const { return m_materialIdx; }
 
-uint32_t Mesh::getIndexOffset() const { return m_indexOffset; }
+uint64_t Mesh::getIndexOffset() const { return m_indexOffset; }
+
+void Mesh::setBounds(const glm::vec3& t_min, const glm::vec3& t_max)
+{
+    m_boundsMin = t_min;
+    m_boundsMax = t_max;
+}
+
+const glm::vec3& Mesh::getBoundsMin() const { return m_boundsMin; }
+
+const glm::vec3& Mesh::getBoundsMax() const { return m_boundsMax; }
+
+void Mesh::setOpaqueIndexCount(uint32_t t_count) { m_opaqueIndexCount = t_count; }
+
+uint32_t Mesh::getOpaqueIndexCount() const { return m_opaqueIndexCount; }
@@ -7,32 +7,51 @@
 #define MANUEME_MESH_H
 
 #include <cstdint>
+#include <glm/glm.hpp>
 
+/** @brief Range of the scene geometry holding a mesh. Offsets (in bytes) and bases (in
+ * elements) are relative to the vertex and index buffers of the geometry chunk of the mesh */
 class Mesh {
 public:
     Mesh();
-    Mesh(uint32_t t_idx, uint32_t t_indexOffset, uint32_t t_indexBase,
-        uint32_t t_indexCount, uint32_t t_vertexOffset, uint32_t t_vertexBase,
+    Mesh(uint32_t t_idx, uint32_t t_chunk, uint64_t t_indexOffset, uint32_t t_indexBase,
+        uint32_t t_indexCount, uint64_t t_vertexOffset, uint32_t t_vertexBase,
         uint32_t t_vertexCount, uint32_t t_materialIdx);
 
     uint32_t getIdx() const;
+    /** @brief Index of the entry of Scene::geometryChunks holding the mesh */
+    uint32_t getChunk() const;
     uint32_t getIndexBase() const;
     uint32_t getIndexCount() const;
-    uint32_t getVertexOffset() const;
+    uint64_t getVertexOffset() const;
     uint32_t getVertexBase() const;
     uint32_t getVertexCount() const;
     uint32_t getMaterialIdx() const;
-    uint32_t getIndexOffset() const;
+    uint64_t getIndexOffset() const;
+
+    /** @brief Bounds of the vertices in the vertex buffer, before any instance transform */
+    void setBounds(const glm::vec3& t_min, const glm::vec3& t_max);
+    const glm::vec3& getBoundsMin() const;
+    const glm::vec3& getBoundsMax() const;
+
+    /** @brief Leading indices whose triangles the any-hit shaders always accept, see
+     * opacity_classifier */
+    void setOpaqueIndexCount(uint32_t t_count);
+    uint32_t getOpaqueIndexCount() const;
 
 private:
     uint32_t m_idx;
-    uint32_t m_indexOffset;
+    uint32_t m_chunk;
+    uint64_t m_indexOffset;
     uint32_t m_indexBase;
     uint32_t m_indexCount;
-    uint32_t m_vertexOffset;
+    uint64_t m_vertexOffset;
     uint32_t m_vertexBase;
     uint32_t m_vertexCount;
     uint32_t m_materialIdx;
+    glm::vec3 m_boundsMin = glm::vec3(0.0f);
+    glm::vec3 m_boundsMax = glm::vec3(0.0f);
+    uint32_t m_opaqueIndexCount = 0;
 };
 
 #endif // MANUEME_MESH_H
@@ -0,0 +1,158 @@
+/*
+ * Manuel Machado Copyright (C) 2021 This code is licensed under the MIT license (MIT)
+ * (http://opensource.org/licenses/MIT)
+ */
+
+#include "opacity_classifier.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+const uint32_t maxGridSize = 64;
+
+struct CellRange {
+    uint32_t first;
+    uint32_t last; // Inclusive
+};
+
+/**
+ * Cells of one axis holding the texels a bilinear lookup anywhere in [t_min, t_max] can read, in
+ * two ranges when the footprint wraps around the texture (repeat addressing). Returns the count.
+ * The footprint is widened to whole 4x4 blocks, block compression can change the alpha of any
+ * texel of a block that is not fully opaque
+ */
+uint32_t getCellRanges(
+    float t_min, float t_max, uint32_t t_size, uint32_t t_cells, CellRange t_ranges[2])
+{
+    const double firstTexel = std::floor(double(t_min) * t_size - 0.5);
+    const double lastTexel = std::floor(double(t_max) * t_size - 0.5) + 1.0;
+    const double first = std::floor(firstTexel / 4.0) * 4.0;
+    const double last = std::floor(lastTexel / 4.0) * 4.0 + 3.0;
+    // Also taken for NaN and for coordinates too large to wrap
+    if (!(last - first + 1.0 < t_size) || !(std::abs(first) < 1e15)) {
+        t_ranges[0] = { 0, t_cells - 1 };
+        return 1;
+    }
+    const auto size = static_cast<int64_t>(t_size);
+    const int64_t start = (static_cast<int64_t>(first) % size + size) % size;
+    const int64_t end = start + static_cast<int64_t>(last - first);
+    const auto toCell = [&](int64_t t_texel) {
+        return static_cast<uint32_t>(uint64_t(t_texel) * t_cells / t_size);
+    };
+    if (end < size) {
+        t_ranges[0] = { toCell(start), toCell(end) };
+        return 1;
+    }
+    t_ranges[0] = { toCell(start), t_cells - 1 };
+    t_ranges[1] = { 0, toCell(end - size) };
+    return 2;
+}
+
+bool isTriangleOpaque(const opacity_classifier::AlphaGrid& t_grid, const glm::vec2 t_uvs[3])
+{
+    const auto uvMin = glm::min(t_uvs[0], glm::min(t_uvs[1], t_uvs[2]));
+    const auto uvMax = glm::max(t_uvs[0], glm::max(t_uvs[1], t_uvs[2]));
+    CellRange columns[2];
+    CellRange rows[2];
+    const auto columnCount
+        = getCellRanges(uvMin.x, uvMax.x, t_grid.textureWidth, t_grid.width, columns);
+    const auto rowCount
+        = getCellRanges(uvMin.y, uvMax.y, t_grid.textureHeight, t_grid.height, rows);
+    for (uint32_t r = 0; r < rowCount; ++r) {
+        for (uint32_t y = rows[r].first; y <= rows[r].last; ++y) {
+            for (uint32_t c = 0; c < columnCount; ++c) {
+                for (uint32_t x = columns[c].first; x <= columns[c].last; ++x) {
+                    if (t_grid.minAlpha[size_t(y) * t_grid.width + x] < 255) {
+                        return false;
+                    }
+                }
+            }
+        }
+    }
+    return true;
+}
+
+}
+
+namespace opacity_classifier {
+
+AlphaGrid buildAlphaGrid(const uint8_t* t_pixels, uint32_t t_width, uint32_t t_height)
+{
+    AlphaGrid grid;
+    grid.width = std::min(t_width, maxGridSize);
+    grid.height = std::min(t_height, maxGridSize);
+    grid.textureWidth = t_width;
+    grid.textureHeight = t_height;
+    grid.minAlpha.assign(size_t(grid.width) * grid.height, 255);
+    for (uint32_t y = 0; y < t_height; ++y) {
+        const size_t row = size_t(y) * grid.height / t_height * grid.width;
+        for (uint32_t x = 0; x < t_width; ++x) {
+            auto& cell = grid.minAlpha[row + size_t(x) * grid.width / t_width];
+            cell = std::min(cell, t_pixels[(size_t(y) * t_width + x) * 4 + 3]);
+        }
+    }
+    return grid;
+}
+
+uint32_t classifyFaces(const aiMesh* t_mesh, const ShaderMaterial& t_material,
+    const AlphaGrid* t_diffuseAlpha, glm::vec2 t_uvScale, std::vector<uint32_t>& t_order)
+{
+    t_order.clear();
+    // Lights are skipped by the shadow rays, whatever their opacity
+    if (t_material.emissiveMapIndex >= 0 || t_material.emissive.r > 0.5f) {
+        return 0;
+    }
+    const bool textured = t_material.diffuseMapIndex >= 0;
+    if (textured && (!t_diffuseAlpha || t_diffuseAlpha->minAlpha.empty())) {
+        return 0;
+    }
+    // The opacity of the material is only used when it has no diffuse map, the refraction index
+    // does not matter as the shadow rays accumulate the transparency of refractive surfaces too
+    if (!textured && t_material.opacity < 1.0f) {
+        return 0;
+    }
+
+    std::vector<bool> opaque(t_mesh->mNumFaces, false);
+    uint32_t opaqueCount = 0;
+    bool ordered = true;
+    for (uint32_t i = 0; i < t_mesh->mNumFaces; ++i) {
+        const aiFace& face = t_mesh->mFaces[i];
+        if (face.mNumIndices != 3) {
+            continue;
+        }
+        if (textured) {
+            glm::vec2 uvs[3] = { glm::vec2(0.0f), glm::vec2(0.0f), glm::vec2(0.0f) };
+            if (t_mesh->HasTextureCoords(0)) {
+                for (int k = 0; k < 3; ++k) {
+                    const auto& uv = t_mesh->mTextureCoords[0][face.mIndices[k]];
+                    uvs[k] = glm::vec2(uv.x, uv.y) * t_uvScale;
+                }
+            }
+            if (!isTriangleOpaque(*t_diffuseAlpha, uvs)) {
+                continue;
+            }
+        }
+        opaque[i] = true;
+        ordered = ordered && opaqueCount == i;
+        ++opaqueCount;
+    }
+    if (ordered) {
+        return opaqueCount;
+    }
+    t_order.reserve(t_mesh->mNumFaces);
+    for (uint32_t i = 0; i < t_mesh->mNumFaces; ++i) {
+        if (opaque[i]) {
+            t_order.push_back(i);
+        }
+    }
+    for (uint32_t i = 0; i < t_mesh->mNumFaces; ++i) {
+        if (!opaque[i]) {
+            t_order.push_back(i);
+        }
+    }
+    return opaqueCount;
+}
+
+} // namespace opacity_classifier
@@ -0,0 +1,46 @@
+/*
+ * Manuel Machado Copyright (C) 2021 This code is licensed under the MIT license (MIT)
+ * (http://opensource.org/licenses/MIT)
+ */
+
+#ifndef MANUEME_OPACITY_CLASSIFIER_H
+#define MANUEME_OPACITY_CLASSIFIER_H
+
+#include <assimp/scene.h>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <vector>
+
+#include "shader_material.h"
+
+/**
+ * @brief Finds the triangles the any-hit shaders can never discard or make partially transparent,
+ * so they can be built as opaque geometry and skip them. Materials decide for untextured meshes,
+ * textured ones are decided per triangle from the alpha of the diffuse map under its texture
+ * coordinates.
+ */
+namespace opacity_classifier {
+
+/** @brief Lowest alpha of the texels covered by every cell of a coarse grid over a texture */
+struct AlphaGrid {
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t textureWidth = 0;
+    uint32_t textureHeight = 0;
+    std::vector<uint8_t> minAlpha;
+};
+
+/** @brief Builds the grid of the base level of an 8 bit BGRA texture, at most 64x64 cells */
+AlphaGrid buildAlphaGrid(const uint8_t* t_pixels, uint32_t t_width, uint32_t t_height);
+
+/**
+ * Orders the faces of t_mesh with the opaque ones first in t_order (left empty when the order does
+ * not change) and returns how many are opaque. t_diffuseAlpha is the grid of the diffuse map of
+ * t_material, if it has one, t_uvScale the scale applied to the texture coordinates
+ */
+uint32_t classifyFaces(const aiMesh* t_mesh, const ShaderMaterial& t_material,
+    const AlphaGrid* t_diffuseAlpha, glm::vec2 t_uvScale, std::vector<uint32_t>& t_order);
+
+} // namespace opacity_classifier
+
+#endif // MANUEME_OPACITY_CLASSIFIER_H
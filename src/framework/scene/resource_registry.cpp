@@ -0,0 +1,96 @@
+/*
+ * Manuel Machado Copyright (C) 2021 This code is licensed under the MIT license (MIT)
+ * (http://opensource.org/licenses/MIT)
+ */
+
+#include "resource_registry.h"
+
+#include <cassert>
+
+#include "../tools/tools.h"
+
+void ResourceRegistry::create(Device* t_device) { m_device = t_device; }
+
+void ResourceRegistry::destroy()
+{
+    std::lock_guard<std::mutex> lock(m_samplerMutex);
+    for (const auto& sampler : m_samplers) {
+        vkDestroySampler(m_device->logicalDevice, sampler.second, nullptr);
+    }
+    m_samplers.clear();
+    m_sources.clear();
+    m_sourceKeys.clear();
+    m_contents.clear();
+    m_extraReferences.clear();
+    m_stats = Stats();
+}
+
+int ResourceRegistry::findSource(const aiTexture* t_texture, TextureType t_type)
+{
+    ++m_stats.textureReferences;
+    const auto registered = m_sources.find(std::make_pair(t_texture, t_type));
+    if (registered == m_sources.end()) {
+        return -1;
+    }
+    ++m_stats.savedDecodes;
+    ++m_extraReferences[registered->second];
+    return registered->second;
+}
+
+int ResourceRegistry::registerSource(
+    const aiTexture* t_texture, TextureType t_type, uint64_t t_sourceKey, int t_index)
+{
+    const auto sameKey = m_sourceKeys.emplace(t_sourceKey, t_index);
+    m_sources.emplace(std::make_pair(t_texture, t_type), sameKey.first->second);
+    if (!sameKey.second) {
+        ++m_stats.savedDecodes;
+        ++m_extraReferences[sameKey.first->second];
+    }
+    return sameKey.first->second;
+}
+
+int ResourceRegistry::registerContent(
+    int t_index, uint64_t t_contentHash, VkDeviceSize t_size, int t_uniqueIndex)
+{
+    const auto extraReferences = m_extraReferences.find(t_index);
+    if (extraReferences != m_extraReferences.end()) {
+        m_stats.savedBytes += t_size * extraReferences->second;
+    }
+    const auto content = m_contents.emplace(t_contentHash, t_uniqueIndex);
+    if (content.second) {
+        return t_uniqueIndex;
+    }
+    ++m_stats.contentDuplicates;
+    m_stats.savedBytes += t_size;
+    return content.first->second;
+}
+
+VkSampler ResourceRegistry::getSampler(const VkSamplerCreateInfo& t_info)
+{
+    assert(t_info.pNext == nullptr && t_info.flags == 0);
+    const SamplerKey key { t_info.magFilter,
+        t_info.minFilter,
+        t_info.mipmapMode,
+        t_info.addressModeU,
+        t_info.addressModeV,
+        t_info.addressModeW,
+        t_info.mipLodBias,
+        t_info.anisotropyEnable,
+        t_info.maxAnisotropy,
+        t_info.compareEnable,
+        t_info.compareOp,
+        t_info.minLod,
+        t_info.maxLod,
+        t_info.borderColor,
+        t_info.unnormalizedCoordinates };
+    std::lock_guard<std::mutex> lock(m_samplerMutex);
+    ++m_stats.samplerRequests;
+    auto& sampler = m_samplers[key];
+    if (sampler == VK_NULL_HANDLE) {
+        CHECK_RESULT(vkCreateSampler(m_device->logicalDevice, &t_info, nullptr, &sampler));
+        ++m_stats.samplers;
+    }
+    return sampler;
+}
+
+const ResourceRegistry::Stats& ResourceRegistry::getStats() const { return m_stats; }
@@ -0,0 +1,91 @@
+/*
+ * Manuel Machado Copyright (C) 2021 This code is licensed under the MIT license (MIT)
+ * (http://opensource.org/licenses/MIT)
+ */
+
+#ifndef MANUEME_RESOURCE_REGISTRY_H
+#define MANUEME_RESOURCE_REGISTRY_H
+
+#include <assimp/texture.h>
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+
+#include "../core/device.h"
+#include "../core/texture_compression.h"
+
+/**
+ * @brief Scene level registry of the resources shared between materials. Textures are
+ * deduplicated by source (same aiTexture or same encoded bytes) before being decoded, and by
+ * content once cooked. Samplers are created once per sampler state and shared by every texture.
+ */
+class ResourceRegistry {
+public:
+    struct Stats {
+        // Texture references made by the materials
+        uint32_t textureReferences = 0;
+        // References resolved to an already queued texture, each one is a decode less
+        uint32_t savedDecodes = 0;
+        // Cooked textures identical to an earlier one, dropped after loading
+        uint32_t contentDuplicates = 0;
+        // Device memory the two cases above did not take
+        VkDeviceSize savedBytes = 0;
+        uint32_t samplers = 0;
+        uint32_t samplerRequests = 0;
+    };
+
+    void create(Device* t_device);
+
+    /** @brief Destroys the shared samplers and forgets the registered textures */
+    void destroy();
+
+    /** @brief Index of the texture already registered for t_texture, -1 if there is none */
+    int findSource(const aiTexture* t_texture, TextureType t_type);
+
+    /**
+     * Index of the texture already registered with the same t_sourceKey (the same file embedded
+     * twice). Registers t_index for t_texture and t_sourceKey otherwise and returns it, call
+     * findSource first
+     */
+    int registerSource(
+        const aiTexture* t_texture, TextureType t_type, uint64_t t_sourceKey, int t_index);
+
+    /**
+     * Called in index order once the texture registered at t_index is cooked. Returns the final
+     * index of an earlier texture with the same t_contentHash, or registers t_uniqueIndex as the
+     * final index of this content and returns it
+     *
+     * @param t_size Device bytes of the texture, for the stats
+     */
+    int registerContent(
+        int t_index, uint64_t t_contentHash, VkDeviceSize t_size, int t_uniqueIndex);
+
+    /** @brief Sampler created from t_info, shared by every request with the same state. Can be
+     * called from several threads at the same time */
+    VkSampler getSampler(const VkSamplerCreateInfo& t_info);
+
+    const Stats& getStats() const;
+
+private:
+    // Sampler state compared by the registry, pNext and flags are not supported
+    using SamplerKey = std::tuple<VkFilter, VkFilter, VkSamplerMipmapMode, VkSamplerAddressMode,
+        VkSamplerAddressMode, VkSamplerAddressMode, float, VkBool32, float, VkBool32, VkCompareOp,
+        float, float, VkBorderColor, VkBool32>;
+
+    Device* m_device = nullptr;
+
+    std::map<std::pair<const aiTexture*, TextureType>, int> m_sources;
+    std::unordered_map<uint64_t, int> m_sourceKeys;
+    std::unordered_map<uint64_t, int> m_contents;
+    // Number of references resolved to each registered index on top of the first one
+    std::unordered_map<int, uint32_t> m_extraReferences;
+
+    std::mutex m_samplerMutex;
+    std::map<SamplerKey, VkSampler> m_samplers;
+
+    Stats m_stats;
+};
+
+#endif // MANUEME_RESOURCE_REGISTRY_H
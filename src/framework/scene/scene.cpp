@@ -5,6 +5,73 @@
 
 #include "scene.h"
 
+#include <atomic>
+#include <chrono>
+#include <glm/gtc/matrix_access.hpp>
+#include <numeric>
+
+#include "../tools/thread_pool.h"
+#include "gltf_instancing.h"
+#include "instancing_recovery.h"
+#include "opacity_classifier.h"
+#include "triangle_splitting.h"
+#include "vertex_packing.hpp"
+
+namespace {
+// Transform of t_node relative to the root, identity if t_node is null
+aiMatrix4x4 getGlobalTransform(const aiNode* t_node)
+{
+    aiMatrix4x4 transform;
+    for (; t_node; t_node = t_node->mParent) {
+        transform = t_node->mTransformation * transform;
+    }
+    return transform;
+}
+
+// Appends the transform of every node instance of each mesh under t_node to t_transforms, nodes
+// using EXT_mesh_gpu_instancing add one transform per element of t_gpuInstances
+void collectMeshInstances(const aiNode* t_node, const aiMatrix4x4& t_parentTransform,
+    const gltf_instancing::NodeInstances& t_gpuInstances,
+    std::vector<std::vector<aiMatrix4x4>>& t_transforms)
+{
+    const aiMatrix4x4 transform = t_parentTransform * t_node->mTransformation;
+    const auto gpuInstances = t_gpuInstances.find(t_node->mName.C_Str());
+    for (unsigned int i = 0; i < t_node->mNumMeshes; ++i) {
+        auto& meshTransforms = t_transforms[t_node->mMeshes[i]];
+        if (gpuInstances == t_gpuInstances.end()) {
+            meshTransforms.push_back(transform);
+            continue;
+        }
+        for (const auto& instance : gpuInstances->second) {
+            meshTransforms.push_back(transform * instance);
+        }
+    }
+    for (unsigned int i = 0; i < t_node->mNumChildren; ++i) {
+        collectMeshInstances(t_node->mChildren[i], transform, t_gpuInstances, t_transforms);
+    }
+}
+
+glm::mat4 toGlm(const aiMatrix4x4& t_matrix)
+{
+    // aiMatrix4x4 is row major
+    return glm::transpose(glm::make_mat4(&t_matrix.a1));
+}
+
+// First camera of t_scene in world space, assimp only does it when the hierarchy is flattened
+aiCamera getWorldCamera(const aiScene* t_scene, bool t_preserveHierarchy)
+{
+    aiCamera camera = *t_scene->mCameras[0];
+    if (t_preserveHierarchy) {
+        const auto transform = getGlobalTransform(t_scene->mRootNode->FindNode(camera.mName));
+        const aiMatrix3x3 rotation(transform);
+        camera.mPosition = transform * camera.mPosition;
+        camera.mLookAt = rotation * camera.mLookAt;
+        camera.mUp = rotation * camera.mUp;
+    }
+    return camera;
+}
+}
+
 uint32_t SceneVertexLayout::stride()
 {
     uint32_t res = 0;
@@ -36,6 +103,14 @@ SceneCreateInfo::SceneCreateInfo()
 
 SceneCreateInfo::~SceneCreateInfo() = default;
 
+int Scene::getImportFlags(const SceneCreateInfo* t_createInfo)
+{
+    if (t_createInfo && t_createInfo->preserveHierarchy) {
+        return defaultFlags & ~aiProcess_PreTransformVertices;
+    }
+    return defaultFlags;
+}
+
 SceneCreateInfo::SceneCreateInfo(glm::vec3 t_scale, glm::vec2 t_uvScale, glm::vec3 t_center)
 {
     this->center = t_center;
@@ -57,41 +132,63 @@ Scene::~Scene() = default;
 void Scene::destroy()
 {
     assert(m_device);
-    vkDestroyBuffer(m_device->logicalDevice, vertices.buffer, nullptr);
-    vkFreeMemory(m_device->logicalDevice, vertices.memory, nullptr);
-    if (indices.buffer != VK_NULL_HANDLE) {
-        vkDestroyBuffer(m_device->logicalDevice, indices.buffer, nullptr);
-        vkFreeMemory(m_device->logicalDevice, indices.memory, nullptr);
+    for (auto& chunk : geometryChunks) {
+        chunk.vertices.destroy();
+        chunk.indices.destroy();
+    }
+    geometryChunks.clear();
+    if (m_descriptorHeap) {
+        for (auto slot : m_textureSlots) {
+            m_descriptorHeap->removeTexture(slot);
+        }
+        m_textureSlots.clear();
+        m_descriptorHeap = nullptr;
     }
     for (auto texture : textures) {
         texture.destroy();
     }
+    m_resources.destroy();
 }
 
 void Scene::draw(VkCommandBuffer t_commandBuffer, VkPipelineLayout t_pipelineLayout,
     uint32_t t_firstBinding) const
 {
-    VkDeviceSize offsets[1] = { 0 };
-    vkCmdBindVertexBuffers(t_commandBuffer, t_firstBinding, 1, &vertices.buffer, offsets);
-    vkCmdBindIndexBuffer(t_commandBuffer, indices.buffer, 0, VK_INDEX_TYPE_UINT32);
-
-    // TODO: iterate over instances instead of meshes,
-    //  generate instances analogously to the ray tracing pipeline.
-    for (const auto mesh : meshes) {
-        // Render from the global scene vertex buffer using the mesh index offset
+    uint32_t boundChunk = UINT32_MAX;
+    for (const auto& mesh : meshes) {
+        if (mesh.getIndexCount() == 0 || m_meshTransforms[mesh.getIdx()].empty()) {
+            continue;
+        }
+        // Render from the buffers of the geometry chunk of the mesh using its index offset, once
+        // per node instance of the mesh. Meshes of the same chunk follow each other
+        if (mesh.getChunk() != boundChunk) {
+            const auto& chunk = geometryChunks[mesh.getChunk()];
+            const VkDeviceSize offsets[1] = { 0 };
+            vkCmdBindVertexBuffers(
+                t_commandBuffer, t_firstBinding, 1, &chunk.vertices.buffer, offsets);
+            vkCmdBindIndexBuffer(t_commandBuffer, chunk.indices.buffer, 0, VK_INDEX_TYPE_UINT32);
+            boundChunk = mesh.getChunk();
+        }
         auto materialIdx = mesh.getMaterialIdx();
         vkCmdPushConstants(t_commandBuffer,
             t_pipelineLayout,
             VK_SHADER_STAGE_FRAGMENT_BIT,
-            0,
+            sizeof(glm::mat4),
             sizeof(uint32_t),
             &materialIdx);
-        vkCmdDrawIndexed(t_commandBuffer,
-            mesh.getIndexCount(),
-            1,
-            mesh.getIndexBase(),
-            mesh.getVertexBase(),
-            0);
+        for (const auto& transform : m_meshTransforms[mesh.getIdx()]) {
+            vkCmdPushConstants(t_commandBuffer,
+                t_pipelineLayout,
+                VK_SHADER_STAGE_VERTEX_BIT,
+                0,
+                sizeof(glm::mat4),
+                &transform);
+            vkCmdDrawIndexed(t_commandBuffer,
+                mesh.getIndexCount(),
+                1,
+                mesh.getIndexBase(),
+                static_cast<int32_t>(mesh.getVertexBase()),
+                0);
+        }
     }
 }
 
@@ -105,15 +202,33 @@ bool Scene::loadFromFile(const std::string& t_modelPath, const SceneVertexLayout
 
     this->m_device = t_device;
     this->m_vertexLayout = t_layout;
+    m_resources.create(t_device);
+
+    const VkBufferUsageFlags extraUsageFlags = t_createInfo ? t_createInfo->memoryPropertyFlags : 0;
+
+    // Warm start, skip the import entirely if the scene was already converted with this layout
+    const auto cachePath = SceneCache::getCachePath(t_modelPath);
+    const auto cacheKey = getCacheKey(t_modelPath, t_layout, t_createInfo);
+    m_contentKey = cacheKey;
+    if (loadFromCache(cachePath, cacheKey, extraUsageFlags, t_copyQueue)) {
+        m_loaded = true;
+        return true;
+    }
 
+    const bool preserveHierarchy = t_createInfo && t_createInfo->preserveHierarchy;
     Assimp::Importer importer;
-    const aiScene* scene = importer.ReadFile((t_modelPath).c_str(), defaultFlags);
+    const aiScene* scene = importer.ReadFile((t_modelPath).c_str(), getImportFlags(t_createInfo));
     if (!scene) {
         m_error = true;
         throw std::logic_error("Error loading assets: " + std::string(importer.GetErrorString()));
     } else {
-        loadCamera(scene);
-        loadLights(scene);
+        if (cacheKey != 0) {
+            // Textures are appended to the cache while the materials are loaded
+            m_cache.beginWrite(cachePath, cacheKey);
+        }
+        loadCamera(scene, preserveHierarchy);
+        loadLights(scene, preserveHierarchy);
+        m_textureCache.create(TextureCache::getCacheDirectory(t_modelPath));
         loadMaterials(scene, t_copyQueue);
 
         meshes.clear();
@@ -128,171 +243,331 @@ bool Scene::loadFromFile(const std::string& t_modelPath, const SceneVertexLayout
             center = t_createInfo->center;
         }
 
-        std::vector<float> vertexBuffer;
-        std::vector<uint32_t> indexBuffer;
+        // Node instances of every mesh, the flattened geometry is already in world space
+        std::vector<std::vector<aiMatrix4x4>> nodeTransforms(scene->mNumMeshes);
+        m_meshTransforms.assign(scene->mNumMeshes, {});
+        // Mesh each mesh is a copy of, copies keep no geometry of their own
+        std::vector<int> copyOf(scene->mNumMeshes, -1);
+        if (preserveHierarchy) {
+            collectMeshInstances(scene->mRootNode,
+                aiMatrix4x4(),
+                gltf_instancing::read(t_modelPath),
+                nodeTransforms);
+            if (t_createInfo->recoverInstancing) {
+                recoverInstancing(scene, nodeTransforms, copyOf);
+            }
+            // Vertices are stored converted, so are the transforms: A * M * inverse(A)
+            const glm::mat4 toConverted
+                = glm::scale(glm::translate(glm::mat4(1.0f), center), scale * glm::vec3(1, -1, 1));
+            const glm::mat4 fromConverted = glm::inverse(toConverted);
+            for (unsigned int i = 0; i < scene->mNumMeshes; ++i) {
+                for (const auto& transform : nodeTransforms[i]) {
+                    m_meshTransforms[i].push_back(toConverted * toGlm(transform) * fromConverted);
+                }
+            }
+        } else {
+            for (auto& transforms : m_meshTransforms) {
+                transforms.emplace_back(1.0f);
+            }
+        }
+        if (t_createInfo && t_createInfo->splitTriangleBudget > 0) {
+            splitTriangles(scene,
+                copyOf,
+                t_createInfo->splitTriangleBudget,
+                t_createInfo->splitAreaRatio);
+        }
+
+        auto& threadPool = ThreadPool::shared();
+        const auto stride = m_vertexLayout.stride();
 
-        vertexCount = 0;
-        indexCount = 0;
         // Load meshes (and instances for each mesh)
         std::cout << "\nLoading Meshes..." << std::endl;
-        const auto length = static_cast<float>(scene->mNumMeshes);
-        for (unsigned int i = 0; i < scene->mNumMeshes; ++i) {
-            const aiMesh* pAiMesh = scene->mMeshes[i];
-            auto currentIndexOffset = static_cast<uint32_t>(indexBuffer.size()) * sizeof(uint32_t);
-            auto currentVertexOffset = static_cast<uint32_t>(vertexBuffer.size()) * sizeof(float);
-
-            const aiVector3D zero3D(0.0f, 0.0f, 0.0f);
-
-            for (unsigned int j = 0; j < pAiMesh->mNumVertices; ++j) {
-                const aiVector3D* pPos = &(pAiMesh->mVertices[j]);
-                const aiVector3D* pNormal = &(pAiMesh->mNormals[j]);
-                const aiVector3D* pTexCoord
-                    = (pAiMesh->HasTextureCoords(0)) ? &(pAiMesh->mTextureCoords[0][j]) : &zero3D;
-                const aiVector3D* pTangent
-                    = (pAiMesh->HasTangentsAndBitangents()) ? &(pAiMesh->mTangents[j]) : &zero3D;
-                const aiVector3D* pBiTangent
-                    = (pAiMesh->HasTangentsAndBitangents()) ? &(pAiMesh->mBitangents[j]) : &zero3D;
-
-                for (auto& component : t_layout.components) {
-                    switch (component) {
-                    case VERTEX_COMPONENT_POSITION:
-                        vertexBuffer.push_back(pPos->x * scale.x + center.x);
-                        vertexBuffer.push_back(-pPos->y * scale.y + center.y);
-                        vertexBuffer.push_back(pPos->z * scale.z + center.z);
-                        break;
-                    case VERTEX_COMPONENT_NORMAL:
-                        vertexBuffer.push_back(pNormal->x);
-                        vertexBuffer.push_back(-pNormal->y);
-                        vertexBuffer.push_back(pNormal->z);
-                        break;
-                    case VERTEX_COMPONENT_UV:
-                        vertexBuffer.push_back(pTexCoord->x * uvscale.s);
-                        vertexBuffer.push_back(pTexCoord->y * uvscale.t);
-                        break;
-                    case VERTEX_COMPONENT_TANGENT:
-                        if (std::isnan(pTangent->x) || std::isnan(pTangent->y)
-                            || std::isnan(pTangent->z)) {
-                            vertexBuffer.push_back(1.f);
-                            vertexBuffer.push_back(1.f);
-                            vertexBuffer.push_back(1.f);
-                        } else {
-                            vertexBuffer.push_back(pTangent->x);
-                            vertexBuffer.push_back(pTangent->y);
-                            vertexBuffer.push_back(pTangent->z);
-                        }
-                        break;
-                    case VERTEX_COMPONENT_BITANGENT:
-                        vertexBuffer.push_back(pBiTangent->x);
-                        vertexBuffer.push_back(pBiTangent->y);
-                        vertexBuffer.push_back(pBiTangent->z);
-                        break;
-                    case VERTEX_COMPONENT_DUMMY_FLOAT:
-                        vertexBuffer.push_back(0.0f);
-                        break;
-                    case VERTEX_COMPONENT_DUMMY_VEC4:
-                        vertexBuffer.push_back(0.0f);
-                        vertexBuffer.push_back(0.0f);
-                        vertexBuffer.push_back(0.0f);
-                        vertexBuffer.push_back(0.0f);
-                        break;
-                    };
-                }
 
-                dim.max.x = fmax(pPos->x, dim.max.x);
-                dim.max.y = fmax(pPos->y, dim.max.y);
-                dim.max.z = fmax(pPos->z, dim.max.z);
+        // Converted geometry is streamed to the device through a fixed size staging ring, so on top
+        // of the assimp scene the host only holds the ring, whatever the size of the scene
+        StagingRing stagingRing;
+        stagingRing.create(m_device, t_copyQueue, m_device->queueFamilyIndices.graphics);
+        const VkDeviceSize chunkSize = stagingRing.getChunkSize();
 
-                dim.min.x = fmin(pPos->x, dim.min.x);
-                dim.min.y = fmin(pPos->y, dim.min.y);
-                dim.min.z = fmin(pPos->z, dim.min.z);
+        // Split the meshes in ranges small enough to balance the work between threads and to fit
+        // in a staging chunk
+        struct ConversionRange {
+            uint32_t meshIdx;
+            uint32_t first; // First vertex or face of the range
+            uint32_t count;
+            bool indices;
+            VkDeviceSize size; // Bytes of the converted range
+            VkDeviceSize outputOffset; // Offset in the vertex or index buffer
+            VkDeviceSize stagingOffset; // Offset in the staging chunk
+            uint32_t geometryChunk = 0; // Geometry chunk of the output
+        };
+        const uint32_t vertexRangeSize
+            = static_cast<uint32_t>(std::min<VkDeviceSize>(1 << 16, chunkSize / stride));
+        const uint32_t faceRangeSize = 1 << 16;
+        std::vector<ConversionRange> ranges;
+        for (unsigned int i = 0; i < scene->mNumMeshes; ++i) {
+            const aiMesh* pAiMesh = scene->mMeshes[i];
+            if (copyOf[i] >= 0) {
+                continue;
+            }
+            for (uint32_t first = 0; first < pAiMesh->mNumVertices; first += vertexRangeSize) {
+                const auto count = std::min(vertexRangeSize, pAiMesh->mNumVertices - first);
+                ranges.push_back({ i, first, count, false, VkDeviceSize(count) * stride, 0, 0 });
+            }
+            for (uint32_t first = 0; first < pAiMesh->mNumFaces; first += faceRangeSize) {
+                const auto count = std::min(faceRangeSize, pAiMesh->mNumFaces - first);
+                ranges.push_back({ i, first, count, true, 0, 0, 0 });
             }
+        }
 
-            dim.size = dim.max - dim.min;
+        // Faces the any-hit shaders always accept are moved to the front of their mesh so they can
+        // be built as a separate opaque geometry, faceOrder stays empty when nothing moves
+        const auto shaderMaterials = getMaterialsShaderData();
+        std::vector<std::vector<uint32_t>> faceOrder(scene->mNumMeshes);
+        std::vector<uint32_t> opaqueFaces(scene->mNumMeshes, 0);
+        threadPool.parallelFor(scene->mNumMeshes, [&](size_t t_meshIdx) {
+            if (copyOf[t_meshIdx] >= 0) {
+                return;
+            }
+            const aiMesh* pAiMesh = scene->mMeshes[t_meshIdx];
+            const auto& material = shaderMaterials[pAiMesh->mMaterialIndex];
+            const auto diffuseMap = static_cast<size_t>(material.diffuseMapIndex);
+            const auto diffuseAlpha = material.diffuseMapIndex >= 0
+                    && diffuseMap < m_textureAlpha.size()
+                ? &m_textureAlpha[diffuseMap]
+                : nullptr;
+            opaqueFaces[t_meshIdx] = opacity_classifier::classifyFaces(
+                pAiMesh, material, diffuseAlpha, uvscale, faceOrder[t_meshIdx]);
+        });
+        m_textureAlpha.clear();
+        const auto getFace = [&](const aiMesh* t_mesh, uint32_t t_meshIdx,
+                                 uint32_t t_faceIdx) -> const aiFace& {
+            const auto& order = faceOrder[t_meshIdx];
+            return t_mesh->mFaces[order.empty() ? t_faceIdx : order[t_faceIdx]];
+        };
 
-            uint32_t meshIndexCount = 0;
+        // First pass: count the indices of every face range and prefix sum the output offsets
+        threadPool.parallelFor(ranges.size(), [&](size_t t_rangeIdx) {
+            auto& range = ranges[t_rangeIdx];
+            if (!range.indices) {
+                return;
+            }
+            const aiMesh* pAiMesh = scene->mMeshes[range.meshIdx];
+            VkDeviceSize rangeIndexCount = 0;
+            for (uint32_t j = range.first; j < range.first + range.count; ++j) {
+                rangeIndexCount += getFace(pAiMesh, range.meshIdx, j).mNumIndices;
+            }
+            range.size = rangeIndexCount * sizeof(uint32_t);
+        });
 
-            for (unsigned int j = 0; j < pAiMesh->mNumFaces; ++j) {
-                const aiFace& face = pAiMesh->mFaces[j];
-                for (unsigned int k = 0; k < face.mNumIndices; ++k) {
-                    indexBuffer.push_back(face.mIndices[k]);
-                    meshIndexCount += 1;
+        // Meshes are packed in order in geometry chunks, a mesh that does not fit in the current
+        // chunk starts the next one
+        const VkDeviceSize geometryChunkSize = getGeometryChunkSize();
+        std::vector<VkDeviceSize> chunkVertexSizes(1, 0);
+        std::vector<VkDeviceSize> chunkIndexSizes(1, 0);
+        vertexCount = 0;
+        indexCount = 0;
+        size_t meshRangeIdx = 0;
+        for (unsigned int i = 0; i < scene->mNumMeshes; ++i) {
+            const aiMesh* pAiMesh = scene->mMeshes[i];
+            const size_t firstRange = meshRangeIdx;
+            VkDeviceSize meshVertexSize = 0;
+            VkDeviceSize meshIndexSize = 0;
+            for (; meshRangeIdx < ranges.size() && ranges[meshRangeIdx].meshIdx == i;
+                 ++meshRangeIdx) {
+                const auto& range = ranges[meshRangeIdx];
+                if (range.size > chunkSize) {
+                    throw std::runtime_error("Mesh faces do not fit in a staging chunk");
                 }
+                (range.indices ? meshIndexSize : meshVertexSize) += range.size;
             }
-            uint32_t meshIndexBase = indexCount;
-            indexCount += meshIndexCount;
-            uint32_t meshVertexBase = vertexCount;
-            vertexCount += pAiMesh->mNumVertices;
-
+            if ((chunkVertexSizes.back() + meshVertexSize > geometryChunkSize
+                    || chunkIndexSizes.back() + meshIndexSize > geometryChunkSize)
+                && (chunkVertexSizes.back() > 0 || chunkIndexSizes.back() > 0)) {
+                chunkVertexSizes.push_back(0);
+                chunkIndexSizes.push_back(0);
+            }
+            const auto geometryChunk = static_cast<uint32_t>(chunkVertexSizes.size() - 1);
+            VkDeviceSize vertexOutputOffset = chunkVertexSizes.back();
+            VkDeviceSize indexOutputOffset = chunkIndexSizes.back();
+            for (size_t j = firstRange; j < meshRangeIdx; ++j) {
+                auto& range = ranges[j];
+                auto& outputOffset = range.indices ? indexOutputOffset : vertexOutputOffset;
+                range.outputOffset = outputOffset;
+                range.geometryChunk = geometryChunk;
+                outputOffset += range.size;
+            }
+            const auto meshIndexCount = static_cast<uint32_t>(meshIndexSize / sizeof(uint32_t));
+            const uint32_t meshVertexCount = copyOf[i] >= 0 ? 0 : pAiMesh->mNumVertices;
             meshes[i] = Mesh(i,
-                currentIndexOffset,
-                meshIndexBase,
+                geometryChunk,
+                chunkIndexSizes.back(),
+                static_cast<uint32_t>(chunkIndexSizes.back() / sizeof(uint32_t)),
                 meshIndexCount,
-                currentVertexOffset,
-                meshVertexBase,
-                pAiMesh->mNumVertices,
+                chunkVertexSizes.back(),
+                static_cast<uint32_t>(chunkVertexSizes.back() / stride),
+                meshVertexCount,
                 pAiMesh->mMaterialIndex);
+            meshes[i].setOpaqueIndexCount(opaqueFaces[i] * 3);
+            chunkVertexSizes.back() += meshVertexSize;
+            chunkIndexSizes.back() += meshIndexSize;
+            indexCount += meshIndexCount;
+            vertexCount += meshVertexCount;
 
-            if (m_materials[meshes[i].getMaterialIdx()].isEmissive()) {
+            // The area light of a source is expanded to the instances of its copies, its primitive
+            // count includes the triangles added by splitTriangles
+            if (copyOf[i] < 0 && m_materials[meshes[i].getMaterialIdx()].isEmissive()) {
                 Light areaLight(i, meshes[i].getMaterialIdx(), pAiMesh->mNumFaces);
                 m_lights.emplace_back(areaLight);
             }
-            debug::printPercentage(i, length);
-        }
-        std::cout << "\nGenerating mesh buffers..." << std::endl;
-
-        uint32_t vBufferSize = static_cast<uint32_t>(vertexBuffer.size()) * sizeof(float);
-        uint32_t iBufferSize = static_cast<uint32_t>(indexBuffer.size()) * sizeof(uint32_t);
-
-        // Use staging buffer to move vertex and index buffer to device local memory
-        // Create staging buffers
-        Buffer vertexStaging, indexStaging;
-
-        // Vertex buffer
-        vertexStaging.create(t_device,
-            VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT_KHR,
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-            vBufferSize,
-            vertexBuffer.data());
-        // Index buffer
-        indexStaging.create(t_device,
-            VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT_KHR,
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-            iBufferSize,
-            indexBuffer.data());
-
-        // Create device local target buffers
-        // Vertex buffer
-        vertices.create(t_device,
-            VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT
-                | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR
-                | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | t_createInfo->memoryPropertyFlags,
-            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-            vBufferSize);
-        // Index buffer
-        indices.create(t_device,
-            VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT
-                | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR
-                | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | t_createInfo->memoryPropertyFlags,
-            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-            iBufferSize);
-        // Copy from staging buffers
-        VkCommandBuffer copyCmd
-            = t_device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
-
-        VkBufferCopy copyRegion {};
-
-        copyRegion.size = vBufferSize;
-        vkCmdCopyBuffer(copyCmd, vertexStaging.buffer, vertices.buffer, 1, &copyRegion);
-
-        copyRegion.size = iBufferSize;
-        vkCmdCopyBuffer(copyCmd, indexStaging.buffer, indices.buffer, 1, &copyRegion);
-
-        t_device->flushCommandBuffer(copyCmd, t_copyQueue);
-        // Destroy staging resources
-        vkDestroyBuffer(t_device->logicalDevice, vertexStaging.buffer, nullptr);
-        vkFreeMemory(t_device->logicalDevice, vertexStaging.memory, nullptr);
-        vkDestroyBuffer(t_device->logicalDevice, indexStaging.buffer, nullptr);
-        vkFreeMemory(t_device->logicalDevice, indexStaging.memory, nullptr);
+        }
+
+        const VkDeviceSize vBufferSize = vertexCount * stride;
+        const VkDeviceSize iBufferSize = indexCount * sizeof(uint32_t);
+        createGeometryChunks(chunkVertexSizes, chunkIndexSizes, extraUsageFlags);
+        m_cache.reserveGeometry(vBufferSize, iBufferSize);
+
+        // Layouts known at compile time use a specialized kernel, others the generic conversion
+        const auto packKernel = vertex_packing::findKernel(m_vertexLayout.components);
+        const vertex_packing::Transform packTransform { scale, uvscale, center };
+        const auto conversionStart = std::chrono::high_resolution_clock::now();
+
+        // Second pass: fill each staging chunk with as many consecutive ranges as fit, convert them
+        // in parallel straight into the mapped memory and copy them to the device while the next
+        // chunk is being converted. Bounds of every range are reduced once all of them are done
+        std::vector<Dimension> rangeBounds(ranges.size());
+        size_t nextRange = 0;
+        while (nextRange < ranges.size()) {
+            auto& chunk = stagingRing.acquire();
+            size_t endRange = nextRange;
+            VkDeviceSize chunkUsed = 0;
+            while (endRange < ranges.size() && chunkUsed + ranges[endRange].size <= chunkSize) {
+                ranges[endRange].stagingOffset = chunkUsed;
+                chunkUsed += ranges[endRange].size;
+                ++endRange;
+            }
+
+            threadPool.parallelFor(endRange - nextRange, [&](size_t t_idx) {
+                const auto rangeIdx = nextRange + t_idx;
+                const auto& range = ranges[rangeIdx];
+                const aiMesh* pAiMesh = scene->mMeshes[range.meshIdx];
+                uint8_t* output = chunk.data + range.stagingOffset;
+                if (range.indices) {
+                    auto indexOutput = reinterpret_cast<uint32_t*>(output);
+                    for (uint32_t j = range.first; j < range.first + range.count; ++j) {
+                        const aiFace& face = getFace(pAiMesh, range.meshIdx, j);
+                        for (unsigned int k = 0; k < face.mNumIndices; ++k) {
+                            *indexOutput++ = face.mIndices[k];
+                        }
+                    }
+                } else if (packKernel) {
+                    packKernel(pAiMesh,
+                        range.first,
+                        range.count,
+                        packTransform,
+                        reinterpret_cast<float*>(output),
+                        rangeBounds[rangeIdx].min,
+                        rangeBounds[rangeIdx].max);
+                } else {
+                    convertVertices(pAiMesh,
+                        range.first,
+                        range.count,
+                        m_vertexLayout,
+                        scale,
+                        uvscale,
+                        center,
+                        reinterpret_cast<float*>(output),
+                        rangeBounds[rangeIdx]);
+                }
+            });
+
+            std::vector<std::vector<VkBufferCopy>> vertexRegions(geometryChunks.size());
+            std::vector<std::vector<VkBufferCopy>> indexRegions(geometryChunks.size());
+            for (size_t i = nextRange; i < endRange; ++i) {
+                const auto& range = ranges[i];
+                if (range.size > 0) {
+                    auto& regions = range.indices ? indexRegions[range.geometryChunk]
+                                                  : vertexRegions[range.geometryChunk];
+                    regions.push_back({ range.stagingOffset, range.outputOffset, range.size });
+                }
+            }
+            for (size_t i = 0; i < geometryChunks.size(); ++i) {
+                auto& geometryChunk = geometryChunks[i];
+                stagingRing.copy(chunk, geometryChunk.vertices.buffer, std::move(vertexRegions[i]));
+                stagingRing.copy(chunk, geometryChunk.indices.buffer, std::move(indexRegions[i]));
+            }
+            stagingRing.submit(chunk);
+
+            // The device only reads the chunk, it can be written to the cache while it is copied.
+            // The cache holds the geometry chunks one after the other
+            for (size_t i = nextRange; i < endRange; ++i) {
+                const auto& range = ranges[i];
+                const auto& geometryChunk = geometryChunks[range.geometryChunk];
+                const auto data = chunk.data + range.stagingOffset;
+                if (range.indices) {
+                    m_cache.writeIndices(
+                        geometryChunk.indexDataOffset + range.outputOffset, data, range.size);
+                } else {
+                    m_cache.writeVertices(
+                        geometryChunk.vertexDataOffset + range.outputOffset, data, range.size);
+                }
+            }
+            debug::printPercentage(static_cast<int>(endRange - 1), static_cast<int>(ranges.size()));
+            nextRange = endRange;
+        }
+        stagingRing.destroy();
+
+        const std::chrono::duration<double> conversionTime
+            = std::chrono::high_resolution_clock::now() - conversionStart;
+        std::cout << "\nConverted and uploaded " << vertexCount << " vertices in "
+                  << conversionTime.count() * 1000.0 << " ms ("
+                  << vertexCount / std::max(conversionTime.count(), 1e-9) / 1e6 << " Mvertices/s, "
+                  << (packKernel ? "specialized" : "generic") << " packing)" << std::endl;
+
+        std::vector<Dimension> meshBounds(scene->mNumMeshes);
+        for (size_t i = 0; i < ranges.size(); ++i) {
+            auto& bounds = meshBounds[ranges[i].meshIdx];
+            bounds.min = glm::min(bounds.min, rangeBounds[i].min);
+            bounds.max = glm::max(bounds.max, rangeBounds[i].max);
+        }
+        // Mesh bounds in the space of the converted vertices
+        const glm::vec3 convertedScale = scale * glm::vec3(1, -1, 1);
+        for (unsigned int i = 0; i < scene->mNumMeshes; ++i) {
+            if (meshBounds[i].min.x <= meshBounds[i].max.x) {
+                const auto corner0 = center + convertedScale * meshBounds[i].min;
+                const auto corner1 = center + convertedScale * meshBounds[i].max;
+                meshes[i].setBounds(glm::min(corner0, corner1), glm::max(corner0, corner1));
+            }
+        }
+        if (preserveHierarchy) {
+            // Bounds of every instance, from the corners of the bounds of its mesh
+            for (unsigned int i = 0; i < scene->mNumMeshes; ++i) {
+                const auto& bounds = meshBounds[i];
+                if (bounds.min.x > bounds.max.x) {
+                    continue;
+                }
+                for (const auto& transform : nodeTransforms[i]) {
+                    for (int corner = 0; corner < 8; ++corner) {
+                        const aiVector3D point = transform
+                            * aiVector3D(corner & 1 ? bounds.max.x : bounds.min.x,
+                                corner & 2 ? bounds.max.y : bounds.min.y,
+                                corner & 4 ? bounds.max.z : bounds.min.z);
+                        dim.min = glm::min(dim.min, glm::vec3(point.x, point.y, point.z));
+                        dim.max = glm::max(dim.max, glm::vec3(point.x, point.y, point.z));
+                    }
+                }
+            }
+        } else {
+            for (const auto& bounds : rangeBounds) {
+                dim.min = glm::min(dim.min, bounds.min);
+                dim.max = glm::max(dim.max, bounds.max);
+            }
+        }
+        dim.size = dim.max - dim.min;
+
+        // The lights take the face count of their mesh after the split, they always match here
+        assert(hasConsistentAreaLights());
+        writeCache(scene, preserveHierarchy);
 
         debug::printPercentage(0, 1);
         m_loaded = true;
@@ -300,10 +575,678 @@ bool Scene::loadFromFile(const std::string& t_modelPath, const SceneVertexLayout
     }
 }
 
-void Scene::loadCamera(const aiScene* t_scene)
+bool Scene::hasConsistentAreaLights() const
+{
+    std::vector<bool> lit(meshes.size(), false);
+    for (const auto& light : m_lights) {
+        const auto shaderLight = light.getShaderLight();
+        if (shaderLight.areaPrimitiveCount == 0) {
+            continue;
+        }
+        const auto meshIdx = shaderLight.areaInstanceId;
+        if (meshIdx >= meshes.size() || lit[meshIdx]
+            || uint64_t(shaderLight.areaPrimitiveCount) * 3 != meshes[meshIdx].getIndexCount()) {
+            return false;
+        }
+        lit[meshIdx] = true;
+    }
+    return true;
+}
+
+void Scene::recoverInstancing(const aiScene* t_scene,
+    std::vector<std::vector<aiMatrix4x4>>& t_nodeTransforms, std::vector<int>& t_copyOf) const
+{
+    std::cout << "\nRecovering instancing..." << std::endl;
+    const auto start = std::chrono::high_resolution_clock::now();
+    const auto recovered = instancing_recovery::find(t_scene);
+    t_copyOf = recovered.source;
+
+    uint32_t geometryCount = 0;
+    VkDeviceSize savedBytes = 0;
+    for (unsigned int i = 0; i < t_scene->mNumMeshes; ++i) {
+        const aiMesh* pAiMesh = t_scene->mMeshes[i];
+        if (pAiMesh->mNumVertices > 0 && pAiMesh->mNumFaces > 0) {
+            ++geometryCount;
+        }
+        const int source = t_copyOf[i];
+        if (source < 0) {
+            continue;
+        }
+        for (const auto& transform : t_nodeTransforms[i]) {
+            t_nodeTransforms[source].push_back(transform * recovered.transforms[i]);
+        }
+        t_nodeTransforms[i].clear();
+        // Triangulated on import, every face has 3 indices
+        savedBytes += VkDeviceSize(pAiMesh->mNumVertices) * m_vertexLayout.stride()
+            + VkDeviceSize(pAiMesh->mNumFaces) * 3 * sizeof(uint32_t);
+    }
+
+    const std::chrono::duration<double> time = std::chrono::high_resolution_clock::now() - start;
+    const uint32_t uniqueCount = geometryCount - recovered.copies;
+    std::cout << recovered.copies << " of " << geometryCount << " meshes are copies, "
+              << uniqueCount << " unique geometries (dedup ratio "
+              << double(geometryCount) / std::max(uniqueCount, 1u) << "), "
+              << (savedBytes >> 20) << " MiB of vertex and index data saved in "
+              << time.count() * 1000.0 << " ms" << std::endl;
+}
+
+void Scene::splitTriangles(const aiScene* t_scene, const std::vector<int>& t_copyOf,
+    uint32_t t_budget, float t_areaRatio) const
+{
+    std::cout << "\nSplitting triangles..." << std::endl;
+    const auto start = std::chrono::high_resolution_clock::now();
+    auto& threadPool = ThreadPool::shared();
+    std::vector<double> weights(t_scene->mNumMeshes, 0.0);
+    threadPool.parallelFor(t_scene->mNumMeshes, [&](size_t t_meshIdx) {
+        if (t_copyOf[t_meshIdx] < 0) {
+            weights[t_meshIdx]
+                = triangle_splitting::getSplitWeight(t_scene->mMeshes[t_meshIdx], t_areaRatio)
+                * static_cast<double>(m_meshTransforms[t_meshIdx].size());
+        }
+    });
+    const double totalWeight = std::accumulate(weights.begin(), weights.end(), 0.0);
+
+    uint64_t triangleCount = 0;
+    uint64_t sourceVertexCount = 0;
+    for (unsigned int i = 0; i < t_scene->mNumMeshes; ++i) {
+        if (t_copyOf[i] < 0) {
+            triangleCount += t_scene->mMeshes[i]->mNumFaces;
+            sourceVertexCount += t_scene->mMeshes[i]->mNumVertices;
+        }
+    }
+    std::atomic<uint64_t> addedCount { 0 };
+    threadPool.parallelFor(t_scene->mNumMeshes, [&](size_t t_meshIdx) {
+        if (weights[t_meshIdx] <= 0.0) {
+            return;
+        }
+        const auto budget = static_cast<uint32_t>(t_budget * (weights[t_meshIdx] / totalWeight));
+        addedCount
+            += triangle_splitting::splitMesh(t_scene->mMeshes[t_meshIdx], budget, t_areaRatio);
+    });
+
+    uint64_t vertexCount = 0;
+    for (unsigned int i = 0; i < t_scene->mNumMeshes; ++i) {
+        if (t_copyOf[i] < 0) {
+            vertexCount += t_scene->mMeshes[i]->mNumVertices;
+        }
+    }
+    const VkDeviceSize addedBytes = (vertexCount - sourceVertexCount) * m_vertexLayout.stride()
+        + addedCount * 3 * sizeof(uint32_t);
+    const std::chrono::duration<double> time = std::chrono::high_resolution_clock::now() - start;
+    std::cout << addedCount << " triangles added to " << triangleCount << " ("
+              << addedCount * 100 / std::max<uint64_t>(triangleCount, 1) << "%), "
+              << (addedBytes >> 10) << " KiB of vertex and index data in "
+              << time.count() * 1000.0 << " ms" << std::endl;
+}
+
+void Scene::convertVertices(const aiMesh* t_mesh, uint32_t t_first, uint32_t t_count,
+    const SceneVertexLayout& t_layout, glm::vec3 t_scale, glm::vec2 t_uvScale, glm::vec3 t_center,
+    float* t_output, Dimension& t_bounds)
+{
+    const aiVector3D zero3D(0.0f, 0.0f, 0.0f);
+    for (uint32_t j = t_first; j < t_first + t_count; ++j) {
+        const aiVector3D* pPos = &(t_mesh->mVertices[j]);
+        const aiVector3D* pNormal = &(t_mesh->mNormals[j]);
+        const aiVector3D* pTexCoord
+            = (t_mesh->HasTextureCoords(0)) ? &(t_mesh->mTextureCoords[0][j]) : &zero3D;
+        const aiVector3D* pTangent
+            = (t_mesh->HasTangentsAndBitangents()) ? &(t_mesh->mTangents[j]) : &zero3D;
+        const aiVector3D* pBiTangent
+            = (t_mesh->HasTangentsAndBitangents()) ? &(t_mesh->mBitangents[j]) : &zero3D;
+
+        for (auto& component : t_layout.components) {
+            switch (component) {
+            case VERTEX_COMPONENT_POSITION:
+                *t_output++ = pPos->x * t_scale.x + t_center.x;
+                *t_output++ = -pPos->y * t_scale.y + t_center.y;
+                *t_output++ = pPos->z * t_scale.z + t_center.z;
+                break;
+            case VERTEX_COMPONENT_NORMAL:
+                *t_output++ = pNormal->x;
+                *t_output++ = -pNormal->y;
+                *t_output++ = pNormal->z;
+                break;
+            case VERTEX_COMPONENT_UV:
+                *t_output++ = pTexCoord->x * t_uvScale.s;
+                *t_output++ = pTexCoord->y * t_uvScale.t;
+                break;
+            case VERTEX_COMPONENT_TANGENT:
+                if (std::isnan(pTangent->x) || std::isnan(pTangent->y) || std::isnan(pTangent->z)) {
+                    *t_output++ = 1.f;
+                    *t_output++ = 1.f;
+                    *t_output++ = 1.f;
+                } else {
+                    *t_output++ = pTangent->x;
+                    *t_output++ = pTangent->y;
+                    *t_output++ = pTangent->z;
+                }
+                break;
+            case VERTEX_COMPONENT_BITANGENT:
+                *t_output++ = pBiTangent->x;
+                *t_output++ = pBiTangent->y;
+                *t_output++ = pBiTangent->z;
+                break;
+            case VERTEX_COMPONENT_DUMMY_FLOAT:
+                *t_output++ = 0.0f;
+                break;
+            case VERTEX_COMPONENT_DUMMY_VEC4:
+                *t_output++ = 0.0f;
+                *t_output++ = 0.0f;
+                *t_output++ = 0.0f;
+                *t_output++ = 0.0f;
+                break;
+            };
+        }
+
+        t_bounds.min = glm::min(t_bounds.min, glm::vec3(pPos->x, pPos->y, pPos->z));
+        t_bounds.max = glm::max(t_bounds.max, glm::vec3(pPos->x, pPos->y, pPos->z));
+    }
+}
+
+VkDeviceSize Scene::getGeometryChunkSize() const
 {
+    // Few chunks for most scenes, while staying well below the allocation limit of the device
+    VkPhysicalDeviceMaintenance3Properties maintenance3Properties {};
+    maintenance3Properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MAINTENANCE_3_PROPERTIES;
+    VkPhysicalDeviceProperties2 properties {};
+    properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    properties.pNext = &maintenance3Properties;
+    vkGetPhysicalDeviceProperties2(m_device->physicalDevice, &properties);
+    return std::min<VkDeviceSize>(maintenance3Properties.maxMemoryAllocationSize, 1u << 30);
+}
+
+bool Scene::getGeometryChunkSizes(
+    std::vector<VkDeviceSize>& t_vertexSizes, std::vector<VkDeviceSize>& t_indexSizes) const
+{
+    const VkDeviceSize stride = m_vertexLayout.stride();
+    t_vertexSizes.assign(1, 0);
+    t_indexSizes.assign(1, 0);
+    for (const auto& mesh : meshes) {
+        if (mesh.getChunk() == t_vertexSizes.size()) {
+            t_vertexSizes.push_back(0);
+            t_indexSizes.push_back(0);
+        }
+        // Meshes are packed one after the other, in chunk order
+        const auto chunk = mesh.getChunk();
+        if (chunk + 1 != t_vertexSizes.size() || mesh.getVertexOffset() != t_vertexSizes[chunk]
+            || mesh.getIndexOffset() != t_indexSizes[chunk]
+            || mesh.getVertexBase() != mesh.getVertexOffset() / stride
+            || mesh.getIndexBase() != mesh.getIndexOffset() / sizeof(uint32_t)) {
+            return false;
+        }
+        t_vertexSizes[chunk] += VkDeviceSize(mesh.getVertexCount()) * stride;
+        t_indexSizes[chunk] += VkDeviceSize(mesh.getIndexCount()) * sizeof(uint32_t);
+    }
+    return true;
+}
+
+void Scene::createGeometryChunks(const std::vector<VkDeviceSize>& t_vertexSizes,
+    const std::vector<VkDeviceSize>& t_indexSizes, VkBufferUsageFlags t_extraUsageFlags)
+{
+    // Create device local target buffers, filled through a StagingRing
+    MemoryCategoryScope category(MEMORY_CATEGORY_GEOMETRY);
+    geometryChunks.assign(t_vertexSizes.size(), {});
+    uint64_t vertexDataOffset = 0;
+    uint64_t indexDataOffset = 0;
+    for (size_t i = 0; i < geometryChunks.size(); ++i) {
+        auto& chunk = geometryChunks[i];
+        chunk.vertexDataOffset = vertexDataOffset;
+        chunk.indexDataOffset = indexDataOffset;
+        vertexDataOffset += t_vertexSizes[i];
+        indexDataOffset += t_indexSizes[i];
+        if (t_vertexSizes[i] > 0) {
+            chunk.vertices.create(m_device,
+                VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT
+                    | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR
+                    | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | t_extraUsageFlags,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                t_vertexSizes[i]);
+        }
+        if (t_indexSizes[i] > 0) {
+            chunk.indices.create(m_device,
+                VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT
+                    | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR
+                    | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | t_extraUsageFlags,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                t_indexSizes[i]);
+        }
+    }
+}
+
+void Scene::uploadBuffer(
+    StagingRing& t_stagingRing, const uint8_t* t_data, VkDeviceSize t_size, Buffer& t_dst)
+{
+    for (VkDeviceSize offset = 0; offset < t_size; offset += t_stagingRing.getChunkSize()) {
+        const auto size = std::min(t_stagingRing.getChunkSize(), t_size - offset);
+        auto& chunk = t_stagingRing.acquire();
+        memcpy(chunk.data, t_data + offset, size);
+        t_stagingRing.copy(chunk, t_dst.buffer, { { 0, offset, size } });
+        t_stagingRing.submit(chunk);
+    }
+}
+
+uint64_t Scene::getCacheKey(const std::string& t_modelPath, const SceneVertexLayout& t_layout,
+    const SceneCreateInfo* t_createInfo)
+{
+    const auto sourceHash = tools::hashFile(t_modelPath);
+    if (sourceHash == 0) {
+        return 0;
+    }
+    const int flags = getImportFlags(t_createInfo);
+    auto key = tools::hashBytes(&sourceHash, sizeof(sourceHash));
+    // The buffers and images next to a .gltf are part of the scene too
+    for (const auto& file : gltf_instancing::readExternalFiles(t_modelPath)) {
+        const auto fileHash = tools::hashFile(file);
+        if (fileHash == 0) {
+            return 0;
+        }
+        key = tools::hashBytes(&fileHash, sizeof(fileHash), key);
+    }
+    key = tools::hashBytes(&flags, sizeof(flags), key);
+    key = tools::hashBytes(t_layout.components.data(),
+        t_layout.components.size() * sizeof(Component),
+        key);
+    if (t_createInfo) {
+        key = tools::hashBytes(&t_createInfo->scale, sizeof(t_createInfo->scale), key);
+        key = tools::hashBytes(&t_createInfo->uvScale, sizeof(t_createInfo->uvScale), key);
+        key = tools::hashBytes(&t_createInfo->center, sizeof(t_createInfo->center), key);
+        key = tools::hashBytes(
+            &t_createInfo->recoverInstancing, sizeof(t_createInfo->recoverInstancing), key);
+        key = tools::hashBytes(
+            &t_createInfo->splitTriangleBudget, sizeof(t_createInfo->splitTriangleBudget), key);
+        key = tools::hashBytes(
+            &t_createInfo->splitAreaRatio, sizeof(t_createInfo->splitAreaRatio), key);
+    }
+    return key;
+}
+
+bool Scene::loadFromCache(const std::string& t_cachePath, uint64_t t_key,
+    VkBufferUsageFlags t_extraUsageFlags, VkQueue t_copyQueue)
+{
+    if (t_key == 0 || !m_cache.open(t_cachePath, t_key)) {
+        return false;
+    }
+    const auto& header = m_cache.getHeader();
+    if (header.vertexStride != m_vertexLayout.stride()) {
+        m_cache.close();
+        return false;
+    }
+    // Written on a device that can sample block compressed textures, this one can not
+    for (uint32_t i = 0; i < header.textureCount; ++i) {
+        const auto format = static_cast<VkFormat>(m_cache.getTextures()[i].format);
+        if (texture_compression::isBlockCompressed(format)
+            && m_device->enabledFeatures.textureCompressionBC != VK_TRUE) {
+            m_cache.close();
+            return false;
+        }
+    }
+    meshes.resize(header.meshCount);
+    for (uint32_t i = 0; i < header.meshCount; ++i) {
+        const auto& mesh = m_cache.getMeshes()[i];
+        meshes[i] = Mesh(mesh.idx,
+            mesh.chunk,
+            mesh.indexOffset,
+            mesh.indexBase,
+            mesh.indexCount,
+            mesh.vertexOffset,
+            mesh.vertexBase,
+            mesh.vertexCount,
+            mesh.materialIdx);
+        meshes[i].setBounds(glm::make_vec3(mesh.boundsMin), glm::make_vec3(mesh.boundsMax));
+        meshes[i].setOpaqueIndexCount(mesh.opaqueIndexCount);
+    }
+    // The geometry chunks are stored one after the other
+    std::vector<VkDeviceSize> chunkVertexSizes;
+    std::vector<VkDeviceSize> chunkIndexSizes;
+    if (!getGeometryChunkSizes(chunkVertexSizes, chunkIndexSizes)
+        || std::accumulate(chunkVertexSizes.begin(), chunkVertexSizes.end(), VkDeviceSize(0))
+            != header.vertexSize
+        || std::accumulate(chunkIndexSizes.begin(), chunkIndexSizes.end(), VkDeviceSize(0))
+            != header.indexSize) {
+        meshes.clear();
+        m_cache.close();
+        return false;
+    }
+    std::cout << "\nLoading scene cache " << t_cachePath << "..." << std::endl;
+
+    if (header.hasCamera) {
+        aiCamera camera;
+        camera.mPosition = aiVector3D(header.cameraPosition[0],
+            header.cameraPosition[1],
+            header.cameraPosition[2]);
+        camera.mLookAt
+            = aiVector3D(header.cameraLookAt[0], header.cameraLookAt[1], header.cameraLookAt[2]);
+        camera.mUp = aiVector3D(header.cameraUp[0], header.cameraUp[1], header.cameraUp[2]);
+        m_camera = Camera(camera);
+    } else {
+        m_camera = Camera();
+    }
+
+    m_meshTransforms.assign(header.meshCount, {});
+    for (uint32_t i = 0; i < header.instanceCount; ++i) {
+        const auto& instance = m_cache.getInstances()[i];
+        if (instance.meshIdx < header.meshCount) {
+            m_meshTransforms[instance.meshIdx].push_back(glm::make_mat4(instance.transform));
+        }
+    }
+
+    m_lights.clear();
+    for (uint32_t i = 0; i < header.lightCount; ++i) {
+        m_lights.emplace_back(m_cache.getLights()[i]);
+    }
+    // Written by a build whose lights did not follow the mesh triangles, import the model again
+    if (!hasConsistentAreaLights()) {
+        std::cout << "\nWARNING: discarding scene cache " << t_cachePath
+                  << ", its area lights do not match the meshes" << std::endl;
+        meshes.clear();
+        m_meshTransforms.clear();
+        m_lights.clear();
+        m_cache.close();
+        return false;
+    }
+    m_materials.clear();
+    for (uint32_t i = 0; i < header.materialCount; ++i) {
+        m_materials.emplace_back(m_cache.getMaterials()[i]);
+    }
+
+    textures.clear();
+    TextureUploader uploader;
+    uploader.create(m_device, t_copyQueue);
+    for (uint32_t i = 0; i < header.textureCount; ++i) {
+        const auto& cachedTexture = m_cache.getTextures()[i];
+        const auto sampler
+            = m_resources.getSampler(Texture::getDefaultSamplerInfo(m_device, VK_LOD_CLAMP_NONE));
+        Texture texture2D;
+        texture2D.loadFromPixels(m_cache.getTextureData(cachedTexture),
+            cachedTexture.width,
+            cachedTexture.height,
+            static_cast<VkFormat>(cachedTexture.format),
+            m_device,
+            uploader,
+            cachedTexture.mipLevels,
+            sampler);
+        textures.push_back(texture2D);
+        debug::printPercentage(i, header.textureCount);
+    }
+    uploader.destroy();
+
+    vertexCount = header.vertexCount;
+    indexCount = header.indexCount;
+    dim.min = glm::vec3(header.dimMin[0], header.dimMin[1], header.dimMin[2]);
+    dim.max = glm::vec3(header.dimMax[0], header.dimMax[1], header.dimMax[2]);
+    dim.size = dim.max - dim.min;
+
+    std::cout << "\nGenerating mesh buffers..." << std::endl;
+    createGeometryChunks(chunkVertexSizes, chunkIndexSizes, t_extraUsageFlags);
+    // Stream the mapped file, only the touched pages of the mapping are resident at any time
+    StagingRing stagingRing;
+    stagingRing.create(m_device, t_copyQueue, m_device->queueFamilyIndices.graphics);
+    for (size_t i = 0; i < geometryChunks.size(); ++i) {
+        auto& chunk = geometryChunks[i];
+        uploadBuffer(stagingRing,
+            m_cache.getVertexData() + chunk.vertexDataOffset,
+            chunkVertexSizes[i],
+            chunk.vertices);
+        uploadBuffer(stagingRing,
+            m_cache.getIndexData() + chunk.indexDataOffset,
+            chunkIndexSizes[i],
+            chunk.indices);
+    }
+    stagingRing.destroy();
+    m_cache.close();
+    debug::printPercentage(0, 1);
+    return true;
+}
+
+void Scene::writeCache(const aiScene* t_scene, bool t_preserveHierarchy)
+{
+    if (!m_cache.isWriting()) {
+        return;
+    }
+    SceneCacheHeader header {};
+    header.vertexStride = m_vertexLayout.stride();
+    header.vertexCount = vertexCount;
+    header.indexCount = indexCount;
     if (t_scene->HasCameras()) {
-        m_camera = Camera(*t_scene->mCameras[0]); // Only one camera supported
+        const auto camera = getWorldCamera(t_scene, t_preserveHierarchy);
+        header.hasCamera = 1;
+        memcpy(header.cameraPosition, &camera.mPosition, sizeof(header.cameraPosition));
+        memcpy(header.cameraLookAt, &camera.mLookAt, sizeof(header.cameraLookAt));
+        memcpy(header.cameraUp, &camera.mUp, sizeof(header.cameraUp));
+    }
+    memcpy(header.dimMin, &dim.min, sizeof(header.dimMin));
+    memcpy(header.dimMax, &dim.max, sizeof(header.dimMax));
+
+    std::vector<SceneCacheMesh> cacheMeshes;
+    cacheMeshes.reserve(meshes.size());
+    for (const auto& mesh : meshes) {
+        cacheMeshes.push_back({ mesh.getIdx(),
+            mesh.getChunk(),
+            mesh.getIndexOffset(),
+            mesh.getVertexOffset(),
+            mesh.getIndexBase(),
+            mesh.getIndexCount(),
+            mesh.getVertexBase(),
+            mesh.getVertexCount(),
+            mesh.getMaterialIdx() });
+        memcpy(cacheMeshes.back().boundsMin, &mesh.getBoundsMin(), sizeof(float) * 3);
+        memcpy(cacheMeshes.back().boundsMax, &mesh.getBoundsMax(), sizeof(float) * 3);
+        cacheMeshes.back().opaqueIndexCount = mesh.getOpaqueIndexCount();
+    }
+    std::vector<SceneCacheInstance> cacheInstances;
+    for (uint32_t i = 0; i < m_meshTransforms.size(); ++i) {
+        for (const auto& transform : m_meshTransforms[i]) {
+            SceneCacheInstance instance { i };
+            memcpy(instance.transform, glm::value_ptr(transform), sizeof(instance.transform));
+            cacheInstances.push_back(instance);
+        }
+    }
+    // Area lights are stored per mesh, they are expanded per instance once the instances exist
+    std::vector<ShaderLight> lights;
+    for (auto& light : m_lights) {
+        lights.push_back(light.getShaderLight());
+    }
+    if (!m_cache.endWrite(header, cacheMeshes, getMaterialsShaderData(), lights, cacheInstances)) {
+        std::cout << "\nWARNING: could not write the scene cache" << std::endl;
+    }
+}
+
+int Scene::addEmbeddedTexture(const aiTexture* t_texture, TextureType t_type)
+{
+    const int registered = m_resources.findSource(t_texture, t_type);
+    if (registered >= 0) {
+        return registered;
+    }
+    // Hashing the source is far cheaper than the decode it may save
+    const bool compress = m_device->enabledFeatures.textureCompressionBC == VK_TRUE;
+    const uint64_t key = getTextureKey(t_texture, t_type, compress);
+    const auto newIndex = static_cast<int>(textures.size() + m_pendingTextures.size());
+    const int index = m_resources.registerSource(t_texture, t_type, key, newIndex);
+    if (index == newIndex) {
+        m_pendingTextures.push_back({ t_texture, t_type, key });
+    }
+    return index;
+}
+
+uint64_t Scene::getTextureKey(const aiTexture* t_texture, TextureType t_type, bool t_compress)
+{
+    // mHeight is 0 for compressed files (png, jpg...) of mWidth bytes
+    const size_t size = t_texture->mHeight == 0
+        ? t_texture->mWidth
+        : size_t(t_texture->mWidth) * t_texture->mHeight * sizeof(aiTexel);
+    const uint32_t settings[] = { t_texture->mWidth,
+        t_texture->mHeight,
+        static_cast<uint32_t>(t_type),
+        t_compress ? 1u : 0u };
+    return tools::hashBytes(settings, sizeof(settings), tools::hashBytes(t_texture->pcData, size));
+}
+
+TextureData Scene::cookTexture(const aiTexture* t_texture, TextureType t_type, bool t_compress)
+{
+    const auto bitmap = Texture::decodeAssimpTexture(t_texture);
+    if (!bitmap) {
+        throw std::runtime_error(
+            "Could not decode embedded texture " + std::string(t_texture->mFilename.C_Str()));
+    }
+    TextureData cooked;
+    cooked.width = FreeImage_GetWidth(bitmap);
+    cooked.height = FreeImage_GetHeight(bitmap);
+    cooked.mipLevels = Texture::getMipLevelCount(cooked.width, cooked.height);
+    cooked.format = VK_FORMAT_B8G8R8A8_UNORM;
+    std::vector<uint8_t> chain(
+        Texture::getMipChainSize(cooked.width, cooked.height, cooked.mipLevels));
+    Texture::generateMipChain(FreeImage_GetBits(bitmap),
+        cooked.width,
+        cooked.height,
+        cooked.mipLevels,
+        chain.data());
+    FreeImage_Unload(bitmap);
+    if (t_type == TEXTURE_TYPE_COLOR) {
+        cooked.alpha
+            = opacity_classifier::buildAlphaGrid(chain.data(), cooked.width, cooked.height);
+    }
+    if (!t_compress) {
+        cooked.data = std::move(chain);
+        return cooked;
+    }
+    cooked.format
+        = texture_compression::selectFormat(t_type, chain.data(), cooked.width, cooked.height);
+    cooked.data.resize(texture_compression::getMipChainSize(
+        cooked.format, cooked.width, cooked.height, cooked.mipLevels));
+    texture_compression::compressMipChain(cooked.format,
+        chain.data(),
+        cooked.width,
+        cooked.height,
+        cooked.mipLevels,
+        cooked.data.data());
+    return cooked;
+}
+
+void Scene::loadPendingTextures(VkQueue t_copyQueue)
+{
+    if (m_pendingTextures.empty()) {
+        return;
+    }
+    std::cout << "\nLoading Textures..." << std::endl;
+
+    // Workers cook (or read from the texture cache) and record the upload of every texture into a
+    // single batch, the results are handed back in index order for the scene cache
+    const bool compress = m_device->enabledFeatures.textureCompressionBC == VK_TRUE;
+    const size_t firstTexture = textures.size();
+    textures.resize(firstTexture + m_pendingTextures.size());
+    TextureUploader uploader;
+    uploader.create(m_device, t_copyQueue);
+    std::atomic<uint32_t> cacheHits { 0 };
+
+    const auto cookAndUpload = [&](size_t t_idx) {
+        const auto& pending = m_pendingTextures[t_idx];
+        TextureData cooked;
+        if (m_textureCache.load(pending.key, cooked)) {
+            ++cacheHits;
+        } else {
+            cooked = cookTexture(pending.texture, pending.type, compress);
+            m_textureCache.store(pending.key, cooked);
+        }
+        // The views limit the levels, so every texture shares the same sampler state
+        const auto sampler
+            = m_resources.getSampler(Texture::getDefaultSamplerInfo(m_device, VK_LOD_CLAMP_NONE));
+        textures[firstTexture + t_idx].loadFromPixels(cooked.data.data(),
+            cooked.width,
+            cooked.height,
+            cooked.format,
+            m_device,
+            uploader,
+            cooked.mipLevels,
+            sampler);
+        return cooked;
+    };
+    std::vector<std::future<TextureData>> cookedTextures;
+    cookedTextures.reserve(m_pendingTextures.size());
+    for (size_t i = 0; i < m_pendingTextures.size(); ++i) {
+        cookedTextures.push_back(
+            ThreadPool::shared().submit([&cookAndUpload, i]() { return cookAndUpload(i); }));
+    }
+
+    // Textures with the same content as an earlier one are released once the uploads are done,
+    // the others are compacted to the front, remap gives the final index of every pending one
+    std::exception_ptr error;
+    VkDeviceSize textureBytes = 0;
+    std::vector<int> remap(cookedTextures.size());
+    std::vector<Texture> duplicates;
+    size_t uniqueCount = 0;
+    m_textureAlpha.resize(firstTexture + cookedTextures.size());
+    for (size_t i = 0; i < cookedTextures.size(); ++i) {
+        try {
+            auto cooked = cookedTextures[i].get();
+            const uint32_t description[] = { cooked.width,
+                cooked.height,
+                cooked.mipLevels,
+                static_cast<uint32_t>(cooked.format) };
+            const uint64_t contentHash = tools::hashBytes(description,
+                sizeof(description),
+                tools::hashBytes(cooked.data.data(), cooked.data.size()));
+            const auto uniqueIndex = static_cast<int>(firstTexture + uniqueCount);
+            remap[i] = m_resources.registerContent(static_cast<int>(firstTexture + i),
+                contentHash,
+                cooked.data.size(),
+                uniqueIndex);
+            if (remap[i] != uniqueIndex) {
+                duplicates.push_back(textures[firstTexture + i]);
+                continue;
+            }
+            // Slots up to i are no longer written by the workers
+            textures[uniqueIndex] = textures[firstTexture + i];
+            m_textureAlpha[uniqueIndex] = std::move(cooked.alpha);
+            ++uniqueCount;
+            textureBytes += cooked.data.size();
+            if (!error) {
+                m_cache.addTexture(cooked.width,
+                    cooked.height,
+                    static_cast<uint32_t>(cooked.format),
+                    cooked.mipLevels,
+                    cooked.data.data(),
+                    cooked.data.size());
+            }
+        } catch (...) {
+            // Keep draining, the remaining tasks reference the uploader
+            if (!error) {
+                error = std::current_exception();
+            }
+            continue;
+        }
+        debug::printPercentage(static_cast<int>(i), static_cast<int>(cookedTextures.size()));
+    }
+    uploader.destroy();
+    for (auto& duplicate : duplicates) {
+        duplicate.destroy();
+    }
+    textures.resize(firstTexture + uniqueCount);
+    m_textureAlpha.resize(firstTexture + uniqueCount);
+    if (error) {
+        m_pendingTextures.clear();
+        std::rethrow_exception(error);
+    }
+    for (auto& material : m_materials) {
+        material.remapTextures(static_cast<int>(firstTexture), remap);
+    }
+
+    const auto& stats = m_resources.getStats();
+    std::cout << "\n"
+              << uniqueCount << " textures (" << cacheHits << " from the texture cache), "
+              << (textureBytes >> 20) << " MiB" << (compress ? " block compressed" : "")
+              << std::endl;
+    std::cout << stats.textureReferences << " texture references, " << stats.savedDecodes
+              << " decodes and " << stats.contentDuplicates << " duplicates avoided, "
+              << (stats.savedBytes >> 10) << " KiB of device memory saved, " << stats.samplers
+              << " samplers for " << stats.samplerRequests << " textures" << std::endl;
+    m_pendingTextures.clear();
+}
+
+void Scene::loadCamera(const aiScene* t_scene, bool t_preserveHierarchy)
+{
+    if (t_scene->HasCameras()) {
+        // Only one camera supported
+        m_camera = Camera(getWorldCamera(t_scene, t_preserveHierarchy));
     } else {
         // Initialize camera with default values if model doesn't have one
         m_camera = Camera();
@@ -312,13 +1255,21 @@ void Scene::loadCamera(const aiScene* t_scene)
 
 Camera* Scene::getCamera() { return &m_camera; }
 
-void Scene::loadLights(const aiScene* t_scene)
+void Scene::loadLights(const aiScene* t_scene, bool t_preserveHierarchy)
 {
     if (t_scene->HasLights()) {
         std::cout << "\nLoading Lights..." << std::endl;
         for (unsigned int i = 0; i < t_scene->mNumLights; ++i) {
-            const auto aiLight = t_scene->mLights[i];
-            m_lights.emplace_back(*aiLight);
+            aiLight light = *t_scene->mLights[i];
+            if (t_preserveHierarchy) {
+                const auto transform
+                    = getGlobalTransform(t_scene->mRootNode->FindNode(light.mName));
+                const aiMatrix3x3 rotation(transform);
+                light.mPosition = transform * light.mPosition;
+                light.mDirection = rotation * light.mDirection;
+                light.mUp = rotation * light.mUp;
+            }
+            m_lights.emplace_back(light);
             debug::printPercentage(i, t_scene->mNumLights);
         }
     }
@@ -328,12 +1279,25 @@ std::vector<ShaderLight> Scene::getLightsShaderData()
 {
     std::vector<ShaderLight> lights;
     for (auto& light : m_lights) {
-        lights.emplace_back(light.getShaderLight());
+        const auto shaderLight = light.getShaderLight();
+        if (shaderLight.areaPrimitiveCount == 0) {
+            lights.emplace_back(shaderLight);
+            continue;
+        }
+        // One area light per instance of the emissive mesh, areaInstanceId is its mesh until here.
+        // Meshes split in several geometries have one instance per part, the light uses the first
+        for (uint32_t i = 0; i < instances.size(); ++i) {
+            if (instances[i].getMeshIdx() == shaderLight.areaInstanceId
+                && instances[i].getFirstIndex() == 0) {
+                lights.emplace_back(shaderLight);
+                lights.back().areaInstanceId = i;
+            }
+        }
     }
     return lights;
 }
 
-size_t Scene::getLightCount() { return m_lights.size(); }
+size_t Scene::getLightCount() { return getLightsShaderData().size(); }
 
 void Scene::loadMaterials(const aiScene* t_scene, VkQueue t_transferQueue)
 {
@@ -341,9 +1305,10 @@ void Scene::loadMaterials(const aiScene* t_scene, VkQueue t_transferQueue)
     std::cout << "\nLoading Materials..." << std::endl;
     const auto length = static_cast<float>(m_materials.size());
     for (size_t i = 0; i < m_materials.size(); ++i) {
-        m_materials[i] = Material(m_device, t_transferQueue, this, t_scene, t_scene->mMaterials[i]);
+        m_materials[i] = Material(this, t_scene, t_scene->mMaterials[i]);
         debug::printPercentage(i, length);
     }
+    loadPendingTextures(t_transferQueue);
 }
 
 std::vector<ShaderMaterial> Scene::getMaterialsShaderData()
@@ -351,6 +1316,13 @@ std::vector<ShaderMaterial> Scene::getMaterialsShaderData()
     std::vector<ShaderMaterial> materials;
     for (auto& material : m_materials) {
         materials.emplace_back(material.getShaderMaterial());
+        for (auto index : { &materials.back().diffuseMapIndex,
+                 &materials.back().normalMapIndex,
+                 &materials.back().emissiveMapIndex }) {
+            if (*index >= 0 && static_cast<size_t>(*index) < m_textureSlots.size()) {
+                *index = static_cast<int>(m_textureSlots[*index]);
+            }
+        }
     }
     return materials;
 }
@@ -359,27 +1331,71 @@ size_t Scene::getMaterialCount() { return m_materials.size(); }
 
 size_t Scene::getTexturesCount() { return textures.size(); }
 
+void Scene::registerTextures(DescriptorHeap* t_heap)
+{
+    assert(!m_descriptorHeap || m_descriptorHeap == t_heap);
+    m_descriptorHeap = t_heap;
+    for (size_t i = m_textureSlots.size(); i < textures.size(); ++i) {
+        m_textureSlots.push_back(t_heap->addTexture(textures[i].descriptor));
+    }
+}
+
 std::vector<ShaderMeshInstance> Scene::getInstancesShaderData()
 {
+    std::vector<VkDeviceAddress> vertexAddresses;
+    std::vector<VkDeviceAddress> indexAddresses;
+    for (auto& chunk : geometryChunks) {
+        vertexAddresses.push_back(chunk.vertices.buffer ? chunk.vertices.getDeviceAddress() : 0);
+        indexAddresses.push_back(chunk.indices.buffer ? chunk.indices.getDeviceAddress() : 0);
+    }
     std::vector<ShaderMeshInstance> dataInstances;
     for (auto& instance : instances) {
         auto mesh = meshes[instance.getMeshIdx()];
         ShaderMeshInstance vulkanMeshInstance {};
         vulkanMeshInstance.materialIndex = mesh.getMaterialIdx();
-        vulkanMeshInstance.vertexBase = mesh.getVertexBase();
-        vulkanMeshInstance.indexBase = mesh.getIndexBase();
+        vulkanMeshInstance.vertexAddress
+            = vertexAddresses[mesh.getChunk()] + mesh.getVertexOffset();
+        vulkanMeshInstance.indexAddress = indexAddresses[mesh.getChunk()] + mesh.getIndexOffset()
+            + uint64_t(instance.getFirstIndex()) * sizeof(uint32_t);
+        vulkanMeshInstance.transform = getShaderTransform(instance.getTransform());
         dataInstances.emplace_back(vulkanMeshInstance);
     }
     return dataInstances;
 }
 
+ShaderInstanceTransform Scene::getShaderTransform(const glm::mat4& t_transform)
+{
+    ShaderInstanceTransform shaderTransform {};
+    const auto normalTransform = glm::transpose(glm::inverse(glm::mat3(t_transform)));
+    for (int row = 0; row < 3; ++row) {
+        shaderTransform.objectToWorld[row] = glm::row(t_transform, row);
+        shaderTransform.normalToWorld[row] = glm::vec4(glm::row(normalTransform, row), 0.0f);
+    }
+    return shaderTransform;
+}
+
 size_t Scene::getInstancesCount() { return instances.size(); }
 
 void Scene::createMeshInstance(uint32_t t_blasIdx, uint32_t t_meshIdx)
 {
-    instances.emplace_back(Instance(t_blasIdx, t_meshIdx));
+    for (const auto& transform : m_meshTransforms[t_meshIdx]) {
+        instances.emplace_back(Instance(t_blasIdx, t_meshIdx, transform));
+    }
+}
+
+void Scene::createMeshInstance(
+    uint32_t t_blasIdx, uint32_t t_meshIdx, const glm::mat4& t_transform, uint32_t t_firstIndex)
+{
+    instances.emplace_back(Instance(t_blasIdx, t_meshIdx, t_transform, t_firstIndex));
 }
 
+const std::vector<glm::mat4>& Scene::getMeshTransforms(uint32_t t_meshIdx) const
+{
+    return m_meshTransforms[t_meshIdx];
+}
+
+uint64_t Scene::getContentKey() const { return m_contentKey; }
+
 bool Scene::isLoaded() { return m_loaded || m_error; }
 
 uint32_t Scene::getVertexLayoutStride() { return m_vertexLayout.stride(); }
@@ -20,7 +20,9 @@
 #include <vector>
 
 #include "../core/buffer.h"
+#include "../core/descriptor_heap.h"
 #include "../core/device.h"
+#include "../core/staging_ring.h"
 #include "../core/texture.h"
 #include "./shader_light.h"
 #include "camera.h"
@@ -28,7 +30,10 @@
 #include "light.h"
 #include "material.h"
 #include "mesh.h"
+#include "resource_registry.h"
+#include "scene_cache.h"
 #include "shader_instance.h"
+#include "texture_cache.h"
 #include "vulkan/vulkan.h"
 
 /** @brief Vertex layout components */
@@ -60,12 +65,34 @@ public:
     glm::vec3 scale;
     glm::vec2 uvScale;
     VkMemoryPropertyFlags memoryPropertyFlags = 0;
+    // Keep the node hierarchy instead of flattening it into world space geometry, meshes are then
+    // stored once and referenced by one instance per node (see Scene::createMeshInstance)
+    bool preserveHierarchy = false;
+    // Turn meshes that are transformed copies of another mesh back into instances of it, for the
+    // formats that flatten instancing (see instancing_recovery). Needs preserveHierarchy
+    bool recoverInstancing = false;
+    // Extra triangles the long thin triangles may be split into before the BVHs are built, 0
+    // disables the split. Triangles are split while their bounds have more than splitAreaRatio
+    // times their area, see triangle_splitting
+    uint32_t splitTriangleBudget = 0;
+    float splitAreaRatio = 32.0f;
     SceneCreateInfo();
     ~SceneCreateInfo();
     SceneCreateInfo(glm::vec3 t_scale, glm::vec2 t_uvScale, glm::vec3 t_center);
     SceneCreateInfo(float t_scale, float t_uvScale, float t_center);
 };
 
+/** @brief Vertex and index buffers of a run of consecutive meshes. The geometry is split in
+ * chunks so no single allocation has to hold all of it, shaders reach the meshes through the
+ * device addresses of their instances (see ShaderMeshInstance) */
+struct SceneGeometryChunk {
+    Buffer vertices;
+    Buffer indices;
+    // Offsets of the chunk in the vertex and index streams of the whole scene (the scene cache)
+    uint64_t vertexDataOffset = 0;
+    uint64_t indexDataOffset = 0;
+};
+
 class Scene {
 public:
     Scene();
@@ -75,10 +102,9 @@ public:
      * this function is NOT called by the destructor of the class */
     void destroy();
 
-    Buffer vertices;
-    Buffer indices;
-    uint32_t indexCount = 0;
-    uint32_t vertexCount = 0;
+    std::vector<SceneGeometryChunk> geometryChunks;
+    uint64_t indexCount = 0;
+    uint64_t vertexCount = 0;
 
     void draw(VkCommandBuffer t_commandBuffer, VkPipelineLayout t_pipelineLayout,
         uint32_t t_firstBinding) const;
@@ -106,20 +132,47 @@ public:
 
     size_t getTexturesCount();
 
+    /** @brief Writes the textures that are not in t_heap yet to free slots of it, the texture
+     * indices of the materials shader data are then their slots. Call it again after loading more
+     * textures, destroy frees the slots */
+    void registerTextures(DescriptorHeap* t_heap);
+
+    /** @brief Creates one instance of the mesh for each node referencing it, all of them using the
+     * acceleration structure t_blasIdx */
     void createMeshInstance(uint32_t t_blasIdx, uint32_t t_meshIdx);
+    /** @brief Creates a single instance of the mesh whose triangles start at index t_firstIndex,
+     * for meshes built as several geometries */
+    void createMeshInstance(uint32_t t_blasIdx, uint32_t t_meshIdx, const glm::mat4& t_transform,
+        uint32_t t_firstIndex);
+    /** @brief Object to world transforms of the node instances of a mesh, a single identity when
+     * the hierarchy is not preserved. Meshes not referenced by any node have none */
+    const std::vector<glm::mat4>& getMeshTransforms(uint32_t t_meshIdx) const;
+    /** @brief Hash of the source model, of the files it references and of the load settings (the
+     * scene cache key), 0 if any of them could not be hashed */
+    uint64_t getContentKey() const;
     std::vector<ShaderMeshInstance> getInstancesShaderData();
+    /** @brief Shader side transforms of an instance with the object to world t_transform */
+    static ShaderInstanceTransform getShaderTransform(const glm::mat4& t_transform);
     size_t getInstancesCount();
 
     bool isLoaded();
 
     uint32_t getVertexLayoutStride();
 
+    /** @brief Queues an embedded texture to be decoded and uploaded by loadMaterials, returns the
+     * index it will have in textures. A texture already queued from the same source gets the same
+     * index, t_type decides the compressed format. Indices of textures with the same content are
+     * merged by loadMaterials, see Material::remapTextures */
+    int addEmbeddedTexture(const aiTexture* t_texture, TextureType t_type);
+
 private:
     static const int defaultFlags = aiProcess_FlipWindingOrder | aiProcess_PreTransformVertices
         | aiProcess_Triangulate | aiProcess_CalcTangentSpace | aiProcess_GenSmoothNormals
         | aiProcess_EmbedTextures | aiProcess_JoinIdenticalVertices
         | aiProcess_ValidateDataStructure;
 
+    static int getImportFlags(const SceneCreateInfo* t_createInfo);
+
     Device* m_device = nullptr;
 
     SceneVertexLayout m_vertexLayout;
@@ -131,11 +184,92 @@ private:
     std::vector<Light> m_lights;
     Camera m_camera;
 
-    void loadCamera(const aiScene* t_scene);
+    // Object to world transforms of the instances of each mesh, in the converted vertex space
+    std::vector<std::vector<glm::mat4>> m_meshTransforms;
+    uint64_t m_contentKey = 0;
+
+    /** @brief Moves the node instances of the meshes that are copies of another mesh to the
+     * source mesh, composed with the recovered transform, and fills t_copyOf */
+    void recoverInstancing(const aiScene* t_scene,
+        std::vector<std::vector<aiMatrix4x4>>& t_nodeTransforms, std::vector<int>& t_copyOf) const;
+
+    /** @brief Splits the long thin triangles of the meshes keeping their own geometry, the
+     * budget is shared between meshes by the bounds area of their candidate triangles, times
+     * their instance count */
+    void splitTriangles(const aiScene* t_scene, const std::vector<int>& t_copyOf,
+        uint32_t t_budget, float t_areaRatio) const;
+    /** @brief Whether every area light points to a different mesh and covers all of its
+     * triangles, a light that does not would sample missing or stale triangles */
+    bool hasConsistentAreaLights() const;
 
-    void loadLights(const aiScene* t_scene);
+    void loadCamera(const aiScene* t_scene, bool t_preserveHierarchy);
+
+    void loadLights(const aiScene* t_scene, bool t_preserveHierarchy);
 
     void loadMaterials(const aiScene* t_scene, VkQueue t_transferQueue);
+
+    struct PendingTexture {
+        const aiTexture* texture;
+        TextureType type;
+        uint64_t key;
+    };
+    // Unique embedded textures referenced by the materials, in index order
+    std::vector<PendingTexture> m_pendingTextures;
+    // Alpha grids of the loaded textures by index, only kept while the meshes are classified
+    std::vector<opacity_classifier::AlphaGrid> m_textureAlpha;
+
+    /** @brief Cooks (or reads from m_textureCache) the pending textures concurrently and uploads
+     * them in index order, textures with the same content as an earlier one are dropped */
+    void loadPendingTextures(VkQueue t_copyQueue);
+
+    // Deduplicated textures and shared samplers, see ResourceRegistry
+    ResourceRegistry m_resources;
+
+    // Heap the textures are registered in and slot of each of them, by index
+    DescriptorHeap* m_descriptorHeap = nullptr;
+    std::vector<uint32_t> m_textureSlots;
+
+    // Binary cache of the converted scene, see SceneCache
+    SceneCache m_cache;
+    // Cooked textures shared by every scene in the same directory, see TextureCache
+    TextureCache m_textureCache;
+
+    /** @brief Key of a texture in m_textureCache, covers its source data and cooking settings */
+    static uint64_t getTextureKey(const aiTexture* t_texture, TextureType t_type, bool t_compress);
+
+    /** @brief Decodes t_texture and builds its mip chain, block compressed if t_compress */
+    static TextureData cookTexture(const aiTexture* t_texture, TextureType t_type, bool t_compress);
+
+    static uint64_t getCacheKey(const std::string& t_modelPath, const SceneVertexLayout& t_layout,
+        const SceneCreateInfo* t_createInfo);
+
+    bool loadFromCache(const std::string& t_cachePath, uint64_t t_key,
+        VkBufferUsageFlags t_extraUsageFlags, VkQueue t_copyQueue);
+
+    void writeCache(const aiScene* t_scene, bool t_preserveHierarchy);
+
+    /** @brief Packs t_count vertices of t_mesh starting at t_first into t_output following
+     * t_layout, and grows t_bounds with their positions */
+    static void convertVertices(const aiMesh* t_mesh, uint32_t t_first, uint32_t t_count,
+        const SceneVertexLayout& t_layout, glm::vec3 t_scale, glm::vec2 t_uvScale,
+        glm::vec3 t_center, float* t_output, Dimension& t_bounds);
+
+    /** @brief Largest vertex or index buffer of a geometry chunk, a mesh larger than that gets a
+     * chunk of its own */
+    VkDeviceSize getGeometryChunkSize() const;
+
+    /** @brief Sizes of the vertex and index buffers of every geometry chunk, from the meshes.
+     * Returns false if the meshes of a chunk leave gaps or overlap or are out of chunk order */
+    bool getGeometryChunkSizes(
+        std::vector<VkDeviceSize>& t_vertexSizes, std::vector<VkDeviceSize>& t_indexSizes) const;
+
+    /** @brief Creates the device local vertex and index buffers of every geometry chunk */
+    void createGeometryChunks(const std::vector<VkDeviceSize>& t_vertexSizes,
+        const std::vector<VkDeviceSize>& t_indexSizes, VkBufferUsageFlags t_extraUsageFlags);
+
+    /** @brief Copies t_size bytes of host data to t_dst one staging chunk at a time */
+    static void uploadBuffer(
+        StagingRing& t_stagingRing, const uint8_t* t_data, VkDeviceSize t_size, Buffer& t_dst);
 };
 
 #endif // MANUEME_SCENE_H
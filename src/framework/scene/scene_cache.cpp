@@ -0,0 +1,258 @@
+/*
+ * Manuel Machado Copyright (C) 2021 This code is licensed under the MIT license (MIT)
+ * (http://opensource.org/licenses/MIT)
+ */
+
+#include "scene_cache.h"
+
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <type_traits>
+
+static_assert(std::is_trivially_copyable<SceneCacheHeader>::value, "Header is written raw");
+static_assert(std::is_trivially_copyable<ShaderMaterial>::value, "Materials are written raw");
+static_assert(std::is_trivially_copyable<ShaderLight>::value, "Lights are written raw");
+static_assert(
+    std::is_trivially_copyable<SceneCacheInstance>::value, "Instances are written raw");
+
+namespace {
+const char cacheMagic[8] = { 'M', 'N', 'M', 'S', 'C', 'E', 'N', 'E' };
+}
+
+SceneCache::SceneCache() = default;
+
+SceneCache::~SceneCache()
+{
+    abortWrite();
+    close();
+}
+
+std::string SceneCache::getCachePath(const std::string& t_modelPath)
+{
+    return t_modelPath + ".scenecache";
+}
+
+bool SceneCache::open(const std::string& t_path, uint64_t t_key)
+{
+    close();
+    if (!m_file.open(t_path)) {
+        return false;
+    }
+    if (m_file.size() < sizeof(SceneCacheHeader)) {
+        close();
+        return false;
+    }
+    m_header = reinterpret_cast<const SceneCacheHeader*>(m_file.data());
+    const auto& header = *m_header;
+    const bool valid = memcmp(header.magic, cacheMagic, sizeof(cacheMagic)) == 0
+        && header.version == version && header.key == t_key
+        && isInside(header.vertexOffset, header.vertexSize)
+        && isInside(header.indexOffset, header.indexSize)
+        && isInside(header.meshOffset, header.meshCount * sizeof(SceneCacheMesh))
+        && isInside(header.materialOffset, header.materialCount * sizeof(ShaderMaterial))
+        && isInside(header.lightOffset, header.lightCount * sizeof(ShaderLight))
+        && isInside(header.textureOffset, header.textureCount * sizeof(SceneCacheTexture))
+        && isInside(header.instanceOffset, header.instanceCount * sizeof(SceneCacheInstance));
+    if (!valid) {
+        close();
+        return false;
+    }
+    for (uint32_t i = 0; i < header.textureCount; ++i) {
+        if (!isInside(getTextures()[i].offset, getTextures()[i].size)) {
+            close();
+            return false;
+        }
+    }
+    return true;
+}
+
+void SceneCache::close()
+{
+    m_header = nullptr;
+    m_file.close();
+}
+
+bool SceneCache::isInside(uint64_t t_offset, uint64_t t_size) const
+{
+    return t_offset <= m_file.size() && t_size <= m_file.size() - t_offset;
+}
+
+const SceneCacheHeader& SceneCache::getHeader() const
+{
+    assert(m_header);
+    return *m_header;
+}
+
+const uint8_t* SceneCache::getVertexData() const { return m_file.data() + m_header->vertexOffset; }
+
+const uint8_t* SceneCache::getIndexData() const { return m_file.data() + m_header->indexOffset; }
+
+const SceneCacheMesh* SceneCache::getMeshes() const
+{
+    return reinterpret_cast<const SceneCacheMesh*>(m_file.data() + m_header->meshOffset);
+}
+
+const ShaderMaterial* SceneCache::getMaterials() const
+{
+    return reinterpret_cast<const ShaderMaterial*>(m_file.data() + m_header->materialOffset);
+}
+
+const ShaderLight* SceneCache::getLights() const
+{
+    return reinterpret_cast<const ShaderLight*>(m_file.data() + m_header->lightOffset);
+}
+
+const SceneCacheTexture* SceneCache::getTextures() const
+{
+    return reinterpret_cast<const SceneCacheTexture*>(m_file.data() + m_header->textureOffset);
+}
+
+const SceneCacheInstance* SceneCache::getInstances() const
+{
+    return reinterpret_cast<const SceneCacheInstance*>(m_file.data() + m_header->instanceOffset);
+}
+
+const uint8_t* SceneCache::getTextureData(const SceneCacheTexture& t_texture) const
+{
+    return m_file.data() + t_texture.offset;
+}
+
+bool SceneCache::beginWrite(const std::string& t_path, uint64_t t_key)
+{
+    abortWrite();
+    m_outputPath = t_path;
+    m_outputKey = t_key;
+    m_output.open(t_path + ".tmp", std::ios::binary | std::ios::trunc);
+    if (!m_output.is_open()) {
+        return false;
+    }
+    // The header is written last, once all the offsets are known
+    SceneCacheHeader header {};
+    m_outputEnd = 0;
+    append(&header, sizeof(header));
+    m_outputTextures.clear();
+    m_vertexOffset = m_vertexSize = m_indexOffset = m_indexSize = 0;
+    return m_output.good();
+}
+
+bool SceneCache::isWriting() const { return m_output.is_open(); }
+
+uint64_t SceneCache::append(const void* t_data, uint64_t t_size)
+{
+    const uint64_t offset = (m_outputEnd + sectionAlignment - 1) & ~(sectionAlignment - 1);
+    writeAt(offset, t_data, t_size);
+    m_outputEnd = offset + t_size;
+    return offset;
+}
+
+void SceneCache::writeAt(uint64_t t_offset, const void* t_data, uint64_t t_size)
+{
+    m_output.seekp(static_cast<std::streamoff>(t_offset));
+    if (t_size > 0) {
+        m_output.write(static_cast<const char*>(t_data), static_cast<std::streamsize>(t_size));
+    }
+}
+
+void SceneCache::addTexture(uint32_t t_width, uint32_t t_height, uint32_t t_format,
+    uint32_t t_mipLevels, const void* t_data, uint64_t t_size)
+{
+    if (!isWriting()) {
+        return;
+    }
+    SceneCacheTexture texture {};
+    texture.width = t_width;
+    texture.height = t_height;
+    texture.format = t_format;
+    texture.mipLevels = t_mipLevels;
+    texture.size = t_size;
+    texture.offset = append(t_data, t_size);
+    m_outputTextures.push_back(texture);
+}
+
+void SceneCache::reserveGeometry(uint64_t t_vertexSize, uint64_t t_indexSize)
+{
+    if (!isWriting()) {
+        return;
+    }
+    m_vertexSize = t_vertexSize;
+    m_vertexOffset = (m_outputEnd + sectionAlignment - 1) & ~(sectionAlignment - 1);
+    m_indexSize = t_indexSize;
+    m_indexOffset
+        = (m_vertexOffset + m_vertexSize + sectionAlignment - 1) & ~(sectionAlignment - 1);
+    m_outputEnd = m_indexOffset + m_indexSize;
+}
+
+void SceneCache::writeVertices(uint64_t t_offset, const void* t_data, uint64_t t_size)
+{
+    if (!isWriting()) {
+        return;
+    }
+    assert(t_offset + t_size <= m_vertexSize);
+    writeAt(m_vertexOffset + t_offset, t_data, t_size);
+}
+
+void SceneCache::writeIndices(uint64_t t_offset, const void* t_data, uint64_t t_size)
+{
+    if (!isWriting()) {
+        return;
+    }
+    assert(t_offset + t_size <= m_indexSize);
+    writeAt(m_indexOffset + t_offset, t_data, t_size);
+}
+
+bool SceneCache::endWrite(SceneCacheHeader t_header, const std::vector<SceneCacheMesh>& t_meshes,
+    const std::vector<ShaderMaterial>& t_materials, const std::vector<ShaderLight>& t_lights,
+    const std::vector<SceneCacheInstance>& t_instances)
+{
+    if (!isWriting()) {
+        return false;
+    }
+    memcpy(t_header.magic, cacheMagic, sizeof(cacheMagic));
+    t_header.version = version;
+    t_header.key = m_outputKey;
+    t_header.vertexOffset = m_vertexOffset;
+    t_header.vertexSize = m_vertexSize;
+    t_header.indexOffset = m_indexOffset;
+    t_header.indexSize = m_indexSize;
+    t_header.meshCount = static_cast<uint32_t>(t_meshes.size());
+    t_header.meshOffset = append(t_meshes.data(), t_meshes.size() * sizeof(SceneCacheMesh));
+    t_header.materialCount = static_cast<uint32_t>(t_materials.size());
+    t_header.materialOffset
+        = append(t_materials.data(), t_materials.size() * sizeof(ShaderMaterial));
+    t_header.lightCount = static_cast<uint32_t>(t_lights.size());
+    t_header.lightOffset = append(t_lights.data(), t_lights.size() * sizeof(ShaderLight));
+    t_header.textureCount = static_cast<uint32_t>(m_outputTextures.size());
+    t_header.textureOffset = append(m_outputTextures.data(),
+        m_outputTextures.size() * sizeof(SceneCacheTexture));
+    t_header.instanceCount = static_cast<uint32_t>(t_instances.size());
+    t_header.instanceOffset
+        = append(t_instances.data(), t_instances.size() * sizeof(SceneCacheInstance));
+    writeAt(0, &t_header, sizeof(t_header));
+
+    m_output.close();
+    if (m_output.fail()) {
+        abortWrite();
+        return false;
+    }
+    // Replace any previous cache only once the new one is complete
+    std::remove(m_outputPath.c_str());
+    if (std::rename((m_outputPath + ".tmp").c_str(), m_outputPath.c_str()) != 0) {
+        abortWrite();
+        return false;
+    }
+    m_outputTextures.clear();
+    return true;
+}
+
+void SceneCache::abortWrite()
+{
+    if (m_output.is_open()) {
+        m_output.close();
+    }
+    if (!m_outputPath.empty()) {
+        std::remove((m_outputPath + ".tmp").c_str());
+        m_outputPath.clear();
+    }
+    m_outputTextures.clear();
+}
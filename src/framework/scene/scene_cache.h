@@ -0,0 +1,163 @@
+/*
+ * Manuel Machado Copyright (C) 2021 This code is licensed under the MIT license (MIT)
+ * (http://opensource.org/licenses/MIT)
+ */
+
+#ifndef MANUEME_SCENE_CACHE_H
+#define MANUEME_SCENE_CACHE_H
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "../tools/mapped_file.h"
+#include "shader_light.h"
+#include "shader_material.h"
+
+/** @brief Mesh table entry, mirrors the fields of Mesh */
+struct SceneCacheMesh {
+    uint32_t idx;
+    uint32_t chunk;
+    uint64_t indexOffset;
+    uint64_t vertexOffset;
+    uint32_t indexBase;
+    uint32_t indexCount;
+    uint32_t vertexBase;
+    uint32_t vertexCount;
+    uint32_t materialIdx;
+    float boundsMin[3];
+    float boundsMax[3];
+    uint32_t opaqueIndexCount;
+};
+
+/** @brief Node instance of a mesh, transform is the column major object to world matrix */
+struct SceneCacheInstance {
+    uint32_t meshIdx;
+    float transform[16];
+};
+
+/** @brief Decoded texture payload, data is stored at offset from the start of the file */
+struct SceneCacheTexture {
+    uint32_t width;
+    uint32_t height;
+    uint32_t format; // VkFormat
+    uint32_t mipLevels; // Levels are stored tightly packed, largest first
+    uint64_t offset;
+    uint64_t size;
+};
+
+/** @brief Fixed size header at the start of every cache file */
+struct SceneCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t vertexStride;
+    uint64_t key;
+
+    uint64_t vertexCount;
+    uint64_t indexCount;
+    uint32_t meshCount;
+    uint32_t materialCount;
+    uint32_t lightCount;
+    uint32_t textureCount;
+    uint32_t instanceCount;
+
+    // Values of the first aiCamera in the source scene, if any
+    uint32_t hasCamera;
+    float cameraPosition[3];
+    float cameraLookAt[3];
+    float cameraUp[3];
+
+    float dimMin[3];
+    float dimMax[3];
+
+    uint64_t vertexOffset;
+    uint64_t vertexSize;
+    uint64_t indexOffset;
+    uint64_t indexSize;
+    uint64_t meshOffset;
+    uint64_t materialOffset;
+    uint64_t lightOffset;
+    uint64_t textureOffset;
+    uint64_t instanceOffset;
+};
+
+/** @brief Versioned binary cache of an imported scene. It stores the packed vertex and index
+ * streams in their final vertex layout (the geometry chunks of the scene one after the other),
+ * the mesh table, the shader materials and lights and the decoded textures, so that later loads
+ * are a single memory mapping of the file */
+class SceneCache {
+public:
+    // Increase when the layout of the file or of any of the stored structs changes
+    static constexpr uint32_t version = 6;
+
+    SceneCache();
+    ~SceneCache();
+
+    /** @brief Returns the cache file used for a given source model */
+    static std::string getCachePath(const std::string& t_modelPath);
+
+    /** @brief Maps a cache file, returns false if it is missing, corrupted, from another version
+     * or was generated with a different key */
+    bool open(const std::string& t_path, uint64_t t_key);
+
+    /** @brief Releases the file mapping */
+    void close();
+
+    const SceneCacheHeader& getHeader() const;
+    const uint8_t* getVertexData() const;
+    const uint8_t* getIndexData() const;
+    const SceneCacheMesh* getMeshes() const;
+    const ShaderMaterial* getMaterials() const;
+    const ShaderLight* getLights() const;
+    const SceneCacheTexture* getTextures() const;
+    const SceneCacheInstance* getInstances() const;
+    const uint8_t* getTextureData(const SceneCacheTexture& t_texture) const;
+
+    /** @brief Starts writing a new cache file, the content is written to a temporary file that
+     * replaces t_path once endWrite succeeds */
+    bool beginWrite(const std::string& t_path, uint64_t t_key);
+
+    bool isWriting() const;
+
+    /** @brief Appends a decoded texture, must be called in the same order textures are added to
+     * the scene */
+    void addTexture(uint32_t t_width, uint32_t t_height, uint32_t t_format, uint32_t t_mipLevels,
+        const void* t_data, uint64_t t_size);
+
+    /** @brief Reserves the space of the vertex and index streams, they can be then written in any
+     * order with writeVertices and writeIndices */
+    void reserveGeometry(uint64_t t_vertexSize, uint64_t t_indexSize);
+    void writeVertices(uint64_t t_offset, const void* t_data, uint64_t t_size);
+    void writeIndices(uint64_t t_offset, const void* t_data, uint64_t t_size);
+
+    /** @brief Writes the tables and the header and moves the file into place. Counts, camera,
+     * dimensions and stride are taken from t_header, offsets are filled by the cache */
+    bool endWrite(SceneCacheHeader t_header, const std::vector<SceneCacheMesh>& t_meshes,
+        const std::vector<ShaderMaterial>& t_materials, const std::vector<ShaderLight>& t_lights,
+        const std::vector<SceneCacheInstance>& t_instances);
+
+    /** @brief Drops a partially written file */
+    void abortWrite();
+
+private:
+    static constexpr uint64_t sectionAlignment = 16;
+
+    MappedFile m_file;
+    const SceneCacheHeader* m_header = nullptr;
+
+    std::ofstream m_output;
+    std::string m_outputPath;
+    uint64_t m_outputKey = 0;
+    uint64_t m_outputEnd = 0;
+    uint64_t m_vertexOffset = 0;
+    uint64_t m_vertexSize = 0;
+    uint64_t m_indexOffset = 0;
+    uint64_t m_indexSize = 0;
+    std::vector<SceneCacheTexture> m_outputTextures;
+
+    uint64_t append(const void* t_data, uint64_t t_size);
+    void writeAt(uint64_t t_offset, const void* t_data, uint64_t t_size);
+    bool isInside(uint64_t t_offset, uint64_t t_size) const;
+};
+
+#endif // MANUEME_SCENE_CACHE_H
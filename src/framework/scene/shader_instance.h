@@ -7,11 +7,22 @@
 #define MANUEME_VULKAN_INSTANCE_H
 
 #include <cstdint>
+#include <glm/glm.hpp>
+
+// Transforms of a ShaderMeshInstance, rewritten alone when the instance moves
+struct ShaderInstanceTransform {
+    glm::vec4 objectToWorld[3]; // Rows of the 3x4 object to world transform
+    glm::vec4 normalToWorld[3]; // Rows of its inverse transpose, w is unused
+};
 
 struct ShaderMeshInstance {
-    uint32_t indexBase; // this is the position of the index, not the real offset on the buffer
-    uint32_t vertexBase; // this is the position of the vertex, not the real offset on the buffer
+    uint64_t vertexAddress; // Device address of the first vertex of the mesh
+    uint64_t indexAddress; // Device address of the first index of the instance
     uint32_t materialIndex;
+    uint32_t pad0;
+    uint32_t pad1;
+    uint32_t pad2;
+    ShaderInstanceTransform transform;
 };
 
 #endif // MANUEME_VULKAN_INSTANCE_H
@@ -0,0 +1,125 @@
+/*
+ * Manuel Machado Copyright (C) 2021 This code is licensed under the MIT license (MIT)
+ * (http://opensource.org/licenses/MIT)
+ */
+
+#include "texture_cache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <thread>
+#include <type_traits>
+
+#include "../core/texture_compression.h"
+
+static_assert(std::is_trivially_copyable<TextureCacheHeader>::value, "Header is written raw");
+
+namespace {
+const char cacheMagic[8] = { 'M', 'N', 'M', 'T', 'E', 'X', 'T', 'R' };
+}
+
+std::string TextureCache::getCacheDirectory(const std::string& t_modelPath)
+{
+    return (std::filesystem::path(t_modelPath).parent_path() / ".texturecache").string();
+}
+
+bool TextureCache::create(const std::string& t_directory)
+{
+    std::error_code error;
+    std::filesystem::create_directories(t_directory, error);
+    m_directory = error ? std::string() : t_directory;
+    return !m_directory.empty();
+}
+
+std::string TextureCache::getPath(uint64_t t_key) const
+{
+    std::ostringstream name;
+    name << std::hex << t_key << ".tex";
+    return (std::filesystem::path(m_directory) / name.str()).string();
+}
+
+bool TextureCache::load(uint64_t t_key, TextureData& t_texture) const
+{
+    if (m_directory.empty()) {
+        return false;
+    }
+    std::ifstream file(getPath(t_key), std::ios::binary);
+    if (!file.is_open()) {
+        return false;
+    }
+    TextureCacheHeader header {};
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+    const auto format = static_cast<VkFormat>(header.format);
+    if (!file || memcmp(header.magic, cacheMagic, sizeof(cacheMagic)) != 0
+        || header.version != version || header.key != t_key || header.mipLevels == 0
+        || header.size
+            != texture_compression::getMipChainSize(
+                format, header.width, header.height, header.mipLevels)
+        || header.alphaGridWidth > header.width || header.alphaGridHeight > header.height) {
+        return false;
+    }
+    t_texture.width = header.width;
+    t_texture.height = header.height;
+    t_texture.mipLevels = header.mipLevels;
+    t_texture.format = format;
+    t_texture.data.resize(header.size);
+    file.read(reinterpret_cast<char*>(t_texture.data.data()),
+        static_cast<std::streamsize>(header.size));
+    auto& alpha = t_texture.alpha;
+    alpha = {};
+    if (header.alphaGridWidth > 0 && header.alphaGridHeight > 0) {
+        alpha.width = header.alphaGridWidth;
+        alpha.height = header.alphaGridHeight;
+        alpha.textureWidth = header.width;
+        alpha.textureHeight = header.height;
+        alpha.minAlpha.resize(size_t(alpha.width) * alpha.height);
+        file.read(reinterpret_cast<char*>(alpha.minAlpha.data()),
+            static_cast<std::streamsize>(alpha.minAlpha.size()));
+    }
+    return static_cast<bool>(file);
+}
+
+void TextureCache::store(uint64_t t_key, const TextureData& t_texture) const
+{
+    if (m_directory.empty()) {
+        return;
+    }
+    TextureCacheHeader header {};
+    memcpy(header.magic, cacheMagic, sizeof(cacheMagic));
+    header.version = version;
+    header.format = static_cast<uint32_t>(t_texture.format);
+    header.width = t_texture.width;
+    header.height = t_texture.height;
+    header.mipLevels = t_texture.mipLevels;
+    header.alphaGridWidth = t_texture.alpha.width;
+    header.alphaGridHeight = t_texture.alpha.height;
+    header.key = t_key;
+    header.size = t_texture.data.size();
+
+    // Two workers may cook the same source at the same time, each one writes its own file
+    const auto path = getPath(t_key);
+    std::ostringstream temporaryPath;
+    temporaryPath << path << "." << std::hash<std::thread::id>()(std::this_thread::get_id())
+                  << ".tmp";
+    {
+        std::ofstream file(temporaryPath.str(), std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(t_texture.data.data()),
+            static_cast<std::streamsize>(t_texture.data.size()));
+        file.write(reinterpret_cast<const char*>(t_texture.alpha.minAlpha.data()),
+            static_cast<std::streamsize>(t_texture.alpha.minAlpha.size()));
+        if (!file) {
+            file.close();
+            std::remove(temporaryPath.str().c_str());
+            return;
+        }
+    }
+    std::remove(path.c_str());
+    if (std::rename(temporaryPath.str().c_str(), path.c_str()) != 0) {
+        std::remove(temporaryPath.str().c_str());
+    }
+}
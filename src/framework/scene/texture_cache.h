@@ -0,0 +1,72 @@
+/*
+ * Manuel Machado Copyright (C) 2021 This code is licensed under the MIT license (MIT)
+ * (http://opensource.org/licenses/MIT)
+ */
+
+#ifndef MANUEME_TEXTURE_CACHE_H
+#define MANUEME_TEXTURE_CACHE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "opacity_classifier.h"
+#include "vulkan/vulkan.h"
+
+/** @brief Texture ready to be uploaded, every mip level tightly packed, largest first */
+struct TextureData {
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t mipLevels = 0;
+    VkFormat format = VK_FORMAT_UNDEFINED;
+    std::vector<uint8_t> data;
+    // Alpha of the source texels, empty for normal maps
+    opacity_classifier::AlphaGrid alpha;
+};
+
+/** @brief Fixed size header at the start of every cooked texture file */
+struct TextureCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t format; // VkFormat
+    uint32_t width;
+    uint32_t height;
+    uint32_t mipLevels;
+    uint32_t alphaGridWidth; // Grid stored after the data, 0 if none
+    uint32_t alphaGridHeight;
+    uint32_t pad;
+    uint64_t key;
+    uint64_t size;
+};
+
+/**
+ * @brief On disk cache of cooked textures (mip chain built and block compressed), one file per
+ * texture named after a hash of its source data. It lives in a directory next to the models, so
+ * scenes sharing textures share the files. Loading from it skips FreeImage and the encoders.
+ */
+class TextureCache {
+public:
+    // Bump when the encoders or the mip generation change
+    static constexpr uint32_t version = 2;
+
+    /** @brief Directory used for the textures of the model at t_modelPath */
+    static std::string getCacheDirectory(const std::string& t_modelPath);
+
+    /** @brief Sets the directory of the cache and creates it if needed, returns false if it cannot
+     * be created, the cache then does nothing */
+    bool create(const std::string& t_directory);
+
+    /** @brief Reads the texture stored for t_key, returns false if missing, corrupted or from
+     * another version */
+    bool load(uint64_t t_key, TextureData& t_texture) const;
+
+    /** @brief Writes t_texture for t_key, can be called from several threads at the same time */
+    void store(uint64_t t_key, const TextureData& t_texture) const;
+
+private:
+    std::string m_directory;
+
+    std::string getPath(uint64_t t_key) const;
+};
+
+#endif // MANUEME_TEXTURE_CACHE_H
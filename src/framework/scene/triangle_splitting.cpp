@@ -0,0 +1,339 @@
+/*
+ * Manuel Machado Copyright (C) 2021 This code is licensed under the MIT license (MIT)
+ * (http://opensource.org/licenses/MIT)
+ */
+
+#include "triangle_splitting.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <glm/glm.hpp>
+#include <numeric>
+#include <queue>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+glm::vec3 toGlm(const aiVector3D& t_vector) { return { t_vector.x, t_vector.y, t_vector.z }; }
+
+bool isSplittable(const aiMesh* t_mesh)
+{
+    return t_mesh->mPrimitiveTypes == aiPrimitiveType_TRIANGLE && t_mesh->mNumBones == 0
+        && t_mesh->mNumAnimMeshes == 0;
+}
+
+/** Surface area of the bounds of a triangle if it is more than t_areaRatio times the area of the
+ * triangle, 0 otherwise */
+float getSplitPriority(
+    const aiVector3D& t_a, const aiVector3D& t_b, const aiVector3D& t_c, float t_areaRatio)
+{
+    const auto a = toGlm(t_a);
+    const auto b = toGlm(t_b);
+    const auto c = toGlm(t_c);
+    const auto extent = glm::max(a, glm::max(b, c)) - glm::min(a, glm::min(b, c));
+    const float boundsArea
+        = 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+    const float area = 0.5f * glm::length(glm::cross(b - a, c - a));
+    // Degenerate triangles have nothing to gain
+    return area > 0.0f && boundsArea > t_areaRatio * area ? boundsArea : 0.0f;
+}
+
+uint64_t getEdgeKey(uint32_t t_a, uint32_t t_b)
+{
+    return uint64_t(std::min(t_a, t_b)) << 32 | std::max(t_a, t_b);
+}
+
+/** @brief Editable copy of the geometry of a mesh, with the triangles around every edge */
+class MeshSplitter {
+public:
+    MeshSplitter(const aiMesh* t_mesh, float t_areaRatio);
+
+    /** @brief Splits the candidates until the budget or the candidates run out */
+    uint32_t split(uint32_t t_budget);
+
+    /** @brief Replaces the vertices and faces of t_mesh */
+    void write(aiMesh* t_mesh) const;
+
+private:
+    struct Candidate {
+        float priority;
+        uint32_t face;
+        uint32_t version;
+        bool operator<(const Candidate& t_other) const { return priority < t_other.priority; }
+    };
+
+    float m_areaRatio;
+    std::vector<aiVector3D> m_positions;
+    std::vector<aiVector3D> m_normals;
+    std::vector<aiVector3D> m_tangents;
+    std::vector<aiVector3D> m_bitangents;
+    std::vector<aiVector3D> m_textureCoords[AI_MAX_NUMBER_OF_TEXTURECOORDS];
+    std::vector<aiColor4D> m_colors[AI_MAX_NUMBER_OF_COLOR_SETS];
+    // Vertices with the same position share an id, edges are matched by these ids
+    std::vector<uint32_t> m_positionIds;
+    uint32_t m_positionCount = 0;
+    std::vector<std::array<uint32_t, 3>> m_faces;
+    // Bumped when a face is split, older candidates of the face are stale
+    std::vector<uint32_t> m_versions;
+    std::unordered_map<uint64_t, std::vector<uint32_t>> m_edgeFaces;
+    std::priority_queue<Candidate> m_candidates;
+
+    void pushCandidate(uint32_t t_face);
+
+    uint32_t addMidpoint(uint32_t t_a, uint32_t t_b, uint32_t t_positionId);
+
+    /** @brief Splits edge t_edge of t_face and the other faces around it if they fit in t_budget,
+     * returns the number of faces added */
+    uint32_t splitEdge(uint32_t t_face, uint32_t t_edge, uint32_t t_budget);
+};
+
+MeshSplitter::MeshSplitter(const aiMesh* t_mesh, float t_areaRatio)
+    : m_areaRatio(t_areaRatio)
+{
+    const uint32_t vertexCount = t_mesh->mNumVertices;
+    const auto copy = [&](auto* t_array, auto& t_values) {
+        if (t_array) {
+            t_values.assign(t_array, t_array + vertexCount);
+        }
+    };
+    copy(t_mesh->mVertices, m_positions);
+    copy(t_mesh->mNormals, m_normals);
+    copy(t_mesh->mTangents, m_tangents);
+    copy(t_mesh->mBitangents, m_bitangents);
+    for (uint32_t i = 0; i < AI_MAX_NUMBER_OF_TEXTURECOORDS; ++i) {
+        copy(t_mesh->mTextureCoords[i], m_textureCoords[i]);
+    }
+    for (uint32_t i = 0; i < AI_MAX_NUMBER_OF_COLOR_SETS; ++i) {
+        copy(t_mesh->mColors[i], m_colors[i]);
+    }
+
+    // Positions are compared bitwise, NaNs included
+    std::vector<std::array<uint32_t, 3>> positionBits(vertexCount);
+    memcpy(positionBits.data(), m_positions.data(), vertexCount * sizeof(aiVector3D));
+    std::vector<uint32_t> sorted(vertexCount);
+    std::iota(sorted.begin(), sorted.end(), 0);
+    std::sort(sorted.begin(), sorted.end(), [&](uint32_t t_a, uint32_t t_b) {
+        return positionBits[t_a] < positionBits[t_b];
+    });
+    m_positionIds.resize(vertexCount);
+    for (uint32_t i = 0; i < vertexCount; ++i) {
+        if (i > 0 && positionBits[sorted[i]] != positionBits[sorted[i - 1]]) {
+            ++m_positionCount;
+        }
+        m_positionIds[sorted[i]] = m_positionCount;
+    }
+    ++m_positionCount;
+
+    m_faces.resize(t_mesh->mNumFaces);
+    m_versions.assign(t_mesh->mNumFaces, 0);
+    m_edgeFaces.reserve(size_t(t_mesh->mNumFaces) * 3 / 2);
+    for (uint32_t i = 0; i < t_mesh->mNumFaces; ++i) {
+        const auto indices = t_mesh->mFaces[i].mIndices;
+        m_faces[i] = { indices[0], indices[1], indices[2] };
+        const uint32_t ids[3]
+            = { m_positionIds[indices[0]], m_positionIds[indices[1]], m_positionIds[indices[2]] };
+        // Faces with a collapsed edge have no area, they are never split
+        if (ids[0] == ids[1] || ids[1] == ids[2] || ids[2] == ids[0]) {
+            continue;
+        }
+        for (uint32_t k = 0; k < 3; ++k) {
+            m_edgeFaces[getEdgeKey(ids[k], ids[(k + 1) % 3])].push_back(i);
+        }
+        pushCandidate(i);
+    }
+}
+
+void MeshSplitter::pushCandidate(uint32_t t_face)
+{
+    const auto& face = m_faces[t_face];
+    const float priority = getSplitPriority(
+        m_positions[face[0]], m_positions[face[1]], m_positions[face[2]], m_areaRatio);
+    if (priority > 0.0f) {
+        m_candidates.push({ priority, t_face, m_versions[t_face] });
+    }
+}
+
+uint32_t MeshSplitter::addMidpoint(uint32_t t_a, uint32_t t_b, uint32_t t_positionId)
+{
+    // The sum is commutative, the faces on the other side of a texture seam get the same position
+    const auto interpolate = [&](auto& t_values, bool t_normalize) {
+        if (t_values.empty()) {
+            return;
+        }
+        auto value = (t_values[t_a] + t_values[t_b]) * 0.5f;
+        if (t_normalize) {
+            const auto length = value.Length();
+            value = length > 0.0f ? value / length : t_values[t_a];
+        }
+        t_values.push_back(value);
+    };
+    interpolate(m_positions, false);
+    interpolate(m_normals, true);
+    interpolate(m_tangents, true);
+    interpolate(m_bitangents, true);
+    for (auto& textureCoords : m_textureCoords) {
+        interpolate(textureCoords, false);
+    }
+    for (auto& colors : m_colors) {
+        if (!colors.empty()) {
+            colors.push_back((colors[t_a] + colors[t_b]) * 0.5f);
+        }
+    }
+    m_positionIds.push_back(t_positionId);
+    return static_cast<uint32_t>(m_positions.size() - 1);
+}
+
+uint32_t MeshSplitter::splitEdge(uint32_t t_face, uint32_t t_edge, uint32_t t_budget)
+{
+    const auto& face = m_faces[t_face];
+    const uint32_t idA = m_positionIds[face[t_edge]];
+    const uint32_t idB = m_positionIds[face[(t_edge + 1) % 3]];
+    const auto edge = m_edgeFaces.find(getEdgeKey(idA, idB));
+    if (edge == m_edgeFaces.end() || edge->second.size() > t_budget) {
+        return 0;
+    }
+    const std::vector<uint32_t> shared = std::move(edge->second);
+    m_edgeFaces.erase(edge);
+
+    const uint32_t idMid = m_positionCount++;
+    // Faces sharing the same two vertices share the midpoint vertex too
+    std::vector<std::pair<uint64_t, uint32_t>> midpoints;
+    for (const auto faceIdx : shared) {
+        const auto vertices = m_faces[faceIdx];
+        uint32_t k = 0;
+        while (getEdgeKey(m_positionIds[vertices[k]], m_positionIds[vertices[(k + 1) % 3]])
+            != getEdgeKey(idA, idB)) {
+            ++k;
+        }
+        // Split x y z in x m z and m y z, both keep the winding of the face
+        const uint32_t x = vertices[k];
+        const uint32_t y = vertices[(k + 1) % 3];
+        const uint32_t z = vertices[(k + 2) % 3];
+        const auto vertexKey = getEdgeKey(x, y);
+        auto midpoint = std::find_if(midpoints.begin(),
+            midpoints.end(),
+            [&](const std::pair<uint64_t, uint32_t>& t_midpoint) {
+                return t_midpoint.first == vertexKey;
+            });
+        if (midpoint == midpoints.end()) {
+            midpoints.emplace_back(vertexKey, addMidpoint(x, y, idMid));
+            midpoint = midpoints.end() - 1;
+        }
+        const uint32_t m = midpoint->second;
+        const auto newFace = static_cast<uint32_t>(m_faces.size());
+        m_faces[faceIdx] = { x, m, z };
+        m_faces.push_back({ m, y, z });
+        m_versions.push_back(0);
+        ++m_versions[faceIdx];
+
+        const uint32_t idX = m_positionIds[x];
+        const uint32_t idY = m_positionIds[y];
+        const uint32_t idZ = m_positionIds[z];
+        m_edgeFaces[getEdgeKey(idX, idMid)].push_back(faceIdx);
+        m_edgeFaces[getEdgeKey(idMid, idY)].push_back(newFace);
+        auto& midZ = m_edgeFaces[getEdgeKey(idMid, idZ)];
+        midZ.push_back(faceIdx);
+        midZ.push_back(newFace);
+        auto& yz = m_edgeFaces[getEdgeKey(idY, idZ)];
+        std::replace(yz.begin(), yz.end(), faceIdx, newFace);
+
+        pushCandidate(faceIdx);
+        pushCandidate(newFace);
+    }
+    return static_cast<uint32_t>(shared.size());
+}
+
+uint32_t MeshSplitter::split(uint32_t t_budget)
+{
+    uint32_t added = 0;
+    while (!m_candidates.empty() && added < t_budget) {
+        const auto candidate = m_candidates.top();
+        m_candidates.pop();
+        if (candidate.version != m_versions[candidate.face]) {
+            continue;
+        }
+        const auto& face = m_faces[candidate.face];
+        uint32_t longest = 0;
+        float longestLength = 0.0f;
+        for (uint32_t k = 0; k < 3; ++k) {
+            const float length = (m_positions[face[(k + 1) % 3]] - m_positions[face[k]]).Length();
+            if (length > longestLength) {
+                longest = k;
+                longestLength = length;
+            }
+        }
+        added += splitEdge(candidate.face, longest, t_budget - added);
+    }
+    return added;
+}
+
+void MeshSplitter::write(aiMesh* t_mesh) const
+{
+    const auto replace = [](auto*& t_array, const auto& t_values) {
+        using Value = typename std::decay<decltype(t_values)>::type::value_type;
+        if (t_values.empty()) {
+            return;
+        }
+        delete[] t_array;
+        t_array = new Value[t_values.size()];
+        std::copy(t_values.begin(), t_values.end(), t_array);
+    };
+    replace(t_mesh->mVertices, m_positions);
+    replace(t_mesh->mNormals, m_normals);
+    replace(t_mesh->mTangents, m_tangents);
+    replace(t_mesh->mBitangents, m_bitangents);
+    for (uint32_t i = 0; i < AI_MAX_NUMBER_OF_TEXTURECOORDS; ++i) {
+        replace(t_mesh->mTextureCoords[i], m_textureCoords[i]);
+    }
+    for (uint32_t i = 0; i < AI_MAX_NUMBER_OF_COLOR_SETS; ++i) {
+        replace(t_mesh->mColors[i], m_colors[i]);
+    }
+    t_mesh->mNumVertices = static_cast<unsigned int>(m_positions.size());
+
+    delete[] t_mesh->mFaces;
+    t_mesh->mFaces = new aiFace[m_faces.size()];
+    for (size_t i = 0; i < m_faces.size(); ++i) {
+        t_mesh->mFaces[i].mNumIndices = 3;
+        t_mesh->mFaces[i].mIndices = new unsigned int[3];
+        std::copy(m_faces[i].begin(), m_faces[i].end(), t_mesh->mFaces[i].mIndices);
+    }
+    t_mesh->mNumFaces = static_cast<unsigned int>(m_faces.size());
+}
+
+}
+
+namespace triangle_splitting {
+
+double getSplitWeight(const aiMesh* t_mesh, float t_areaRatio)
+{
+    if (!isSplittable(t_mesh)) {
+        return 0.0;
+    }
+    double weight = 0.0;
+    for (uint32_t i = 0; i < t_mesh->mNumFaces; ++i) {
+        const auto indices = t_mesh->mFaces[i].mIndices;
+        weight += getSplitPriority(t_mesh->mVertices[indices[0]],
+            t_mesh->mVertices[indices[1]],
+            t_mesh->mVertices[indices[2]],
+            t_areaRatio);
+    }
+    return weight;
+}
+
+uint32_t splitMesh(aiMesh* t_mesh, uint32_t t_budget, float t_areaRatio)
+{
+    if (t_budget == 0 || t_mesh->mNumFaces == 0 || !isSplittable(t_mesh)) {
+        return 0;
+    }
+    MeshSplitter splitter(t_mesh, t_areaRatio);
+    const uint32_t added = splitter.split(t_budget);
+    if (added > 0) {
+        splitter.write(t_mesh);
+    }
+    return added;
+}
+
+} // namespace triangle_splitting
@@ -0,0 +1,34 @@
+/*
+ * Manuel Machado Copyright (C) 2021 This code is licensed under the MIT license (MIT)
+ * (http://opensource.org/licenses/MIT)
+ */
+
+#ifndef MANUEME_TRIANGLE_SPLITTING_H
+#define MANUEME_TRIANGLE_SPLITTING_H
+
+#include <assimp/scene.h>
+#include <cstdint>
+
+/**
+ * @brief Splits the long thin triangles of a mesh, whose bounding boxes are much larger than the
+ * triangles themselves and overlap in the BVH, before the geometry is converted. The longest edge
+ * of the worst triangle is split at its midpoint, together with every other triangle sharing it
+ * (also across texture seams, edges are matched by position) so the mesh stays watertight.
+ */
+namespace triangle_splitting {
+
+/** @brief Surface area of the bounds of the triangles of t_mesh that would be split, used to share
+ * a triangle budget between meshes. 0 when nothing would be split */
+double getSplitWeight(const aiMesh* t_mesh, float t_areaRatio);
+
+/**
+ * Splits, largest bounds first, the triangles whose bounds have more than t_areaRatio times their
+ * own area, adding at most t_budget triangles. New vertices interpolate every attribute of the
+ * edge they split. Only meshes made of triangles, without bones or morph targets, are split.
+ * Returns the number of triangles added
+ */
+uint32_t splitMesh(aiMesh* t_mesh, uint32_t t_budget, float t_areaRatio);
+
+} // namespace triangle_splitting
+
+#endif // MANUEME_TRIANGLE_SPLITTING_H
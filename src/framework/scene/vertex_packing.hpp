@@ -0,0 +1,328 @@
+/*
+ * Manuel Machado Copyright (C) 2021 This code is licensed under the MIT license (MIT)
+ * (http://opensource.org/licenses/MIT)
+ */
+
+#ifndef MANUEME_VERTEX_PACKING_HPP
+#define MANUEME_VERTEX_PACKING_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iterator>
+#include <vector>
+
+#include <assimp/mesh.h>
+#include <glm/glm.hpp>
+
+#include "scene.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MANUEME_VERTEX_PACKING_SSE 1
+#include <emmintrin.h>
+#else
+#define MANUEME_VERTEX_PACKING_SSE 0
+#endif
+
+// Vertex packing kernels specialized at compile time for a vertex layout. The runtime
+// SceneVertexLayout is matched against the known layouts once per scene, the inner loop of the
+// resulting kernel has no branches on the layout components.
+namespace vertex_packing {
+
+/** @brief Transform applied while packing, see SceneCreateInfo */
+struct Transform {
+    glm::vec3 scale;
+    glm::vec2 uvScale;
+    glm::vec3 center;
+};
+
+/** @brief Attribute streams of a mesh, missing optional streams are null and packed as zero */
+struct Source {
+    const aiVector3D* positions;
+    const aiVector3D* normals;
+    const aiVector3D* texCoords;
+    const aiVector3D* tangents;
+    const aiVector3D* bitangents;
+
+    explicit Source(const aiMesh* t_mesh)
+        : positions(t_mesh->mVertices)
+        , normals(t_mesh->mNormals)
+        , texCoords(t_mesh->HasTextureCoords(0) ? t_mesh->mTextureCoords[0] : nullptr)
+        , tangents(t_mesh->HasTangentsAndBitangents() ? t_mesh->mTangents : nullptr)
+        , bitangents(t_mesh->HasTangentsAndBitangents() ? t_mesh->mBitangents : nullptr)
+    {
+    }
+};
+
+#if MANUEME_VERTEX_PACKING_SSE
+using Lane = __m128;
+
+inline Lane set3(float t_x, float t_y, float t_z) { return _mm_set_ps(0.0f, t_z, t_y, t_x); }
+
+inline Lane load3(const aiVector3D& t_vector) { return set3(t_vector.x, t_vector.y, t_vector.z); }
+
+inline Lane mul(Lane t_a, Lane t_b) { return _mm_mul_ps(t_a, t_b); }
+
+inline Lane mulAdd(Lane t_a, Lane t_b, Lane t_c) { return _mm_add_ps(_mm_mul_ps(t_a, t_b), t_c); }
+
+inline Lane minLane(Lane t_a, Lane t_b) { return _mm_min_ps(t_a, t_b); }
+
+inline Lane maxLane(Lane t_a, Lane t_b) { return _mm_max_ps(t_a, t_b); }
+
+/** @brief Returns t_fallback if any of the xyz lanes of t_value is NaN, without branching */
+inline Lane replaceNaN(Lane t_value, Lane t_fallback)
+{
+    const int anyNaN = (_mm_movemask_ps(_mm_cmpunord_ps(t_value, t_value)) & 0x7) != 0;
+    const Lane mask = _mm_castsi128_ps(_mm_set1_epi32(-anyNaN));
+    return _mm_or_ps(_mm_and_ps(mask, t_fallback), _mm_andnot_ps(mask, t_value));
+}
+
+/** @brief Stores xyz, with t_wide the w lane is written too and must be overwritten later */
+template <bool t_wide>
+inline void store3(float* t_output, Lane t_value)
+{
+    if constexpr (t_wide) {
+        _mm_storeu_ps(t_output, t_value);
+    } else {
+        _mm_storel_pi(reinterpret_cast<__m64*>(t_output), t_value);
+        _mm_store_ss(t_output + 2, _mm_movehl_ps(t_value, t_value));
+    }
+}
+
+inline void store2(float* t_output, Lane t_value)
+{
+    _mm_storel_pi(reinterpret_cast<__m64*>(t_output), t_value);
+}
+
+inline void store4(float* t_output, Lane t_value) { _mm_storeu_ps(t_output, t_value); }
+
+inline glm::vec3 toVec3(Lane t_value)
+{
+    alignas(16) float values[4];
+    _mm_store_ps(values, t_value);
+    return glm::vec3(values[0], values[1], values[2]);
+}
+#else
+using Lane = glm::vec4;
+
+inline Lane set3(float t_x, float t_y, float t_z) { return Lane(t_x, t_y, t_z, 0.0f); }
+
+inline Lane load3(const aiVector3D& t_vector) { return set3(t_vector.x, t_vector.y, t_vector.z); }
+
+inline Lane mul(Lane t_a, Lane t_b) { return t_a * t_b; }
+
+inline Lane mulAdd(Lane t_a, Lane t_b, Lane t_c) { return t_a * t_b + t_c; }
+
+inline Lane minLane(Lane t_a, Lane t_b) { return glm::min(t_a, t_b); }
+
+inline Lane maxLane(Lane t_a, Lane t_b) { return glm::max(t_a, t_b); }
+
+inline Lane replaceNaN(Lane t_value, Lane t_fallback)
+{
+    const bool anyNaN = std::isnan(t_value.x) || std::isnan(t_value.y) || std::isnan(t_value.z);
+    return anyNaN ? t_fallback : t_value;
+}
+
+template <bool t_wide>
+inline void store3(float* t_output, Lane t_value)
+{
+    t_output[0] = t_value.x;
+    t_output[1] = t_value.y;
+    t_output[2] = t_value.z;
+}
+
+inline void store2(float* t_output, Lane t_value)
+{
+    t_output[0] = t_value.x;
+    t_output[1] = t_value.y;
+}
+
+inline void store4(float* t_output, Lane t_value)
+{
+    store3<false>(t_output, t_value);
+    t_output[3] = t_value.w;
+}
+
+inline glm::vec3 toVec3(Lane t_value) { return glm::vec3(t_value); }
+#endif
+
+/** @brief Transform values expanded to lanes once per kernel call */
+struct Constants {
+    Lane positionScale;
+    Lane positionOffset;
+    Lane normalSign;
+    Lane uvScale;
+    Lane tangentFallback;
+    Lane zero;
+
+    explicit Constants(const Transform& t_transform)
+        : positionScale(set3(t_transform.scale.x, -t_transform.scale.y, t_transform.scale.z))
+        , positionOffset(set3(t_transform.center.x, t_transform.center.y, t_transform.center.z))
+        , normalSign(set3(1.0f, -1.0f, 1.0f))
+        , uvScale(set3(t_transform.uvScale.s, t_transform.uvScale.t, 0.0f))
+        , tangentFallback(set3(1.0f, 1.0f, 1.0f))
+        , zero(set3(0.0f, 0.0f, 0.0f))
+    {
+    }
+};
+
+// Layout components. Each one packs a single vertex, t_wide is true when a component is followed
+// by another one in the same vertex, so it can store a full lane and let the next one overwrite
+// the extra float.
+struct Position {
+    static constexpr Component id = VERTEX_COMPONENT_POSITION;
+    static constexpr uint32_t floats = 3;
+    template <bool t_wide>
+    static void pack(const Constants& t_constants, const Source&, uint32_t, Lane t_position,
+        float* t_output)
+    {
+        store3<t_wide>(t_output,
+            mulAdd(t_position, t_constants.positionScale, t_constants.positionOffset));
+    }
+};
+
+struct Normal {
+    static constexpr Component id = VERTEX_COMPONENT_NORMAL;
+    static constexpr uint32_t floats = 3;
+    template <bool t_wide>
+    static void pack(const Constants& t_constants, const Source& t_source, uint32_t t_idx, Lane,
+        float* t_output)
+    {
+        const Lane normal = t_source.normals ? load3(t_source.normals[t_idx]) : t_constants.zero;
+        store3<t_wide>(t_output, mul(normal, t_constants.normalSign));
+    }
+};
+
+struct UV {
+    static constexpr Component id = VERTEX_COMPONENT_UV;
+    static constexpr uint32_t floats = 2;
+    template <bool t_wide>
+    static void pack(const Constants& t_constants, const Source& t_source, uint32_t t_idx, Lane,
+        float* t_output)
+    {
+        const Lane uv = t_source.texCoords ? load3(t_source.texCoords[t_idx]) : t_constants.zero;
+        store2(t_output, mul(uv, t_constants.uvScale));
+    }
+};
+
+struct Tangent {
+    static constexpr Component id = VERTEX_COMPONENT_TANGENT;
+    static constexpr uint32_t floats = 3;
+    template <bool t_wide>
+    static void pack(const Constants& t_constants, const Source& t_source, uint32_t t_idx, Lane,
+        float* t_output)
+    {
+        // Degenerated UVs make assimp generate NaN tangents
+        const Lane tangent = t_source.tangents
+            ? replaceNaN(load3(t_source.tangents[t_idx]), t_constants.tangentFallback)
+            : t_constants.zero;
+        store3<t_wide>(t_output, tangent);
+    }
+};
+
+struct Bitangent {
+    static constexpr Component id = VERTEX_COMPONENT_BITANGENT;
+    static constexpr uint32_t floats = 3;
+    template <bool t_wide>
+    static void pack(const Constants& t_constants, const Source& t_source, uint32_t t_idx, Lane,
+        float* t_output)
+    {
+        const Lane bitangent
+            = t_source.bitangents ? load3(t_source.bitangents[t_idx]) : t_constants.zero;
+        store3<t_wide>(t_output, bitangent);
+    }
+};
+
+struct DummyFloat {
+    static constexpr Component id = VERTEX_COMPONENT_DUMMY_FLOAT;
+    static constexpr uint32_t floats = 1;
+    template <bool t_wide>
+    static void pack(const Constants&, const Source&, uint32_t, Lane, float* t_output)
+    {
+        *t_output = 0.0f;
+    }
+};
+
+struct DummyVec4 {
+    static constexpr Component id = VERTEX_COMPONENT_DUMMY_VEC4;
+    static constexpr uint32_t floats = 4;
+    template <bool t_wide>
+    static void pack(const Constants& t_constants, const Source&, uint32_t, Lane, float* t_output)
+    {
+        store4(t_output, t_constants.zero);
+    }
+};
+
+/** @brief Packing kernel signature, packs t_count vertices starting at t_first and grows the
+ * t_min/t_max bounds with the untransformed positions */
+using PackFunction = void (*)(const aiMesh* t_mesh, uint32_t t_first, uint32_t t_count,
+    const Transform& t_transform, float* t_output, glm::vec3& t_min, glm::vec3& t_max);
+
+/** @brief Compile time vertex layout, generates a fully unrolled packing kernel */
+template <typename... Components>
+struct VertexLayout {
+    static constexpr uint32_t floatCount = (Components::floats + ...);
+    static constexpr uint32_t stride = floatCount * sizeof(float);
+
+    static bool matches(const std::vector<Component>& t_components)
+    {
+        const Component ids[] = { Components::id... };
+        return t_components.size() == sizeof...(Components)
+            && std::equal(std::begin(ids), std::end(ids), t_components.begin());
+    }
+
+    static void pack(const aiMesh* t_mesh, uint32_t t_first, uint32_t t_count,
+        const Transform& t_transform, float* t_output, glm::vec3& t_min, glm::vec3& t_max)
+    {
+        const Constants constants(t_transform);
+        const Source source(t_mesh);
+        Lane minBounds = set3(t_min.x, t_min.y, t_min.z);
+        Lane maxBounds = set3(t_max.x, t_max.y, t_max.z);
+        for (uint32_t j = t_first; j < t_first + t_count; ++j) {
+            const Lane position = load3(source.positions[j]);
+            minBounds = minLane(minBounds, position);
+            maxBounds = maxLane(maxBounds, position);
+            packComponents<Components...>(constants, source, j, position, t_output);
+            t_output += floatCount;
+        }
+        t_min = toVec3(minBounds);
+        t_max = toVec3(maxBounds);
+    }
+
+private:
+    template <typename First, typename... Rest>
+    static void packComponents(const Constants& t_constants, const Source& t_source, uint32_t t_idx,
+        Lane t_position, float* t_output)
+    {
+        // The last component can not store past its end, that float belongs to the next vertex
+        First::template pack<sizeof...(Rest) != 0>(t_constants, t_source, t_idx, t_position, t_output);
+        if constexpr (sizeof...(Rest) != 0) {
+            packComponents<Rest...>(t_constants, t_source, t_idx, t_position, t_output + First::floats);
+        }
+    }
+};
+
+// Layouts with a specialized kernel, any other layout falls back to the generic loader
+// Used by the three ray tracing applications (3 vec4 per vertex)
+using RayTracingLayout = VertexLayout<Position, Normal, Tangent, UV, DummyFloat>;
+using RasterLayout = VertexLayout<Position, Normal, UV>;
+using TangentSpaceLayout = VertexLayout<Position, Normal, UV, Tangent, Bitangent>;
+
+/** @brief Returns the specialized kernel for a runtime layout or nullptr if there is none */
+inline PackFunction findKernel(const std::vector<Component>& t_components)
+{
+    if (RayTracingLayout::matches(t_components)) {
+        return &RayTracingLayout::pack;
+    }
+    if (RasterLayout::matches(t_components)) {
+        return &RasterLayout::pack;
+    }
+    if (TangentSpaceLayout::matches(t_components)) {
+        return &TangentSpaceLayout::pack;
+    }
+    return nullptr;
+}
+
+} // namespace vertex_packing
+
+#endif // MANUEME_VERTEX_PACKING_HPP
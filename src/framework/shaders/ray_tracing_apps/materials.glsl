@@ -1,33 +1,54 @@
 #ifndef MATERIALS_GLSL
 #define MATERIALS_GLSL
 
-layout(binding = 0, set = MATERIALS_AND_TEXTURES_SET) uniform sampler2D textures[];
-layout(binding = 1, set = MATERIALS_AND_TEXTURES_SET) buffer _Materials { MaterialProperties m[]; }
-materials;
+// Bindless descriptor heap, the materials are in a fixed slot of its buffer array
+layout(binding = BINDLESS_TEXTURES_BINDING, set = MATERIALS_AND_TEXTURES_SET) uniform sampler2D
+    textures[];
+layout(binding = BINDLESS_BUFFERS_BINDING, set = MATERIALS_AND_TEXTURES_SET) buffer _Materials {
+    MaterialProperties m[];
+}
+materialBuffers[];
+#define materials materialBuffers[BINDLESS_MATERIALS_BUFFER]
+
+// Explicit LOD of a texture, lodBase comes from ray_cone_lod
+float get_texture_lod(const int textureIndex, const float lodBase)
+{
+    const ivec2 size = textureSize(textures[nonuniformEXT(textureIndex)], 0);
+    return lodBase + 0.5f * log2(float(size.x) * float(size.y));
+}
 
-vec4 get_surface_emissive(MaterialProperties material, vec2 hitUV)
+vec4 get_surface_emissive(MaterialProperties material, vec2 hitUV, float lodBase)
 {
     if (material.emissiveMapIndex >= 0) {
-        return texture(textures[nonuniformEXT(material.emissiveMapIndex)], hitUV);
+        return textureLod(textures[nonuniformEXT(material.emissiveMapIndex)],
+            hitUV,
+            get_texture_lod(material.emissiveMapIndex, lodBase));
     }
     return material.emissive;
 }
 
-vec4 get_surface_albedo(MaterialProperties material, vec2 hitUV)
+vec4 get_surface_albedo(MaterialProperties material, vec2 hitUV, float lodBase)
 {
     if (material.diffuseMapIndex >= 0) {
-        return texture(textures[nonuniformEXT(material.diffuseMapIndex)], hitUV);
+        return textureLod(textures[nonuniformEXT(material.diffuseMapIndex)],
+            hitUV,
+            get_texture_lod(material.diffuseMapIndex, lodBase));
     }
     return vec4(material.diffuse.rgb, material.opacity);
 }
 
-vec3 get_surface_normal(
-    const MaterialProperties material, const vec3 hitNormal, const mat3 TBN, const vec2 hitUV)
+vec3 get_surface_normal(const MaterialProperties material, const vec3 hitNormal, const mat3 TBN,
+    const vec2 hitUV, const float lodBase)
 {
     if (material.normalMapIndex >= 0) {
-        vec3 shadingNormal = texture(textures[nonuniformEXT(material.normalMapIndex)], hitUV).rgb;
-        shadingNormal = normalize(shadingNormal * 2.0 - 1.0);
-        return TBN * shadingNormal;
+        const float lod = get_texture_lod(material.normalMapIndex, lodBase);
+        // Only X and Y are read, BC5 normal maps do not store Z
+        vec3 shadingNormal;
+        shadingNormal.xy
+            = textureLod(textures[nonuniformEXT(material.normalMapIndex)], hitUV, lod).rg * 2.0
+            - 1.0;
+        shadingNormal.z = sqrt(max(0.0, 1.0 - dot(shadingNormal.xy, shadingNormal.xy)));
+        return TBN * normalize(shadingNormal);
     }
     return hitNormal;
 }
@@ -0,0 +1,38 @@
+/*
+ * Manuel Machado Copyright (C) 2021 This code is licensed under the MIT license (MIT)
+ * (http://opensource.org/licenses/MIT)
+ */
+
+#ifndef RAY_CONES_GLSL
+#define RAY_CONES_GLSL
+
+// Texture LOD selection with ray cones, every ray carries the width of its footprint at the
+// origin and the angle it grows with, both are kept in the RayPayload
+
+// Spread added to the cone by a diffuse bounce, it gets blurry fast so coarse mips are enough
+const float RAY_CONE_DIFFUSE_SPREAD = 0.1f;
+
+// Spread angle of the primary rays, projInverse[1][1] is tan(fovY / 2)
+float ray_cone_pixel_spread(const mat4 projInverse, const float height)
+{
+    return atan(2.0f * abs(projInverse[1][1]) / height);
+}
+
+// Returned for degenerate hits, far enough below any texture size term to clamp to mip 0
+const float RAY_CONE_LOD_FINEST = -1e4f;
+
+// Grazing hits get the footprint of this angle (about 89.94 degrees), a finite coarse LOD
+const float RAY_CONE_MIN_COS_THETA = 1e-3f;
+
+// Texture independent part of the LOD at a hit, get_texture_lod adds the texture size
+float ray_cone_lod(const float worldArea, const float uvArea, const float coneWidth,
+    const vec3 rayDirection, const vec3 normal)
+{
+    if (worldArea <= 0.0f || uvArea <= 0.0f || coneWidth <= 0.0f) {
+        return RAY_CONE_LOD_FINEST;
+    }
+    const float cosTheta = max(abs(dot(rayDirection, normal)), RAY_CONE_MIN_COS_THETA);
+    return 0.5f * log2(uvArea / worldArea) + log2(coneWidth / cosTheta);
+}
+
+#endif // RAY_CONES_GLSL
@@ -34,7 +34,8 @@ vec3 sample_area_light(in LightProperties light, in vec3 hitPoint, float minHitD
     if (areaMaterial.emissiveMapIndex >= 0) {
         vec2 lightUV = get_surface_uv(areaSurface);
         lightIntensity
-            = texture(textures[nonuniformEXT(areaMaterial.emissiveMapIndex)], lightUV).rgb;
+            = textureLod(textures[nonuniformEXT(areaMaterial.emissiveMapIndex)], lightUV, 0.0f)
+                  .rgb;
     } else {
         lightIntensity = areaMaterial.emissive.rgb;
     }
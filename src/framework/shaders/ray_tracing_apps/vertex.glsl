@@ -6,13 +6,23 @@
 #ifndef VERTEX_GLSL
 #define VERTEX_GLSL
 
-layout(binding = 0, set = VERTEX_SET) buffer Vertices { vec4 v[]; }
-vertices;
-layout(binding = 1, set = VERTEX_SET) buffer _Indices { uint i[]; }
-indices;
-layout(binding = 2, set = VERTEX_SET) readonly buffer _Instances { ShaderMeshInstance i[]; }
+// Needs GL_EXT_buffer_reference and GL_EXT_buffer_reference_uvec2. The geometry of the scene is
+// split in several buffers, every instance points to its vertices and indices
+layout(buffer_reference, std430, buffer_reference_align = 16) readonly buffer Vertices
+{
+    vec4 v[];
+};
+layout(buffer_reference, std430, buffer_reference_align = 4) readonly buffer Indices
+{
+    uint i[];
+};
+layout(binding = 0, set = VERTEX_SET) readonly buffer _Instances { ShaderMeshInstance i[]; }
 instanceInfo;
 
+// Entry of instanceInfo of the geometry hit, in hit shaders only. Every geometry of a BLAS has an
+// entry and the TLAS instances point to the first one of theirs in their custom index
+#define HIT_GEOMETRY_ID (gl_InstanceCustomIndexEXT + gl_GeometryIndexEXT)
+
 struct Vertex {
     vec3 pos;
     vec3 normal;
@@ -21,7 +31,7 @@ struct Vertex {
     float padding0;
 };
 
-Vertex unpack(const uint index)
+Vertex unpack(const Vertices vertices, const uint index)
 {
     vec4 d0 = vertices.v[3 * index];
     vec4 d1 = vertices.v[3 * index + 1];
@@ -42,21 +52,49 @@ struct Surface {
     Vertex v2;
 };
 
-Surface get_surface_instance(uint instanceId, uint primitiveId, vec2 sampleCoords)
+// Surface in object space, enough when only the texture coordinates are needed
+Surface get_surface_object(uint instanceId, uint primitiveId, vec2 sampleCoords)
 {
     Surface p;
-    uint indexBase = instanceInfo.i[instanceId].indexBase + (3 * primitiveId);
-    uint vertexBase = instanceInfo.i[instanceId].vertexBase;
-    const ivec3 index
-        = ivec3(indices.i[indexBase], indices.i[indexBase + 1], indices.i[indexBase + 2]);
-    p.v0 = unpack(vertexBase + index.x);
-    p.v1 = unpack(vertexBase + index.y);
-    p.v2 = unpack(vertexBase + index.z);
+    const Vertices vertices = Vertices(instanceInfo.i[instanceId].vertexAddress);
+    const Indices indices = Indices(instanceInfo.i[instanceId].indexAddress);
+    const uint indexBase = 3 * primitiveId;
+    const uvec3 index
+        = uvec3(indices.i[indexBase], indices.i[indexBase + 1], indices.i[indexBase + 2]);
+    p.v0 = unpack(vertices, index.x);
+    p.v1 = unpack(vertices, index.y);
+    p.v2 = unpack(vertices, index.z);
     p.barycentricCoords
         = vec3(1.0f - sampleCoords.x - sampleCoords.y, sampleCoords.x, sampleCoords.y);
     return p;
 }
 
+Vertex to_world(const ShaderMeshInstance instance, Vertex v)
+{
+    const vec4 pos = vec4(v.pos, 1.0f);
+    v.pos = vec3(dot(instance.objectToWorld[0], pos),
+        dot(instance.objectToWorld[1], pos),
+        dot(instance.objectToWorld[2], pos));
+    v.normal = normalize(vec3(dot(instance.normalToWorld[0].xyz, v.normal),
+        dot(instance.normalToWorld[1].xyz, v.normal),
+        dot(instance.normalToWorld[2].xyz, v.normal)));
+    v.tangent = normalize(vec3(dot(instance.objectToWorld[0].xyz, v.tangent),
+        dot(instance.objectToWorld[1].xyz, v.tangent),
+        dot(instance.objectToWorld[2].xyz, v.tangent)));
+    return v;
+}
+
+// Surface in world space
+Surface get_surface_instance(uint instanceId, uint primitiveId, vec2 sampleCoords)
+{
+    Surface p = get_surface_object(instanceId, primitiveId, sampleCoords);
+    const ShaderMeshInstance instance = instanceInfo.i[instanceId];
+    p.v0 = to_world(instance, p.v0);
+    p.v1 = to_world(instance, p.v1);
+    p.v2 = to_world(instance, p.v2);
+    return p;
+}
+
 vec3 get_surface_normal(const Surface s)
 {
 #ifdef FLAT_SHADING
@@ -101,4 +139,11 @@ float get_surface_area(const Surface s)
     return 0.5f * length(cross(s.v1.pos.xyz - s.v0.pos.xyz, s.v2.pos.xyz - s.v0.pos.xyz));
 }
 
+float get_surface_uv_area(const Surface s)
+{
+    const vec2 uv10 = s.v1.uv - s.v0.uv;
+    const vec2 uv20 = s.v2.uv - s.v0.uv;
+    return 0.5f * abs(uv10.x * uv20.y - uv20.x * uv10.y);
+}
+
 #endif // VERTEX_GLSL
@@ -29,4 +29,11 @@
 
 #define AS_FLAG_EVERYTHING 0xFF
 
+// Bindless descriptor heap (DescriptorHeap), its set holds the textures and storage buffers
+#define BINDLESS_TEXTURES_BINDING 0
+#define BINDLESS_BUFFERS_BINDING 1
+// Buffer slots of the heap with a fixed meaning, addBuffer hands out the ones after them
+#define BINDLESS_MATERIALS_BUFFER 0
+#define BINDLESS_RESERVED_BUFFERS 1
+
 #endif // COMMON_CONSTANTS_H
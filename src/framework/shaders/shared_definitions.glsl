@@ -19,16 +19,24 @@ struct RayPayload {
     int rayType; // RAY_TYPE_DIFFUSE 1, RAY_TYPE_REFRACTION 1, RAY_TYPE_REFLECTION 2, RAY_TYPE_MISS
                  // 3
     float hitDistance;
+    float coneWidth; // Ray cone footprint at the ray origin
+    float coneSpread; // Ray cone spread angle
 };
 
 struct RayPayloadShadow {
     float shadowAmount;
 };
 
+// Addresses are read as buffer references by vertex.glsl
 struct ShaderMeshInstance {
-    uint indexBase;
-    uint vertexBase;
+    uvec2 vertexAddress;
+    uvec2 indexAddress;
     uint materialIndex;
+    uint pad0;
+    uint pad1;
+    uint pad2;
+    vec4 objectToWorld[3]; // Rows of the 3x4 object to world transform
+    vec4 normalToWorld[3]; // Rows of its inverse transpose, w is unused
 };
 
 struct MaterialProperties {
@@ -0,0 +1,45 @@
+/*
+ * Manuel Machado Copyright (C) 2021 This code is licensed under the MIT license (MIT)
+ * (http://opensource.org/licenses/MIT)
+ */
+
+#ifndef MANUEME_MAPPED_FILE_H
+#define MANUEME_MAPPED_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/** @brief Read only memory mapping of a whole file */
+class MappedFile {
+public:
+    MappedFile();
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    /** @brief Maps the file at t_path, returns false if it does not exist or cannot be mapped */
+    bool open(const std::string& t_path);
+
+    /** @brief Unmaps the file, pointers returned by data() are no longer valid */
+    void close();
+
+    bool isOpen() const;
+
+    const uint8_t* data() const;
+
+    size_t size() const;
+
+private:
+    const uint8_t* m_data = nullptr;
+    size_t m_size = 0;
+#ifdef _WIN32
+    void* m_file = nullptr;
+    void* m_mapping = nullptr;
+#else
+    int m_fd = -1;
+#endif
+};
+
+#endif // MANUEME_MAPPED_FILE_H
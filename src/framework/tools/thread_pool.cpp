@@ -0,0 +1,113 @@
+/*
+ * Manuel Machado Copyright (C) 2021 This code is licensed under the MIT license (MIT)
+ * (http://opensource.org/licenses/MIT)
+ */
+
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+
+ThreadPool::ThreadPool(uint32_t t_threadCount)
+{
+    t_threadCount = std::max(t_threadCount, 1u);
+    m_workers.reserve(t_threadCount);
+    for (uint32_t i = 0; i < t_threadCount; ++i) {
+        m_workers.emplace_back(&ThreadPool::workerLoop, this);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_condition.notify_all();
+    for (auto& worker : m_workers) {
+        worker.join();
+    }
+}
+
+ThreadPool& ThreadPool::shared()
+{
+    static ThreadPool pool;
+    return pool;
+}
+
+uint32_t ThreadPool::getThreadCount() const { return static_cast<uint32_t>(m_workers.size()); }
+
+void ThreadPool::enqueue(std::function<void()> t_task)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_tasks.push(std::move(t_task));
+    }
+    m_condition.notify_one();
+}
+
+void ThreadPool::workerLoop()
+{
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_condition.wait(lock, [this] { return m_stop || !m_tasks.empty(); });
+            if (m_stop && m_tasks.empty()) {
+                return;
+            }
+            task = std::move(m_tasks.front());
+            m_tasks.pop();
+        }
+        task();
+    }
+}
+
+void ThreadPool::parallelFor(size_t t_count, const std::function<void(size_t)>& t_function)
+{
+    if (t_count == 0) {
+        return;
+    }
+
+    struct State {
+        std::atomic<size_t> next { 0 };
+        std::atomic<size_t> done { 0 };
+        std::mutex mutex;
+        std::condition_variable finished;
+        std::exception_ptr error;
+    };
+    auto state = std::make_shared<State>();
+
+    // Helpers that start after all the work has been taken return without touching t_function,
+    // so it is fine for them to outlive this call
+    auto run = [state, t_count, &t_function]() {
+        size_t processed = 0;
+        for (size_t i = state->next++; i < t_count; i = state->next++) {
+            try {
+                t_function(i);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                if (!state->error) {
+                    state->error = std::current_exception();
+                }
+            }
+            ++processed;
+        }
+        if (processed > 0 && (state->done += processed) == t_count) {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            state->finished.notify_all();
+        }
+    };
+
+    const auto helpers = std::min<size_t>(m_workers.size(), t_count - 1);
+    for (size_t i = 0; i < helpers; ++i) {
+        enqueue(run);
+    }
+    run();
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->finished.wait(lock, [&state, t_count] { return state->done == t_count; });
+    if (state->error) {
+        std::rethrow_exception(state->error);
+    }
+}
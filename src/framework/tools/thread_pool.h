@@ -0,0 +1,60 @@
+/*
+ * Manuel Machado Copyright (C) 2021 This code is licensed under the MIT license (MIT)
+ * (http://opensource.org/licenses/MIT)
+ */
+
+#ifndef MANUEME_THREAD_POOL_H
+#define MANUEME_THREAD_POOL_H
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+/** @brief Fixed size pool of worker threads used by the loaders */
+class ThreadPool {
+public:
+    explicit ThreadPool(uint32_t t_threadCount = std::thread::hardware_concurrency());
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    /** @brief Pool shared by the framework, sized to the hardware concurrency */
+    static ThreadPool& shared();
+
+    /** @brief Queues a task, the returned future holds its result or exception */
+    template <typename Function>
+    auto submit(Function&& t_function) -> std::future<decltype(t_function())>
+    {
+        using Result = decltype(t_function());
+        auto task
+            = std::make_shared<std::packaged_task<Result()>>(std::forward<Function>(t_function));
+        auto future = task->get_future();
+        enqueue([task]() { (*task)(); });
+        return future;
+    }
+
+    /** @brief Calls t_function(i) for every i in [0, t_count) and blocks until all of them are
+     * done. The calling thread takes work too, so it is safe to call from inside a task. The first
+     * exception thrown by t_function is rethrown on the calling thread */
+    void parallelFor(size_t t_count, const std::function<void(size_t)>& t_function);
+
+    uint32_t getThreadCount() const;
+
+private:
+    std::vector<std::thread> m_workers;
+    std::queue<std::function<void()>> m_tasks;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    bool m_stop = false;
+
+    void enqueue(std::function<void()> t_task);
+    void workerLoop();
+};
+
+#endif // MANUEME_THREAD_POOL_H
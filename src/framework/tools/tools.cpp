@@ -373,4 +373,35 @@ uint32_t alignedSize(uint32_t t_value, uint32_t t_alignment)
     return (t_value + t_alignment - 1) & ~(t_alignment - 1);
 }
 
+VkDeviceSize alignedVkSize(VkDeviceSize t_value, VkDeviceSize t_alignment)
+{
+    return (t_value + t_alignment - 1) & ~(t_alignment - 1);
+}
+
+uint64_t hashBytes(const void* t_data, size_t t_size, uint64_t t_seed)
+{
+    const auto bytes = static_cast<const uint8_t*>(t_data);
+    uint64_t hash = t_seed;
+    for (size_t i = 0; i < t_size; ++i) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+uint64_t hashFile(const std::string& t_path)
+{
+    std::ifstream file(t_path, std::ios::binary);
+    if (!file.is_open()) {
+        return 0;
+    }
+    uint64_t hash = hashBytes(nullptr, 0);
+    std::vector<char> chunk(1 << 20);
+    while (file) {
+        file.read(chunk.data(), static_cast<std::streamsize>(chunk.size()));
+        hash = hashBytes(chunk.data(), static_cast<size_t>(file.gcount()), hash);
+    }
+    return hash;
+}
+
 } // namespace tools
\ No newline at end of file
@@ -103,6 +103,13 @@ bool validateDeviceExtensionSupport(
     VkPhysicalDevice t_device, const std::vector<const char*>& t_extensionList);
 
 uint32_t alignedSize(uint32_t t_value, uint32_t t_alignment);
+VkDeviceSize alignedVkSize(VkDeviceSize t_value, VkDeviceSize t_alignment);
+
+/** @brief 64 bit FNV-1a hash of a memory range, pass a previous hash as seed to chain ranges */
+uint64_t hashBytes(const void* t_data, size_t t_size, uint64_t t_seed = 14695981039346656037ull);
+
+/** @brief Hashes the full content of a file, returns 0 if the file cannot be read */
+uint64_t hashFile(const std::string& t_path);
 
 } // namespace tools
 
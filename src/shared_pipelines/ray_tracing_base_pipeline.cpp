@@ -7,7 +7,12 @@
 #include "core/device.h"
 #include "scene/scene.h"
 #include "shaders/shared_constants.h"
+#include "tools/thread_pool.h"
 #include "tools/tools.h"
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
 #include <thread>
 #include <vector>
 
@@ -27,13 +32,30 @@ RayTracingBasePipeline::RayTracingBasePipeline(Device* t_vulkanDevice, uint32_t
 
 void RayTracingBasePipeline::getDeviceRayTracingProperties()
 {
+    m_deviceIdProperties = {};
+    m_deviceIdProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES;
+    m_accelerationStructureProperties = {};
+    m_accelerationStructureProperties.sType
+        = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_PROPERTIES_KHR;
+    m_accelerationStructureProperties.pNext = &m_deviceIdProperties;
     m_rayTracingPipelineProperties = {};
     m_rayTracingPipelineProperties.sType
         = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_PROPERTIES_KHR;
+    m_rayTracingPipelineProperties.pNext = &m_accelerationStructureProperties;
     VkPhysicalDeviceProperties2 deviceProps2 {};
     deviceProps2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
     deviceProps2.pNext = &m_rayTracingPipelineProperties;
     vkGetPhysicalDeviceProperties2(m_vulkanDevice->physicalDevice, &deviceProps2);
+
+    // Enabled by the base project whenever the device supports it
+    VkPhysicalDeviceAccelerationStructureFeaturesKHR accelerationStructureFeatures {};
+    accelerationStructureFeatures.sType
+        = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR;
+    VkPhysicalDeviceFeatures2 deviceFeatures2 {};
+    deviceFeatures2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    deviceFeatures2.pNext = &accelerationStructureFeatures;
+    vkGetPhysicalDeviceFeatures2(m_vulkanDevice->physicalDevice, &deviceFeatures2);
+    m_hostCommandsSupported = accelerationStructureFeatures.accelerationStructureHostCommands;
 }
 
 RayTracingBasePipeline::~RayTracingBasePipeline()
@@ -42,11 +64,46 @@ RayTracingBasePipeline::~RayTracingBasePipeline()
     vkDestroyPipelineLayout(m_device, m_pipelineLayout, nullptr);
     m_shaderBindingTable.destroy();
     m_topLevelAS.destroy();
+    m_tlasInstanceBuffer.destroy();
+    m_tlasScratchBuffer.destroy();
     for (auto& blas : m_bottomLevelAS) {
         blas.destroy();
     }
+    m_blasPool.destroy();
 };
 
+void RayTracingBasePipeline::setBlasScratchBudget(VkDeviceSize t_budget)
+{
+    m_blasScratchBudget = t_budget;
+}
+
+void RayTracingBasePipeline::setBlasClusterTarget(uint32_t t_triangles, float t_extent)
+{
+    m_blasClusterTriangles = t_triangles;
+    m_blasClusterExtent = t_extent;
+}
+
+void RayTracingBasePipeline::setOpaqueGeometry(bool t_enabled) { m_opaqueGeometry = t_enabled; }
+
+void RayTracingBasePipeline::setTriangleSplitting(uint32_t t_budget, float t_areaRatio)
+{
+    m_splitTriangleBudget = t_budget;
+    m_splitAreaRatio = t_areaRatio;
+}
+
+void RayTracingBasePipeline::setBlasBuildType(VkAccelerationStructureBuildTypeKHR t_buildType)
+{
+    m_blasBuildType = t_buildType;
+    if (m_blasBuildType != VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR
+        && (m_blasBuildType != VK_ACCELERATION_STRUCTURE_BUILD_TYPE_HOST_KHR
+            || !m_hostCommandsSupported)) {
+        std::cout << "\nWARNING: host acceleration structure builds are not supported, the BLASes "
+                     "are built on the device"
+                  << std::endl;
+        m_blasBuildType = VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR;
+    }
+}
+
 void RayTracingBasePipeline::createPipeline(
     std::vector<VkPipelineShaderStageCreateInfo> t_shaderStages,
     std::vector<VkRayTracingShaderGroupCreateInfoKHR> t_shaderGroups)
@@ -81,11 +138,28 @@ VkDeviceSize RayTracingBasePipeline::copyRTShaderIdentifier(uint8_t* t_data,
 }
 
 Scene* RayTracingBasePipeline::createRTScene(VkQueue t_queue, const std::string& t_modelPath,
-    SceneVertexLayout t_vertexLayout)
+    SceneVertexLayout t_vertexLayout, uint32_t t_framesInFlight)
 {
+    // One bit per frame in the dirty masks of the TLAS instances
+    if (t_framesInFlight == 0 || t_framesInFlight > 32) {
+        throw std::runtime_error("Frames in flight must be between 1 and 32");
+    }
+    m_tlasFrameCount = t_framesInFlight;
+
     // Models
     SceneCreateInfo modelCreateInfo(glm::vec3(1.0f), glm::vec3(1.0f), glm::vec3(0.0f));
     modelCreateInfo.memoryPropertyFlags = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+    // Host builds read the geometry back from the device
+    const bool hostBuild = m_blasBuildType == VK_ACCELERATION_STRUCTURE_BUILD_TYPE_HOST_KHR;
+    if (hostBuild) {
+        modelCreateInfo.memoryPropertyFlags |= VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    }
+    // Meshes are built once and instanced by every node referencing them, or by every copy of them
+    // for the formats that flatten instancing
+    modelCreateInfo.preserveHierarchy = true;
+    modelCreateInfo.recoverInstancing = true;
+    modelCreateInfo.splitTriangleBudget = m_splitTriangleBudget;
+    modelCreateInfo.splitAreaRatio = m_splitAreaRatio;
     auto scene = new Scene();
     std::thread loadSceneThread(&Scene::loadFromFile,
         scene,
@@ -100,80 +174,263 @@ Scene* RayTracingBasePipeline::createRTScene(VkQueue t_queue, const std::string&
     }
     std::cout << "\nGenerating acceleration structure..." << std::endl;
 
-    // One Geometry per blas for this scene
+    // Geometry layout shared by every mesh, the data of each one is addressed inside its chunk
     VkAccelerationStructureGeometryKHR geometry {};
     geometry.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR;
     geometry.geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR;
     geometry.geometry.triangles.sType
         = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR;
     geometry.geometry.triangles.vertexFormat = VK_FORMAT_R32G32B32_SFLOAT;
-    geometry.geometry.triangles.vertexData.deviceAddress = scene->vertices.getDeviceAddress();
     geometry.geometry.triangles.vertexStride = t_vertexLayout.stride();
-    geometry.geometry.triangles.maxVertex = scene->vertexCount;
     geometry.geometry.triangles.indexType = VK_INDEX_TYPE_UINT32;
-    geometry.geometry.triangles.indexData.deviceAddress = scene->indices.getDeviceAddress();
-    geometry.flags = VK_GEOMETRY_NO_DUPLICATE_ANY_HIT_INVOCATION_BIT_KHR;
-
-    std::vector<BlasCreateInfo> blases;
-    for (auto i = 0; i < scene->meshes.size(); ++i) {
-        const auto mesh = scene->meshes[i];
-        uint32_t primitiveCount = mesh.getIndexCount() / 3;
+    std::vector<Buffer> hostVertices;
+    std::vector<Buffer> hostIndices;
+    if (hostBuild) {
+        for (const auto& chunk : scene->geometryChunks) {
+            hostVertices.push_back(createHostCopy(t_queue, chunk.vertices));
+            hostIndices.push_back(createHostCopy(t_queue, chunk.indices));
+        }
+    }
+    const auto setMeshData = [&](const Mesh& t_mesh) {
+        auto& triangles = geometry.geometry.triangles;
+        // The indices are relative to the first vertex of the mesh
+        triangles.maxVertex = t_mesh.getVertexCount() > 0 ? t_mesh.getVertexCount() - 1 : 0;
+        if (hostBuild) {
+            triangles.vertexData.hostAddress
+                = static_cast<const uint8_t*>(hostVertices[t_mesh.getChunk()].mapped)
+                + t_mesh.getVertexOffset();
+            triangles.indexData.hostAddress
+                = static_cast<const uint8_t*>(hostIndices[t_mesh.getChunk()].mapped)
+                + t_mesh.getIndexOffset();
+        } else {
+            const auto& chunk = scene->geometryChunks[t_mesh.getChunk()];
+            triangles.vertexData.deviceAddress
+                = chunk.vertices.getDeviceAddress() + t_mesh.getVertexOffset();
+            triangles.indexData.deviceAddress
+                = chunk.indices.getDeviceAddress() + t_mesh.getIndexOffset();
+        }
+    };
 
-        // Skip meshes with less than 1 triangle (3 indices)
-        if (primitiveCount == 0) {
+    // Small meshes with a single node instance are merged with their neighbours, the others get
+    // a BLAS of their own instanced by every node referencing them
+    std::vector<uint32_t> clusterCandidates;
+    std::vector<std::vector<uint32_t>> clusters;
+    for (uint32_t i = 0; i < scene->meshes.size(); ++i) {
+        const uint32_t primitiveCount = scene->meshes[i].getIndexCount() / 3;
+        const auto& transforms = scene->getMeshTransforms(i);
+        // Skip meshes with less than 1 triangle (3 indices) and meshes no node references
+        if (primitiveCount == 0 || transforms.empty()) {
             continue;
         }
+        if (transforms.size() == 1 && primitiveCount < m_blasClusterTriangles) {
+            clusterCandidates.push_back(i);
+        } else {
+            clusters.push_back({ i });
+        }
+    }
+    const auto meshClusters = clusterMeshes(scene, clusterCandidates);
+    clusters.insert(clusters.end(), meshClusters.begin(), meshClusters.end());
 
-        VkAccelerationStructureBuildRangeInfoKHR meshOffsetInfo {};
-        meshOffsetInfo.primitiveCount = primitiveCount;
-        meshOffsetInfo.primitiveOffset = mesh.getIndexOffset();
-        meshOffsetInfo.firstVertex = mesh.getVertexBase();
-
-        BlasCreateInfo blas; // One blas per mesh. All the meshes are part of the same geometry with
-        // different offsets
-        blas.geomery = { geometry };
-        blas.meshes = { meshOffsetInfo };
-        blases.emplace_back(blas);
+    // Every geometry of a BLAS has its own entry in the scene instances, the TLAS instances point
+    // to the first one in their custom index and the hit shaders add gl_GeometryIndexEXT. Meshes
+    // with opaque triangles (moved to the front by the scene) are split in an opaque geometry and
+    // one for the rest
+    struct MeshPart {
+        uint32_t firstIndex;
+        uint32_t indexCount;
+        VkGeometryFlagsKHR flags;
+    };
+    const auto getMeshParts = [this](const Mesh& t_mesh) {
+        const uint32_t opaqueCount = m_opaqueGeometry ? t_mesh.getOpaqueIndexCount() : 0;
+        std::vector<MeshPart> parts;
+        if (opaqueCount > 0) {
+            parts.push_back({ 0, opaqueCount, VK_GEOMETRY_OPAQUE_BIT_KHR });
+        }
+        if (opaqueCount < t_mesh.getIndexCount()) {
+            parts.push_back({ opaqueCount,
+                t_mesh.getIndexCount() - opaqueCount,
+                VK_GEOMETRY_NO_DUPLICATE_ANY_HIT_INVOCATION_BIT_KHR });
+        }
+        return parts;
+    };
+    std::vector<BlasCreateInfo> blases;
+    std::vector<VkAccelerationStructureInstanceKHR> tlasInstances;
+    std::vector<TlasInstanceEntries> tlasInstanceEntries;
+    std::vector<glm::mat4> sceneInstanceTransforms;
+    std::vector<VkAabbPositionsKHR> tlasBounds;
+    std::vector<uint32_t> tlasInstanceBlas;
+    std::vector<VkTransformMatrixKHR> geometryTransforms;
+    std::vector<bool> mergedBlases;
+    uint32_t clusteredMeshes = 0;
+    uint64_t opaqueTriangles = 0;
+    uint64_t totalTriangles = 0;
+    for (const auto& cluster : clusters) {
+        const auto blasIdx = static_cast<uint32_t>(blases.size());
+        const auto firstEntry = static_cast<uint32_t>(scene->getInstancesCount());
+        const bool merged = cluster.size() > 1;
+        BlasCreateInfo blas;
+        VkAabbPositionsKHR blasBounds = { FLT_MAX, FLT_MAX, FLT_MAX, -FLT_MAX, -FLT_MAX, -FLT_MAX };
+        for (const auto meshIdx : cluster) {
+            const auto& mesh = scene->meshes[meshIdx];
+            VkAabbPositionsKHR meshBounds = { mesh.getBoundsMin().x,
+                mesh.getBoundsMin().y,
+                mesh.getBoundsMin().z,
+                mesh.getBoundsMax().x,
+                mesh.getBoundsMax().y,
+                mesh.getBoundsMax().z };
+            VkAccelerationStructureBuildRangeInfoKHR meshOffsetInfo {};
+            setMeshData(mesh);
+            if (merged) {
+                // Merged meshes are placed by the BLAS, their instance has no transform
+                meshOffsetInfo.transformOffset = static_cast<uint32_t>(
+                    geometryTransforms.size() * sizeof(VkTransformMatrixKHR));
+                geometryTransforms.push_back(
+                    toTransformMatrix(scene->getMeshTransforms(meshIdx).front()));
+                meshBounds = transformBounds(meshBounds, geometryTransforms.back());
+            }
+            blasBounds.minX = std::min(blasBounds.minX, meshBounds.minX);
+            blasBounds.minY = std::min(blasBounds.minY, meshBounds.minY);
+            blasBounds.minZ = std::min(blasBounds.minZ, meshBounds.minZ);
+            blasBounds.maxX = std::max(blasBounds.maxX, meshBounds.maxX);
+            blasBounds.maxY = std::max(blasBounds.maxY, meshBounds.maxY);
+            blasBounds.maxZ = std::max(blasBounds.maxZ, meshBounds.maxZ);
+            // The parts of a mesh share its data, they start at different indices
+            const auto& transform = scene->getMeshTransforms(meshIdx).front();
+            for (const auto& part : getMeshParts(mesh)) {
+                meshOffsetInfo.primitiveCount = part.indexCount / 3;
+                meshOffsetInfo.primitiveOffset = part.firstIndex * sizeof(uint32_t);
+                geometry.flags = part.flags;
+                blas.geomery.push_back(geometry);
+                blas.meshes.push_back(meshOffsetInfo);
+                if (merged) {
+                    scene->createMeshInstance(blasIdx, meshIdx, transform, part.firstIndex);
+                    sceneInstanceTransforms.push_back(transform);
+                }
+                if (part.flags & VK_GEOMETRY_OPAQUE_BIT_KHR) {
+                    opaqueTriangles += part.indexCount / 3;
+                }
+            }
+            totalTriangles += mesh.getIndexCount() / 3;
+        }
+        blases.push_back(blas);
+        mergedBlases.push_back(merged);
 
-        uint32_t blasIdx = static_cast<uint32_t>(blases.size() - 1);
-        scene->createMeshInstance(blasIdx, i);
+        VkAccelerationStructureInstanceKHR instance = {};
+        instance.mask = AS_FLAG_EVERYTHING;
+        instance.instanceShaderBindingTableRecordOffset = 0;
+        instance.flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR;
+        if (merged) {
+            clusteredMeshes += static_cast<uint32_t>(cluster.size());
+            instance.transform = toTransformMatrix(glm::mat4(1.0f));
+            instance.instanceCustomIndex = firstEntry;
+            tlasInstances.push_back(instance);
+            tlasInstanceEntries.push_back(
+                { firstEntry, static_cast<uint32_t>(blas.geomery.size()) });
+            tlasBounds.push_back(blasBounds);
+            tlasInstanceBlas.push_back(blasIdx);
+            continue;
+        }
+        // The entries of the geometries of every node instance follow each other
+        const auto meshIdx = cluster.front();
+        const auto parts = getMeshParts(scene->meshes[meshIdx]);
+        const auto& transforms = scene->getMeshTransforms(meshIdx);
+        for (uint32_t i = 0; i < transforms.size(); ++i) {
+            for (const auto& part : parts) {
+                scene->createMeshInstance(blasIdx, meshIdx, transforms[i], part.firstIndex);
+                sceneInstanceTransforms.push_back(glm::mat4(1.0f));
+            }
+            instance.transform = toTransformMatrix(transforms[i]);
+            instance.instanceCustomIndex = firstEntry + i * static_cast<uint32_t>(parts.size());
+            tlasInstances.push_back(instance);
+            tlasInstanceEntries.push_back(
+                { instance.instanceCustomIndex, static_cast<uint32_t>(parts.size()) });
+            tlasBounds.push_back(blasBounds);
+            tlasInstanceBlas.push_back(blasIdx);
+        }
     }
 
     if (blases.empty()) {
         throw std::runtime_error("No valid meshes found for acceleration structure");
     }
-    createBottomLevelAccelerationStructure(t_queue, blases);
-
-    VkTransformMatrixKHR transform = {
-        1.0f,
-        0.0f,
-        0.0f,
-        0.0f,
-        0.0f,
-        1.0f,
-        0.0f,
-        0.0f,
-        0.0f,
-        0.0f,
-        1.0f,
-        0.0f,
-    };
+    std::cout << "\nMerged " << clusteredMeshes << " small meshes into " << meshClusters.size()
+              << " BLAS (" << blases.size() << " BLAS and " << tlasInstances.size()
+              << " TLAS instances in total)" << std::endl;
+    if (m_opaqueGeometry) {
+        std::cout << opaqueTriangles << " of " << totalTriangles
+                  << " triangles built as opaque geometry ("
+                  << opaqueTriangles * 100 / std::max<uint64_t>(totalTriangles, 1) << "%)"
+                  << std::endl;
+    }
+
+    // Placement of the merged meshes, only read by the builds
+    Buffer geometryTransformBuffer;
+    if (!geometryTransforms.empty()) {
+        VkDeviceOrHostAddressConstKHR transformData {};
+        if (hostBuild) {
+            transformData.hostAddress = geometryTransforms.data();
+        } else {
+            MemoryCategoryScope category(MEMORY_CATEGORY_GEOMETRY);
+            geometryTransformBuffer.create(m_vulkanDevice,
+                VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR
+                    | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                geometryTransforms.size() * sizeof(VkTransformMatrixKHR),
+                geometryTransforms.data());
+            transformData.deviceAddress = geometryTransformBuffer.getDeviceAddress();
+        }
+        for (uint32_t i = 0; i < blases.size(); ++i) {
+            if (mergedBlases[i]) {
+                for (auto& blasGeometry : blases[i].geomery) {
+                    blasGeometry.geometry.triangles.transformData = transformData;
+                }
+            }
+        }
+    }
+    // BLASes serialized by a previous run are deserialized instead of built, as long as the driver
+    // can still use them. The TLAS references the BLAS addresses and is always built
+    const auto asCachePath = AccelerationStructureCache::getCachePath(t_modelPath);
+    const uint64_t asCacheKey
+        = scene->getContentKey() != 0 ? getBlasCacheKey(scene->getContentKey(), blases) : 0;
+    if (asCacheKey == 0
+        || !loadBottomLevelAccelerationStructures(t_queue,
+            asCachePath,
+            asCacheKey,
+            static_cast<uint32_t>(blases.size()))) {
+        createBottomLevelAccelerationStructure(t_queue, blases);
+        if (asCacheKey != 0) {
+            storeBottomLevelAccelerationStructures(t_queue, asCachePath, asCacheKey);
+        }
+    }
+    geometryTransformBuffer.destroy();
+    for (auto& buffer : hostVertices) {
+        buffer.destroy();
+    }
+    for (auto& buffer : hostIndices) {
+        buffer.destroy();
+    }
+
     TlasCreateInfo geometryInstances;
-    for (auto meshInstance : scene->instances) {
-        VkAccelerationStructureInstanceKHR instance = {};
-        instance.transform = transform;
-        instance.instanceCustomIndex = meshInstance.getBlasIdx();
-        instance.mask = AS_FLAG_EVERYTHING;
-        instance.instanceShaderBindingTableRecordOffset = 0;
-        instance.flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR;
-        instance.accelerationStructureReference
-            = m_bottomLevelAS[meshInstance.getBlasIdx()].getDeviceAddress();
-        geometryInstances.instances.push_back(instance);
-        geometryInstances.update = false;
+    for (uint32_t i = 0; i < tlasInstances.size(); ++i) {
+        tlasInstances[i].accelerationStructureReference
+            = m_bottomLevelAS[tlasInstanceBlas[i]].getDeviceAddress();
     }
+    geometryInstances.instances = tlasInstances;
+    geometryInstances.bounds = tlasBounds;
+    geometryInstances.update = false;
     createTopLevelAccelerationStructure(t_queue, geometryInstances);
+    m_scene = scene;
+    m_tlasInstanceEntries = std::move(tlasInstanceEntries);
+    m_sceneInstanceTransforms = std::move(sceneInstanceTransforms);
     debug::printPercentage(0, 1);
 
+    const auto memory = m_vulkanDevice->allocator->getStatistics();
+    std::cout << "\nDevice memory: " << (memory.usedBytes >> 20) << " of "
+              << (memory.blockBytes >> 20) << " MiB used by " << memory.allocationCount
+              << " allocations in " << memory.blockCount << " blocks ("
+              << static_cast<int>(memory.fragmentation * 100.0f) << "% of the free memory "
+              << "fragmented), " << memory.dedicatedCount << " dedicated allocations ("
+              << (memory.dedicatedBytes >> 20) << " MiB)" << std::endl;
+
     return scene;
 }
 
@@ -181,12 +438,12 @@ void RayTracingBasePipeline::createBottomLevelAccelerationStructure(VkQueue t_qu
     const std::vector<BlasCreateInfo>& t_blases)
 
 {
-    m_bottomLevelAS.resize(t_blases.size());
+    MemoryCategoryScope category(MEMORY_CATEGORY_BLAS);
     const auto blasCount = static_cast<uint32_t>(t_blases.size());
     std::vector<VkAccelerationStructureBuildGeometryInfoKHR> buildInfos(blasCount);
     for (uint32_t idx = 0; idx < blasCount; ++idx) {
         buildInfos[idx].sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
-        buildInfos[idx].flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR;
+        buildInfos[idx].flags = BlasCreateInfo::getBuildFlags(t_blases[idx].policy);
         buildInfos[idx].geometryCount = t_blases[idx].geomery.size();
         buildInfos[idx].pGeometries = t_blases[idx].geomery.data();
         buildInfos[idx].mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
@@ -194,7 +451,15 @@ void RayTracingBasePipeline::createBottomLevelAccelerationStructure(VkQueue t_qu
         buildInfos[idx].srcAccelerationStructure = VK_NULL_HANDLE;
     }
 
-    VkDeviceSize maxScratch { 0 };
+    // Sizes of every BLAS, they are placed one after the other in a single pooled buffer and get
+    // their own range of the scratch buffer
+    const VkDeviceSize scratchAlignment
+        = m_accelerationStructureProperties.minAccelerationStructureScratchOffsetAlignment;
+    std::vector<VkDeviceSize> asOffsets(blasCount);
+    std::vector<VkDeviceSize> asSizes(blasCount);
+    std::vector<VkDeviceSize> scratchSizes(blasCount);
+    VkDeviceSize poolSize = 0;
+    VkDeviceSize maxScratch = 0;
     for (uint32_t idx = 0; idx < blasCount; ++idx) {
         const auto meshCount = static_cast<uint32_t>(t_blases[idx].meshes.size());
         std::vector<uint32_t> maxPrimCount(meshCount);
@@ -205,7 +470,7 @@ void RayTracingBasePipeline::createBottomLevelAccelerationStructure(VkQueue t_qu
             VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR
         };
         vkGetAccelerationStructureBuildSizesKHR(m_device,
-            VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
+            m_blasBuildType,
             &buildInfos[idx],
             maxPrimCount.data(),
             &sizeInfo);
@@ -213,38 +478,160 @@ void RayTracingBasePipeline::createBottomLevelAccelerationStructure(VkQueue t_qu
         if (sizeInfo.accelerationStructureSize == 0) {
             throw std::runtime_error("Cannot create BLAS with zero size");
         }
+        if (sizeInfo.buildScratchSize == 0) {
+            throw std::runtime_error("Cannot create acceleration structure with zero scratch size");
+        }
+        asOffsets[idx] = poolSize;
+        asSizes[idx] = sizeInfo.accelerationStructureSize;
+        poolSize += tools::alignedVkSize(
+            sizeInfo.accelerationStructureSize, AccelerationStructure::placementAlignment);
+        scratchSizes[idx] = tools::alignedVkSize(sizeInfo.buildScratchSize, scratchAlignment);
+        maxScratch = glm::max(maxScratch, scratchSizes[idx]);
+    }
 
-        // Create acceleration structure object. Not yet bound to memory.
+    // Host builds write the structures through the host, they are moved to device local memory
+    // once built
+    const bool hostBuild = m_blasBuildType == VK_ACCELERATION_STRUCTURE_BUILD_TYPE_HOST_KHR;
+    for (auto& blas : m_bottomLevelAS) {
+        blas.destroy();
+    }
+    m_blasPool.destroy();
+    m_blasPool = Buffer();
+    m_blasPool.create(m_vulkanDevice,
+        VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR
+            | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+        hostBuild ? VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+                  : VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        poolSize);
+    m_bottomLevelAS.resize(blasCount);
+    for (uint32_t idx = 0; idx < blasCount; ++idx) {
         m_bottomLevelAS[idx] = AccelerationStructure(m_vulkanDevice,
             VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
-            sizeInfo);
+            asSizes[idx],
+            m_blasPool.buffer,
+            asOffsets[idx]);
         buildInfos[idx].dstAccelerationStructure = m_bottomLevelAS[idx].getHandle();
-        maxScratch = glm::max(maxScratch, sizeInfo.buildScratchSize);
     }
 
-    if (maxScratch == 0) {
-        throw std::runtime_error("Cannot create acceleration structure with zero scratch size");
+    // Split the builds in batches whose scratch ranges fit in the budget, a BLAS larger than the
+    // budget is built alone
+    std::vector<uint32_t> batchEnds;
+    std::vector<VkDeviceSize> scratchOffsets(blasCount);
+    VkDeviceSize scratchSize = 0;
+    VkDeviceSize batchScratch = 0;
+    for (uint32_t idx = 0; idx < blasCount; ++idx) {
+        if (batchScratch > 0 && batchScratch + scratchSizes[idx] > m_blasScratchBudget) {
+            batchEnds.push_back(idx);
+            batchScratch = 0;
+        }
+        scratchOffsets[idx] = batchScratch;
+        batchScratch += scratchSizes[idx];
+        scratchSize = glm::max(scratchSize, batchScratch);
     }
+    batchEnds.push_back(blasCount);
 
+    // The scratch address is not necessarily aligned, the slack lets it be realigned
     Buffer scratchBuffer;
-    scratchBuffer.create(m_vulkanDevice,
-        VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-        maxScratch);
-    VkCommandBuffer cmdBuffer
-        = m_vulkanDevice->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+    std::vector<uint8_t> hostScratch;
+    if (hostBuild) {
+        hostScratch.resize(scratchSize + scratchAlignment);
+        const auto hostScratchAddress = tools::alignedVkSize(
+            reinterpret_cast<VkDeviceSize>(hostScratch.data()), scratchAlignment);
+        for (uint32_t idx = 0; idx < blasCount; ++idx) {
+            buildInfos[idx].scratchData.hostAddress
+                = reinterpret_cast<void*>(hostScratchAddress + scratchOffsets[idx]);
+        }
+    } else {
+        MemoryCategoryScope scratchCategory(MEMORY_CATEGORY_SCRATCH);
+        scratchBuffer.create(m_vulkanDevice,
+            VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            scratchSize + scratchAlignment);
+        const VkDeviceAddress scratchAddress
+            = tools::alignedVkSize(scratchBuffer.getDeviceAddress(), scratchAlignment);
+        for (uint32_t idx = 0; idx < blasCount; ++idx) {
+            buildInfos[idx].scratchData.deviceAddress = scratchAddress + scratchOffsets[idx];
+        }
+    }
 
+    std::vector<const VkAccelerationStructureBuildRangeInfoKHR*> pBuildOffsets(blasCount);
+    std::vector<uint32_t> compactable;
+    std::vector<VkAccelerationStructureKHR> compactableHandles;
     for (uint32_t idx = 0; idx < blasCount; ++idx) {
-        const auto meshCount = t_blases[idx].meshes.size();
-        std::vector<const VkAccelerationStructureBuildRangeInfoKHR*> pBuildOffset(meshCount);
-        for (size_t infoIdx = 0; infoIdx < meshCount; ++infoIdx) {
-            pBuildOffset[infoIdx] = &t_blases[idx].meshes[infoIdx];
+        pBuildOffsets[idx] = t_blases[idx].meshes.data();
+        if (buildInfos[idx].flags & VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR) {
+            compactable.push_back(idx);
+            compactableHandles.push_back(buildInfos[idx].dstAccelerationStructure);
         }
-        buildInfos[idx].scratchData.deviceAddress = scratchBuffer.getDeviceAddress();
-        vkCmdBuildAccelerationStructuresKHR(cmdBuffer, 1, &buildInfos[idx], pBuildOffset.data());
+    }
+
+    const auto buildStart = std::chrono::high_resolution_clock::now();
+    if (hostBuild) {
+        uint32_t batchStart = 0;
+        for (const auto batchEnd : batchEnds) {
+            buildOnHost(batchEnd - batchStart, &buildInfos[batchStart], &pBuildOffsets[batchStart]);
+            batchStart = batchEnd;
+        }
+        // The structures are complete, their compacted sizes can be read straight away
+        std::vector<VkDeviceSize> compactedSizes(compactable.size());
+        if (!compactable.empty()) {
+            CHECK_RESULT(vkWriteAccelerationStructuresPropertiesKHR(m_device,
+                static_cast<uint32_t>(compactableHandles.size()),
+                compactableHandles.data(),
+                VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR,
+                compactedSizes.size() * sizeof(VkDeviceSize),
+                compactedSizes.data(),
+                sizeof(VkDeviceSize)));
+        }
+        const std::chrono::duration<double> buildTime
+            = std::chrono::high_resolution_clock::now() - buildStart;
+        std::cout << "\nBuilt " << blasCount << " BLAS on the host in " << batchEnds.size()
+                  << " batches and " << buildTime.count() * 1000.0 << " ms with "
+                  << ThreadPool::shared().getThreadCount() << " threads, " << (poolSize >> 20)
+                  << " MiB pool, " << (scratchSize >> 20) << " MiB scratch" << std::endl;
+        compactBottomLevelAccelerationStructures(
+            t_queue, compactable, compactedSizes, asSizes, true);
+        return;
+    }
 
-        // Since the scratch buffer is reused across builds, we need a barrier to ensure one build
-        // is finished before starting the next one
+    VkCommandBuffer cmdBuffer
+        = m_vulkanDevice->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+    // Compacted sizes, written once all the builds are done
+    VkQueryPool queryPool = VK_NULL_HANDLE;
+    if (!compactable.empty()) {
+        VkQueryPoolCreateInfo queryPoolCreateInfo { VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO };
+        queryPoolCreateInfo.queryType = VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR;
+        queryPoolCreateInfo.queryCount = static_cast<uint32_t>(compactable.size());
+        CHECK_RESULT(vkCreateQueryPool(m_device, &queryPoolCreateInfo, nullptr, &queryPool));
+        vkCmdResetQueryPool(cmdBuffer, queryPool, 0, queryPoolCreateInfo.queryCount);
+    }
+    uint32_t batchStart = 0;
+    for (const auto batchEnd : batchEnds) {
+        if (batchStart > 0) {
+            // The scratch ranges are reused by the next batch, its builds must wait for the
+            // previous ones to finish
+            VkMemoryBarrier barrier { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+            barrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+            barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR
+                | VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+            vkCmdPipelineBarrier(cmdBuffer,
+                VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                0,
+                1,
+                &barrier,
+                0,
+                nullptr,
+                0,
+                nullptr);
+        }
+        vkCmdBuildAccelerationStructuresKHR(cmdBuffer,
+            batchEnd - batchStart,
+            &buildInfos[batchStart],
+            &pBuildOffsets[batchStart]);
+        batchStart = batchEnd;
+    }
+    if (queryPool != VK_NULL_HANDLE) {
         VkMemoryBarrier barrier { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
         barrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
         barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
@@ -258,112 +645,746 @@ void RayTracingBasePipeline::createBottomLevelAccelerationStructure(VkQueue t_qu
             nullptr,
             0,
             nullptr);
+        vkCmdWriteAccelerationStructuresPropertiesKHR(cmdBuffer,
+            static_cast<uint32_t>(compactableHandles.size()),
+            compactableHandles.data(),
+            VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR,
+            queryPool,
+            0);
     }
     m_vulkanDevice->flushCommandBuffer(cmdBuffer, t_queue);
     scratchBuffer.destroy();
+
+    const std::chrono::duration<double> buildTime
+        = std::chrono::high_resolution_clock::now() - buildStart;
+    std::cout << "\nBuilt " << blasCount << " BLAS in " << batchEnds.size() << " batches and "
+              << buildTime.count() * 1000.0 << " ms, " << (poolSize >> 20) << " MiB pool, "
+              << (scratchSize >> 20) << " MiB scratch" << std::endl;
+
+    if (queryPool != VK_NULL_HANDLE) {
+        std::vector<VkDeviceSize> compactedSizes(compactable.size());
+        CHECK_RESULT(vkGetQueryPoolResults(m_device,
+            queryPool,
+            0,
+            static_cast<uint32_t>(compactedSizes.size()),
+            compactedSizes.size() * sizeof(VkDeviceSize),
+            compactedSizes.data(),
+            sizeof(VkDeviceSize),
+            VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+        vkDestroyQueryPool(m_device, queryPool, nullptr);
+        compactBottomLevelAccelerationStructures(
+            t_queue, compactable, compactedSizes, asSizes, false);
+    }
 }
 
-void RayTracingBasePipeline::createTopLevelAccelerationStructure(VkQueue t_queue,
-    TlasCreateInfo t_tlasCreateInfo)
+void RayTracingBasePipeline::buildOnHost(uint32_t t_count,
+    const VkAccelerationStructureBuildGeometryInfoKHR* t_buildInfos,
+    const VkAccelerationStructureBuildRangeInfoKHR* const* t_buildRanges)
 {
-    if (t_tlasCreateInfo.instances.empty()) {
-        throw std::runtime_error("Cannot create TLAS with zero instances");
+    // One deferred operation per BLAS, each one joined by as many workers of the pool as the
+    // driver can use, so the small BLASes and the parts of the large ones all run in parallel
+    auto& threadPool = ThreadPool::shared();
+    std::vector<VkDeferredOperationKHR> operations(t_count, VK_NULL_HANDLE);
+    std::vector<uint32_t> joins;
+    VkResult error = VK_SUCCESS;
+    for (uint32_t i = 0; i < t_count && error == VK_SUCCESS; ++i) {
+        CHECK_RESULT(vkCreateDeferredOperationKHR(m_device, nullptr, &operations[i]));
+        const VkResult result = vkBuildAccelerationStructuresKHR(
+            m_device, operations[i], 1, &t_buildInfos[i], &t_buildRanges[i]);
+        if (result == VK_OPERATION_DEFERRED_KHR) {
+            const uint32_t concurrency = std::min(
+                vkGetDeferredOperationMaxConcurrencyKHR(m_device, operations[i]),
+                threadPool.getThreadCount());
+            joins.insert(joins.end(), std::max(concurrency, 1u), i);
+        } else if (result != VK_OPERATION_NOT_DEFERRED_KHR && result != VK_SUCCESS) {
+            error = result;
+        }
+    }
+    // VK_THREAD_DONE_KHR only means the worker is no longer needed, the operation is complete once
+    // all of them are done. VK_THREAD_IDLE_KHR asks to join again later
+    threadPool.parallelFor(joins.size(), [&](size_t t_idx) {
+        while (vkDeferredOperationJoinKHR(m_device, operations[joins[t_idx]])
+            == VK_THREAD_IDLE_KHR) {
+            std::this_thread::yield();
+        }
+    });
+    for (const auto operation : operations) {
+        if (operation == VK_NULL_HANDLE) {
+            continue;
+        }
+        VkResult result = vkGetDeferredOperationResultKHR(m_device, operation);
+        while (result == VK_NOT_READY) {
+            vkDeferredOperationJoinKHR(m_device, operation);
+            result = vkGetDeferredOperationResultKHR(m_device, operation);
+        }
+        if (result != VK_SUCCESS && error == VK_SUCCESS) {
+            error = result;
+        }
+        vkDestroyDeferredOperationKHR(m_device, operation, nullptr);
+    }
+    if (error != VK_SUCCESS) {
+        throw std::runtime_error("Host BLAS build failed: " + tools::errorString(error));
+    }
+}
+
+void RayTracingBasePipeline::compactBottomLevelAccelerationStructures(VkQueue t_queue,
+    const std::vector<uint32_t>& t_compactable, const std::vector<VkDeviceSize>& t_compactedSizes,
+    const std::vector<VkDeviceSize>& t_sizes, bool t_relocate)
+{
+    MemoryCategoryScope category(MEMORY_CATEGORY_BLAS);
+    const auto blasCount = static_cast<uint32_t>(m_bottomLevelAS.size());
+    std::vector<VkDeviceSize> sizes = t_sizes;
+    std::vector<bool> compact(blasCount, false);
+    for (size_t i = 0; i < t_compactable.size(); ++i) {
+        if (t_compactedSizes[i] > 0 && t_compactedSizes[i] <= sizes[t_compactable[i]]) {
+            sizes[t_compactable[i]] = t_compactedSizes[i];
+            compact[t_compactable[i]] = true;
+        }
+    }
+    std::vector<VkDeviceSize> offsets(blasCount);
+    VkDeviceSize poolSize = 0;
+    for (uint32_t idx = 0; idx < blasCount; ++idx) {
+        offsets[idx] = poolSize;
+        poolSize += tools::alignedVkSize(sizes[idx], AccelerationStructure::placementAlignment);
+    }
+    const VkDeviceSize builtSize = m_blasPool.size;
+    if (poolSize >= builtSize && !t_relocate) {
+        return;
     }
 
-    // Buffer for instance data
-    VkDeviceSize instancesBufferSize
-        = sizeof(VkAccelerationStructureInstanceKHR) * t_tlasCreateInfo.instances.size();
+    Buffer pool;
+    pool.create(m_vulkanDevice,
+        VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR
+            | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        poolSize);
+    std::vector<AccelerationStructure> compacted(blasCount);
+    VkCommandBuffer cmdBuffer
+        = m_vulkanDevice->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+    for (uint32_t idx = 0; idx < blasCount; ++idx) {
+        compacted[idx] = AccelerationStructure(m_vulkanDevice,
+            VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
+            sizes[idx],
+            pool.buffer,
+            offsets[idx]);
+        VkCopyAccelerationStructureInfoKHR copyInfo {
+            VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_INFO_KHR
+        };
+        copyInfo.src = m_bottomLevelAS[idx].getHandle();
+        copyInfo.dst = compacted[idx].getHandle();
+        copyInfo.mode = compact[idx] ? VK_COPY_ACCELERATION_STRUCTURE_MODE_COMPACT_KHR
+                                     : VK_COPY_ACCELERATION_STRUCTURE_MODE_CLONE_KHR;
+        vkCmdCopyAccelerationStructureKHR(cmdBuffer, &copyInfo);
+    }
+    m_vulkanDevice->flushCommandBuffer(cmdBuffer, t_queue);
+
+    for (auto& blas : m_bottomLevelAS) {
+        blas.destroy();
+    }
+    m_blasPool.destroy();
+    m_bottomLevelAS = std::move(compacted);
+    m_blasPool = pool;
+    std::cout << "BLAS memory compacted from " << (builtSize >> 10) << " KiB to "
+              << (poolSize >> 10) << " KiB (" << 100.0 * double(poolSize) / double(builtSize)
+              << "%)" << std::endl;
+}
 
-    Buffer instancesBuffer;
-    instancesBuffer.create(m_vulkanDevice,
-        VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
-            | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
+Buffer RayTracingBasePipeline::createHostCopy(VkQueue t_queue, const Buffer& t_source)
+{
+    MemoryCategoryScope category(MEMORY_CATEGORY_STAGING);
+    Buffer copy;
+    copy.create(m_vulkanDevice,
+        VK_BUFFER_USAGE_TRANSFER_DST_BIT,
         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-        instancesBufferSize,
-        t_tlasCreateInfo.instances.data());
-
-    VkDeviceOrHostAddressConstKHR instanceDataDeviceAddress {};
-    instanceDataDeviceAddress.deviceAddress = instancesBuffer.getDeviceAddress();
-    VkAccelerationStructureGeometryKHR accelerationStructureGeometry {};
-    accelerationStructureGeometry.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR;
-    accelerationStructureGeometry.geometryType = VK_GEOMETRY_TYPE_INSTANCES_KHR;
-    accelerationStructureGeometry.geometry.instances.sType
-        = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR;
-    accelerationStructureGeometry.geometry.instances.arrayOfPointers = VK_FALSE;
-    accelerationStructureGeometry.geometry.instances.data = instanceDataDeviceAddress;
+        t_source.size);
+    VkCommandBuffer cmdBuffer
+        = m_vulkanDevice->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+    const VkBufferCopy region { 0, 0, t_source.size };
+    vkCmdCopyBuffer(cmdBuffer, t_source.buffer, copy.buffer, 1, &region);
+    VkMemoryBarrier barrier { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    vkCmdPipelineBarrier(cmdBuffer,
+        VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_PIPELINE_STAGE_HOST_BIT,
+        0,
+        1,
+        &barrier,
+        0,
+        nullptr,
+        0,
+        nullptr);
+    m_vulkanDevice->flushCommandBuffer(cmdBuffer, t_queue);
+    CHECK_RESULT(copy.map());
+    return copy;
+}
 
-    // Find sizes
-    VkAccelerationStructureBuildGeometryInfoKHR buildInfo {
-        VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR
-    };
-    buildInfo.flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR;
-    buildInfo.geometryCount = 1;
-    buildInfo.pGeometries = &accelerationStructureGeometry;
-    buildInfo.mode = t_tlasCreateInfo.update ? VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR
-                                             : VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
-    buildInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
-    buildInfo.srcAccelerationStructure = VK_NULL_HANDLE;
+VkTransformMatrixKHR RayTracingBasePipeline::toTransformMatrix(const glm::mat4& t_transform)
+{
+    // Row major 3x4 object to world transform
+    VkTransformMatrixKHR transform;
+    for (int row = 0; row < 3; ++row) {
+        for (int column = 0; column < 4; ++column) {
+            transform.matrix[row][column] = t_transform[column][row];
+        }
+    }
+    return transform;
+}
+
+std::vector<std::vector<uint32_t>> RayTracingBasePipeline::clusterMeshes(
+    const Scene* t_scene, const std::vector<uint32_t>& t_meshes) const
+{
+    std::vector<std::vector<uint32_t>> clusters;
+    if (t_meshes.empty()) {
+        return clusters;
+    }
+
+    // World space bounds of every mesh, from the corners of its bounds
+    std::vector<Scene::Dimension> bounds(t_meshes.size());
+    glm::vec3 centerMin(FLT_MAX);
+    glm::vec3 centerMax(-FLT_MAX);
+    for (size_t i = 0; i < t_meshes.size(); ++i) {
+        const auto& mesh = t_scene->meshes[t_meshes[i]];
+        const auto& transform = t_scene->getMeshTransforms(t_meshes[i]).front();
+        for (int corner = 0; corner < 8; ++corner) {
+            const glm::vec3 point = transform
+                * glm::vec4(corner & 1 ? mesh.getBoundsMax().x : mesh.getBoundsMin().x,
+                    corner & 2 ? mesh.getBoundsMax().y : mesh.getBoundsMin().y,
+                    corner & 4 ? mesh.getBoundsMax().z : mesh.getBoundsMin().z,
+                    1.0f);
+            bounds[i].min = glm::min(bounds[i].min, point);
+            bounds[i].max = glm::max(bounds[i].max, point);
+        }
+        const auto center = 0.5f * (bounds[i].min + bounds[i].max);
+        centerMin = glm::min(centerMin, center);
+        centerMax = glm::max(centerMax, center);
+    }
 
-    auto instanceCount = static_cast<uint32_t>(t_tlasCreateInfo.instances.size());
-    VkAccelerationStructureBuildSizesInfoKHR sizeInfo {
-        VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR
+    // Meshes are sorted along a Morton curve of their centers so neighbours end up next to each
+    // other, 10 bits per axis
+    const auto spreadBits = [](uint32_t t_value) {
+        t_value = (t_value | (t_value << 16)) & 0x030000FF;
+        t_value = (t_value | (t_value << 8)) & 0x0300F00F;
+        t_value = (t_value | (t_value << 4)) & 0x030C30C3;
+        t_value = (t_value | (t_value << 2)) & 0x09249249;
+        return t_value;
     };
-    vkGetAccelerationStructureBuildSizesKHR(m_device,
-        VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
-        &buildInfo,
-        &instanceCount,
-        &sizeInfo);
+    const auto centerExtent = glm::max(centerMax - centerMin, glm::vec3(FLT_MIN));
+    std::vector<std::pair<uint32_t, uint32_t>> order(t_meshes.size());
+    for (uint32_t i = 0; i < t_meshes.size(); ++i) {
+        const auto center = 0.5f * (bounds[i].min + bounds[i].max);
+        const glm::uvec3 cell = glm::min(
+            glm::uvec3((center - centerMin) / centerExtent * 1024.0f), glm::uvec3(1023));
+        const uint32_t code
+            = spreadBits(cell.x) | (spreadBits(cell.y) << 1) | (spreadBits(cell.z) << 2);
+        order[i] = { code, i };
+    }
+    std::sort(order.begin(), order.end());
 
-    if (sizeInfo.accelerationStructureSize == 0) {
-        throw std::runtime_error("Cannot create TLAS with zero size");
+    // Runs of the curve are cut when they reach the triangle target or when their bounds grow
+    // beyond a fraction of the scene, the curve jumps between distant cells at its high bits
+    const float maxExtent = m_blasClusterExtent * glm::length(t_scene->dim.size);
+    Scene::Dimension clusterBounds;
+    uint32_t clusterTriangles = 0;
+    for (const auto& entry : order) {
+        const auto meshIdx = t_meshes[entry.second];
+        const uint32_t triangles = t_scene->meshes[meshIdx].getIndexCount() / 3;
+        const auto grownMin = glm::min(clusterBounds.min, bounds[entry.second].min);
+        const auto grownMax = glm::max(clusterBounds.max, bounds[entry.second].max);
+        if (clusters.empty() || clusterTriangles + triangles > m_blasClusterTriangles
+            || glm::length(grownMax - grownMin) > maxExtent) {
+            clusters.emplace_back();
+            clusterBounds = bounds[entry.second];
+            clusterTriangles = 0;
+        } else {
+            clusterBounds.min = grownMin;
+            clusterBounds.max = grownMax;
+        }
+        clusters.back().push_back(meshIdx);
+        clusterTriangles += triangles;
     }
+    return clusters;
+}
 
-    if (sizeInfo.buildScratchSize == 0) {
-        throw std::runtime_error("Cannot create TLAS scratch buffer with zero size");
+uint64_t RayTracingBasePipeline::getBlasCacheKey(
+    uint64_t t_sceneKey, const std::vector<BlasCreateInfo>& t_blases)
+{
+    auto key = tools::hashBytes(&t_sceneKey, sizeof(t_sceneKey));
+    for (const auto& blas : t_blases) {
+        const uint32_t description[] = { static_cast<uint32_t>(blas.policy),
+            static_cast<uint32_t>(blas.geomery.size()),
+            static_cast<uint32_t>(blas.meshes.size()) };
+        key = tools::hashBytes(description, sizeof(description), key);
+        // Device addresses change between runs, only the layout of the inputs is hashed
+        for (const auto& geometry : blas.geomery) {
+            const auto& triangles = geometry.geometry.triangles;
+            const uint64_t layout[] = { static_cast<uint64_t>(geometry.geometryType),
+                static_cast<uint64_t>(geometry.flags),
+                static_cast<uint64_t>(triangles.transformData.deviceAddress != 0),
+                static_cast<uint64_t>(triangles.vertexFormat),
+                triangles.vertexStride,
+                triangles.maxVertex,
+                static_cast<uint64_t>(triangles.indexType) };
+            key = tools::hashBytes(layout, sizeof(layout), key);
+        }
+        key = tools::hashBytes(blas.meshes.data(),
+            blas.meshes.size() * sizeof(VkAccelerationStructureBuildRangeInfoKHR),
+            key);
     }
+    return key;
+}
 
-    // Create TLAS
-    if (t_tlasCreateInfo.update == false) {
-        m_topLevelAS = AccelerationStructure(m_vulkanDevice,
-            VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR,
-            sizeInfo);
-    } else {
-        buildInfo.srcAccelerationStructure = m_topLevelAS.getHandle();
+bool RayTracingBasePipeline::loadBottomLevelAccelerationStructures(
+    VkQueue t_queue, const std::string& t_path, uint64_t t_key, uint32_t t_count)
+{
+    AccelerationStructureCache cache;
+    if (!cache.open(t_path, t_key, m_deviceIdProperties.driverUUID)
+        || cache.getEntries().size() != t_count) {
+        return false;
     }
-    buildInfo.dstAccelerationStructure = m_topLevelAS.getHandle();
+    const auto loadStart = std::chrono::high_resolution_clock::now();
 
-    Buffer scratchBuffer;
-    scratchBuffer.create(m_vulkanDevice,
+    // The file is read straight into memory the device copies from
+    const auto alignment = AccelerationStructureCache::dataAlignment;
+    MemoryCategoryScope stagingCategory(MEMORY_CATEGORY_STAGING);
+    Buffer serialized;
+    serialized.create(m_vulkanDevice,
         VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        cache.getDataSize() + alignment);
+    CHECK_RESULT(serialized.map());
+    const VkDeviceAddress bufferAddress = serialized.getDeviceAddress();
+    const VkDeviceAddress dataAddress = tools::alignedVkSize(bufferAddress, alignment);
+    const auto data = static_cast<uint8_t*>(serialized.mapped) + (dataAddress - bufferAddress);
+    if (!cache.readData(data)) {
+        serialized.destroy();
+        return false;
+    }
+
+    // Every serialized structure starts with the driver and compatibility UUIDs, followed by its
+    // serialized and deserialized sizes
+    const auto& entries = cache.getEntries();
+    const size_t versionSize = 2 * VK_UUID_SIZE;
+    std::vector<VkDeviceSize> offsets(t_count);
+    std::vector<VkDeviceSize> sizes(t_count);
+    VkDeviceSize poolSize = 0;
+    for (uint32_t idx = 0; idx < t_count; ++idx) {
+        const uint8_t* blob = data + entries[idx].offset;
+        VkAccelerationStructureCompatibilityKHR compatibility
+            = VK_ACCELERATION_STRUCTURE_COMPATIBILITY_INCOMPATIBLE_KHR;
+        if (entries[idx].size >= versionSize + 2 * sizeof(uint64_t)) {
+            VkAccelerationStructureVersionInfoKHR versionInfo {
+                VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_VERSION_INFO_KHR
+            };
+            versionInfo.pVersionData = blob;
+            vkGetDeviceAccelerationStructureCompatibilityKHR(
+                m_device, &versionInfo, &compatibility);
+            memcpy(&sizes[idx], blob + versionSize + sizeof(uint64_t), sizeof(uint64_t));
+        }
+        if (compatibility != VK_ACCELERATION_STRUCTURE_COMPATIBILITY_COMPATIBLE_KHR
+            || sizes[idx] == 0) {
+            std::cout << "\nAcceleration structure cache is not compatible with this driver, "
+                         "rebuilding"
+                      << std::endl;
+            serialized.destroy();
+            return false;
+        }
+        offsets[idx] = poolSize;
+        poolSize += tools::alignedVkSize(sizes[idx], AccelerationStructure::placementAlignment);
+    }
+
+    for (auto& blas : m_bottomLevelAS) {
+        blas.destroy();
+    }
+    m_blasPool.destroy();
+    MemoryCategoryScope blasCategory(MEMORY_CATEGORY_BLAS);
+    m_blasPool = Buffer();
+    m_blasPool.create(m_vulkanDevice,
+        VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR
+            | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-        sizeInfo.buildScratchSize);
-    buildInfo.scratchData.deviceAddress = scratchBuffer.getDeviceAddress();
+        poolSize);
+    m_bottomLevelAS.resize(t_count);
+    VkCommandBuffer cmdBuffer
+        = m_vulkanDevice->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+    for (uint32_t idx = 0; idx < t_count; ++idx) {
+        m_bottomLevelAS[idx] = AccelerationStructure(m_vulkanDevice,
+            VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
+            sizes[idx],
+            m_blasPool.buffer,
+            offsets[idx]);
+        VkCopyMemoryToAccelerationStructureInfoKHR copyInfo {
+            VK_STRUCTURE_TYPE_COPY_MEMORY_TO_ACCELERATION_STRUCTURE_INFO_KHR
+        };
+        copyInfo.src.deviceAddress = dataAddress + entries[idx].offset;
+        copyInfo.dst = m_bottomLevelAS[idx].getHandle();
+        copyInfo.mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_DESERIALIZE_KHR;
+        vkCmdCopyMemoryToAccelerationStructureKHR(cmdBuffer, &copyInfo);
+    }
+    m_vulkanDevice->flushCommandBuffer(cmdBuffer, t_queue);
+    serialized.destroy();
+
+    const std::chrono::duration<double> loadTime
+        = std::chrono::high_resolution_clock::now() - loadStart;
+    std::cout << "\nLoaded " << t_count << " BLAS from the acceleration structure cache in "
+              << loadTime.count() * 1000.0 << " ms, " << (poolSize >> 20) << " MiB" << std::endl;
+    return true;
+}
+
+void RayTracingBasePipeline::storeBottomLevelAccelerationStructures(
+    VkQueue t_queue, const std::string& t_path, uint64_t t_key)
+{
+    const auto blasCount = static_cast<uint32_t>(m_bottomLevelAS.size());
+    std::vector<VkAccelerationStructureKHR> handles(blasCount);
+    for (uint32_t idx = 0; idx < blasCount; ++idx) {
+        handles[idx] = m_bottomLevelAS[idx].getHandle();
+    }
+
+    // Serialized sizes, the builds are already complete
+    VkQueryPoolCreateInfo queryPoolCreateInfo { VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO };
+    queryPoolCreateInfo.queryType = VK_QUERY_TYPE_ACCELERATION_STRUCTURE_SERIALIZATION_SIZE_KHR;
+    queryPoolCreateInfo.queryCount = blasCount;
+    VkQueryPool queryPool;
+    CHECK_RESULT(vkCreateQueryPool(m_device, &queryPoolCreateInfo, nullptr, &queryPool));
+    VkCommandBuffer cmdBuffer
+        = m_vulkanDevice->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+    vkCmdResetQueryPool(cmdBuffer, queryPool, 0, blasCount);
+    vkCmdWriteAccelerationStructuresPropertiesKHR(cmdBuffer,
+        blasCount,
+        handles.data(),
+        VK_QUERY_TYPE_ACCELERATION_STRUCTURE_SERIALIZATION_SIZE_KHR,
+        queryPool,
+        0);
+    m_vulkanDevice->flushCommandBuffer(cmdBuffer, t_queue);
+    std::vector<VkDeviceSize> serializedSizes(blasCount);
+    CHECK_RESULT(vkGetQueryPoolResults(m_device,
+        queryPool,
+        0,
+        blasCount,
+        serializedSizes.size() * sizeof(VkDeviceSize),
+        serializedSizes.data(),
+        sizeof(VkDeviceSize),
+        VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+    vkDestroyQueryPool(m_device, queryPool, nullptr);
+
+    const auto alignment = AccelerationStructureCache::dataAlignment;
+    std::vector<AccelerationStructureCacheEntry> entries(blasCount);
+    VkDeviceSize dataSize = 0;
+    for (uint32_t idx = 0; idx < blasCount; ++idx) {
+        entries[idx] = { dataSize, serializedSizes[idx] };
+        dataSize += tools::alignedVkSize(serializedSizes[idx], alignment);
+    }
+
+    MemoryCategoryScope category(MEMORY_CATEGORY_STAGING);
+    Buffer serialized;
+    serialized.create(m_vulkanDevice,
+        VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        dataSize + alignment);
+    CHECK_RESULT(serialized.map());
+    const VkDeviceAddress bufferAddress = serialized.getDeviceAddress();
+    const VkDeviceAddress dataAddress = tools::alignedVkSize(bufferAddress, alignment);
+    cmdBuffer = m_vulkanDevice->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+    for (uint32_t idx = 0; idx < blasCount; ++idx) {
+        VkCopyAccelerationStructureToMemoryInfoKHR copyInfo {
+            VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_TO_MEMORY_INFO_KHR
+        };
+        copyInfo.src = handles[idx];
+        copyInfo.dst.deviceAddress = dataAddress + entries[idx].offset;
+        copyInfo.mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_SERIALIZE_KHR;
+        vkCmdCopyAccelerationStructureToMemoryKHR(cmdBuffer, &copyInfo);
+    }
+    m_vulkanDevice->flushCommandBuffer(cmdBuffer, t_queue);
+
+    const auto data
+        = static_cast<const uint8_t*>(serialized.mapped) + (dataAddress - bufferAddress);
+    if (!AccelerationStructureCache::write(
+            t_path, t_key, m_deviceIdProperties.driverUUID, entries, data, dataSize)) {
+        std::cout << "\nWARNING: could not write the acceleration structure cache" << std::endl;
+    }
+    serialized.destroy();
+}
+
+void RayTracingBasePipeline::createTopLevelAccelerationStructure(VkQueue t_queue,
+    TlasCreateInfo t_tlasCreateInfo)
+{
+    if (t_tlasCreateInfo.instances.empty()) {
+        throw std::runtime_error("Cannot create TLAS with zero instances");
+    }
+    const bool update = t_tlasCreateInfo.update && m_topLevelAS.getHandle() != VK_NULL_HANDLE
+        && t_tlasCreateInfo.instances.size() == m_tlasInstances.size();
+    m_tlasInstances = t_tlasCreateInfo.instances;
+    m_tlasBounds = t_tlasCreateInfo.bounds;
+    const auto instanceCount = static_cast<uint32_t>(m_tlasInstances.size());
+
+    if (!update) {
+        MemoryCategoryScope category(MEMORY_CATEGORY_TLAS);
+        if (m_topLevelAS.getHandle() != VK_NULL_HANDLE) {
+            m_topLevelAS.destroy();
+        }
+        m_tlasInstanceBuffer.destroy();
+        m_tlasScratchBuffer.destroy();
 
-    VkAccelerationStructureBuildRangeInfoKHR accelerationStructureBuildRangeInfo {};
-    accelerationStructureBuildRangeInfo.primitiveCount = instanceCount;
-    accelerationStructureBuildRangeInfo.primitiveOffset = 0;
-    accelerationStructureBuildRangeInfo.firstVertex = 0;
-    accelerationStructureBuildRangeInfo.transformOffset = 0;
-    std::vector<VkAccelerationStructureBuildRangeInfoKHR*> accelerationBuildStructureRangeInfos
-        = { &accelerationStructureBuildRangeInfo };
+        // Instances of every frame in flight, persistently mapped
+        m_tlasInstanceBuffer = Buffer();
+        m_tlasInstanceBuffer.create(m_vulkanDevice,
+            VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
+                | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            sizeof(VkAccelerationStructureInstanceKHR) * instanceCount * m_tlasFrameCount);
+        CHECK_RESULT(m_tlasInstanceBuffer.map());
+
+        // Sizes of the TLAS and of the scratch, large enough for both builds and refits
+        VkAccelerationStructureGeometryKHR geometry = getTlasGeometry(0);
+        VkAccelerationStructureBuildGeometryInfoKHR buildInfo {
+            VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR
+        };
+        buildInfo.flags = tlasBuildFlags;
+        buildInfo.geometryCount = 1;
+        buildInfo.pGeometries = &geometry;
+        buildInfo.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
+        buildInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
+        VkAccelerationStructureBuildSizesInfoKHR sizeInfo {
+            VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR
+        };
+        vkGetAccelerationStructureBuildSizesKHR(m_device,
+            VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
+            &buildInfo,
+            &instanceCount,
+            &sizeInfo);
+        if (sizeInfo.accelerationStructureSize == 0) {
+            throw std::runtime_error("Cannot create TLAS with zero size");
+        }
+        if (sizeInfo.buildScratchSize == 0) {
+            throw std::runtime_error("Cannot create TLAS scratch buffer with zero size");
+        }
+        m_topLevelAS = AccelerationStructure(m_vulkanDevice,
+            VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR,
+            sizeInfo);
+
+        const VkDeviceSize scratchAlignment
+            = m_accelerationStructureProperties.minAccelerationStructureScratchOffsetAlignment;
+        MemoryCategoryScope scratchCategory(MEMORY_CATEGORY_SCRATCH);
+        m_tlasScratchBuffer = Buffer();
+        m_tlasScratchBuffer.create(m_vulkanDevice,
+            VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            std::max(sizeInfo.buildScratchSize, sizeInfo.updateScratchSize) + scratchAlignment);
+        m_tlasScratchAddress
+            = tools::alignedVkSize(m_tlasScratchBuffer.getDeviceAddress(), scratchAlignment);
+    }
+
+    // Every frame starts with all the instances written
+    auto mapped = static_cast<VkAccelerationStructureInstanceKHR*>(m_tlasInstanceBuffer.mapped);
+    for (uint32_t frame = 0; frame < m_tlasFrameCount; ++frame) {
+        memcpy(mapped + frame * instanceCount,
+            m_tlasInstances.data(),
+            sizeof(VkAccelerationStructureInstanceKHR) * instanceCount);
+    }
+    m_tlasDirtyFrames.assign(instanceCount, 0);
+    m_tlasDirty.assign(m_tlasFrameCount, {});
 
     // Acceleration structure needs to be build on the device
     VkCommandBuffer cmdBuffer
         = m_vulkanDevice->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
-    vkCmdBuildAccelerationStructuresKHR(cmdBuffer,
-        1,
-        &buildInfo,
-        accelerationBuildStructureRangeInfos.data());
+    recordTopLevelBuild(cmdBuffer,
+        update ? VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR
+               : VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR,
+        0);
+    m_vulkanDevice->flushCommandBuffer(cmdBuffer, t_queue);
+    if (!update) {
+        resetTlasDegradation();
+    }
+}
 
+void RayTracingBasePipeline::setTlasRebuildThreshold(float t_threshold)
+{
+    m_tlasRebuildThreshold = t_threshold;
+}
+
+uint32_t RayTracingBasePipeline::getTlasInstanceCount() const
+{
+    return static_cast<uint32_t>(m_tlasInstances.size());
+}
+
+glm::mat4 RayTracingBasePipeline::getInstanceTransform(uint32_t t_instanceIdx) const
+{
+    const auto& transform = m_tlasInstances.at(t_instanceIdx).transform;
+    glm::mat4 instanceTransform(1.0f);
+    for (int row = 0; row < 3; ++row) {
+        for (int column = 0; column < 4; ++column) {
+            instanceTransform[column][row] = transform.matrix[row][column];
+        }
+    }
+    return instanceTransform;
+}
+
+void RayTracingBasePipeline::setInstanceTransform(
+    uint32_t t_instanceIdx, const glm::mat4& t_transform)
+{
+    auto& instance = m_tlasInstances.at(t_instanceIdx);
+    instance.transform = toTransformMatrix(t_transform);
+
+    // The scene keeps the shading transforms, later uploads of its instances see the move
+    const auto& entries = m_tlasInstanceEntries[t_instanceIdx];
+    for (uint32_t entry = entries.first; entry < entries.first + entries.count; ++entry) {
+        m_scene->instances[entry].setTransform(t_transform * m_sceneInstanceTransforms[entry]);
+    }
+
+    // The instance buffer of every frame gets the new transform on its next update
+    for (uint32_t frame = 0; frame < m_tlasFrameCount; ++frame) {
+        if ((m_tlasDirtyFrames[t_instanceIdx] & (1u << frame)) == 0) {
+            m_tlasDirty[frame].push_back(t_instanceIdx);
+        }
+    }
+    m_tlasDirtyFrames[t_instanceIdx] = ~0u >> (32 - m_tlasFrameCount);
+
+    // Refits keep the tree built for the old positions, the nodes above a moved instance grow to
+    // cover both. The area the instance adds over its bounds at the last build estimates that loss
+    if (!m_tlasBounds.empty()) {
+        const auto bounds = transformBounds(m_tlasBounds[t_instanceIdx], instance.transform);
+        const auto& built = m_tlasBuiltBounds[t_instanceIdx];
+        const VkAabbPositionsKHR swept = { std::min(bounds.minX, built.minX),
+            std::min(bounds.minY, built.minY),
+            std::min(bounds.minZ, built.minZ),
+            std::max(bounds.maxX, built.maxX),
+            std::max(bounds.maxY, built.maxY),
+            std::max(bounds.maxZ, built.maxZ) };
+        const float degradation = getSurfaceArea(swept) - getSurfaceArea(built);
+        m_tlasDegradation += degradation - m_tlasInstanceDegradation[t_instanceIdx];
+        m_tlasInstanceDegradation[t_instanceIdx] = degradation;
+    }
+}
+
+bool RayTracingBasePipeline::recordTopLevelAccelerationStructureUpdate(
+    VkCommandBuffer t_commandBuffer, uint32_t t_frameIdx, const Buffer& t_sceneInstances)
+{
+    if (t_frameIdx >= m_tlasFrameCount) {
+        throw std::runtime_error("TLAS frame index out of range");
+    }
+    auto& dirty = m_tlasDirty[t_frameIdx];
+    if (dirty.empty()) {
+        return false;
+    }
+    // The GPU is done with the instances of this frame, only the ones that changed are written
+    const auto instanceCount = static_cast<uint32_t>(m_tlasInstances.size());
+    auto mapped = static_cast<VkAccelerationStructureInstanceKHR*>(m_tlasInstanceBuffer.mapped)
+        + t_frameIdx * instanceCount;
+    for (const auto idx : dirty) {
+        mapped[idx] = m_tlasInstances[idx];
+        m_tlasDirtyFrames[idx] &= ~(1u << t_frameIdx);
+    }
+
+    // Earlier frames may still trace against the TLAS and read the scene instances
     VkMemoryBarrier memoryBarrier = {};
     memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
     memoryBarrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR
         | VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
     memoryBarrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR
         | VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
-    vkCmdPipelineBarrier(cmdBuffer,
-        VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+    vkCmdPipelineBarrier(t_commandBuffer,
+        VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR
+            | VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+        VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR | VK_PIPELINE_STAGE_TRANSFER_BIT,
+        0,
+        1,
+        &memoryBarrier,
+        0,
+        0,
+        0,
+        0);
+
+    // The scene instances are shared by the frames, every frame writes the latest transforms
+    for (const auto idx : dirty) {
+        const auto& entries = m_tlasInstanceEntries[idx];
+        for (uint32_t entry = entries.first; entry < entries.first + entries.count; ++entry) {
+            const auto shaderTransform
+                = Scene::getShaderTransform(m_scene->instances[entry].getTransform());
+            vkCmdUpdateBuffer(t_commandBuffer,
+                t_sceneInstances.buffer,
+                entry * sizeof(ShaderMeshInstance) + offsetof(ShaderMeshInstance, transform),
+                sizeof(ShaderInstanceTransform),
+                &shaderTransform);
+        }
+    }
+    dirty.clear();
+    VkBufferMemoryBarrier instancesBarrier = {};
+    instancesBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    instancesBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    instancesBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    instancesBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    instancesBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    instancesBarrier.buffer = t_sceneInstances.buffer;
+    instancesBarrier.offset = 0;
+    instancesBarrier.size = VK_WHOLE_SIZE;
+    vkCmdPipelineBarrier(t_commandBuffer,
+        VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+        0,
+        0,
+        nullptr,
+        1,
+        &instancesBarrier,
+        0,
+        nullptr);
+
+    const bool rebuild
+        = !m_tlasBounds.empty() && m_tlasDegradation > m_tlasRebuildThreshold * m_tlasSceneArea;
+    recordTopLevelBuild(t_commandBuffer,
+        rebuild ? VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR
+                : VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR,
+        t_frameIdx);
+    if (rebuild) {
+        resetTlasDegradation();
+    }
+    return true;
+}
+
+VkAccelerationStructureGeometryKHR RayTracingBasePipeline::getTlasGeometry(uint32_t t_frameIdx)
+{
+    VkAccelerationStructureGeometryKHR geometry {};
+    geometry.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR;
+    geometry.geometryType = VK_GEOMETRY_TYPE_INSTANCES_KHR;
+    geometry.geometry.instances.sType
+        = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR;
+    geometry.geometry.instances.arrayOfPointers = VK_FALSE;
+    geometry.geometry.instances.data.deviceAddress = m_tlasInstanceBuffer.getDeviceAddress()
+        + sizeof(VkAccelerationStructureInstanceKHR) * m_tlasInstances.size() * t_frameIdx;
+    return geometry;
+}
+
+void RayTracingBasePipeline::recordTopLevelBuild(VkCommandBuffer t_commandBuffer,
+    VkBuildAccelerationStructureModeKHR t_mode, uint32_t t_frameIdx)
+{
+    VkAccelerationStructureGeometryKHR geometry = getTlasGeometry(t_frameIdx);
+    VkAccelerationStructureBuildGeometryInfoKHR buildInfo {
+        VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR
+    };
+    buildInfo.flags = tlasBuildFlags;
+    buildInfo.geometryCount = 1;
+    buildInfo.pGeometries = &geometry;
+    buildInfo.mode = t_mode;
+    buildInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
+    // Refits happen in place
+    buildInfo.srcAccelerationStructure = t_mode == VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR
+        ? m_topLevelAS.getHandle()
+        : VK_NULL_HANDLE;
+    buildInfo.dstAccelerationStructure = m_topLevelAS.getHandle();
+    buildInfo.scratchData.deviceAddress = m_tlasScratchAddress;
+
+    VkAccelerationStructureBuildRangeInfoKHR rangeInfo {};
+    rangeInfo.primitiveCount = static_cast<uint32_t>(m_tlasInstances.size());
+    const VkAccelerationStructureBuildRangeInfoKHR* rangeInfos[] = { &rangeInfo };
+    vkCmdBuildAccelerationStructuresKHR(t_commandBuffer, 1, &buildInfo, rangeInfos);
+
+    VkMemoryBarrier memoryBarrier = {};
+    memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    memoryBarrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+    memoryBarrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
+    vkCmdPipelineBarrier(t_commandBuffer,
         VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+        VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR
+            | VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
         0,
         1,
         &memoryBarrier,
@@ -371,8 +1392,53 @@ void RayTracingBasePipeline::createTopLevelAccelerationStructure(VkQueue t_queue
         0,
         0,
         0);
+}
 
-    m_vulkanDevice->flushCommandBuffer(cmdBuffer, t_queue);
-    scratchBuffer.destroy();
-    instancesBuffer.destroy();
+void RayTracingBasePipeline::resetTlasDegradation()
+{
+    m_tlasDegradation = 0.0f;
+    m_tlasSceneArea = 0.0f;
+    m_tlasInstanceDegradation.assign(m_tlasBounds.size(), 0.0f);
+    m_tlasBuiltBounds.resize(m_tlasBounds.size());
+    if (m_tlasBounds.empty()) {
+        return;
+    }
+    VkAabbPositionsKHR scene = { FLT_MAX, FLT_MAX, FLT_MAX, -FLT_MAX, -FLT_MAX, -FLT_MAX };
+    for (size_t i = 0; i < m_tlasBounds.size(); ++i) {
+        m_tlasBuiltBounds[i] = transformBounds(m_tlasBounds[i], m_tlasInstances[i].transform);
+        scene.minX = std::min(scene.minX, m_tlasBuiltBounds[i].minX);
+        scene.minY = std::min(scene.minY, m_tlasBuiltBounds[i].minY);
+        scene.minZ = std::min(scene.minZ, m_tlasBuiltBounds[i].minZ);
+        scene.maxX = std::max(scene.maxX, m_tlasBuiltBounds[i].maxX);
+        scene.maxY = std::max(scene.maxY, m_tlasBuiltBounds[i].maxY);
+        scene.maxZ = std::max(scene.maxZ, m_tlasBuiltBounds[i].maxZ);
+    }
+    m_tlasSceneArea = getSurfaceArea(scene);
+}
+
+VkAabbPositionsKHR RayTracingBasePipeline::transformBounds(
+    const VkAabbPositionsKHR& t_bounds, const VkTransformMatrixKHR& t_transform)
+{
+    float boundsMin[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+    float boundsMax[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+    for (int corner = 0; corner < 8; ++corner) {
+        const float point[3] = { corner & 1 ? t_bounds.maxX : t_bounds.minX,
+            corner & 2 ? t_bounds.maxY : t_bounds.minY,
+            corner & 4 ? t_bounds.maxZ : t_bounds.minZ };
+        for (int row = 0; row < 3; ++row) {
+            const auto& m = t_transform.matrix[row];
+            const float value = m[0] * point[0] + m[1] * point[1] + m[2] * point[2] + m[3];
+            boundsMin[row] = std::min(boundsMin[row], value);
+            boundsMax[row] = std::max(boundsMax[row], value);
+        }
+    }
+    return { boundsMin[0], boundsMin[1], boundsMin[2], boundsMax[0], boundsMax[1], boundsMax[2] };
+}
+
+float RayTracingBasePipeline::getSurfaceArea(const VkAabbPositionsKHR& t_bounds)
+{
+    const float x = std::max(t_bounds.maxX - t_bounds.minX, 0.0f);
+    const float y = std::max(t_bounds.maxY - t_bounds.minY, 0.0f);
+    const float z = std::max(t_bounds.maxZ - t_bounds.minZ, 0.0f);
+    return 2.0f * (x * y + y * z + z * x);
 }
@@ -7,22 +7,77 @@
 #define BASE_RAY_TRACING_PIPELINE_H
 
 #include "core/acceleration_structure.h"
+#include "core/acceleration_structure_cache.h"
 #include "core/buffer.h"
 #include "scene/scene.h"
 #include "vulkan/vulkan_core.h"
 
+class DescriptorHeap;
 class Texture;
 class Device;
 
 class RayTracingBasePipeline {
 public:
-    virtual void createDescriptorSetsLayout(Scene* t_scene) = 0;
+    /** @brief Layouts of the pipeline, set 3 (textures and materials) is the layout of t_heap */
+    virtual void createDescriptorSetsLayout(DescriptorHeap* t_heap) = 0;
 
     void createPipeline(std::vector<VkPipelineShaderStageCreateInfo> t_shaderStages,
         std::vector<VkRayTracingShaderGroupCreateInfoKHR> t_shaderGroups);
 
-    Scene* createRTScene(
-        VkQueue t_queue, const std::string& t_modelPath, SceneVertexLayout t_vertexLayout);
+    /** @brief Loads the model and builds its acceleration structures. Each of the
+     * t_framesInFlight frames (at most 32) that may be in flight at the same time gets its own
+     * copy of the TLAS instances */
+    Scene* createRTScene(VkQueue t_queue, const std::string& t_modelPath,
+        SceneVertexLayout t_vertexLayout, uint32_t t_framesInFlight);
+
+    /** @brief Device memory the BLAS builds may use as scratch at the same time, builds that do
+     * not fit are split in batches separated by a barrier. Set before createRTScene */
+    void setBlasScratchBudget(VkDeviceSize t_budget);
+
+    /** @brief Static meshes with a single instance and less than t_triangles triangles are merged
+     * with their neighbours into BLASes of about t_triangles triangles, whose bounds span at most
+     * t_extent times the scene diagonal. 0 triangles disables the merge. Set before
+     * createRTScene */
+    void setBlasClusterTarget(uint32_t t_triangles, float t_extent);
+
+    /** @brief Builds the BLASes of the next scenes on the device (default) or on the host with the
+     * workers of the shared thread pool, the latter needs the accelerationStructureHostCommands
+     * feature and falls back to the device otherwise. Host built BLASes are moved to device local
+     * memory afterwards. Set before createRTScene */
+    void setBlasBuildType(VkAccelerationStructureBuildTypeKHR t_buildType);
+
+    /** @brief Builds the triangles the any-hit shaders always accept (see opacity_classifier) as
+     * opaque geometry, traversal then skips the any-hit shaders for them. The shadow hit group
+     * needs a closest hit shader that records the occlusion. Set before createRTScene */
+    void setOpaqueGeometry(bool t_enabled);
+
+    /** @brief Splits the long thin triangles of the next scenes (see triangle_splitting) adding at
+     * most t_budget triangles, those whose bounds have less than t_areaRatio times their area are
+     * kept. A budget of 0 (default) disables the split. Set before createRTScene */
+    void setTriangleSplitting(uint32_t t_budget, float t_areaRatio);
+
+    /** @brief Area the refits may add to the TLAS, relative to the surface area of the scene,
+     * before recordTopLevelAccelerationStructureUpdate rebuilds it instead */
+    void setTlasRebuildThreshold(float t_threshold);
+
+    uint32_t getTlasInstanceCount() const;
+
+    glm::mat4 getInstanceTransform(uint32_t t_instanceIdx) const;
+
+    /** @brief Moves a TLAS instance, the change is written to the TLAS by the next update of every
+     * frame. The scene instances of its geometries (used for shading) move with it, the meshes
+     * merged into a BLAS keep their placement relative to the instance */
+    void setInstanceTransform(uint32_t t_instanceIdx, const glm::mat4& t_transform);
+
+    /** @brief Writes the instances moved since the last update of frame t_frameIdx to its instance
+     * buffer and records the TLAS refit, or a full rebuild when the refits have degraded it past
+     * the rebuild threshold, into t_commandBuffer. The transforms of their scene instances are
+     * copied to t_sceneInstances (the getInstancesShaderData of the scene, which needs the
+     * transfer dst usage) in the same command buffer. Must be called outside of a render pass,
+     * once the GPU is done with the previous submission of the frame. Returns false (and records
+     * nothing) if nothing moved */
+    bool recordTopLevelAccelerationStructureUpdate(
+        VkCommandBuffer t_commandBuffer, uint32_t t_frameIdx, const Buffer& t_sceneInstances);
 
 protected:
     RayTracingBasePipeline(Device* t_vulkanDevice, uint32_t t_maxDepth, uint32_t t_sampleCount);
@@ -36,6 +91,19 @@ protected:
 
     PFN_vkGetAccelerationStructureBuildSizesKHR vkGetAccelerationStructureBuildSizesKHR;
     PFN_vkCmdBuildAccelerationStructuresKHR vkCmdBuildAccelerationStructuresKHR;
+    PFN_vkBuildAccelerationStructuresKHR vkBuildAccelerationStructuresKHR;
+    PFN_vkCmdWriteAccelerationStructuresPropertiesKHR vkCmdWriteAccelerationStructuresPropertiesKHR;
+    PFN_vkWriteAccelerationStructuresPropertiesKHR vkWriteAccelerationStructuresPropertiesKHR;
+    PFN_vkCreateDeferredOperationKHR vkCreateDeferredOperationKHR;
+    PFN_vkDestroyDeferredOperationKHR vkDestroyDeferredOperationKHR;
+    PFN_vkGetDeferredOperationMaxConcurrencyKHR vkGetDeferredOperationMaxConcurrencyKHR;
+    PFN_vkGetDeferredOperationResultKHR vkGetDeferredOperationResultKHR;
+    PFN_vkDeferredOperationJoinKHR vkDeferredOperationJoinKHR;
+    PFN_vkCmdCopyAccelerationStructureKHR vkCmdCopyAccelerationStructureKHR;
+    PFN_vkCmdCopyAccelerationStructureToMemoryKHR vkCmdCopyAccelerationStructureToMemoryKHR;
+    PFN_vkCmdCopyMemoryToAccelerationStructureKHR vkCmdCopyMemoryToAccelerationStructureKHR;
+    PFN_vkGetDeviceAccelerationStructureCompatibilityKHR
+        vkGetDeviceAccelerationStructureCompatibilityKHR;
     PFN_vkCreateRayTracingPipelinesKHR vkCreateRayTracingPipelinesKHR;
     PFN_vkGetRayTracingShaderGroupHandlesKHR vkGetRayTracingShaderGroupHandlesKHR;
     PFN_vkCmdTraceRaysKHR vkCmdTraceRaysKHR;
@@ -44,6 +112,36 @@ protected:
         vkCmdBuildAccelerationStructuresKHR
             = reinterpret_cast<PFN_vkCmdBuildAccelerationStructuresKHR>(
                 vkGetDeviceProcAddr(m_device, "vkCmdBuildAccelerationStructuresKHR"));
+        vkBuildAccelerationStructuresKHR = reinterpret_cast<PFN_vkBuildAccelerationStructuresKHR>(
+            vkGetDeviceProcAddr(m_device, "vkBuildAccelerationStructuresKHR"));
+        vkCmdWriteAccelerationStructuresPropertiesKHR
+            = reinterpret_cast<PFN_vkCmdWriteAccelerationStructuresPropertiesKHR>(
+                vkGetDeviceProcAddr(m_device, "vkCmdWriteAccelerationStructuresPropertiesKHR"));
+        vkWriteAccelerationStructuresPropertiesKHR
+            = reinterpret_cast<PFN_vkWriteAccelerationStructuresPropertiesKHR>(
+                vkGetDeviceProcAddr(m_device, "vkWriteAccelerationStructuresPropertiesKHR"));
+        vkCreateDeferredOperationKHR = reinterpret_cast<PFN_vkCreateDeferredOperationKHR>(
+            vkGetDeviceProcAddr(m_device, "vkCreateDeferredOperationKHR"));
+        vkDestroyDeferredOperationKHR = reinterpret_cast<PFN_vkDestroyDeferredOperationKHR>(
+            vkGetDeviceProcAddr(m_device, "vkDestroyDeferredOperationKHR"));
+        vkGetDeferredOperationMaxConcurrencyKHR
+            = reinterpret_cast<PFN_vkGetDeferredOperationMaxConcurrencyKHR>(
+                vkGetDeviceProcAddr(m_device, "vkGetDeferredOperationMaxConcurrencyKHR"));
+        vkGetDeferredOperationResultKHR = reinterpret_cast<PFN_vkGetDeferredOperationResultKHR>(
+            vkGetDeviceProcAddr(m_device, "vkGetDeferredOperationResultKHR"));
+        vkDeferredOperationJoinKHR = reinterpret_cast<PFN_vkDeferredOperationJoinKHR>(
+            vkGetDeviceProcAddr(m_device, "vkDeferredOperationJoinKHR"));
+        vkCmdCopyAccelerationStructureKHR = reinterpret_cast<PFN_vkCmdCopyAccelerationStructureKHR>(
+            vkGetDeviceProcAddr(m_device, "vkCmdCopyAccelerationStructureKHR"));
+        vkCmdCopyAccelerationStructureToMemoryKHR
+            = reinterpret_cast<PFN_vkCmdCopyAccelerationStructureToMemoryKHR>(
+                vkGetDeviceProcAddr(m_device, "vkCmdCopyAccelerationStructureToMemoryKHR"));
+        vkCmdCopyMemoryToAccelerationStructureKHR
+            = reinterpret_cast<PFN_vkCmdCopyMemoryToAccelerationStructureKHR>(
+                vkGetDeviceProcAddr(m_device, "vkCmdCopyMemoryToAccelerationStructureKHR"));
+        vkGetDeviceAccelerationStructureCompatibilityKHR
+            = reinterpret_cast<PFN_vkGetDeviceAccelerationStructureCompatibilityKHR>(
+                vkGetDeviceProcAddr(m_device, "vkGetDeviceAccelerationStructureCompatibilityKHR"));
         vkGetAccelerationStructureBuildSizesKHR
             = reinterpret_cast<PFN_vkGetAccelerationStructureBuildSizesKHR>(
                 vkGetDeviceProcAddr(m_device, "vkGetAccelerationStructureBuildSizesKHR"));
@@ -57,15 +155,93 @@ protected:
     }
 
     VkPhysicalDeviceRayTracingPipelinePropertiesKHR m_rayTracingPipelineProperties;
+    VkPhysicalDeviceAccelerationStructurePropertiesKHR m_accelerationStructureProperties;
+    VkPhysicalDeviceIDProperties m_deviceIdProperties;
+    bool m_hostCommandsSupported = false;
     void getDeviceRayTracingProperties();
 
-    // Bottom level acceleration structure
+    // Bottom level acceleration structure, all of them placed in m_blasPool
     std::vector<AccelerationStructure> m_bottomLevelAS;
+    Buffer m_blasPool;
+    VkDeviceSize m_blasScratchBudget = VkDeviceSize(256) << 20;
+    uint32_t m_blasClusterTriangles = 1 << 16;
+    float m_blasClusterExtent = 0.25f;
+    bool m_opaqueGeometry = false;
+    uint32_t m_splitTriangleBudget = 0;
+    float m_splitAreaRatio = 32.0f;
+    VkAccelerationStructureBuildTypeKHR m_blasBuildType
+        = VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR;
+    /** @brief Groups spatially close meshes of t_meshes (each with a single instance) in clusters
+     * of up to m_blasClusterTriangles triangles, every cluster becomes one BLAS */
+    std::vector<std::vector<uint32_t>> clusterMeshes(
+        const Scene* t_scene, const std::vector<uint32_t>& t_meshes) const;
+    static VkTransformMatrixKHR toTransformMatrix(const glm::mat4& t_transform);
+    /** @brief Mapped host visible copy of a device buffer, the input of the host builds */
+    Buffer createHostCopy(VkQueue t_queue, const Buffer& t_source);
     void createBottomLevelAccelerationStructure(
         VkQueue t_queue, const std::vector<BlasCreateInfo>& t_blases);
-    // Top level acceleration structure
+    /** @brief Builds t_count BLASes on the host, concurrently, and waits for all of them */
+    void buildOnHost(uint32_t t_count,
+        const VkAccelerationStructureBuildGeometryInfoKHR* t_buildInfos,
+        const VkAccelerationStructureBuildRangeInfoKHR* const* t_buildRanges);
+    /** @brief Moves every BLAS to a new device local pool, the ones listed in t_compactable with
+     * their t_compactedSizes (in the same order) and the others cloned. The original pool is
+     * released. Nothing is moved when it would not save memory, unless t_relocate */
+    void compactBottomLevelAccelerationStructures(VkQueue t_queue,
+        const std::vector<uint32_t>& t_compactable,
+        const std::vector<VkDeviceSize>& t_compactedSizes, const std::vector<VkDeviceSize>& t_sizes,
+        bool t_relocate);
+    /** @brief Key of the serialized BLASes, from the scene content and the build inputs */
+    static uint64_t getBlasCacheKey(
+        uint64_t t_sceneKey, const std::vector<BlasCreateInfo>& t_blases);
+    /** @brief Deserializes the t_count BLASes stored in the acceleration structure cache at
+     * t_path, returns false (nothing is created) if the file is missing, stale or was written by
+     * an incompatible driver */
+    bool loadBottomLevelAccelerationStructures(
+        VkQueue t_queue, const std::string& t_path, uint64_t t_key, uint32_t t_count);
+    /** @brief Serializes the BLASes to the acceleration structure cache at t_path */
+    void storeBottomLevelAccelerationStructures(
+        VkQueue t_queue, const std::string& t_path, uint64_t t_key);
+    // Top level acceleration structure, refitted in place from the instances of the frame
+    static constexpr VkBuildAccelerationStructureFlagsKHR tlasBuildFlags
+        = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR
+        | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR;
     AccelerationStructure m_topLevelAS;
+    std::vector<VkAccelerationStructureInstanceKHR> m_tlasInstances;
+    // Instances of every frame one after the other, persistently mapped
+    Buffer m_tlasInstanceBuffer;
+    // Shared by builds and refits, they are ordered by barriers
+    Buffer m_tlasScratchBuffer;
+    VkDeviceAddress m_tlasScratchAddress = 0;
+    uint32_t m_tlasFrameCount = 1;
+    // Per instance mask of the frames whose copy is outdated, and the outdated instances per frame
+    std::vector<uint32_t> m_tlasDirtyFrames;
+    std::vector<std::vector<uint32_t>> m_tlasDirty;
+    // Scene instances of the geometries of every TLAS instance, and the transform of each scene
+    // instance relative to its TLAS instance (the mesh placement of the merged BLASes)
+    struct TlasInstanceEntries {
+        uint32_t first;
+        uint32_t count;
+    };
+    Scene* m_scene = nullptr;
+    std::vector<TlasInstanceEntries> m_tlasInstanceEntries;
+    std::vector<glm::mat4> m_sceneInstanceTransforms;
+    // Rebuild heuristic, see setInstanceTransform
+    std::vector<VkAabbPositionsKHR> m_tlasBounds;
+    std::vector<VkAabbPositionsKHR> m_tlasBuiltBounds;
+    std::vector<float> m_tlasInstanceDegradation;
+    float m_tlasDegradation = 0.0f;
+    float m_tlasSceneArea = 0.0f;
+    float m_tlasRebuildThreshold = 0.5f;
     void createTopLevelAccelerationStructure(VkQueue t_queue, TlasCreateInfo t_tlasCreateInfo);
+    VkAccelerationStructureGeometryKHR getTlasGeometry(uint32_t t_frameIdx);
+    void recordTopLevelBuild(VkCommandBuffer t_commandBuffer,
+        VkBuildAccelerationStructureModeKHR t_mode, uint32_t t_frameIdx);
+    /** @brief Takes the current instance bounds as the ones of the last build */
+    void resetTlasDegradation();
+    static VkAabbPositionsKHR transformBounds(
+        const VkAabbPositionsKHR& t_bounds, const VkTransformMatrixKHR& t_transform);
+    static float getSurfaceArea(const VkAabbPositionsKHR& t_bounds);
 
     // Push constant sent to the path tracer
     struct PathTracerParameters {